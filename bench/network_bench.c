@@ -0,0 +1,177 @@
+// Compare the network drivers on loopback: a forked server answers
+// keep-alive requests with a fixed-size body, and each driver goes through
+// the same number of requests on a pooled connection.
+//
+// Usage: bin/network_bench [n_requests] [body_size] [driver...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "logger.h"
+#include "event_loop.h"
+#include "network.h"
+#include "network_pool.h"
+#include "http.h"
+
+#define BENCH_DEFAULT_N_REQUESTS 20000
+#define BENCH_DEFAULT_BODY_SIZE  1024
+
+// Serve the connections one after the other, a reply per request
+static void bench_serve(int lfd, size_t body_size)
+{
+  char   *reply = NULL;
+  size_t  reply_len = 0;
+  char    head[128];
+  int     head_len = -1;
+  int     fd = -1;
+
+  head_len = snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", body_size);
+  reply_len = (size_t) head_len + body_size;
+  if (! (reply = malloc(reply_len)))
+    _exit(1);
+
+  memcpy(reply, head, (size_t) head_len);
+  memset(reply + head_len, 'x', body_size);
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    char    buf[4096];
+    size_t  len = 0;
+    ssize_t n = -1;
+
+    while ((n = recv(fd, buf + len, sizeof buf - len - 1, 0)) > 0) {
+      char *end = NULL;
+
+      len += (size_t) n;
+      buf[len] = '\0';
+
+      while ((end = strstr(buf, "\r\n\r\n"))) {
+        size_t off = 0;
+
+        while (off < reply_len) {
+          ssize_t w = send(fd, reply + off, reply_len - off, MSG_NOSIGNAL);
+          if (w < 0)
+            goto next;
+          off += (size_t) w;
+        }
+
+        end += 4;
+        len -= (size_t) (end - buf);
+        memmove(buf, end, len + 1);
+      }
+    }
+
+  next:
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+static int bench_driver(char *driver, uint16_t port, unsigned n_requests)
+{
+  tnetwork_pool *pool = NULL;
+  thttp_request *request = NULL;
+  thttp_headers *headers = NULL;
+  long long      start_ms = 0;
+  long long      elapsed_ms = 0;
+  int            ret = -1;
+
+  if (network_pool_new(1, NETWORK_POOL_DEFAULT_IDLE_TIMEOUT_SEC, &pool) < 0 ||
+      http_headers_new("Host", "127.0.0.1", &headers) < 0 ||
+      http_request_new("127.0.0.1", port, "/", HTTP_METHOD_GET, headers, 0, &request) < 0 ||
+      http_request_set_driver(request, driver) < 0)
+    goto end;
+
+  start_ms = event_loop_now_ms();
+
+  for (unsigned i = 0; i < n_requests; i++) {
+    thttp_reply *reply = NULL;
+
+    if (http_send_request_pool(pool, request, &reply) < 0 || http_reply_code(reply) != 200) {
+      logger("%s: request #%u failed", driver, i);
+      http_reply_free(reply);
+      goto end;
+    }
+
+    http_reply_free(reply);
+  }
+
+  elapsed_ms = event_loop_now_ms() - start_ms;
+  printf("%-8s %8u requests in %6lld ms, %8.0f req/s\n", driver, n_requests, elapsed_ms,
+         elapsed_ms ? n_requests * 1000.0 / elapsed_ms : 0.0);
+
+  ret = 0;
+ end:
+  http_request_free(request);
+  network_pool_free(pool);
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  unsigned           n_requests = BENCH_DEFAULT_N_REQUESTS;
+  size_t             body_size = BENCH_DEFAULT_BODY_SIZE;
+  char              *default_drivers[] = { "plain", "uring" };
+  char             **drivers = default_drivers;
+  int                n_drivers = 2;
+  int                lfd = -1;
+  pid_t              pid = -1;
+  int                rc = EXIT_FAILURE;
+
+  if (argc > 1)
+    n_requests = (unsigned) strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    body_size = (size_t) strtoul(argv[2], NULL, 10);
+  if (argc > 3) {
+    drivers = argv + 3;
+    n_drivers = argc - 3;
+  }
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(lfd, 16) < 0 ||
+      getsockname(lfd, (struct sockaddr *) &addr, &len) < 0) {
+    logger("failed to set up the loopback server: %m");
+    goto end;
+  }
+
+  if ((pid = fork()) < 0) {
+    logger("fork: %m");
+    goto end;
+  }
+
+  if (0 == pid)
+    bench_serve(lfd, body_size);
+
+  printf("%u requests, %zu-byte bodies\n", n_requests, body_size);
+
+  rc = EXIT_SUCCESS;
+  for (int i = 0; i < n_drivers; i++) {
+    if (bench_driver(drivers[i], ntohs(addr.sin_port), n_requests) < 0)
+      rc = EXIT_FAILURE;
+  }
+
+ end:
+  if (pid > 0) {
+    (void) kill(pid, SIGTERM);
+    (void) waitpid(pid, NULL, 0);
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  return rc;
+}
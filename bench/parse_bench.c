@@ -0,0 +1,165 @@
+// Parse the same header-heavy reply over and over, as a CDN or an API
+// gateway would send it, once per delimiter scanning implementation the CPU
+// supports.  Reports the parser throughput, header storage included, and
+// that of the line and colon scanning alone.  Then the same parse with the
+// headers in an arena, reset after each reply, rather than malloc()'d.
+//
+// Usage: bin/parse_bench [n_replies]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+#include "scan.h"
+#include "arena.h"
+#include "http_parse.h"
+
+#define BENCH_DEFAULT_N_REPLIES 200000
+
+static char bench_reply[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Sat, 17 Oct 2026 12:00:00 GMT\r\n"
+  "Content-Type: application/json; charset=utf-8\r\n"
+  "Content-Length: 2\r\n"
+  "Connection: keep-alive\r\n"
+  "Server: envoy\r\n"
+  "Cache-Control: private, no-cache, no-store, must-revalidate, max-age=0\r\n"
+  "Pragma: no-cache\r\n"
+  "Expires: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+  "Vary: Accept-Encoding, Origin, Access-Control-Request-Method, Access-Control-Request-Headers\r\n"
+  "Access-Control-Allow-Origin: https://www.example.com\r\n"
+  "Access-Control-Allow-Credentials: true\r\n"
+  "Access-Control-Expose-Headers: X-Request-Id, X-RateLimit-Limit, X-RateLimit-Remaining\r\n"
+  "Strict-Transport-Security: max-age=63072000; includeSubDomains; preload\r\n"
+  "Content-Security-Policy: default-src 'self'; script-src 'self' https://cdn.example.com "
+  "'nonce-2726c7f26c'; style-src 'self' 'unsafe-inline'; img-src 'self' data: https:; "
+  "connect-src 'self' https://api.example.com wss://push.example.com; frame-ancestors 'none'\r\n"
+  "X-Content-Type-Options: nosniff\r\n"
+  "X-Frame-Options: DENY\r\n"
+  "Referrer-Policy: strict-origin-when-cross-origin\r\n"
+  "Permissions-Policy: geolocation=(), microphone=(), camera=()\r\n"
+  "Set-Cookie: session=8f14e45fceea167a5a36dedd4bea2543; Path=/; Secure; HttpOnly; SameSite=Lax\r\n"
+  "Set-Cookie: csrftoken=Zm9vYmFyYmF6cXV4cXV1eGNvcmdlZ3JhdWx0; Path=/; Secure; SameSite=Strict\r\n"
+  "ETag: W/\"5e1b3c7d-2a9f-4f61-8d0e-1c2b3a4d5e6f\"\r\n"
+  "Last-Modified: Fri, 16 Oct 2026 08:30:00 GMT\r\n"
+  "X-Request-Id: 0d7c9a52-6b1e-4f3a-9c8d-2e5f7a1b3c4d\r\n"
+  "X-RateLimit-Limit: 1000\r\n"
+  "X-RateLimit-Remaining: 998\r\n"
+  "X-Envoy-Upstream-Service-Time:   12   \r\n"
+  "Alt-Svc: h3=\":443\"; ma=86400, h3-29=\":443\"; ma=86400\r\n"
+  "Via: 1.1 varnish, 1.1 b3c7e2a1.cloudfront.net (CloudFront)\r\n"
+  "\r\n"
+  "{}";
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int bench_parse(unsigned char *buf, size_t len, unsigned n_replies, tarena *arena, double *secondsp)
+{
+  double start = bench_now();
+
+  for (unsigned i = 0; i < n_replies; i++) {
+    thttp_parser *parser = NULL;
+
+    if (http_parser_new(NULL, NULL, 0, &parser) < 0)
+      return -1;
+
+    http_parser_set_arena(parser, arena);
+    if (http_parser_feed(parser, buf, len) != (ssize_t) len || ! http_parser_is_done(parser)) {
+      http_parser_free(parser);
+      return -1;
+    }
+
+    http_parser_free(parser);
+    arena_reset(arena);
+  }
+
+  *secondsp = bench_now() - start;
+  return 0;
+}
+
+// What the parser scans for, line by line: the LF, then the colon and the
+// whitespace around the value
+static double bench_scan(unsigned char *buf, size_t len, unsigned n_replies, size_t *sinkp)
+{
+  double start = bench_now();
+  size_t sink = 0;
+
+  for (unsigned i = 0; i < n_replies; i++) {
+    size_t off = 0;
+
+    while (off < len) {
+      size_t line_len = scan_byte(buf + off, len - off, '\n');
+      size_t colon = scan_byte(buf + off, line_len, ':');
+
+      if (colon < line_len)
+        sink += scan_ws_span(buf + off + colon + 1, line_len - colon - 1) +
+          scan_ws_span_back(buf + off + colon + 1, line_len - colon - 1);
+
+      off += line_len + 1;
+    }
+  }
+
+  *sinkp += sink;
+  return bench_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned char *buf = (unsigned char *) bench_reply;
+  size_t         len = sizeof bench_reply - 1;
+  size_t         head_len = (size_t) (strstr(bench_reply, "\r\n\r\n") - bench_reply) + 4;
+  unsigned       n_replies = BENCH_DEFAULT_N_REPLIES;
+  char         **names = scan_impl_names();
+  tarena        *arena = NULL;
+  double         parse_sec = 0;
+  size_t         sink = 0;
+  int            rc = EXIT_SUCCESS;
+
+  if (argc > 1)
+    n_replies = (unsigned) strtoul(argv[1], NULL, 10);
+
+  printf("%u replies, %zu-byte header block\n", n_replies, head_len);
+
+  for (size_t i = 0; names[i]; i++) {
+    double scan_sec = 0;
+
+    if (scan_set_impl(names[i]) < 0) {
+      printf("%-8s not supported by this CPU\n", names[i]);
+      continue;
+    }
+
+    if (bench_parse(buf, len, n_replies, NULL, &parse_sec) < 0) {
+      logger("%s: failed to parse the reply", names[i]);
+      rc = EXIT_FAILURE;
+      continue;
+    }
+
+    scan_sec = bench_scan(buf, head_len, n_replies, &sink);
+
+    printf("%-8s parse %6.3f GB/s, %8.0f replies/s   scan %6.2f GB/s\n", names[i],
+           parse_sec ? (double) head_len * n_replies / parse_sec / 1e9 : 0.0,
+           parse_sec ? n_replies / parse_sec : 0.0,
+           scan_sec ? (double) head_len * n_replies / scan_sec / 1e9 : 0.0);
+  }
+
+  // The last implementation the CPU supports, the default one
+  if (arena_new(0, NULL, &arena) < 0 || bench_parse(buf, len, n_replies, arena, &parse_sec) < 0) {
+    logger("failed to parse the reply in an arena");
+    rc = EXIT_FAILURE;
+  } else {
+    printf("%-8s parse %6.3f GB/s, %8.0f replies/s   (%s, in an arena)\n", "arena",
+           parse_sec ? (double) head_len * n_replies / parse_sec / 1e9 : 0.0,
+           parse_sec ? n_replies / parse_sec : 0.0, scan_impl_name());
+  }
+
+  arena_free(arena);
+  return sink ? rc : EXIT_FAILURE;
+}
@@ -0,0 +1,176 @@
+// Measure what TCP Fast Open saves on short-lived requests: a forked
+// loopback server answers each request on a new connection then closes it,
+// and the same requests go out without, then with --tcp-fastopen.  The server
+// tells in the body whether the request came in the SYN.
+//
+// Loopback has no latency worth saving, add some to see the round trip:
+//   tc qdisc add dev lo root netem delay 5ms
+// TCP Fast Open has to be allowed on both sides too:
+//   sysctl -w net.ipv4.tcp_fastopen=3
+//
+// Usage: bin/tfo_bench [n_requests]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "logger.h"
+#include "event_loop.h"
+#include "network_connect.h"
+#include "http.h"
+
+#define BENCH_DEFAULT_N_REQUESTS 200
+#define BENCH_FASTOPEN_QLEN      64
+
+// A request per connection, the reply body being "1" when it came in the SYN
+static void bench_serve(int lfd)
+{
+  int fd = -1;
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    struct tcp_info info;
+    socklen_t       info_len = sizeof info;
+    char            buf[4096];
+    char            reply[128];
+    int             reply_len = -1;
+    size_t          len = 0;
+    ssize_t         n = -1;
+    int             syn_data = 0;
+
+    memset(&info, 0, sizeof info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0)
+      syn_data = !! (info.tcpi_options & TCPI_OPT_SYN_DATA);
+
+    while ((n = recv(fd, buf + len, sizeof buf - len - 1, 0)) > 0) {
+      len += (size_t) n;
+      buf[len] = '\0';
+      if (strstr(buf, "\r\n\r\n"))
+        break;
+    }
+
+    reply_len = snprintf(reply, sizeof reply,
+                         "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1\r\n\r\n%d", syn_data);
+    (void) send(fd, reply, (size_t) reply_len, MSG_NOSIGNAL);
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+static int bench_fastopen(int fastopen, uint16_t port, unsigned n_requests)
+{
+  thttp_request *request = NULL;
+  thttp_headers *headers = NULL;
+  long long      start_ms = 0;
+  long long      elapsed_ms = 0;
+  unsigned       n_syn_data = 0;
+  int            ret = -1;
+
+  if (http_headers_new("Host", "127.0.0.1", &headers) < 0 ||
+      http_request_new("127.0.0.1", port, "/", HTTP_METHOD_GET, headers, 0, &request) < 0)
+    goto end;
+
+  network_connect_set_fastopen(fastopen);
+  start_ms = event_loop_now_ms();
+
+  for (unsigned i = 0; i < n_requests; i++) {
+    thttp_reply   *reply = NULL;
+    unsigned char *body = NULL;
+
+    if (http_send_request(request, &reply) < 0 || http_reply_code(reply) != 200) {
+      logger("%s: request #%u failed", fastopen ? "fastopen" : "plain", i);
+      http_reply_free(reply);
+      goto end;
+    }
+
+    if (http_reply_body(reply, &body) == 1 && body[0] == '1')
+      n_syn_data++;
+
+    http_reply_free(reply);
+  }
+
+  elapsed_ms = event_loop_now_ms() - start_ms;
+  printf("%-8s %6u requests in %6lld ms, %7.3f ms/request, %u in the SYN\n",
+         fastopen ? "fastopen" : "plain", n_requests, elapsed_ms,
+         n_requests ? (double) elapsed_ms / n_requests : 0.0, n_syn_data);
+
+  ret = 0;
+ end:
+  network_connect_set_fastopen(0);
+  http_request_free(request);
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  unsigned           n_requests = BENCH_DEFAULT_N_REQUESTS;
+  int                qlen = BENCH_FASTOPEN_QLEN;
+  int                lfd = -1;
+  pid_t              pid = -1;
+  FILE              *sysctl = NULL;
+  int                mode = 0;
+  int                rc = EXIT_FAILURE;
+
+  if (argc > 1)
+    n_requests = (unsigned) strtoul(argv[1], NULL, 10);
+
+  // 1 for the client side, 2 for the server side
+  if ((sysctl = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r"))) {
+    if (fscanf(sysctl, "%d", &mode) != 1)
+      mode = 0;
+    (void) fclose(sysctl);
+  }
+  if ((mode & 3) != 3)
+    printf("net.ipv4.tcp_fastopen is %d, not 3: expect no request in the SYN\n", mode);
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(lfd, 128) < 0 ||
+      getsockname(lfd, (struct sockaddr *) &addr, &len) < 0) {
+    logger("failed to set up the loopback server: %m");
+    goto end;
+  }
+
+  if (setsockopt(lfd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen) < 0)
+    logger("TCP_FASTOPEN: %m");
+
+  if ((pid = fork()) < 0) {
+    logger("fork: %m");
+    goto end;
+  }
+
+  if (0 == pid)
+    bench_serve(lfd);
+
+  printf("%u requests, a connection each\n", n_requests);
+
+  // The first fastopen connection only gets the cookie, the others use it
+  rc = EXIT_SUCCESS;
+  if (bench_fastopen(0, ntohs(addr.sin_port), n_requests) < 0 ||
+      bench_fastopen(1, ntohs(addr.sin_port), n_requests) < 0)
+    rc = EXIT_FAILURE;
+
+ end:
+  if (pid > 0) {
+    (void) kill(pid, SIGTERM);
+    (void) waitpid(pid, NULL, 0);
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  return rc;
+}
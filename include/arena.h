@@ -0,0 +1,42 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+// Bump allocator: allocations are carved one after the other out of chunks,
+// chained as they fill up, and released all at once with the arena.  A
+// request, its headers and its reply may be built in one, which then costs
+// a few calls to the allocator rather than dozens.
+//
+// Every function takes a NULL arena as well, malloc() and friends then
+// doing the job: code can allocate the same way whether it was given an
+// arena or not.
+typedef struct arena tarena;
+
+// Where the chunks come from: malloc(), realloc() and free() by default,
+// the embedder's allocator otherwise.  user_data is handed to each.
+struct arena_hooks {
+  void *(*alloc_func)(size_t size, void *user_data);
+  void *(*realloc_func)(void *ptr, size_t size, void *user_data);
+  void  (*free_func)(void *ptr, void *user_data);
+  void  *user_data;
+};
+
+// chunk_size is 0 for the default, hooks NULL for malloc() and the like
+int arena_new(size_t chunk_size, struct arena_hooks *hooks, tarena **arenap);
+void arena_free(tarena *arena);
+// Everything allocated released, the first chunk kept for what comes next
+void arena_reset(tarena *arena);
+
+void *arena_alloc(tarena *arena, size_t size);
+// Grows in place the last allocation, or one of its own chunk; old_size is
+// that of ptr, ignored without an arena
+void *arena_realloc(tarena *arena, void *ptr, size_t old_size, size_t size);
+char *arena_strdup(tarena *arena, char *s);
+// Only frees without an arena: the memory goes with the arena otherwise
+void arena_release(tarena *arena, void *ptr);
+
+// Unit tests.
+int arena_utest(void);
+
+#endif // __ARENA_H__
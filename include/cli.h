@@ -6,6 +6,8 @@
 
 #include "http_headers.h"
 #include "http_request.h"
+#include "tls_context.h"
+#include "resolver.h"
 
 struct cli_options {
 #define DEFAULT_HOST "httpbin.io"
@@ -19,6 +21,18 @@ struct cli_options {
   thttp_headers *headers;
 #define DEFAULT_USE_TLS 0
   int            use_tls;
+  char          *output;
+  char          *driver;
+  int            verbose;
+  int            tcp_fastopen;
+  int            http2_prior_knowledge;
+
+  struct tls_options      tls;
+  struct resolver_options resolver;
+  char                  **resolve; // --resolve host:port:addr overrides
+  size_t                  n_resolve;
+  char                  **paths; // --path, pipelined after the target's
+  size_t                  n_paths;
 
   struct {
     int code;
@@ -0,0 +1,23 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#define EVENT_LOOP_READ    0x1
+#define EVENT_LOOP_WRITE   0x2
+#define EVENT_LOOP_TIMEOUT 0x4
+
+typedef struct event_loop tevent_loop;
+
+// Called with the EVENT_LOOP_* events the fd is ready for, or with
+// EVENT_LOOP_TIMEOUT once its deadline is over.
+typedef void (*tevent_loop_func)(int fd, int events, void *user_data);
+
+void event_loop_free(tevent_loop *loop);
+int event_loop_new(tevent_loop **loopp);
+int event_loop_add(tevent_loop *loop, int fd, int events, long long deadline_ms, tevent_loop_func func, void *user_data);
+int event_loop_mod(tevent_loop *loop, int fd, int events);
+void event_loop_del(tevent_loop *loop, int fd);
+int event_loop_run(tevent_loop *loop);
+void event_loop_stop(tevent_loop *loop);
+long long event_loop_now_ms(void);
+
+#endif // __EVENT_LOOP_H__
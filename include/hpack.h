@@ -0,0 +1,41 @@
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <stddef.h>
+
+#include "http_headers.h"
+
+// HPACK (RFC 7541), the header compression of HTTP/2.  A table holds the
+// dynamic entries of one direction of a connection: the decoder's follows
+// what the peer encoded, the encoder's what we did.
+
+// SETTINGS_HEADER_TABLE_SIZE until told otherwise (RFC 9113 section 6.5.2)
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+typedef struct hpack_table thpack_table;
+
+// Growing output buffer
+struct hpack_buf {
+  unsigned char *data;
+  size_t         len;
+  size_t         size;
+};
+
+// Each decoded field, nul-terminated.  A negative return value aborts the
+// decoding.
+typedef int (*thpack_field_func)(char *name, char *value, void *user_data);
+
+void hpack_table_free(thpack_table *table);
+int hpack_table_new(size_t limit, thpack_table **tablep);
+void hpack_table_set_limit(thpack_table *table, size_t limit);
+
+int hpack_decode(thpack_table *table, unsigned char *buf, size_t len, thpack_field_func func, void *user_data);
+int hpack_encode(thpack_table *table, struct http_headers_elem *fields, size_t n_fields, struct hpack_buf *out);
+
+int hpack_buf_append(struct hpack_buf *buf, void *data, size_t len);
+void hpack_buf_free(struct hpack_buf *buf);
+
+// Unit tests.
+int hpack_utest(void);
+
+#endif // __HPACK_H__
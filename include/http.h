@@ -4,9 +4,21 @@
 #include "http_headers.h"
 #include "http_request.h"
 #include "http_reply.h"
+#include "network_pool.h"
+#include "event_loop.h"
 
 
-char *http_method_to_str(thttp_method method);
 int http_send_request(thttp_request *request, thttp_reply **replyp);
+int http_send_request_pool(tnetwork_pool *pool, thttp_request *request, thttp_reply **replyp);
+int http_send_requests_pipelined(tnetwork_pool *pool, thttp_request **requests, size_t n_requests,
+                                 thttp_reply **replies);
+
+// Called once the request is over, with a NULL reply on failure.  The reply
+// belongs to the callee.
+typedef void (*thttp_async_done_func)(thttp_request *request, thttp_reply *reply, void *user_data);
+int http_send_request_async(tevent_loop *loop, thttp_request *request, thttp_async_done_func done_func, void *user_data);
+
+// Unit tests.
+int http_utest(void);
 
 #endif // __HTTP_H__
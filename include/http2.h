@@ -0,0 +1,41 @@
+#ifndef __HTTP2_H__
+#define __HTTP2_H__
+
+#include <stddef.h>
+
+#include "network.h"
+#include "http_request.h"
+#include "http_reply.h"
+
+// Protocol identifier, as offered through ALPN
+#define HTTP2_ALPN_ID "h2"
+
+// Connection preface (RFC 9113 section 3.4)
+#define HTTP2_PREFACE     "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN (sizeof HTTP2_PREFACE - 1)
+
+#define HTTP2_FRAME_HEADER_LEN 9
+// SETTINGS_MAX_FRAME_SIZE, we keep the default
+#define HTTP2_MAX_FRAME_SIZE   16384
+
+// Receive windows: each stream may have that many bytes in flight, all of
+// them together the connection's.
+#define HTTP2_STREAM_WINDOW    (1 << 20)
+#define HTTP2_CONN_WINDOW      (16 << 20)
+
+// Concurrent streams, until the server tells its own limit
+#define HTTP2_DEFAULT_MAX_STREAMS 100
+
+typedef struct http2_conn thttp2_conn;
+
+void http2_conn_free(thttp2_conn *conn);
+int http2_conn_new(tnetwork_driver_ctx *ctx, thttp2_conn **connp);
+int http2_conn_new_upgraded(tnetwork_driver_ctx *ctx, unsigned char *data, size_t len, thttp2_conn **connp);
+int http2_upgrade_settings(char **valuep);
+int http2_send_requests(thttp2_conn *conn, thttp_request **requests, size_t n_requests, thttp_reply **replies);
+void http2_conn_shutdown(thttp2_conn *conn);
+
+// Unit tests.
+int http2_utest(void);
+
+#endif // __HTTP2_H__
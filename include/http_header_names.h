@@ -0,0 +1,91 @@
+#ifndef __HTTP_HEADER_NAMES_H__
+#define __HTTP_HEADER_NAMES_H__
+
+#include <stdint.h>
+
+// The header names we know of, looked up by hash when headers are added or
+// parsed so that the code handling them can switch on an ID rather than
+// compare strings, and that they need not be copied.  Keep the list sorted;
+// the unit tests tell when HTTP_HEADER_NAMES_SEED must change for the
+// lookups to stay collision-free.
+#define HTTP_HEADER_TABLE                                   \
+  X(ACCEPT,                    "Accept")                    \
+  X(ACCEPT_ENCODING,           "Accept-Encoding")           \
+  X(ACCEPT_LANGUAGE,           "Accept-Language")           \
+  X(ACCEPT_RANGES,             "Accept-Ranges")             \
+  X(AGE,                       "Age")                       \
+  X(ALT_SVC,                   "Alt-Svc")                   \
+  X(AUTHORIZATION,             "Authorization")             \
+  X(CACHE_CONTROL,             "Cache-Control")             \
+  X(CONNECTION,                "Connection")                \
+  X(CONTENT_DISPOSITION,       "Content-Disposition")       \
+  X(CONTENT_ENCODING,          "Content-Encoding")          \
+  X(CONTENT_LANGUAGE,          "Content-Language")          \
+  X(CONTENT_LENGTH,            "Content-Length")            \
+  X(CONTENT_LOCATION,          "Content-Location")          \
+  X(CONTENT_RANGE,             "Content-Range")             \
+  X(CONTENT_SECURITY_POLICY,   "Content-Security-Policy")   \
+  X(CONTENT_TYPE,              "Content-Type")              \
+  X(COOKIE,                    "Cookie")                    \
+  X(DATE,                      "Date")                      \
+  X(ETAG,                      "ETag")                      \
+  X(EXPECT,                    "Expect")                    \
+  X(EXPIRES,                   "Expires")                   \
+  X(HOST,                      "Host")                      \
+  X(HTTP2_SETTINGS,            "HTTP2-Settings")            \
+  X(IF_MODIFIED_SINCE,         "If-Modified-Since")         \
+  X(IF_NONE_MATCH,             "If-None-Match")             \
+  X(KEEP_ALIVE,                "Keep-Alive")                \
+  X(LAST_MODIFIED,             "Last-Modified")             \
+  X(LINK,                      "Link")                      \
+  X(LOCATION,                  "Location")                  \
+  X(PRAGMA,                    "Pragma")                    \
+  X(PROXY_AUTHENTICATE,        "Proxy-Authenticate")        \
+  X(PROXY_AUTHORIZATION,       "Proxy-Authorization")       \
+  X(PROXY_CONNECTION,          "Proxy-Connection")          \
+  X(RANGE,                     "Range")                     \
+  X(REFERER,                   "Referer")                   \
+  X(RETRY_AFTER,               "Retry-After")               \
+  X(SERVER,                    "Server")                    \
+  X(SET_COOKIE,                "Set-Cookie")                \
+  X(STRICT_TRANSPORT_SECURITY, "Strict-Transport-Security") \
+  X(TE,                        "TE")                        \
+  X(TRAILER,                   "Trailer")                   \
+  X(TRANSFER_ENCODING,         "Transfer-Encoding")         \
+  X(UPGRADE,                   "Upgrade")                   \
+  X(USER_AGENT,                "User-Agent")                \
+  X(VARY,                      "Vary")                      \
+  X(VIA,                       "Via")                       \
+  X(WWW_AUTHENTICATE,          "WWW-Authenticate")          \
+  X(X_CONTENT_TYPE_OPTIONS,    "X-Content-Type-Options")    \
+  X(X_FRAME_OPTIONS,           "X-Frame-Options")           \
+
+#define X(a, b) HTTP_HEADER_##a,
+typedef enum {
+  HTTP_HEADER_TABLE
+  HTTP_HEADER_UNKNOWN,
+} thttp_header_id;
+#undef X
+
+// FNV-1a over the name in lower case, HTTP names being ASCII: that of the
+// header indexes too
+uint32_t http_header_name_hash(char *name, unsigned *name_lenp);
+
+thttp_header_id http_header_name_id(char *name);
+// The same, name hashed already
+thttp_header_id http_header_name_find(char *name, uint32_t hash, unsigned name_len);
+
+// As in the table, or in lower case for HTTP/2: NULL for HTTP_HEADER_UNKNOWN
+char *http_header_name(thttp_header_id id);
+char *http_header_name_lower(thttp_header_id id);
+uint32_t http_header_name_hash_of(thttp_header_id id, unsigned *name_lenp);
+
+// One of the two spellings above, when name is exactly that of id: such
+// names live as long as the program and are never to be freed
+char *http_header_name_intern(thttp_header_id id, char *name);
+int http_header_name_is_interned(char *name);
+
+// Unit tests.
+int http_header_names_utest(void);
+
+#endif // __HTTP_HEADER_NAMES_H__
@@ -1,6 +1,9 @@
 #ifndef __HTTP_HEADERS_H__
 #define __HTTP_HEADERS_H__
 
+#include "arena.h"
+#include "http_header_names.h"
+
 struct http_headers_elem {
   char *key;
   char *value;
@@ -11,9 +14,20 @@ typedef int (*titerate_func)(struct http_headers_elem *, void *);
 void http_headers_free(thttp_headers *headers);
 int http_headers_new(char *key, char *value, thttp_headers **headersp);
 int http_headers_add(thttp_headers *headers, char *key, char *value);
+int http_headers_new_in(tarena *arena, thttp_headers **headersp);
+int http_headers_new_view(tarena *arena, unsigned size_hint, thttp_headers **headersp);
+int http_headers_add_view(thttp_headers *headers, char *key, char *value);
+int http_headers_dup(thttp_headers *headers, thttp_headers **copyp);
+int http_headers_dup_in(tarena *arena, thttp_headers *headers, thttp_headers **copyp);
 int http_headers_update_value(thttp_headers *headers, char *key, char *value);
 int http_headers_lookup(thttp_headers *headers, char * key, char **valuep);
+int http_headers_lookup_id(thttp_headers *headers, thttp_header_id id, char **valuep);
+int http_headers_lookup_next(thttp_headers *headers, int prev, char **valuep);
 int http_headers_foreach(thttp_headers *headers, titerate_func func, void *user_data);
+unsigned http_headers_count(thttp_headers *headers);
 char *http_headers_to_string(thttp_headers *headers);
 
+// Unit tests.
+int http_headers_utest(void);
+
 #endif // __HTTP_HEADERS_H__
@@ -1,8 +1,39 @@
 #ifndef __HTTP_PARSE_H__
 #define __HTTP_PARSE_H__
 
+#include <sys/types.h>
+
+#include "arena.h"
 #include "http_reply.h"
 
+typedef struct http_parser thttp_parser;
+
+// Parser events, all of them optional.  Return 0 to go on, HTTP_PARSER_PAUSE
+// to have http_parser_feed() return right after the event, or -1 to abort.
+#define HTTP_PARSER_PAUSE 1
+struct http_parser_callbacks {
+  int (*on_status)(int code, void *user_data);
+  int (*on_header)(char *key, char *value, void *user_data);
+  int (*on_headers_complete)(void *user_data);
+  int (*on_body)(unsigned char *data, size_t len, void *user_data);
+  int (*on_message_complete)(void *user_data);
+};
+
+void http_parser_free(thttp_parser *parser);
+int http_parser_new(struct http_parser_callbacks *callbacks, void *user_data, int is_head, thttp_parser **parserp);
+void http_parser_set_in_place(thttp_parser *parser);
+void http_parser_set_arena(thttp_parser *parser, tarena *arena);
+ssize_t http_parser_feed(thttp_parser *parser, unsigned char *buf, size_t len);
+int http_parser_finish(thttp_parser *parser);
+int http_parser_is_done(thttp_parser *parser);
+int http_parser_code(thttp_parser *parser);
+thttp_headers *http_parser_headers(thttp_parser *parser);
+int http_parser_reply(thttp_parser *parser, thttp_reply **replyp);
+int http_parser_reply_view(thttp_parser *parser, unsigned char *buf, unsigned char *body, size_t body_len,
+                           int body_in_buf, thttp_reply **replyp);
+int http_parser_body_left(thttp_parser *parser, unsigned long long *leftp);
+int http_parser_skip_body(thttp_parser *parser, size_t len);
+
 int http_parse_reply(unsigned char *buf, size_t buf_len, thttp_reply **replyp);
 
 // Unit test.
@@ -3,7 +3,9 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
+#include "arena.h"
 #include "http_headers.h"
 
 // We don't use anything else but GET, but hey, we do love X macros.
@@ -26,13 +28,53 @@ typedef enum {
 
 typedef struct http_request thttp_request;
 
+// Cleartext HTTP/2 on plain connections
+typedef enum {
+  HTTP_H2C_OFF,
+  HTTP_H2C_UPGRADE,         // Asked for along the first request, HTTP/1.1 if declined
+  HTTP_H2C_PRIOR_KNOWLEDGE, // Spoken straight away
+} thttp_h2c_mode;
+
+// Streaming reply delivery, instead of buffering the whole body in the
+// reply: head_func gets the status and the headers once they are parsed,
+// body_func every piece of the decoded body.  Both are optional, and a
+// negative return value aborts the transfer.
+//
+// body_fd_func, optional too, offers a file descriptor for a body of known
+// length: the driver may then splice it there without any copy to user
+// space, body_func getting whatever it cannot.  -1 declines.
+typedef int (*thttp_head_func)(int code, thttp_headers *headers, void *user_data);
+typedef int (*thttp_body_func)(unsigned char *data, size_t len, void *user_data);
+typedef int (*thttp_body_fd_func)(unsigned long long len, void *user_data);
+
+struct http_body_sink {
+  thttp_head_func    head_func;
+  thttp_body_func    body_func;
+  void              *user_data;
+  thttp_body_fd_func body_fd_func;
+};
+
 void http_request_free(thttp_request *request);
 int http_request_new(char *host, uint16_t port, char *path, thttp_method method, thttp_headers *headers, int use_tls, thttp_request **requestp);
+int http_request_new_in(tarena *arena, char *host, uint16_t port, char *path, thttp_method method,
+                        thttp_headers *headers, int use_tls, thttp_request **requestp);
+int http_request_dup(thttp_request *request, char *path, thttp_request **copyp);
+char *http_method_to_str(thttp_method method);
+int http_request_get_iovec(thttp_request *request, struct iovec **iovp, int *iovcntp);
 int http_request_get_buffer(thttp_request *request, unsigned char **bufp, size_t *buf_lenp);
 char *http_request_host(thttp_request *request);
 uint16_t http_request_port(thttp_request *request);
 char *http_request_path(thttp_request *request);
+thttp_method http_request_method(thttp_request *request);
 unsigned http_request_timeout(thttp_request *request);
 int http_request_use_tls(thttp_request *request);
+int http_request_set_driver(thttp_request *request, char *driver);
+char *http_request_driver(thttp_request *request);
+void http_request_set_h2c(thttp_request *request, thttp_h2c_mode mode);
+thttp_h2c_mode http_request_h2c(thttp_request *request);
+thttp_headers *http_request_headers(thttp_request *request);
+tarena *http_request_arena(thttp_request *request);
+void http_request_set_body_sink(thttp_request *request, struct http_body_sink *sink);
+struct http_body_sink *http_request_body_sink(thttp_request *request);
 
 #endif // __HTTP_REQUEST_H__
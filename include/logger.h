@@ -5,5 +5,9 @@ void logger__(const char *file, const char *func, const int line, const char *fm
 
 #define logger(...) logger__(__FILE__, __func__, __LINE__, __VA_ARGS__)
 
+// Progress reports for the user, only shown in verbose mode
+void logger_set_verbose(int verbose);
+void logger_verbose(const char *fmt, ...);
+
 
 #endif // __LOGGER_H__
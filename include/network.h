@@ -2,34 +2,80 @@
 #define __NETWORK_H__
 
 #include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 typedef enum {
   NETWORK_DRIVER_TYPE_PLAIN,
   NETWORK_DRIVER_TYPE_TLS,
+  NETWORK_DRIVER_TYPE_NONBLOCK,
+  NETWORK_DRIVER_TYPE_TLS_NONBLOCK,
+  NETWORK_DRIVER_TYPE_URING,
 } tnetwork_driver_type;
 
+// What a non-blocking driver waits for before making any progress
+#define NETWORK_WANT_READ  1
+#define NETWORK_WANT_WRITE 2
+
 typedef struct network_driver_ctx tnetwork_driver_ctx;
 
 typedef char *(* tnetwork_driver_get_name_func)(void);
 typedef int (* tnetwork_driver_connect_func)(tnetwork_driver_ctx *, char *, char *, unsigned);
 typedef int (* tnetwork_driver_send_func)(tnetwork_driver_ctx *, void *, size_t);
-typedef int (* tnetwork_driver_recv_func)(tnetwork_driver_ctx *, unsigned char **, size_t *);
+typedef ssize_t (* tnetwork_driver_read_func)(tnetwork_driver_ctx *, unsigned char *, size_t);
 typedef void (* tnetwork_driver_free_func)(tnetwork_driver_ctx *);
+typedef int (* tnetwork_driver_is_alive_func)(tnetwork_driver_ctx *);
+typedef int (* tnetwork_driver_get_fd_func)(tnetwork_driver_ctx *);
+typedef int (* tnetwork_driver_progress_func)(tnetwork_driver_ctx *);
+typedef ssize_t (* tnetwork_driver_write_func)(tnetwork_driver_ctx *, void *, size_t);
+typedef int (* tnetwork_driver_send_early_func)(tnetwork_driver_ctx *, void *, size_t);
+typedef ssize_t (* tnetwork_driver_splice_func)(tnetwork_driver_ctx *, int, size_t);
+typedef char *(* tnetwork_driver_get_alpn_func)(tnetwork_driver_ctx *);
+typedef int (* tnetwork_driver_sendv_func)(tnetwork_driver_ctx *, struct iovec *, int);
 
 void network_driver_free(tnetwork_driver_ctx *);
 tnetwork_driver_ctx *network_driver_create(tnetwork_driver_type);
 int network_driver_connect(tnetwork_driver_ctx *, char *, char *, unsigned);
 int network_driver_send(tnetwork_driver_ctx *, void *, size_t);
-int network_driver_recv(tnetwork_driver_ctx *, unsigned char **, size_t *);
+int network_driver_send_early(tnetwork_driver_ctx *, void *, size_t);
+int network_driver_sendv(tnetwork_driver_ctx *, struct iovec *, int);
+int network_driver_sendv_early(tnetwork_driver_ctx *, struct iovec *, int);
+ssize_t network_driver_read(tnetwork_driver_ctx *, unsigned char *, size_t);
+int network_driver_is_alive(tnetwork_driver_ctx *);
+int network_driver_get_fd(tnetwork_driver_ctx *);
+int network_driver_progress(tnetwork_driver_ctx *);
+ssize_t network_driver_write(tnetwork_driver_ctx *, void *, size_t);
+ssize_t network_driver_splice(tnetwork_driver_ctx *, int, size_t);
+char *network_driver_get_alpn(tnetwork_driver_ctx *);
+char *network_driver_get_name(tnetwork_driver_ctx *);
 tnetwork_driver_ctx *network_driver_create_by_name(char *);
+int network_driver_is_plain(char *);
 tnetwork_driver_ctx *network_driver_create(tnetwork_driver_type);
 
 struct network_driver_ctx {
   tnetwork_driver_get_name_func get_name_func;
   tnetwork_driver_connect_func  connect_func;
   tnetwork_driver_send_func     send_func;
-  tnetwork_driver_recv_func     recv_func;
+  tnetwork_driver_read_func     read_func;
   tnetwork_driver_free_func     free_func;
+  tnetwork_driver_is_alive_func is_alive_func;
+  tnetwork_driver_get_fd_func   get_fd_func;
+
+  // Non-blocking drivers only
+  tnetwork_driver_progress_func progress_func;
+  tnetwork_driver_write_func    write_func;
+
+  // Optional, for requests which may be replayed (TLS 1.3 early data)
+  tnetwork_driver_send_early_func send_early_func;
+
+  // Optional, moving received data to a file descriptor within the kernel
+  tnetwork_driver_splice_func     splice_func;
+
+  // Optional, the application protocol agreed on during the handshake
+  tnetwork_driver_get_alpn_func   get_alpn_func;
+
+  // Optional, sending scattered pieces in one go (writev)
+  tnetwork_driver_sendv_func      sendv_func;
 };
 
 #endif // __NETWORK_H__
@@ -0,0 +1,25 @@
+#ifndef __NETWORK_CONNECT_H__
+#define __NETWORK_CONNECT_H__
+
+// Delay before racing the next address, the recommended value of RFC 8305
+#define NETWORK_CONNECT_ATTEMPT_DELAY_MS 250
+
+typedef struct network_connector tnetwork_connector;
+
+void network_connector_free(tnetwork_connector *connector);
+int network_connector_new(char *host, char *port, tnetwork_connector **connectorp);
+int network_connector_get_fd(tnetwork_connector *connector);
+int network_connector_progress(tnetwork_connector *connector);
+int network_connector_take_fd(tnetwork_connector *connector);
+
+int network_connect(char *host, char *port, long long deadline_ms);
+void network_connect_set_fastopen(int enable);
+
+int network_set_nonblock(int fd, int nonblock);
+int network_set_timeouts(int fd, unsigned timeout_sec);
+int network_wait_fd(int fd, int do_write, long long deadline_ms);
+
+// Unit tests.
+int network_connect_utest(void);
+
+#endif // __NETWORK_CONNECT_H__
@@ -0,0 +1,8 @@
+#ifndef __NETWORK_NONBLOCK_H__
+#define __NETWORK_NONBLOCK_H__
+
+#include "network.h"
+
+tnetwork_driver_ctx *network_driver_nonblock_create(void);
+
+#endif // __NETWORK_NONBLOCK_H__
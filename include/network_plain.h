@@ -3,6 +3,11 @@
 
 #include "network.h"
 
+#include <sys/types.h>
+
+#define NETWORK_SPLICE_PIPE_SIZE (1024 * 1024)
+
 tnetwork_driver_ctx *network_driver_plain_create(void);
+ssize_t network_splice(int fd, int pipefd[2], int out_fd, size_t len);
 
 #endif // __NETWORK_PLAIN_H__
@@ -0,0 +1,20 @@
+#ifndef __NETWORK_POOL_H__
+#define __NETWORK_POOL_H__
+
+#include "network.h"
+
+#define NETWORK_POOL_DEFAULT_MAX_PER_ORIGIN   4
+#define NETWORK_POOL_DEFAULT_IDLE_TIMEOUT_SEC 30
+
+typedef struct network_pool tnetwork_pool;
+
+void network_pool_free(tnetwork_pool *pool);
+int network_pool_new(unsigned max_per_origin, unsigned idle_timeout_sec, tnetwork_pool **poolp);
+int network_pool_get(tnetwork_pool *pool, char *host, char *port, int use_tls, char *driver, unsigned timeout_sec, tnetwork_driver_ctx **ctxp);
+void network_pool_put(tnetwork_pool *pool, tnetwork_driver_ctx *ctx, char *host, char *port, int use_tls,
+                      char *driver, int reusable);
+
+// Unit tests.
+int network_pool_utest(void);
+
+#endif // __NETWORK_POOL_H__
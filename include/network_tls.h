@@ -4,5 +4,9 @@
 #include "network.h"
 
 tnetwork_driver_ctx *network_driver_tls_create(void);
+tnetwork_driver_ctx *network_driver_tls_nonblock_create(void);
+
+// Unit tests.
+int network_tls_utest(void);
 
 #endif // __NETWORK_TLS_H__
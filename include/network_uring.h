@@ -0,0 +1,12 @@
+#ifndef __NETWORK_URING_H__
+#define __NETWORK_URING_H__
+
+#include "network.h"
+
+// Falls back to the plain driver when io_uring is not available.
+tnetwork_driver_ctx *network_driver_uring_create(void);
+
+// Unit tests.
+int network_uring_utest(void);
+
+#endif // __NETWORK_URING_H__
@@ -0,0 +1,51 @@
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <netdb.h>
+
+#define RESOLVER_CACHE_MAX_ENTRIES 256
+#define RESOLVER_MAX_ADDRS         16
+
+// getaddrinfo() does not tell the TTLs
+#define RESOLVER_DEFAULT_TTL_SEC   60
+// For failures without any SOA record to tell for how long
+#define RESOLVER_NEGATIVE_TTL_SEC  5
+
+// Stub resolver: a query is sent up to RESOLVER_STUB_TRIES times, every
+// RESOLVER_STUB_RETRY_MS until answered.
+#define RESOLVER_STUB_TRIES        3
+#define RESOLVER_STUB_RETRY_MS     1000
+
+// How host names are resolved, NULL fields standing for the defaults
+struct resolver_options {
+  int   stub;       // Own non-blocking DNS queries rather than getaddrinfo()
+  char *nameserver; // addr, addr:port or [addr6]:port, else from /etc/resolv.conf
+
+  char *overrides_file; // host:port:addr[,addr...] lines, pinning addresses
+};
+
+struct resolver_stats {
+  unsigned long hits;          // Answered by the cache
+  unsigned long negative_hits; // Ditto, with a cached failure
+  unsigned long misses;        // Went to the resolver
+};
+
+typedef struct resolver_query tresolver_query;
+
+int resolver_configure(struct resolver_options *options);
+void resolver_cleanup(void);
+void resolver_get_stats(struct resolver_stats *stats);
+int resolver_add_override(char *spec);
+int resolver_check_override(char *spec);
+int resolver_load_overrides(char *path);
+
+void resolver_query_free(tresolver_query *query);
+int resolver_query_new(char *host, char *port, tresolver_query **queryp);
+int resolver_query_get_fd(tresolver_query *query);
+int resolver_query_progress(tresolver_query *query);
+struct addrinfo *resolver_query_take_result(tresolver_query *query);
+
+// Unit tests.
+int resolver_utest(void);
+
+#endif // __RESOLVER_H__
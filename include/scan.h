@@ -0,0 +1,27 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+
+// Delimiter scanning for the parsers, 16 or 32 bytes at a time where the CPU
+// allows it.  The implementation is chosen on first use, the best one the
+// CPU supports, unless scan_set_impl() said otherwise.  Whitespace is that of
+// isspace() in the C locale: SP, HTAB, LF, VT, FF and CR.
+
+// Index of the first c in p, len if none
+size_t scan_byte(const unsigned char *p, size_t len, unsigned char c);
+
+// Length of the whitespace run starting p, ending p + len
+size_t scan_ws_span(const unsigned char *p, size_t len);
+size_t scan_ws_span_back(const unsigned char *p, size_t len);
+
+// "scalar", "sse2" or "avx2": -1 when unknown or unsupported by the CPU
+int scan_set_impl(char *name);
+char *scan_impl_name(void);
+// The implementations, supported or not, NULL-terminated
+char **scan_impl_names(void);
+
+// Unit tests.
+int scan_utest(void);
+
+#endif // __SCAN_H__
@@ -0,0 +1,29 @@
+#ifndef __TLS_CONTEXT_H__
+#define __TLS_CONTEXT_H__
+
+#include <openssl/ssl.h>
+
+// How TLS connections are set up, NULL fields standing for OpenSSL's
+// defaults.
+struct tls_options {
+  char *ca_file; // PEM bundle, instead of the system's trust store
+  char *ca_path; // Directory of hashed certificates, ditto
+  char *ciphers; // Cipher list for TLS 1.2 and below
+  char *groups;  // Key exchange groups, e.g. "X25519:P-256"
+
+  char *session_cache; // File sharing resumable sessions across processes
+  int   early_data;    // Send safe requests in the 0-RTT data of resumed sessions
+  int   ktls;          // Leave the record layer to the kernel when possible
+  int   http2;         // Offer h2 through ALPN, before http/1.1
+};
+
+int tls_context_configure(struct tls_options *options);
+SSL_CTX *tls_context_acquire(void);
+void tls_context_cleanup(void);
+int tls_context_early_data(void);
+int tls_context_http2(void);
+
+// Unit tests.
+int tls_context_utest(void);
+
+#endif // __TLS_CONTEXT_H__
@@ -0,0 +1,16 @@
+#ifndef __TLS_SESSION_H__
+#define __TLS_SESSION_H__
+
+#include <openssl/ssl.h>
+
+#define TLS_SESSION_CACHE_MAX_ENTRIES 64
+
+int tls_session_cache_load(char *path);
+void tls_session_cache_cleanup(void);
+int tls_session_resume(SSL *ssl, char *host, char *port);
+int tls_session_new_cb(SSL *ssl, SSL_SESSION *session);
+
+// Unit tests.
+int tls_session_utest(void);
+
+#endif // __TLS_SESSION_H__
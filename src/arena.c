@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "logger.h"
+#include "arena.h"
+
+#define ARENA_DEFAULT_CHUNK_SIZE (8 * 1024)
+
+// Enough for any type on the platforms we build on
+#define ARENA_ALIGN    16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+// Above which a size cannot be rounded, chunk header included
+#define ARENA_MAX_SIZE (SIZE_MAX / 2)
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  unsigned char      *data;
+  size_t              size;
+  size_t              used;
+};
+
+struct arena {
+  struct arena_hooks  hooks;
+  size_t              chunk_size;
+
+  // Allocations are carved out of the first one, the others are full
+  struct arena_chunk *chunks;
+  // One allocation each, those too large for the chunks: they can be
+  // reallocated on their own
+  struct arena_chunk *large;
+  // The last one carved, which can grow in place
+  unsigned char      *last;
+
+  // Allocated along with the arena, right after it
+  struct arena_chunk  first;
+};
+
+static void *arena_default_alloc(size_t size, void *user_data)
+{
+  (void) user_data;
+  return malloc(size);
+}
+
+static void *arena_default_realloc(void *ptr, size_t size, void *user_data)
+{
+  (void) user_data;
+  return realloc(ptr, size);
+}
+
+static void arena_default_free(void *ptr, void *user_data)
+{
+  (void) user_data;
+  free(ptr);
+}
+
+static struct arena_hooks arena_default_hooks = {
+  .alloc_func = arena_default_alloc,
+  .realloc_func = arena_default_realloc,
+  .free_func = arena_default_free,
+};
+
+int arena_new(size_t chunk_size, struct arena_hooks *hooks, tarena **arenap)
+{
+  tarena *arena = NULL;
+
+  if (! chunk_size)
+    chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+
+  if (! hooks)
+    hooks = &arena_default_hooks;
+
+  if (chunk_size > ARENA_MAX_SIZE) {
+    logger("chunks of %zu bytes are too large", chunk_size);
+    return -1;
+  }
+
+  chunk_size = ARENA_ROUND(chunk_size);
+  if (! (arena = hooks->alloc_func(ARENA_ROUND(sizeof *arena) + chunk_size, hooks->user_data))) {
+    logger("failed to allocate an arena of %zu bytes", chunk_size);
+    return -1;
+  }
+
+  arena->hooks = *hooks;
+  arena->chunk_size = chunk_size;
+  arena->first.next = NULL;
+  arena->first.data = (unsigned char *) arena + ARENA_ROUND(sizeof *arena);
+  arena->first.size = chunk_size;
+  arena->first.used = 0;
+  arena->chunks = &arena->first;
+  arena->large = NULL;
+  arena->last = NULL;
+
+  *arenap = arena;
+  return 0;
+}
+
+static void arena_free_chunks(tarena *arena)
+{
+  struct arena_chunk *next = NULL;
+
+  for (struct arena_chunk *chunk = arena->large; chunk; chunk = next) {
+    next = chunk->next;
+    arena->hooks.free_func(chunk, arena->hooks.user_data);
+  }
+
+  for (struct arena_chunk *chunk = arena->chunks; chunk != &arena->first; chunk = next) {
+    next = chunk->next;
+    arena->hooks.free_func(chunk, arena->hooks.user_data);
+  }
+
+  arena->large = NULL;
+  arena->chunks = &arena->first;
+  arena->first.used = 0;
+  arena->last = NULL;
+}
+
+void arena_free(tarena *arena)
+{
+  if (! arena)
+    return;
+
+  arena_free_chunks(arena);
+  arena->hooks.free_func(arena, arena->hooks.user_data);
+}
+
+void arena_reset(tarena *arena)
+{
+  if (arena)
+    arena_free_chunks(arena);
+}
+
+static struct arena_chunk *arena_chunk_new(tarena *arena, size_t size)
+{
+  struct arena_chunk *chunk = NULL;
+
+  if (! (chunk = arena->hooks.alloc_func(ARENA_ROUND(sizeof *chunk) + size, arena->hooks.user_data)))
+    return NULL;
+
+  chunk->next = NULL;
+  chunk->data = (unsigned char *) chunk + ARENA_ROUND(sizeof *chunk);
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+void *arena_alloc(tarena *arena, size_t size)
+{
+  struct arena_chunk *chunk = NULL;
+  unsigned char      *p = NULL;
+
+  if (! arena)
+    return malloc(size);
+
+  if (size > ARENA_MAX_SIZE)
+    return NULL;
+
+  size = ARENA_ROUND(size ? size : 1);
+
+  // Large ones would leave most of a chunk unused
+  if (size > arena->chunk_size / 4) {
+    if (! (chunk = arena_chunk_new(arena, size)))
+      return NULL;
+
+    chunk->used = size;
+    chunk->next = arena->large;
+    arena->large = chunk;
+    return chunk->data;
+  }
+
+  chunk = arena->chunks;
+  if (chunk->size - chunk->used < size) {
+    if (! (chunk = arena_chunk_new(arena, arena->chunk_size)))
+      return NULL;
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  p = chunk->data + chunk->used;
+  chunk->used += size;
+  arena->last = p;
+  return p;
+}
+
+void *arena_realloc(tarena *arena, void *ptr, size_t old_size, size_t size)
+{
+  unsigned char *p = NULL;
+
+  if (! arena)
+    return realloc(ptr, size);
+
+  if (! ptr)
+    return arena_alloc(arena, size);
+
+  if (size <= old_size)
+    return ptr;
+
+  if (size > ARENA_MAX_SIZE)
+    return NULL;
+
+  if (ptr == arena->last) {
+    struct arena_chunk *chunk = arena->chunks;
+    size_t              off = PTRDIFF(ptr, chunk->data);
+
+    if (ARENA_ROUND(size) <= chunk->size - off) {
+      chunk->used = off + ARENA_ROUND(size);
+      return ptr;
+    }
+  }
+
+  for (struct arena_chunk **link = &arena->large; *link; link = &(*link)->next) {
+    struct arena_chunk *chunk = *link;
+
+    if (chunk->data != ptr)
+      continue;
+
+    if (! (chunk = arena->hooks.realloc_func(chunk, ARENA_ROUND(sizeof *chunk) + ARENA_ROUND(size),
+                                             arena->hooks.user_data)))
+      return NULL;
+
+    chunk->data = (unsigned char *) chunk + ARENA_ROUND(sizeof *chunk);
+    chunk->size = chunk->used = ARENA_ROUND(size);
+    *link = chunk;
+    return chunk->data;
+  }
+
+  if (! (p = arena_alloc(arena, size)))
+    return NULL;
+
+  memcpy(p, ptr, old_size);
+  return p;
+}
+
+char *arena_strdup(tarena *arena, char *s)
+{
+  size_t len = strlen(s) + 1;
+  char  *p = NULL;
+
+  if (! arena)
+    return strdup(s);
+
+  if ((p = arena_alloc(arena, len)))
+    memcpy(p, s, len);
+
+  return p;
+}
+
+void arena_release(tarena *arena, void *ptr)
+{
+  if (! arena) {
+    free(ptr);
+    return;
+  }
+
+  // The last one carved can be taken back, e.g. a buffer given up
+  if (ptr && ptr == arena->last) {
+    arena->chunks->used = PTRDIFF(ptr, arena->chunks->data);
+    arena->last = NULL;
+  }
+}
+
+#include "../tests/arena_utest.c"
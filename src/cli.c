@@ -7,6 +7,7 @@
 #include "utest.h"
 #include "strutil.h"
 #include "logger.h"
+#include "network.h"
 #include "cli.h"
 
 static struct option long_options[] =
@@ -19,6 +20,24 @@ static struct option long_options[] =
   {"get-code",    no_argument,       NULL,  0},
   {"get-headers", no_argument,       NULL,  0},
   {"get-body",    no_argument,       NULL,  0},
+  {"output",      required_argument, NULL,  0},
+  {"driver",      required_argument, NULL,  0},
+  {"cacert",      required_argument, NULL,  0},
+  {"capath",      required_argument, NULL,  0},
+  {"ciphers",     required_argument, NULL,  0},
+  {"tls-groups",  required_argument, NULL,  0},
+  {"tls-session-cache", required_argument, NULL, 0},
+  {"tls-early-data", no_argument,    NULL,  0},
+  {"ktls",        no_argument,       NULL,  0},
+  {"http2",       no_argument,       NULL,  0},
+  {"http2-prior-knowledge", no_argument, NULL, 0},
+  {"verbose",     no_argument,       NULL,  0},
+  {"dns-stub",    no_argument,       NULL,  0},
+  {"nameserver",  required_argument, NULL,  0},
+  {"resolve",     required_argument, NULL,  0},
+  {"resolve-file", required_argument, NULL, 0},
+  {"tcp-fastopen", no_argument,      NULL,  0},
+  {"path",        required_argument, NULL,  0},
   {NULL,          0,                 NULL,  0},
 };
 
@@ -45,6 +64,24 @@ static void cli_usage(const char * const progname)
           "\t    --get-code\t\t       display the reply code\n"
           "\t    --get-headers\t\t    display the reply headers\n"
           "\t    --get-body\t\t       display the reply body\n"
+          "\t    --output <file>\t    write the reply body to a file\n"
+          "\t    --driver <name>\t    network driver for plain HTTP (plain, uring)\n"
+          "\t    --cacert <file>\t    CA certificates to trust, instead of the system's\n"
+          "\t    --capath <dir>\t    directory of CA certificates to trust, ditto\n"
+          "\t    --ciphers <list>\t    TLS 1.2 cipher list, OpenSSL format\n"
+          "\t    --tls-groups <list>\t    TLS key exchange groups, e.g. X25519:P-256\n"
+          "\t    --tls-session-cache <file> resume TLS sessions across runs\n"
+          "\t    --tls-early-data\t       send GET and HEAD requests in the 0-RTT data\n"
+          "\t    --ktls\t\t       let the kernel encrypt and decrypt the TLS records\n"
+          "\t    --http2\t\t       use HTTP/2 when the server supports it (ALPN, h2c upgrade)\n"
+          "\t    --http2-prior-knowledge use h2c straight away on plain connections\n"
+          "\t    --verbose\t\t       report what happens on the connection\n"
+          "\t    --dns-stub\t\t       resolve through our own DNS queries\n"
+          "\t    --nameserver <addr>\t    DNS server for --dns-stub, addr[:port]\n"
+          "\t    --resolve <host:port:addr[,addr...]> use these addresses for host:port\n"
+          "\t    --resolve-file <file>   ditto, one host:port:addr per line\n"
+          "\t    --tcp-fastopen\t       send the request in the SYN, if the server allows\n"
+          "\t    --path <path>\t    also request this path, pipelined on the connection\n"
           "\n",
           progname);
 }
@@ -232,6 +269,21 @@ static int cli_parse_header(char *input, char **keyp, char **valuep)
   return rc;
 }
 
+// Replace a string option with a copy of the argument
+static int cli_set_string(char **optionp, char *arg)
+{
+  char *tmp = strdup(arg);
+
+  if (! tmp) {
+    logger("strdup: %m");
+    return -1;
+  }
+
+  free(*optionp);
+  *optionp = tmp;
+  return 0;
+}
+
 int cli_process_args(int argc, char **argv, struct cli_options *options, thttp_request **requestp)
 {
   int            ch;
@@ -262,7 +314,7 @@ int cli_process_args(int argc, char **argv, struct cli_options *options, thttp_r
   }
     
 
-  while ((ch = getopt_long(argc, argv, "hvdt", long_options, &option_index)) != -1) {
+  while ((ch = getopt_long(argc, argv, "hvdDt", long_options, &option_index)) != -1) {
     switch (ch) {
     case 0: // long options
       name = (char *) long_options[option_index].name;
@@ -272,6 +324,81 @@ int cli_process_args(int argc, char **argv, struct cli_options *options, thttp_r
         options->display.body = 1;
       } else if (! strcmp(name, "get-headers")) {
         options->display.headers = 1;
+      } else if (! strcmp(name, "output")) {
+        if (cli_set_string(&options->output, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "driver")) {
+        if (! network_driver_is_plain(optarg)) {
+          logger("%s: not a network driver for plain HTTP", optarg);
+          goto err;
+        }
+
+        if (cli_set_string(&options->driver, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "cacert")) {
+        if (cli_set_string(&options->tls.ca_file, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "capath")) {
+        if (cli_set_string(&options->tls.ca_path, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "ciphers")) {
+        if (cli_set_string(&options->tls.ciphers, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "tls-groups")) {
+        if (cli_set_string(&options->tls.groups, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "tls-session-cache")) {
+        if (cli_set_string(&options->tls.session_cache, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "tls-early-data")) {
+        options->tls.early_data = 1;
+      } else if (! strcmp(name, "ktls")) {
+        options->tls.ktls = 1;
+      } else if (! strcmp(name, "http2")) {
+        options->tls.http2 = 1;
+      } else if (! strcmp(name, "http2-prior-knowledge")) {
+        options->http2_prior_knowledge = 1;
+      } else if (! strcmp(name, "verbose")) {
+        options->verbose = 1;
+      } else if (! strcmp(name, "dns-stub")) {
+        options->resolver.stub = 1;
+      } else if (! strcmp(name, "nameserver")) {
+        if (cli_set_string(&options->resolver.nameserver, optarg) < 0)
+          goto err;
+      } else if (! strcmp(name, "resolve")) {
+        char **tmp = NULL;
+
+        if (resolver_check_override(optarg) < 0)
+          goto err;
+
+        if (! (tmp = realloc(options->resolve, (options->n_resolve + 1) * sizeof *tmp))) {
+          logger("realloc: %m");
+          goto err;
+        }
+
+        options->resolve = tmp;
+        options->resolve[options->n_resolve] = NULL;
+        if (cli_set_string(&options->resolve[options->n_resolve], optarg) < 0)
+          goto err;
+        options->n_resolve++;
+      } else if (! strcmp(name, "tcp-fastopen")) {
+        options->tcp_fastopen = 1;
+      } else if (! strcmp(name, "path")) {
+        char **tmp = realloc(options->paths, (options->n_paths + 1) * sizeof *tmp);
+
+        if (! tmp) {
+          logger("realloc: %m");
+          goto err;
+        }
+
+        options->paths = tmp;
+        options->paths[options->n_paths] = NULL;
+        if (cli_set_string(&options->paths[options->n_paths], optarg) < 0)
+          goto err;
+        options->n_paths++;
+      } else if (! strcmp(name, "resolve-file")) {
+        if (cli_set_string(&options->resolver.overrides_file, optarg) < 0)
+          goto err;
       } else if (! strcmp(name, "http-header")) {
         char *key = NULL;
         char *value = NULL;
@@ -302,6 +429,10 @@ int cli_process_args(int argc, char **argv, struct cli_options *options, thttp_r
     case 'h':
       cli_usage(progname);
       exit(EXIT_SUCCESS);
+
+    case '?':
+      // Unknown, or without its argument: getopt_long() said which
+      goto err;
     }
   }
 
@@ -312,6 +443,16 @@ int cli_process_args(int argc, char **argv, struct cli_options *options, thttp_r
     goto err;
   }
 
+  if (options->driver && http_request_set_driver(request, options->driver) < 0) {
+    http_request_free(request);
+    goto err;
+  }
+
+  if (options->http2_prior_knowledge)
+    http_request_set_h2c(request, HTTP_H2C_PRIOR_KNOWLEDGE);
+  else if (options->tls.http2)
+    http_request_set_h2c(request, HTTP_H2C_UPGRADE);
+
   if (requestp)
     *requestp = request;
   else
@@ -360,6 +501,21 @@ void cli_options_deinit(struct cli_options *options)
 {
   free(options->host);
   free(options->path);
+  free(options->output);
+  free(options->driver);
+  free(options->tls.ca_file);
+  free(options->tls.ca_path);
+  free(options->tls.ciphers);
+  free(options->tls.groups);
+  free(options->tls.session_cache);
+  free(options->resolver.nameserver);
+  free(options->resolver.overrides_file);
+  for (size_t i = 0; i < options->n_resolve; i++)
+    free(options->resolve[i]);
+  free(options->resolve);
+  for (size_t i = 0; i < options->n_paths; i++)
+    free(options->paths[i]);
+  free(options->paths);
 }
 
 
@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "util.h"
+#include "logger.h"
+#include "event_loop.h"
+
+// Deadlines are checked once per tick rather than kept sorted: timeouts are
+// in seconds, and this keeps the per-event cost constant however many fds
+// are watched.
+#define EVENT_LOOP_TICK_MS    100
+#define EVENT_LOOP_MAX_EVENTS 256
+
+// Handlers are indexed by fd.  The generation tells apart an fd number
+// reused within a single epoll_wait() batch, whose pending events belong to
+// the previous owner.
+struct event_handler {
+  int               fd;
+  int               events;
+  uint32_t          gen;
+  long long         deadline_ms;
+  tevent_loop_func  func;
+  void             *user_data;
+};
+
+struct event_loop {
+  int                   epfd;
+  struct event_handler *handlers;
+  int                   n_handlers;
+  unsigned              n_active;
+  uint32_t              gen;
+  int                   stop;
+  long long             next_tick_ms;
+};
+
+long long event_loop_now_ms(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void event_loop_free(tevent_loop *loop)
+{
+  if (! loop)
+    return;
+
+  if (loop->epfd >= 0)
+    (void) close(loop->epfd);
+
+  free(loop->handlers);
+  free(loop);
+}
+
+int event_loop_new(tevent_loop **loopp)
+{
+  tevent_loop *loop = calloc(1, sizeof *loop);
+  if (! loop) {
+    logger("calloc: %m");
+    goto err;
+  }
+
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    logger("epoll_create1: %m");
+    goto err;
+  }
+
+  if (loopp)
+    *loopp = loop;
+  else
+    event_loop_free(loop);
+
+  return 0;
+ err:
+  event_loop_free(loop);
+  return -1;
+}
+
+static uint32_t event_loop_to_epoll(int events)
+{
+  return (events & EVENT_LOOP_READ ? EPOLLIN : 0) |
+    (events & EVENT_LOOP_WRITE ? EPOLLOUT : 0);
+}
+
+static int event_loop_ctl(tevent_loop *loop, int op, struct event_handler *handler)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof ev);
+  ev.events = event_loop_to_epoll(handler->events);
+  ev.data.u64 = (uint64_t) handler->gen << 32 | (uint32_t) handler->fd;
+
+  if (epoll_ctl(loop->epfd, op, handler->fd, &ev) < 0) {
+    logger("epoll_ctl: %m");
+    return -1;
+  }
+
+  return 0;
+}
+
+// deadline_ms is an event_loop_now_ms() date, or 0 for none.
+int event_loop_add(tevent_loop *loop, int fd, int events, long long deadline_ms, tevent_loop_func func, void *user_data)
+{
+  struct event_handler *handler = NULL;
+
+  if (fd < 0) {
+    logger("invalid fd %d", fd);
+    return -1;
+  }
+
+  if (fd >= loop->n_handlers) {
+    int                   n = loop->n_handlers ? loop->n_handlers : 64;
+    struct event_handler *tmp = NULL;
+
+    while (n <= fd)
+      n *= 2;
+
+    if (! (tmp = realloc(loop->handlers, n * sizeof *tmp))) {
+      logger("realloc: %m");
+      return -1;
+    }
+
+    for (int i = loop->n_handlers; i < n; i++)
+      tmp[i].fd = -1;
+
+    loop->handlers = tmp;
+    loop->n_handlers = n;
+  }
+
+  handler = &loop->handlers[fd];
+  if (handler->fd >= 0) {
+    logger("fd %d is already watched", fd);
+    return -1;
+  }
+
+  handler->fd = fd;
+  handler->events = events;
+  handler->gen = ++loop->gen;
+  handler->deadline_ms = deadline_ms;
+  handler->func = func;
+  handler->user_data = user_data;
+
+  if (event_loop_ctl(loop, EPOLL_CTL_ADD, handler) < 0) {
+    handler->fd = -1;
+    return -1;
+  }
+
+  loop->n_active++;
+  return 0;
+}
+
+int event_loop_mod(tevent_loop *loop, int fd, int events)
+{
+  struct event_handler *handler = NULL;
+
+  if (fd < 0 || fd >= loop->n_handlers || loop->handlers[fd].fd != fd) {
+    logger("fd %d is not watched", fd);
+    return -1;
+  }
+
+  handler = &loop->handlers[fd];
+  if (handler->events == events)
+    return 0;
+
+  handler->events = events;
+  return event_loop_ctl(loop, EPOLL_CTL_MOD, handler);
+}
+
+// The fd may already be closed, in which case the kernel forgot it already.
+void event_loop_del(tevent_loop *loop, int fd)
+{
+  struct epoll_event ev;
+
+  if (fd < 0 || fd >= loop->n_handlers || loop->handlers[fd].fd != fd)
+    return;
+
+  (void) epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+
+  loop->handlers[fd].fd = -1;
+  loop->n_active--;
+}
+
+void event_loop_stop(tevent_loop *loop)
+{
+  loop->stop = 1;
+}
+
+static void event_loop_expire(tevent_loop *loop, long long now)
+{
+  // Handlers may add or remove others, hence the index-based walk
+  for (int fd = 0; fd < loop->n_handlers; fd++) {
+    struct event_handler *handler = &loop->handlers[fd];
+
+    if (handler->fd < 0 || ! handler->deadline_ms || handler->deadline_ms > now)
+      continue;
+
+    handler->deadline_ms = 0;
+    handler->func(fd, EVENT_LOOP_TIMEOUT, handler->user_data);
+  }
+}
+
+// Dispatch the events until there's no fd left to watch, or until stopped.
+int event_loop_run(tevent_loop *loop)
+{
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+  loop->stop = 0;
+  loop->next_tick_ms = event_loop_now_ms() + EVENT_LOOP_TICK_MS;
+
+  while (loop->n_active && ! loop->stop) {
+    long long now = 0;
+    int       n = epoll_wait(loop->epfd, events, N_ELEMS(events), EVENT_LOOP_TICK_MS);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      logger("epoll_wait: %m");
+      return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int                   fd = (int) (uint32_t) events[i].data.u64;
+      uint32_t              gen = (uint32_t) (events[i].data.u64 >> 32);
+      struct event_handler *handler = &loop->handlers[fd];
+      int                   ready = 0;
+
+      if (handler->fd != fd || handler->gen != gen)
+        continue;
+
+      // Errors and hang-ups are for the handler to find out when reading
+      // or writing, whatever it was waiting for.
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        ready = handler->events;
+      } else {
+        ready |= events[i].events & EPOLLIN ? EVENT_LOOP_READ : 0;
+        ready |= events[i].events & EPOLLOUT ? EVENT_LOOP_WRITE : 0;
+      }
+
+      handler->func(fd, ready, handler->user_data);
+    }
+
+    if ((now = event_loop_now_ms()) >= loop->next_tick_ms) {
+      event_loop_expire(loop, now);
+      loop->next_tick_ms = now + EVENT_LOOP_TICK_MS;
+    }
+  }
+
+  return 0;
+}
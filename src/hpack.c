@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "logger.h"
+#include "hpack.h"
+
+// Entries count their name and value lengths, plus 32 for the overhead
+#define HPACK_ENTRY_OVERHEAD 32
+
+// Integers above this many continuation bytes are not worth decoding
+#define HPACK_INT_MAX_SHIFT  28
+
+struct hpack_entry {
+  char  *name;
+  char  *value;
+  size_t size;
+};
+
+struct hpack_table {
+  struct hpack_entry *entries; // Newest first
+  size_t              n_entries;
+  size_t              size;     // Sum of the entry sizes
+  size_t              max_size; // As last signalled
+  size_t              limit;    // SETTINGS_HEADER_TABLE_SIZE, bounding max_size
+
+  // Encoder only: max_size changed, and went down to pending_min meanwhile
+  int                 pending_update;
+  size_t              pending_min;
+};
+
+// RFC 7541 appendix A
+static struct http_headers_elem hpack_static_table[] = {
+  { ":authority",                  ""              },
+  { ":method",                     "GET"           },
+  { ":method",                     "POST"          },
+  { ":path",                       "/"             },
+  { ":path",                       "/index.html"   },
+  { ":scheme",                     "http"          },
+  { ":scheme",                     "https"         },
+  { ":status",                     "200"           },
+  { ":status",                     "204"           },
+  { ":status",                     "206"           },
+  { ":status",                     "304"           },
+  { ":status",                     "400"           },
+  { ":status",                     "404"           },
+  { ":status",                     "500"           },
+  { "accept-charset",              ""              },
+  { "accept-encoding",             "gzip, deflate" },
+  { "accept-language",             ""              },
+  { "accept-ranges",               ""              },
+  { "accept",                      ""              },
+  { "access-control-allow-origin", ""              },
+  { "age",                         ""              },
+  { "allow",                       ""              },
+  { "authorization",               ""              },
+  { "cache-control",               ""              },
+  { "content-disposition",         ""              },
+  { "content-encoding",            ""              },
+  { "content-language",            ""              },
+  { "content-length",              ""              },
+  { "content-location",            ""              },
+  { "content-range",               ""              },
+  { "content-type",                ""              },
+  { "cookie",                      ""              },
+  { "date",                        ""              },
+  { "etag",                        ""              },
+  { "expect",                      ""              },
+  { "expires",                     ""              },
+  { "from",                        ""              },
+  { "host",                        ""              },
+  { "if-match",                    ""              },
+  { "if-modified-since",           ""              },
+  { "if-none-match",               ""              },
+  { "if-range",                    ""              },
+  { "if-unmodified-since",         ""              },
+  { "last-modified",               ""              },
+  { "link",                        ""              },
+  { "location",                    ""              },
+  { "max-forwards",                ""              },
+  { "proxy-authenticate",          ""              },
+  { "proxy-authorization",         ""              },
+  { "range",                       ""              },
+  { "referer",                     ""              },
+  { "refresh",                     ""              },
+  { "retry-after",                 ""              },
+  { "server",                      ""              },
+  { "set-cookie",                  ""              },
+  { "strict-transport-security",   ""              },
+  { "transfer-encoding",           ""              },
+  { "user-agent",                  ""              },
+  { "vary",                        ""              },
+  { "via",                         ""              },
+  { "www-authenticate",            ""              },
+};
+
+// RFC 7541 appendix B, by symbol, 256 being EOS
+static struct {
+  uint32_t code;
+  uint8_t  bits;
+} hpack_huffman_codes[257] = {
+  { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+  { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+  { 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+  { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+  { 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+  { 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+  { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+  { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+  { 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+  { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+  { 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+  { 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+  { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+  { 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+  { 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+  { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+  { 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+  { 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+  { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+  { 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+  { 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+  { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+  { 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+  { 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+  { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+  { 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+  { 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+  { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+  { 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+  { 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+  { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+  { 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+  { 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+  { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+  { 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+  { 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+  { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+  { 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+  { 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+  { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+  { 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+  { 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+  { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+  { 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+  { 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+  { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+  { 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+  { 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+  { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+  { 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+  { 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+  { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+  { 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+  { 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+  { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+  { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+  { 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+  { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+  { 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+  { 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+  { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+  { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+  { 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+  { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+  { 0x3fffffff, 30 },
+};
+
+// The code is canonical: the symbols sorted by code length then value, and
+// the number of codes of each length, are enough to decode it.
+static uint16_t hpack_huffman_syms[257] = {
+   48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+   45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+   95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+   58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+   77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+  106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+   88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+    0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+  167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+  132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+  173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+  151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+  183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+  171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+  255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+  246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+    6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+   21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+  249,  10,  13,  22, 256,
+};
+
+static uint8_t hpack_huffman_counts[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+  0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+#define HPACK_STATIC_TABLE_LEN N_ELEMS(hpack_static_table)
+
+
+//
+// Output buffer
+//
+
+int hpack_buf_append(struct hpack_buf *buf, void *data, size_t len)
+{
+  if (! len)
+    return 0;
+
+  if (buf->len + len > buf->size) {
+    size_t         size = buf->size ? buf->size : 256;
+    unsigned char *tmp = NULL;
+
+    while (size < buf->len + len)
+      size *= 2;
+
+    if (! (tmp = realloc(buf->data, size))) {
+      logger("realloc: %m");
+      return -1;
+    }
+
+    buf->data = tmp;
+    buf->size = size;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return 0;
+}
+
+void hpack_buf_free(struct hpack_buf *buf)
+{
+  free(buf->data);
+  buf->data = NULL;
+  buf->len = buf->size = 0;
+}
+
+
+//
+// Dynamic table
+//
+
+void hpack_table_free(thpack_table *table)
+{
+  if (! table)
+    return;
+
+  for (size_t i = 0; i < table->n_entries; i++) {
+    free(table->entries[i].name);
+    free(table->entries[i].value);
+  }
+
+  free(table->entries);
+  free(table);
+}
+
+int hpack_table_new(size_t limit, thpack_table **tablep)
+{
+  thpack_table *table = calloc(1, sizeof *table);
+
+  if (! table) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  table->max_size = limit;
+  table->limit = limit;
+
+  *tablep = table;
+  return 0;
+}
+
+// Drop the oldest entries until room bytes fit
+static void hpack_table_evict(thpack_table *table, size_t room)
+{
+  while (table->n_entries && table->size + room > table->max_size) {
+    struct hpack_entry *entry = &table->entries[--table->n_entries];
+
+    table->size -= entry->size;
+    free(entry->name);
+    free(entry->value);
+  }
+}
+
+// The encoder follows the peer's SETTINGS_HEADER_TABLE_SIZE, without using
+// more than the default even if allowed to.  The change is signalled at the
+// start of the next header block.
+void hpack_table_set_limit(thpack_table *table, size_t limit)
+{
+  size_t max_size = limit < HPACK_DEFAULT_TABLE_SIZE ? limit : HPACK_DEFAULT_TABLE_SIZE;
+
+  table->limit = limit;
+  if (max_size == table->max_size)
+    return;
+
+  if (! table->pending_update || max_size < table->pending_min)
+    table->pending_min = max_size;
+
+  table->pending_update = 1;
+  table->max_size = max_size;
+  hpack_table_evict(table, 0);
+}
+
+// Takes name and value over.  An entry larger than the table empties it
+// without being added (RFC 7541 section 4.4).
+static int hpack_table_insert(thpack_table *table, char *name, char *value)
+{
+  size_t              size = strlen(name) + strlen(value) + HPACK_ENTRY_OVERHEAD;
+  struct hpack_entry *tmp = NULL;
+
+  hpack_table_evict(table, size);
+  if (size > table->max_size) {
+    free(name);
+    free(value);
+    return 0;
+  }
+
+  if (! (tmp = realloc(table->entries, (table->n_entries + 1) * sizeof *tmp))) {
+    logger("realloc: %m");
+    free(name);
+    free(value);
+    return -1;
+  }
+
+  memmove(tmp + 1, tmp, table->n_entries * sizeof *tmp);
+  tmp[0].name = name;
+  tmp[0].value = value;
+  tmp[0].size = size;
+  table->entries = tmp;
+  table->n_entries++;
+  table->size += size;
+  return 0;
+}
+
+// Index 1 and up: the static table, then the dynamic one
+static struct http_headers_elem *hpack_table_get(thpack_table *table, size_t index,
+                                                 struct http_headers_elem *elem)
+{
+  if (index >= 1 && index <= HPACK_STATIC_TABLE_LEN)
+    return &hpack_static_table[index - 1];
+
+  index -= HPACK_STATIC_TABLE_LEN + 1;
+  if (index >= table->n_entries)
+    return NULL;
+
+  elem->key = table->entries[index].name;
+  elem->value = table->entries[index].value;
+  return elem;
+}
+
+
+//
+// Primitives (RFC 7541 section 5)
+//
+
+static int hpack_decode_int(unsigned char **pp, unsigned char *end, unsigned prefix_bits, size_t *valuep)
+{
+  unsigned char *p = *pp;
+  size_t         max = (1u << prefix_bits) - 1;
+  size_t         value = 0;
+  unsigned       shift = 0;
+
+  if (p == end)
+    return -1;
+
+  if ((value = *p++ & max) == max) {
+    do {
+      if (p == end || shift > HPACK_INT_MAX_SHIFT)
+        return -1;
+
+      value += (size_t) (*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+  }
+
+  *pp = p;
+  *valuep = value;
+  return 0;
+}
+
+static int hpack_encode_int(struct hpack_buf *out, unsigned char first, unsigned prefix_bits, size_t value)
+{
+  unsigned char buf[16];
+  size_t        n = 0;
+  size_t        max = (1u << prefix_bits) - 1;
+
+  if (value < max) {
+    buf[n++] = first | (unsigned char) value;
+  } else {
+    buf[n++] = first | (unsigned char) max;
+    for (value -= max; value >= 0x80; value >>= 7)
+      buf[n++] = (unsigned char) (0x80 | (value & 0x7f));
+    buf[n++] = (unsigned char) value;
+  }
+
+  return hpack_buf_append(out, buf, n);
+}
+
+// Canonical decoding, a bit at a time: code gathers the bits of the
+// current symbol, first is the first code of its length, index the
+// position of that code in hpack_huffman_syms.  The padding must be the
+// most significant bits of EOS, all ones, and shorter than a byte.
+static int hpack_huffman_decode(unsigned char *in, size_t len, char *out, size_t *out_lenp)
+{
+  size_t   n = 0;
+  unsigned code = 0;
+  unsigned first = 0;
+  unsigned index = 0;
+  unsigned bits = 0;
+  int      ones = 1;
+
+  for (size_t i = 0; i < len; i++) {
+    for (int b = 7; b >= 0; b--) {
+      unsigned bit = (in[i] >> b) & 1;
+      unsigned count = hpack_huffman_counts[++bits];
+
+      code |= bit;
+      ones &= bit;
+
+      if (code < first + count) {
+        unsigned sym = hpack_huffman_syms[index + code - first];
+
+        if (sym == 256) {
+          logger("EOS in a Huffman-encoded string");
+          return -1;
+        }
+
+        out[n++] = (char) sym;
+        code = first = index = bits = 0;
+        ones = 1;
+        continue;
+      }
+
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+  }
+
+  if (bits > 7 || ! ones) {
+    logger("invalid Huffman padding");
+    return -1;
+  }
+
+  *out_lenp = n;
+  return 0;
+}
+
+static size_t hpack_huffman_len(char *s, size_t len)
+{
+  size_t bits = 0;
+
+  for (size_t i = 0; i < len; i++)
+    bits += hpack_huffman_codes[(unsigned char) s[i]].bits;
+
+  return (bits + 7) / 8;
+}
+
+static int hpack_huffman_encode(struct hpack_buf *out, char *s, size_t len)
+{
+  unsigned char buf[256];
+  size_t        n = 0;
+  uint64_t      acc = 0;
+  unsigned      bits = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    acc = (acc << hpack_huffman_codes[(unsigned char) s[i]].bits) | hpack_huffman_codes[(unsigned char) s[i]].code;
+    bits += hpack_huffman_codes[(unsigned char) s[i]].bits;
+
+    while (bits >= 8) {
+      bits -= 8;
+      buf[n++] = (unsigned char) (acc >> bits);
+      if (n == sizeof buf) {
+        if (hpack_buf_append(out, buf, n) < 0)
+          return -1;
+        n = 0;
+      }
+    }
+    acc &= (1u << bits) - 1;
+  }
+
+  if (bits)
+    buf[n++] = (unsigned char) ((acc << (8 - bits)) | (0xff >> bits));
+
+  return hpack_buf_append(out, buf, n);
+}
+
+// Nul-terminated, which rules out nul bytes in the string
+static int hpack_decode_string(unsigned char **pp, unsigned char *end, char **strp)
+{
+  unsigned char *p = *pp;
+  size_t         len = 0;
+  size_t         out_len = 0;
+  char          *str = NULL;
+  int            huffman = 0;
+
+  if (p == end)
+    return -1;
+
+  huffman = *p & 0x80;
+  if (hpack_decode_int(&p, end, 7, &len) < 0 || len > PTRDIFF(end, p))
+    return -1;
+
+  // The shortest codes are 5 bits long
+  if (! (str = malloc(huffman ? len * 8 / 5 + 1 : len + 1))) {
+    logger("malloc: %m");
+    return -1;
+  }
+
+  if (huffman) {
+    if (hpack_huffman_decode(p, len, str, &out_len) < 0) {
+      free(str);
+      return -1;
+    }
+  } else {
+    memcpy(str, p, len);
+    out_len = len;
+  }
+
+  if (memchr(str, '\0', out_len)) {
+    logger("nul byte in a header field");
+    free(str);
+    return -1;
+  }
+
+  str[out_len] = '\0';
+  *pp = p + len;
+  *strp = str;
+  return 0;
+}
+
+// Huffman-encoded when shorter
+static int hpack_encode_string(struct hpack_buf *out, char *s)
+{
+  size_t len = strlen(s);
+  size_t huffman_len = hpack_huffman_len(s, len);
+
+  if (huffman_len < len)
+    return hpack_encode_int(out, 0x80, 7, huffman_len) < 0 ? -1 : hpack_huffman_encode(out, s, len);
+
+  return hpack_encode_int(out, 0, 7, len) < 0 ? -1 : hpack_buf_append(out, s, len);
+}
+
+
+//
+// Header blocks
+//
+
+int hpack_decode(thpack_table *table, unsigned char *buf, size_t len, thpack_field_func func, void *user_data)
+{
+  unsigned char *p = buf;
+  unsigned char *end = buf + len;
+  int            may_update = 1; // Size updates come first (RFC 7541 section 4.2)
+
+  while (p < end) {
+    struct http_headers_elem  elem;
+    struct http_headers_elem *found = NULL;
+    size_t                    index = 0;
+    char                     *name = NULL;
+    char                     *value = NULL;
+    int                       indexing = 0;
+
+    // Indexed field
+    if (*p & 0x80) {
+      if (hpack_decode_int(&p, end, 7, &index) < 0 || ! (found = hpack_table_get(table, index, &elem)))
+        goto err;
+
+      if (func(found->key, found->value, user_data) < 0)
+        return -1;
+
+      may_update = 0;
+      continue;
+    }
+
+    // Dynamic table size update
+    if ((*p & 0xe0) == 0x20) {
+      if (! may_update || hpack_decode_int(&p, end, 5, &index) < 0 || index > table->limit)
+        goto err;
+
+      table->max_size = index;
+      hpack_table_evict(table, 0);
+      continue;
+    }
+
+    // Literal field, with incremental indexing or not
+    indexing = (*p & 0xc0) == 0x40;
+    if (hpack_decode_int(&p, end, indexing ? 6 : 4, &index) < 0)
+      goto err;
+
+    if (index) {
+      if (! (found = hpack_table_get(table, index, &elem)))
+        goto err;
+
+      if (! (name = strdup(found->key))) {
+        logger("strdup: %m");
+        return -1;
+      }
+    } else if (hpack_decode_string(&p, end, &name) < 0) {
+      goto err;
+    }
+
+    if (hpack_decode_string(&p, end, &value) < 0) {
+      free(name);
+      goto err;
+    }
+
+    if (func(name, value, user_data) < 0) {
+      free(name);
+      free(value);
+      return -1;
+    }
+
+    if (indexing) {
+      if (hpack_table_insert(table, name, value) < 0)
+        return -1;
+    } else {
+      free(name);
+      free(value);
+    }
+
+    may_update = 0;
+  }
+
+  return 0;
+ err:
+  logger("invalid header block, at byte %zu", PTRDIFF(p, buf));
+  return -1;
+}
+
+// Credentials are never indexed, so that no intermediary stores them
+// (RFC 7541 section 7.1.3).  Whatever could fill most of the table is not
+// indexed either.
+static int hpack_encode_field(thpack_table *table, char *name, char *value, struct hpack_buf *out)
+{
+  size_t name_index = 0;
+  size_t size = strlen(name) + strlen(value) + HPACK_ENTRY_OVERHEAD;
+  int    sensitive = ! strcmp(name, "authorization") || ! strcmp(name, "proxy-authorization");
+  int    indexing = ! sensitive && size <= table->max_size / 4 * 3;
+  char  *name_dup = NULL;
+  char  *value_dup = NULL;
+
+  for (size_t i = 0; i < HPACK_STATIC_TABLE_LEN; i++) {
+    if (strcmp(hpack_static_table[i].key, name))
+      continue;
+
+    if (! strcmp(hpack_static_table[i].value, value))
+      return hpack_encode_int(out, 0x80, 7, i + 1);
+
+    if (! name_index)
+      name_index = i + 1;
+  }
+
+  for (size_t i = 0; i < table->n_entries; i++) {
+    if (strcmp(table->entries[i].name, name))
+      continue;
+
+    if (! strcmp(table->entries[i].value, value))
+      return hpack_encode_int(out, 0x80, 7, HPACK_STATIC_TABLE_LEN + 1 + i);
+
+    if (! name_index)
+      name_index = HPACK_STATIC_TABLE_LEN + 1 + i;
+  }
+
+  if (hpack_encode_int(out, indexing ? 0x40 : sensitive ? 0x10 : 0, indexing ? 6 : 4, name_index) < 0 ||
+      (! name_index && hpack_encode_string(out, name) < 0) ||
+      hpack_encode_string(out, value) < 0)
+    return -1;
+
+  if (! indexing)
+    return 0;
+
+  if (! (name_dup = strdup(name)) || ! (value_dup = strdup(value))) {
+    logger("strdup: %m");
+    free(name_dup);
+    return -1;
+  }
+
+  return hpack_table_insert(table, name_dup, value_dup);
+}
+
+// The names must be lowercase already
+int hpack_encode(thpack_table *table, struct http_headers_elem *fields, size_t n_fields, struct hpack_buf *out)
+{
+  if (table->pending_update) {
+    if (table->pending_min < table->max_size &&
+        hpack_encode_int(out, 0x20, 5, table->pending_min) < 0)
+      return -1;
+
+    if (hpack_encode_int(out, 0x20, 5, table->max_size) < 0)
+      return -1;
+
+    table->pending_update = 0;
+  }
+
+  for (size_t i = 0; i < n_fields; i++) {
+    if (hpack_encode_field(table, fields[i].key, fields[i].value, out) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/hpack_utest.c"
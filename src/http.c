@@ -1,24 +1,526 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "logger.h"
 #include "util.h"
 #include "http.h"
 #include "network.h"
+#include "network_pool.h"
 #include "http_parse.h"
+#include "scan.h"
+#include "http2.h"
+#include "event_loop.h"
+
+#define HTTP_RECV_BUF_SIZE (16 * 1024)
+// Reply heads received in place may be that large
+#define HTTP_RECV_HEAD_MAX_SIZE (256 * 1024)
+
+// HTTP/1.1 connections are persistent unless the server says otherwise.
+static int http_reply_is_persistent(thttp_reply *reply)
+{
+  thttp_headers *headers = http_reply_header(reply);
+  char          *value = NULL;
+
+  if (! headers)
+    return 1;
+
+  if (http_headers_lookup_id(headers, HTTP_HEADER_CONNECTION, &value) >= 0 &&
+      0 == strcasecmp(value, "close"))
+    return 0;
+
+  return 1;
+}
+
+// Such requests have no side effect, the server getting them twice through a
+// replay of the TLS early data does not matter.
+static int http_request_is_safe(thttp_request *request)
+{
+  thttp_method method = http_request_method(request);
+
+  return method == HTTP_METHOD_GET || method == HTTP_METHOD_HEAD;
+}
+
+struct http_recv_ctx {
+  thttp_parser          *parser;
+  struct http_body_sink *sink;
+
+  // Blocking receptions only: the body may go straight to splice_fd
+  int                    can_splice;
+  int                    splice_fd;
+};
+
+static int http_on_headers_complete(void *user_data)
+{
+  struct http_recv_ctx *recv_ctx = user_data;
+  unsigned long long    left = 0;
+
+  // A switch to HTTP/2, the actual reply coming in a stream
+  if (http_parser_code(recv_ctx->parser) == 101)
+    return 0;
+
+  if (recv_ctx->sink->head_func &&
+      recv_ctx->sink->head_func(http_parser_code(recv_ctx->parser),
+                                http_parser_headers(recv_ctx->parser),
+                                recv_ctx->sink->user_data) < 0)
+    return -1;
+
+  // Hand over to http_splice_body() before any body byte gets copied
+  if (recv_ctx->can_splice && recv_ctx->sink->body_fd_func &&
+      http_parser_body_left(recv_ctx->parser, &left) &&
+      (recv_ctx->splice_fd = recv_ctx->sink->body_fd_func(left, recv_ctx->sink->user_data)) >= 0)
+    return HTTP_PARSER_PAUSE;
+
+  return 0;
+}
+
+static int http_on_body(unsigned char *data, size_t len, void *user_data)
+{
+  struct http_recv_ctx *recv_ctx = user_data;
+
+  if (! recv_ctx->sink->body_func)
+    return 0;
+
+  return recv_ctx->sink->body_func(data, len, recv_ctx->sink->user_data) < 0 ? -1 : 0;
+}
+
+// The body bytes which came along with the headers go to the sink's file
+// descriptor first, then the rest of the body is spliced from the connection.
+// Return how many bytes of buf were taken.  Drivers unable to splice leave
+// the rest of the body to the parser and body_func, as usual.
+static ssize_t http_splice_body(tnetwork_driver_ctx *ctx, struct http_recv_ctx *recv_ctx,
+                                unsigned char *buf, size_t len, size_t *n_receivedp)
+{
+  unsigned long long left = 0;
+  size_t             off = 0;
+  int                fd = recv_ctx->splice_fd;
+
+  recv_ctx->splice_fd = -1;
+
+  if (! http_parser_body_left(recv_ctx->parser, &left))
+    return 0;
+
+  if (len > left)
+    len = (size_t) left;
+
+  while (off < len) {
+    ssize_t n = write(fd, buf + off, len - off);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      logger("write: %m");
+      return -1;
+    }
+
+    off += (size_t) n;
+  }
+
+  if (http_parser_skip_body(recv_ctx->parser, len) < 0)
+    return -1;
+
+  while (http_parser_body_left(recv_ctx->parser, &left)) {
+    ssize_t n = network_driver_splice(ctx, fd, left < SSIZE_MAX ? (size_t) left : SSIZE_MAX);
+
+    if (n < 0 && errno == ENOTSUP)
+      break;
+
+    if (n < 0)
+      return -1;
+
+    if (0 == n) {
+      (void) http_parser_finish(recv_ctx->parser);
+      return -1;
+    }
+
+    *n_receivedp += (size_t) n;
+    if (http_parser_skip_body(recv_ctx->parser, (size_t) n) < 0)
+      return -1;
+  }
+
+  return (ssize_t) len;
+}
+
+// Received bytes not parsed yet: with pipelining, the next reply may come
+// along with the end of the previous one.
+struct http_recv_buf {
+  unsigned char data[HTTP_RECV_BUF_SIZE];
+  size_t        off;
+  size_t        len;
+};
+
+// A reply without a sink, received in a buffer of its own which it keeps
+struct http_recv_view {
+  unsigned char *buf;
+  size_t         size;
+  unsigned char *body;        // Read by ourselves, NULL when the parser has it
+  size_t         body_len;
+  int            body_in_buf;
+};
+
+static int http_on_head_in_place(void *user_data)
+{
+  *(int *) user_data = 1;
+  return HTTP_PARSER_PAUSE;
+}
+
+// Whatever came after the reply, for the next one
+static int http_recv_keep_rest(struct http_recv_buf *rbuf, unsigned char *data, size_t len)
+{
+  if (len > sizeof rbuf->data) {
+    logger("%zu unexpected bytes after the reply head", len);
+    return -1;
+  }
+
+  memcpy(rbuf->data, data, len);
+  rbuf->off = 0;
+  rbuf->len = len;
+  return 0;
+}
+
+// Offset right after the first empty line from off, where a head ends,
+// interim or not: 0 when it has yet to come.
+static size_t http_head_end(unsigned char *buf, size_t off, size_t len)
+{
+  while (off < len) {
+    size_t lf = off + scan_byte(buf + off, len - off, '\n');
+
+    if (lf + 1 < len && buf[lf + 1] == '\n')
+      return lf + 2;
+
+    if (lf + 2 < len && buf[lf + 1] == '\r' && buf[lf + 2] == '\n')
+      return lf + 3;
+
+    off = lf + 1;
+  }
+
+  return 0;
+}
+
+// Receive the head in view->buf, parsed there once it came whole, so that
+// growing the buffer for a large one never moves it from under the headers,
+// which are views into it.  A body of known length is read right after it, when it fits, or in a
+// buffer of the exact size, the parser skipping it: the bytes are never
+// copied but for those which came along with the head.  Other bodies go
+// through the parser as usual.  No read is ever larger than rbuf, where the
+// bytes following the head end up, so that they always fit.  Everything
+// comes from the request's arena, if any.
+static int http_recv_in_place(tnetwork_driver_ctx *ctx, thttp_request *request, struct http_recv_buf *rbuf,
+                              struct http_recv_view *view, thttp_parser **parserp, size_t *n_receivedp,
+                              int *cleanp)
+{
+  struct http_parser_callbacks callbacks = { .on_headers_complete = http_on_head_in_place };
+  tarena                      *arena = http_request_arena(request);
+  thttp_parser                *parser = NULL;
+  unsigned long long           left = 0;
+  size_t                       len = rbuf->len - rbuf->off;
+  size_t                       off = 0;
+  size_t                       scanned = 0;
+  ssize_t                      n = -1;
+  int                          head_done = 0;
+  int                          ret = -1;
+
+  view->size = HTTP_RECV_BUF_SIZE;
+  if (! (view->buf = arena_alloc(arena, view->size))) {
+    logger("malloc: %m");
+    goto end;
+  }
+
+  memcpy(view->buf, rbuf->data + rbuf->off, len);
+  rbuf->off = rbuf->len = 0;
+
+  if (http_parser_new(&callbacks, &head_done, http_request_method(request) == HTTP_METHOD_HEAD, &parser) < 0)
+    goto end;
+  http_parser_set_in_place(parser);
+  http_parser_set_arena(parser, arena);
+
+  // Heads are parsed whole, the buffer then never moving from under views
+  while (! head_done) {
+    size_t head_end = http_head_end(view->buf, off > scanned ? off : scanned, len);
+
+    if (head_end) {
+      if ((n = http_parser_feed(parser, view->buf + off, head_end - off)) < 0)
+        goto end;
+
+      off += (size_t) n;
+      scanned = off;
+      continue;
+    }
+
+    // Not that far again, but for a line end which may have been cut short
+    scanned = len > 2 ? len - 2 : 0;
+
+    if (len == view->size) {
+      unsigned char *tmp = NULL;
+
+      if (view->size >= HTTP_RECV_HEAD_MAX_SIZE) {
+        logger("reply head larger than %dKB", HTTP_RECV_HEAD_MAX_SIZE / 1024);
+        goto end;
+      }
+
+      if (! (tmp = arena_realloc(arena, view->buf, view->size, view->size * 2))) {
+        logger("realloc: %m");
+        goto end;
+      }
+
+      view->buf = tmp;
+      view->size *= 2;
+    }
+
+    n = network_driver_read(ctx, view->buf + len,
+                            view->size - len < HTTP_RECV_BUF_SIZE ? view->size - len : HTTP_RECV_BUF_SIZE);
+    if (n < 0)
+      goto end;
+
+    if (0 == n) {
+      *cleanp = 0;
+      (void) http_parser_feed(parser, view->buf + off, len - off);
+      (void) http_parser_finish(parser);
+      goto end;
+    }
+
+    len += (size_t) n;
+    *n_receivedp += (size_t) n;
+  }
+
+  if (! http_parser_body_left(parser, &left)) {
+    if ((n = http_parser_feed(parser, view->buf + off, len - off)) < 0)
+      goto end;
+
+    off += (size_t) n;
+    ret = http_recv_keep_rest(rbuf, view->buf + off, len - off);
+    goto end;
+  }
+
+  if (left >= SIZE_MAX - view->size) {
+    logger("reply body too large: %llu bytes", left);
+    goto end;
+  }
+
+  // The body, nul-terminated as the parser's would be
+  if (off + left < view->size) {
+    view->body = view->buf + off;
+    view->body_in_buf = 1;
+  } else if (! (view->body = arena_alloc(arena, left + 1))) {
+    logger("malloc: %m");
+    goto end;
+  }
+
+  view->body_len = len - off < left ? len - off : (size_t) left;
+  if (! view->body_in_buf)
+    memcpy(view->body, view->buf + off, view->body_len);
+
+  off += view->body_len;
+  if (http_recv_keep_rest(rbuf, view->buf + off, len - off) < 0)
+    goto end;
+
+  while (view->body_len < left) {
+    size_t want = left - view->body_len < SSIZE_MAX ? (size_t) left - view->body_len : SSIZE_MAX;
+
+    if ((n = network_driver_read(ctx, view->body + view->body_len, want)) < 0)
+      goto end;
+
+    if (0 == n) {
+      *cleanp = 0;
+      (void) http_parser_finish(parser);
+      goto end;
+    }
+
+    view->body_len += (size_t) n;
+    *n_receivedp += (size_t) n;
+  }
+
+  view->body[view->body_len] = '\0';
+  ret = http_parser_skip_body(parser, view->body_len);
+
+ end:
+  *parserp = parser;
+  return ret;
+}
+
+// Feed the parser with whatever comes from the network until the reply is
+// complete.  With a body sink, that's through a fixed-size buffer, the memory
+// usage not depending on the reply size.  Without, the reply is received in
+// place, through http_recv_in_place().  What follows the reply stays in
+// rbuf.  *n_receivedp tells whether anything came at all, and *cleanp whether
+// the connection ended up in a state fit for another request.
+static int http_recv_reply(tnetwork_driver_ctx *ctx, thttp_request *request, struct http_recv_buf *rbuf,
+                           thttp_reply **replyp, size_t *n_receivedp, int *cleanp)
+{
+  thttp_parser                *parser = NULL;
+  struct http_recv_ctx         recv_ctx = { .parser = NULL, .sink = NULL, .can_splice = 1, .splice_fd = -1 };
+  struct http_recv_view        view = { .buf = NULL, .size = 0, .body = NULL, .body_len = 0, .body_in_buf = 0 };
+  struct http_parser_callbacks callbacks = {
+    .on_headers_complete = http_on_headers_complete,
+    .on_body             = http_on_body,
+  };
+  int                          ret = -1;
+
+  *n_receivedp = 0;
+  *cleanp = 1;
+
+  recv_ctx.sink = http_request_body_sink(request);
+  if (! recv_ctx.sink) {
+    if (http_recv_in_place(ctx, request, rbuf, &view, &parser, n_receivedp, cleanp) < 0)
+      goto err;
+  } else if (http_parser_new(&callbacks, &recv_ctx, http_request_method(request) == HTTP_METHOD_HEAD, &parser) < 0) {
+    goto err;
+  } else {
+    http_parser_set_arena(parser, http_request_arena(request));
+  }
+
+  recv_ctx.parser = parser;
+
+  while (! http_parser_is_done(parser)) {
+    ssize_t consumed = -1;
+
+    if (rbuf->off == rbuf->len) {
+      ssize_t n = network_driver_read(ctx, rbuf->data, sizeof rbuf->data);
+
+      if (n < 0)
+        goto err;
+
+      if (0 == n) {
+        *cleanp = 0;
+        if (http_parser_finish(parser) < 0)
+          goto err;
+        break;
+      }
+
+      rbuf->off = 0;
+      rbuf->len = (size_t) n;
+    }
+
+    if ((consumed = http_parser_feed(parser, rbuf->data + rbuf->off, rbuf->len - rbuf->off)) < 0)
+      goto err;
+
+    rbuf->off += (size_t) consumed;
+    *n_receivedp += (size_t) consumed;
+
+    if (recv_ctx.splice_fd >= 0) {
+      ssize_t taken = http_splice_body(ctx, &recv_ctx, rbuf->data + rbuf->off, rbuf->len - rbuf->off, n_receivedp);
+
+      if (taken < 0)
+        goto err;
+
+      rbuf->off += (size_t) taken;
+      *n_receivedp += (size_t) taken;
+    }
+  }
+
+  if (view.buf) {
+    if (http_parser_reply_view(parser, view.buf, view.body, view.body_len, view.body_in_buf, replyp) < 0)
+      goto err;
+    view.buf = view.body = NULL;
+  } else if (http_parser_reply(parser, replyp) < 0) {
+    goto err;
+  }
+
+  ret = 0;
+ err:
+  if (! view.body_in_buf)
+    arena_release(http_request_arena(request), view.body);
+  arena_release(http_request_arena(request), view.buf);
+  http_parser_free(parser);
+  return ret;
+}
+
+// Negotiated through ALPN, or known beforehand on plain connections
+static int http_speaks_http2(tnetwork_driver_ctx *ctx, thttp_request *request)
+{
+  char *alpn = network_driver_get_alpn(ctx);
+
+  if (http_request_use_tls(request))
+    return alpn && ! strcmp(alpn, HTTP2_ALPN_ID);
+
+  return http_request_h2c(request) == HTTP_H2C_PRIOR_KNOWLEDGE;
+}
+
+static int http_wants_h2c_upgrade(thttp_request *request)
+{
+  return ! http_request_use_tls(request) && http_request_h2c(request) == HTTP_H2C_UPGRADE;
+}
+
+// The request, asking the server to switch to h2c (RFC 7540 section 3.2)
+static int http_h2c_upgrade_buffer(thttp_request *request, unsigned char **bufp, size_t *buf_lenp)
+{
+  unsigned char *req_buf = NULL;
+  size_t         req_buf_len = 0;
+  char          *settings = NULL;
+  int            n = -1;
+
+  if (http_request_get_buffer(request, &req_buf, &req_buf_len) < 0 ||
+      http2_upgrade_settings(&settings) < 0)
+    goto end;
+
+  // Before the empty line ending the headers
+  n = asprintf((char **) bufp, "%.*sConnection: Upgrade, HTTP2-Settings" CRLF "Upgrade: h2c" CRLF
+               "HTTP2-Settings: %s" CRLF CRLF, (int) (req_buf_len - CRLF_LEN), req_buf, settings);
+  if (n < 0)
+    logger("asprintf: %m");
+  else
+    *buf_lenp = (size_t) n;
+
+ end:
+  free(req_buf);
+  free(settings);
+  return n < 0 ? -1 : 0;
+}
+
+// The requests as concurrent streams on a connection speaking HTTP/2.  Such
+// connections do not go back to the pool, their HTTP/2 state ending here
+// along with conn.
+static int http_send_requests_http2(thttp2_conn *conn, thttp_request **requests, size_t n_requests,
+                                    thttp_reply **replies)
+{
+  int rc = http2_send_requests(conn, requests, n_requests, replies);
+
+  http2_conn_shutdown(conn);
+  http2_conn_free(conn);
+
+  return rc;
+}
 
 int http_send_request(thttp_request *request, thttp_reply **replyp)
 {
-  unsigned char       *buf = NULL;
-  size_t               buf_len = 0;
+  return http_send_request_pool(NULL, request, replyp);
+}
+
+int http_send_request_pool(tnetwork_pool *pool, thttp_request *request, thttp_reply **replyp)
+{
+  struct iovec        *iov = NULL;
+  int                  iovcnt = 0;
+  size_t               n_received = 0;
   char                *host_buf = NULL;
   char                *port_buf = NULL;
   tnetwork_driver_ctx *ctx = NULL;
+  thttp_reply         *reply = NULL;
+  thttp2_conn         *conn = NULL;
+  struct http_recv_buf rbuf;
+  int                  use_tls = 0;
+  int                  reused = 0;
+  int                  clean = 0;
   int                  ret = -1;
-  tnetwork_driver_type type;
+
+  // The switch to h2c comes with the reply to a first request, which batches
+  // deal with
+  if (http_wants_h2c_upgrade(request)) {
+    if (http_send_requests_pipelined(pool, &request, 1, &reply) < 0)
+      return -1;
+
+    if (replyp)
+      *replyp = reply;
+    else
+      http_reply_free(reply);
+
+    return 0;
+  }
 
   if (asprintf(&port_buf, "%"PRIu16, http_request_port(request)) < 0) {
     logger("failed to convert port %"PRIu16" to numerical value\n",
@@ -27,48 +529,555 @@ int http_send_request(thttp_request *request, thttp_reply **replyp)
   }
 
   host_buf = http_request_host(request);
+  use_tls = http_request_use_tls(request);
 
-  type = http_request_use_tls(request) ? NETWORK_DRIVER_TYPE_TLS : NETWORK_DRIVER_TYPE_PLAIN;
-  if (! (ctx = network_driver_create(type))) {
-    logger("failed to create the network driver");
+  if (http_request_get_iovec(request, &iov, &iovcnt) < 0) {
+    logger("failed to build request buffer");
     goto err;
   }
 
-  if (network_driver_connect(ctx, host_buf, port_buf,
-                             http_request_timeout(request)) < 0) {
-    logger("tcp connection failed: %s:%s", host_buf, port_buf);
-    goto err;
+  // An idle connection may have been closed by the server right when we
+  // picked it, which only shows when sending or when no reply comes back.
+  // Each failure consumes one idle connection, so we end up on a fresh one.
+  while (1) {
+    if ((reused = network_pool_get(pool, host_buf, port_buf, use_tls,
+                                   http_request_driver(request),
+                                   http_request_timeout(request), &ctx)) < 0)
+      goto err;
+
+    rbuf.off = rbuf.len = 0;
+    if (http_speaks_http2(ctx, request)) {
+      if (http2_conn_new(ctx, &conn) < 0 || http_send_requests_http2(conn, &request, 1, &reply) < 0 || ! reply) {
+        logger("failed to receive the HTTP/2 reply from %s:%s", host_buf, port_buf);
+        goto err;
+      }
+
+      break;
+    }
+
+    if ((http_request_is_safe(request) ?
+         network_driver_sendv_early(ctx, iov, iovcnt) :
+         network_driver_sendv(ctx, iov, iovcnt)) < 0) {
+      network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(request), 0);
+      ctx = NULL;
+      if (reused)
+        continue;
+
+      logger("failed to send HTTP request to %s:%s", host_buf, port_buf);
+      goto err;
+    }
+
+    if (http_recv_reply(ctx, request, &rbuf, &reply, &n_received, &clean) < 0) {
+      network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(request), 0);
+      ctx = NULL;
+      if (reused && ! n_received)
+        continue;
+
+      logger("failed to receive the HTTP reply from %s:%s\n", host_buf, port_buf);
+      goto err;
+    }
+
+    break;
   }
 
-  if (http_request_get_buffer(request, &buf, &buf_len) < 0) {
-    logger("failed to build request buffer");
+  // Whatever follows the reply was not asked for, and would be mistaken for
+  // the next reply on this connection.
+  if (rbuf.off < rbuf.len) {
+    logger("ignoring %zu unexpected bytes after the reply", rbuf.len - rbuf.off);
+    clean = 0;
+  }
+
+  network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(request),
+                   clean && http_reply_is_persistent(reply));
+  ctx = NULL;
+
+  if (replyp)
+    *replyp = reply;
+  else
+    http_reply_free(reply);
+
+  ret = 0;
+ err:
+  network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(request), 0);
+  free(iov);
+  free(port_buf);
+
+  return ret;
+}
+
+static int http_requests_same_origin(thttp_request *a, thttp_request *b)
+{
+  char *a_driver = http_request_driver(a);
+  char *b_driver = http_request_driver(b);
+
+  return ! strcmp(http_request_host(a), http_request_host(b)) &&
+    http_request_port(a) == http_request_port(b) &&
+    http_request_use_tls(a) == http_request_use_tls(b) &&
+    (a_driver && b_driver ? ! strcmp(a_driver, b_driver) : a_driver == b_driver);
+}
+
+// Pipelining (RFC 9112 section 9.3.2): the requests to one origin go back to
+// back on a single connection, in a single write, and the replies come back
+// in the same order, each one parsed from where the previous one ended.
+// Should the connection end before all the replies are in, as the server
+// closed it or failed, the unanswered requests go again on another one.
+// Only safe requests are sent again, the server may have processed the
+// others already.  replies[i] gets the reply to requests[i], NULL if none
+// came.  On connections speaking HTTP/2, the requests go as concurrent
+// streams instead, and the replies may come in any order.  With the h2c
+// upgrade, the first request goes alone, the others following as HTTP/2
+// streams if the server switched, pipelined otherwise.
+int http_send_requests_pipelined(tnetwork_pool *pool, thttp_request **requests, size_t n_requests,
+                                 thttp_reply **replies)
+{
+  struct iovec        *iov = NULL;
+  int                 *offs = NULL; // Where each request starts in iov
+  int                  iovcnt = 0;
+  char                *host_buf = NULL;
+  char                *port_buf = NULL;
+  tnetwork_driver_ctx *ctx = NULL;
+  struct http_recv_buf rbuf;
+  int                  use_tls = 0;
+  size_t               done = 0; // Requests answered, in order
+  size_t               n_answered = 0;
+  int                  ret = -1;
+
+  for (size_t i = 0; i < n_requests; i++)
+    replies[i] = NULL;
+
+  if (! n_requests)
+    return 0;
+
+  host_buf = http_request_host(requests[0]);
+  use_tls = http_request_use_tls(requests[0]);
+
+  if (asprintf(&port_buf, "%"PRIu16, http_request_port(requests[0])) < 0) {
+    logger("asprintf: %m");
     goto err;
   }
 
-  if (network_driver_send(ctx, buf, buf_len) < 0) {
-    logger("failed to send HTTP request to %s:%s", host_buf, port_buf);
+  if (! (offs = malloc((n_requests + 1) * sizeof *offs))) {
+    logger("malloc: %m");
     goto err;
   }
 
-  free(buf);
-  buf = NULL;
+  for (size_t i = 0; i < n_requests; i++) {
+    struct iovec *req_iov = NULL;
+    int           req_iovcnt = 0;
+    struct iovec *tmp = NULL;
 
-  if (network_driver_recv(ctx, &buf, &buf_len) < 0) {
-    logger("failed to receive the HTTP reply from %s:%s\n", host_buf, port_buf);
-    goto err;
+    if (! http_requests_same_origin(requests[0], requests[i])) {
+      logger("pipelined requests must all go to %s:%s", host_buf, port_buf);
+      goto err;
+    }
+
+    if (http_request_get_iovec(requests[i], &req_iov, &req_iovcnt) < 0) {
+      logger("failed to build request buffer");
+      goto err;
+    }
+
+    if (! (tmp = realloc(iov, (size_t) (iovcnt + req_iovcnt) * sizeof *iov))) {
+      logger("realloc: %m");
+      free(req_iov);
+      goto err;
+    }
+
+    iov = tmp;
+    memcpy(iov + iovcnt, req_iov, (size_t) req_iovcnt * sizeof *iov);
+    offs[i] = iovcnt;
+    iovcnt += req_iovcnt;
+    free(req_iov);
   }
+  offs[n_requests] = iovcnt;
 
-  if (http_parse_reply(buf, buf_len, replyp) < 0) {
-    fprintf(stderr, "Failed to parse HTTP reply buffer\n");
-    goto err;
+  while (done < n_requests) {
+    thttp2_conn   *conn = NULL;
+    unsigned char *upgrade_buf = NULL;
+    size_t         upgrade_buf_len = 0;
+    size_t         start = n_answered;
+    size_t         n_received = 0;
+    int            upgrade = 0;
+    int            reused = 0;
+    int            clean = 0;
+    int            rc = -1;
+
+    if ((reused = network_pool_get(pool, host_buf, port_buf, use_tls,
+                                   http_request_driver(requests[0]),
+                                   http_request_timeout(requests[0]), &ctx)) < 0)
+      goto err;
+
+    rbuf.off = rbuf.len = 0;
+
+    if (http_speaks_http2(ctx, requests[0])) {
+      if (http2_conn_new(ctx, &conn) < 0)
+        goto err;
+    } else if ((upgrade = http_wants_h2c_upgrade(requests[0]))) {
+      if (http_h2c_upgrade_buffer(requests[done], &upgrade_buf, &upgrade_buf_len) < 0)
+        goto err;
+
+      rc = network_driver_send(ctx, upgrade_buf, upgrade_buf_len);
+      free(upgrade_buf);
+    } else {
+      rc = network_driver_sendv(ctx, iov + offs[done], iovcnt - offs[done]);
+    }
+
+    while (rc == 0 && ! conn && done < n_requests) {
+      // Answered already, on an HTTP/2 connection gone since
+      if (replies[done]) {
+        http_reply_free(replies[done]);
+        replies[done] = NULL;
+        n_answered--;
+      }
+
+      if ((rc = http_recv_reply(ctx, requests[done], &rbuf, &replies[done], &n_received, &clean)) < 0)
+        break;
+
+      // Switched, the reply comes as stream 1 after what followed the 101
+      if (upgrade && http_reply_code(replies[done]) == 101) {
+        http_reply_free(replies[done]);
+        replies[done] = NULL;
+        if (http2_conn_new_upgraded(ctx, rbuf.data + rbuf.off, rbuf.len - rbuf.off, &conn) < 0)
+          goto err;
+        rbuf.off = rbuf.len;
+        logger_verbose("h2c upgrade with %s:%s: switched to HTTP/2", host_buf, port_buf);
+        break;
+      }
+
+      done++;
+      n_answered++;
+      if (! clean || ! http_reply_is_persistent(replies[done - 1]))
+        break;
+
+      // Declined, the other requests follow on HTTP/1.1
+      if (upgrade) {
+        logger_verbose("h2c upgrade with %s:%s: declined, staying on HTTP/1.1", host_buf, port_buf);
+        upgrade = 0;
+        n_received = 0;
+        if (done < n_requests)
+          rc = network_driver_sendv(ctx, iov + offs[done], iovcnt - offs[done]);
+      }
+    }
+
+    if (conn) {
+      clean = 0;
+      if ((rc = http_send_requests_http2(conn, requests, n_requests, replies)) < 0)
+        goto err;
+
+      while (done < n_requests && replies[done])
+        done++;
+      n_answered = done;
+      for (size_t i = done; i < n_requests; i++)
+        n_answered += replies[i] != NULL;
+    }
+
+    if (done == n_requests && rbuf.off < rbuf.len) {
+      logger("ignoring %zu unexpected bytes after the replies", rbuf.len - rbuf.off);
+      clean = 0;
+    }
+
+    network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(requests[0]),
+                     done == n_requests && clean && http_reply_is_persistent(replies[done - 1]));
+    ctx = NULL;
+
+    if (done == n_requests)
+      break;
+
+    // Nothing came on a new connection, or a partial body went to the sink
+    if ((n_answered == start && ! reused) ||
+        (rc < 0 && n_received && http_request_body_sink(requests[done]))) {
+      logger("failed to receive the HTTP reply from %s:%s", host_buf, port_buf);
+      goto err;
+    }
+
+    for (size_t i = done; i < n_requests; i++) {
+      if (! http_request_is_safe(requests[i])) {
+        logger("not sending %s again to %s:%s, the server may have processed it",
+               http_request_path(requests[i]), host_buf, port_buf);
+        goto err;
+      }
+    }
+
+    logger_verbose("connection to %s:%s over after %zu replies, sending the %zu other requests again",
+                   host_buf, port_buf, n_answered - start, n_requests - n_answered);
   }
 
   ret = 0;
  err:
-  network_driver_free(ctx);
-  free(buf);
+  network_pool_put(pool, ctx, host_buf, port_buf, use_tls, http_request_driver(requests[0]), 0);
+  free(offs);
+  free(iov);
   free(port_buf);
 
   return ret;
 }
 
+
+//
+// Asynchronous requests, driven by an event loop: each request goes through
+// connection, sending and receiving as its socket gets ready, so that a
+// single thread can carry as many of them as there are fds.
+//
+
+typedef enum {
+  HTTP_ASYNC_STATE_CONNECTING,
+  HTTP_ASYNC_STATE_SENDING,
+  HTTP_ASYNC_STATE_RECEIVING,
+} thttp_async_state;
+
+struct http_async {
+  tevent_loop           *loop;
+  thttp_request         *request;
+  tnetwork_driver_ctx   *ctx;
+  int                    fd;
+  thttp_async_state      state;
+  long long              deadline_ms;
+
+  unsigned char         *req_buf;
+  size_t                 req_buf_len;
+  size_t                 req_buf_off;
+
+  thttp_parser          *parser;
+  struct http_recv_ctx   recv_ctx;
+
+  thttp_async_done_func  done_func;
+  void                  *user_data;
+};
+
+static void http_async_free(struct http_async *async)
+{
+  if (! async)
+    return;
+
+  if (async->fd >= 0)
+    event_loop_del(async->loop, async->fd);
+
+  network_driver_free(async->ctx);
+  http_parser_free(async->parser);
+  free(async->req_buf);
+  free(async);
+}
+
+static void http_async_done(struct http_async *async, int status)
+{
+  thttp_async_done_func  done_func = async->done_func;
+  thttp_request         *request = async->request;
+  void                  *user_data = async->user_data;
+  thttp_reply           *reply = NULL;
+
+  if (! status && http_parser_reply(async->parser, &reply) < 0)
+    reply = NULL;
+
+  // Release the fd before the callback, which may well start new requests
+  http_async_free(async);
+  done_func(request, reply, user_data);
+}
+
+static void http_async_handler(int fd, int events, void *user_data);
+
+// Watch the driver's fd for what it needs.  The fd changes while connecting,
+// when the driver moves on to the next address.
+static int http_async_watch(struct http_async *async, int want)
+{
+  int fd = network_driver_get_fd(async->ctx);
+  int events = want == NETWORK_WANT_READ ? EVENT_LOOP_READ : EVENT_LOOP_WRITE;
+
+  if (async->state != HTTP_ASYNC_STATE_CONNECTING && fd == async->fd)
+    return event_loop_mod(async->loop, fd, events);
+
+  if (async->fd >= 0)
+    event_loop_del(async->loop, async->fd);
+
+  async->fd = -1;
+  if (event_loop_add(async->loop, fd, events, async->deadline_ms, http_async_handler, async) < 0)
+    return -1;
+
+  async->fd = fd;
+  return 0;
+}
+
+static int http_async_send(struct http_async *async)
+{
+  while (async->req_buf_off < async->req_buf_len) {
+    ssize_t n = network_driver_write(async->ctx, async->req_buf + async->req_buf_off,
+                                     async->req_buf_len - async->req_buf_off);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return NETWORK_WANT_WRITE;
+      return -1;
+    }
+
+    async->req_buf_off += (size_t) n;
+  }
+
+  return 0;
+}
+
+// Read whatever is there, 1 once the reply is complete
+static int http_async_recv(struct http_async *async)
+{
+  unsigned char buf[HTTP_RECV_BUF_SIZE];
+
+  while (1) {
+    ssize_t n = network_driver_read(async->ctx, buf, sizeof buf);
+    ssize_t consumed = -1;
+
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return -1;
+    }
+
+    if (0 == n)
+      return http_parser_finish(async->parser) < 0 ? -1 : 1;
+
+    if ((consumed = http_parser_feed(async->parser, buf, (size_t) n)) < 0)
+      return -1;
+
+    if (http_parser_is_done(async->parser)) {
+      if (consumed < n)
+        logger("ignoring %zd unexpected bytes after the reply", n - consumed);
+      return 1;
+    }
+  }
+}
+
+static void http_async_handler(int fd, int events, void *user_data)
+{
+  struct http_async *async = user_data;
+  int                rc = -1;
+
+  (void) fd;
+
+  if (events & EVENT_LOOP_TIMEOUT) {
+    logger("request to %s:%"PRIu16" timed out",
+           http_request_host(async->request), http_request_port(async->request));
+    goto err;
+  }
+
+  switch (async->state) {
+  case HTTP_ASYNC_STATE_CONNECTING:
+    if ((rc = network_driver_progress(async->ctx)) < 0) {
+      logger("connection to %s:%"PRIu16" failed",
+             http_request_host(async->request), http_request_port(async->request));
+      goto err;
+    }
+
+    if (rc > 0) {
+      if (http_async_watch(async, rc) < 0)
+        goto err;
+      return;
+    }
+
+    async->state = HTTP_ASYNC_STATE_SENDING;
+    // Fall through
+
+  case HTTP_ASYNC_STATE_SENDING:
+    if ((rc = http_async_send(async)) < 0) {
+      logger("failed to send HTTP request to %s:%"PRIu16,
+             http_request_host(async->request), http_request_port(async->request));
+      goto err;
+    }
+
+    if (rc > 0) {
+      if (http_async_watch(async, rc) < 0)
+        goto err;
+      return;
+    }
+
+    async->state = HTTP_ASYNC_STATE_RECEIVING;
+    if (http_async_watch(async, NETWORK_WANT_READ) < 0)
+      goto err;
+    return;
+
+  case HTTP_ASYNC_STATE_RECEIVING:
+    if ((rc = http_async_recv(async)) < 0) {
+      logger("failed to receive the HTTP reply from %s:%"PRIu16,
+             http_request_host(async->request), http_request_port(async->request));
+      goto err;
+    }
+
+    if (rc > 0)
+      http_async_done(async, 0);
+    return;
+  }
+
+ err:
+  http_async_done(async, -1);
+}
+
+// Start the request, which completes within event_loop_run().  On failure
+// to start, done_func is not called.
+int http_send_request_async(tevent_loop *loop, thttp_request *request, thttp_async_done_func done_func, void *user_data)
+{
+  struct http_async           *async = NULL;
+  char                        *port_buf = NULL;
+  int                          rc = -1;
+  struct http_parser_callbacks callbacks = {
+    .on_headers_complete = http_on_headers_complete,
+    .on_body             = http_on_body,
+  };
+
+  if (! (async = calloc(1, sizeof *async))) {
+    logger("calloc: %m");
+    goto err;
+  }
+
+  async->loop = loop;
+  async->request = request;
+  async->fd = -1;
+  async->state = HTTP_ASYNC_STATE_CONNECTING;
+  async->deadline_ms = event_loop_now_ms() + http_request_timeout(request) * 1000LL;
+  async->done_func = done_func;
+  async->user_data = user_data;
+  async->recv_ctx.sink = http_request_body_sink(request);
+
+  if (http_request_get_buffer(request, &async->req_buf, &async->req_buf_len) < 0) {
+    logger("failed to build request buffer");
+    goto err;
+  }
+
+  if (http_parser_new(async->recv_ctx.sink ? &callbacks : NULL, &async->recv_ctx,
+                      http_request_method(request) == HTTP_METHOD_HEAD, &async->parser) < 0)
+    goto err;
+
+  async->recv_ctx.parser = async->parser;
+
+  // With TLS, the handshake is part of the connection phase
+  if (! (async->ctx = network_driver_create(http_request_use_tls(request) ?
+                                            NETWORK_DRIVER_TYPE_TLS_NONBLOCK :
+                                            NETWORK_DRIVER_TYPE_NONBLOCK)))
+    goto err;
+
+  if (asprintf(&port_buf, "%"PRIu16, http_request_port(request)) < 0) {
+    logger("asprintf: %m");
+    port_buf = NULL;
+    goto err;
+  }
+
+  if (network_driver_connect(async->ctx, http_request_host(request), port_buf,
+                             http_request_timeout(request)) < 0) {
+    logger("tcp connection failed: %s:%s", http_request_host(request), port_buf);
+    goto err;
+  }
+
+  // Whatever the driver waits for to go on connecting, the socket gets
+  // writable once connected
+  if ((rc = network_driver_progress(async->ctx)) < 0 ||
+      http_async_watch(async, rc ? rc : NETWORK_WANT_WRITE) < 0)
+    goto err;
+
+  free(port_buf);
+  return 0;
+
+ err:
+  free(port_buf);
+  http_async_free(async);
+  return -1;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/http_utest.c"
@@ -0,0 +1,1039 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "logger.h"
+#include "hpack.h"
+#include "http2.h"
+
+// HTTP/2 (RFC 9113) on a blocking driver: the requests of a batch go as
+// concurrent streams, whose frames come back interleaved on the connection,
+// each one to its stream.  Requests have no body, so that we only ever
+// receive DATA frames: flow control boils down to handing the bytes we read
+// back to the server through WINDOW_UPDATE frames.
+
+#define HTTP2_RECV_BUF_SIZE   (64 * 1024)
+// Header blocks, across CONTINUATION frames
+#define HTTP2_MAX_BLOCK_SIZE  (256 * 1024)
+#define HTTP2_MAX_STREAM_ID   0x7fffffffu
+// Before any WINDOW_UPDATE (RFC 9113 section 6.9.2)
+#define HTTP2_INITIAL_WINDOW  65535
+
+// Frame types (RFC 9113 section 6)
+#define HTTP2_DATA          0x0
+#define HTTP2_HEADERS       0x1
+#define HTTP2_PRIORITY      0x2
+#define HTTP2_RST_STREAM    0x3
+#define HTTP2_SETTINGS      0x4
+#define HTTP2_PUSH_PROMISE  0x5
+#define HTTP2_PING          0x6
+#define HTTP2_GOAWAY        0x7
+#define HTTP2_WINDOW_UPDATE 0x8
+#define HTTP2_CONTINUATION  0x9
+
+#define HTTP2_FLAG_END_STREAM  0x01
+#define HTTP2_FLAG_ACK         0x01
+#define HTTP2_FLAG_END_HEADERS 0x04
+#define HTTP2_FLAG_PADDED      0x08
+#define HTTP2_FLAG_PRIORITY    0x20
+
+#define HTTP2_SETTINGS_HEADER_TABLE_SIZE      0x1
+#define HTTP2_SETTINGS_ENABLE_PUSH            0x2
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define HTTP2_SETTINGS_MAX_FRAME_SIZE         0x5
+
+// Error codes (RFC 9113 section 7)
+#define HTTP2_NO_ERROR          0x0
+#define HTTP2_PROTOCOL_ERROR    0x1
+#define HTTP2_FLOW_CONTROL      0x3
+#define HTTP2_FRAME_SIZE_ERROR  0x6
+#define HTTP2_REFUSED_STREAM    0x7
+#define HTTP2_CANCEL            0x8
+#define HTTP2_COMPRESSION_ERROR 0x9
+
+typedef enum {
+  HTTP2_STREAM_PENDING, // Not opened yet, or to be opened again
+  HTTP2_STREAM_OPEN,
+  HTTP2_STREAM_ENDED,   // Received whole, its sink waiting for the previous ones
+  HTTP2_STREAM_DONE,    // With its reply
+  HTTP2_STREAM_FAILED,
+} thttp2_stream_state;
+
+struct http2_stream {
+  uint32_t               id;
+  thttp2_stream_state    state;
+  thttp_request         *request;
+  thttp_reply          **replyp;
+  struct http_body_sink *sink;
+
+  int                    code; // 0 until the final headers
+  thttp_headers         *headers;
+  unsigned char         *body;
+  size_t                 body_len;
+  size_t                 body_size;
+  int                    got_head; // The headers went to the sink
+  int                    got_data; // Some of it went to the sink
+  size_t                 unacked;  // Received since our last WINDOW_UPDATE
+};
+
+struct http2_conn {
+  tnetwork_driver_ctx *ctx;
+  thpack_table        *encoder;
+  thpack_table        *decoder;
+  uint32_t             next_stream_id;
+  int                  upgraded; // Stream 1 open already, through an HTTP/1.1 upgrade
+  int                  failed;
+  int                  goaway;
+  uint32_t             goaway_last_id;
+
+  // The server's settings
+  uint32_t             max_frame_size;
+  uint32_t             max_streams;
+
+  size_t               unacked; // Connection-wide
+
+  // Frames to send, in one go before reading
+  struct hpack_buf     out;
+
+  unsigned char        rbuf[HTTP2_RECV_BUF_SIZE];
+  size_t               rbuf_off;
+  size_t               rbuf_len;
+
+  // Header block being gathered from HEADERS and CONTINUATION frames
+  struct hpack_buf     block;
+  uint32_t             block_stream_id;
+  int                  block_end_stream;
+  int                  in_block;
+
+  struct http2_stream *streams;
+  size_t               n_streams;
+};
+
+// The frame being processed
+struct http2_frame {
+  uint32_t       len;
+  uint8_t        type;
+  uint8_t        flags;
+  uint32_t       stream_id;
+  unsigned char *payload;
+};
+
+static uint32_t http2_get32(unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void http2_put32(unsigned char *p, uint32_t value)
+{
+  p[0] = (unsigned char) (value >> 24);
+  p[1] = (unsigned char) (value >> 16);
+  p[2] = (unsigned char) (value >> 8);
+  p[3] = (unsigned char) value;
+}
+
+static int http2_queue_frame(thttp2_conn *conn, uint8_t type, uint8_t flags, uint32_t stream_id,
+                             void *payload, size_t len)
+{
+  unsigned char header[HTTP2_FRAME_HEADER_LEN];
+
+  header[0] = (unsigned char) (len >> 16);
+  header[1] = (unsigned char) (len >> 8);
+  header[2] = (unsigned char) len;
+  header[3] = type;
+  header[4] = flags;
+  http2_put32(header + 5, stream_id & HTTP2_MAX_STREAM_ID);
+
+  if (hpack_buf_append(&conn->out, header, sizeof header) < 0 ||
+      (len && hpack_buf_append(&conn->out, payload, len) < 0))
+    return -1;
+
+  return 0;
+}
+
+static int http2_queue_u32(thttp2_conn *conn, uint8_t type, uint32_t stream_id, uint32_t value)
+{
+  unsigned char payload[4];
+
+  http2_put32(payload, value);
+  return http2_queue_frame(conn, type, 0, stream_id, payload, sizeof payload);
+}
+
+static int http2_flush(thttp2_conn *conn)
+{
+  int rc = 0;
+
+  if (conn->out.len && (rc = network_driver_send(conn->ctx, conn->out.data, conn->out.len)) < 0)
+    conn->failed = 1;
+
+  conn->out.len = 0;
+  return rc;
+}
+
+// The connection is over: the server gets told why, as far as possible
+static int http2_conn_error(thttp2_conn *conn, uint32_t code, char *what)
+{
+  unsigned char payload[8];
+
+  logger("HTTP/2 connection error: %s", what);
+
+  http2_put32(payload, 0);
+  http2_put32(payload + 4, code);
+  if (! conn->failed && http2_queue_frame(conn, HTTP2_GOAWAY, 0, 0, payload, sizeof payload) == 0)
+    (void) http2_flush(conn);
+
+  conn->failed = 1;
+  return -1;
+}
+
+
+//
+// Streams
+//
+
+static struct http2_stream *http2_stream_lookup(thttp2_conn *conn, uint32_t stream_id)
+{
+  for (size_t i = 0; i < conn->n_streams; i++) {
+    if (conn->streams[i].id == stream_id && conn->streams[i].state == HTTP2_STREAM_OPEN)
+      return &conn->streams[i];
+  }
+
+  return NULL;
+}
+
+// Drop whatever the stream received, and its id
+static void http2_stream_reset(struct http2_stream *stream, thttp2_stream_state state)
+{
+  http_headers_free(stream->headers);
+  free(stream->body);
+  stream->headers = NULL;
+  stream->body = NULL;
+  stream->body_len = stream->body_size = 0;
+  stream->code = 0;
+  stream->got_head = 0;
+  stream->unacked = 0;
+  stream->id = 0;
+  stream->state = state;
+}
+
+static int http2_stream_error(thttp2_conn *conn, struct http2_stream *stream, uint32_t code, char *what)
+{
+  logger("HTTP/2 stream %"PRIu32" error: %s", stream->id, what);
+
+  if (http2_queue_u32(conn, HTTP2_RST_STREAM, stream->id, code) < 0)
+    return -1;
+
+  stream->state = HTTP2_STREAM_FAILED;
+  return 0;
+}
+
+static int http2_stream_complete(struct http2_stream *stream)
+{
+  if (http_reply_new(stream->code, stream->headers, stream->body, stream->body_len, stream->replyp) < 0)
+    return -1;
+
+  stream->headers = NULL;
+  stream->body = NULL;
+  stream->state = HTTP2_STREAM_DONE;
+  return 0;
+}
+
+// The whole reply is in, its sink may still have to wait
+static int http2_stream_end(struct http2_stream *stream)
+{
+  if (! stream->sink)
+    return http2_stream_complete(stream);
+
+  stream->state = HTTP2_STREAM_ENDED;
+  return 0;
+}
+
+// Sinks get the replies in the order of the requests, as they would on an
+// HTTP/1.1 connection, e.g. one after the other in the same file: the
+// streams behind one still going keep what they receive until it is over.
+static int http2_sink_flush(thttp2_conn *conn)
+{
+  for (size_t i = 0; i < conn->n_streams; i++) {
+    struct http2_stream   *stream = &conn->streams[i];
+    struct http_body_sink *sink = stream->sink;
+
+    if (! sink || stream->state == HTTP2_STREAM_DONE || stream->state == HTTP2_STREAM_FAILED)
+      continue;
+
+    if (stream->state == HTTP2_STREAM_PENDING || ! stream->code)
+      return 0;
+
+    if (! stream->got_head) {
+      stream->got_head = stream->got_data = 1;
+      if (sink->head_func && sink->head_func(stream->code, stream->headers, sink->user_data) < 0)
+        goto abort;
+    }
+
+    if (stream->body_len) {
+      stream->got_data = 1;
+      if (sink->body_func && sink->body_func(stream->body, stream->body_len, sink->user_data) < 0)
+        goto abort;
+      stream->body_len = 0;
+    }
+
+    if (stream->state == HTTP2_STREAM_OPEN)
+      return 0;
+
+    if (http2_stream_complete(stream) < 0)
+      return -1;
+    continue;
+
+  abort:
+    if (stream->state == HTTP2_STREAM_OPEN) {
+      if (http2_stream_error(conn, stream, HTTP2_CANCEL, "aborted by the sink") < 0)
+        return -1;
+    } else {
+      logger("HTTP/2 stream %"PRIu32" aborted by the sink", stream->id);
+      stream->state = HTTP2_STREAM_FAILED;
+    }
+  }
+
+  return 0;
+}
+
+// Connection-specific headers have no meaning in HTTP/2 (RFC 9113 section
+// 8.2.2)
+static int http2_is_hop_header(thttp_header_id id)
+{
+  switch (id) {
+  case HTTP_HEADER_CONNECTION:
+  case HTTP_HEADER_KEEP_ALIVE:
+  case HTTP_HEADER_PROXY_CONNECTION:
+  case HTTP_HEADER_TRANSFER_ENCODING:
+  case HTTP_HEADER_UPGRADE:
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+struct http2_request_fields {
+  struct http_headers_elem *elems;
+  size_t                    n_elems;
+  char                     *authority;
+};
+
+// Field names are lowercase in HTTP/2: those of HTTP_HEADER_TABLE are
+// there already, the others are copied
+static int http2_collect_header(struct http_headers_elem *elem, void *user_data)
+{
+  struct http2_request_fields *fields = user_data;
+  struct http_headers_elem    *tmp = NULL;
+  thttp_header_id              id = http_header_name_id(elem->key);
+  char                        *name = NULL;
+
+  if (id == HTTP_HEADER_HOST) {
+    fields->authority = elem->value;
+    return 1;
+  }
+
+  if (http2_is_hop_header(id))
+    return 1;
+
+  if (! (tmp = realloc(fields->elems, (fields->n_elems + 1) * sizeof *tmp)) ||
+      ! (name = id != HTTP_HEADER_UNKNOWN ? http_header_name_lower(id) : strdup(elem->key))) {
+    logger("failed to gather the request headers: %m");
+    if (tmp)
+      fields->elems = tmp;
+    return -1;
+  }
+
+  for (char *p = name; id == HTTP_HEADER_UNKNOWN && *p; p++)
+    *p = (char) tolower((unsigned char) *p);
+
+  fields->elems = tmp;
+  fields->elems[fields->n_elems].key = name;
+  fields->elems[fields->n_elems].value = elem->value;
+  fields->n_elems++;
+  return 1;
+}
+
+// The HEADERS frame, and as many CONTINUATION ones as the header block
+// needs, all of them in the output buffer.
+static int http2_stream_open(thttp2_conn *conn, struct http2_stream *stream)
+{
+  thttp_request              *request = stream->request;
+  struct http2_request_fields fields = { NULL, 0, NULL };
+  struct http_headers_elem    pseudo[4];
+  struct hpack_buf            block = { NULL, 0, 0 };
+  char                       *authority = NULL;
+  char                       *host = http_request_host(request);
+  uint16_t                    port = http_request_port(request);
+  int                         default_port = port == (http_request_use_tls(request) ? 443 : 80);
+  size_t                      off = 0;
+  int                         ret = -1;
+
+  if (http_request_headers(request) &&
+      http_headers_foreach(http_request_headers(request), http2_collect_header, &fields) < 0)
+    goto end;
+
+  // Without any Host header, IPv6 addresses go within brackets
+  if (fields.authority)
+    authority = strdup(fields.authority);
+  else if (asprintf(&authority, strchr(host, ':') ? (default_port ? "[%s]" : "[%s]:%"PRIu16) :
+                    (default_port ? "%s" : "%s:%"PRIu16), host, port) < 0)
+    authority = NULL;
+
+  if (! authority) {
+    logger("failed to build :authority: %m");
+    goto end;
+  }
+
+  pseudo[0] = (struct http_headers_elem) { ":method", http_method_to_str(http_request_method(request)) };
+  pseudo[1] = (struct http_headers_elem) { ":scheme", http_request_use_tls(request) ? "https" : "http" };
+  pseudo[2] = (struct http_headers_elem) { ":authority", authority };
+  pseudo[3] = (struct http_headers_elem) { ":path", http_request_path(request) };
+
+  if (hpack_encode(conn->encoder, pseudo, N_ELEMS(pseudo), &block) < 0 ||
+      hpack_encode(conn->encoder, fields.elems, fields.n_elems, &block) < 0)
+    goto end;
+
+  stream->id = conn->next_stream_id;
+  conn->next_stream_id += 2;
+
+  do {
+    size_t  len = block.len - off < conn->max_frame_size ? block.len - off : conn->max_frame_size;
+    uint8_t flags = off + len == block.len ? HTTP2_FLAG_END_HEADERS : 0;
+
+    if (http2_queue_frame(conn, off ? HTTP2_CONTINUATION : HTTP2_HEADERS,
+                          flags | (off ? 0 : HTTP2_FLAG_END_STREAM), stream->id,
+                          block.data + off, len) < 0)
+      goto end;
+
+    off += len;
+  } while (off < block.len);
+
+  stream->state = HTTP2_STREAM_OPEN;
+  ret = 0;
+ end:
+  for (size_t i = 0; i < fields.n_elems; i++) {
+    if (! http_header_name_is_interned(fields.elems[i].key))
+      free(fields.elems[i].key);
+  }
+  free(fields.elems);
+  free(authority);
+  hpack_buf_free(&block);
+  return ret;
+}
+
+
+//
+// Frame reception
+//
+
+// The next frame, whole, in rbuf.  Whatever we have to send goes before
+// waiting for the server.
+static int http2_read_frame(thttp2_conn *conn, struct http2_frame *frame)
+{
+  size_t need = HTTP2_FRAME_HEADER_LEN;
+
+  while (1) {
+    unsigned char *p = conn->rbuf + conn->rbuf_off;
+    ssize_t        n = -1;
+
+    if (conn->rbuf_len - conn->rbuf_off >= HTTP2_FRAME_HEADER_LEN) {
+      frame->len = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+      if (frame->len > HTTP2_MAX_FRAME_SIZE)
+        return http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "frame too large");
+
+      need = HTTP2_FRAME_HEADER_LEN + frame->len;
+      if (conn->rbuf_len - conn->rbuf_off >= need) {
+        frame->type = p[3];
+        frame->flags = p[4];
+        frame->stream_id = http2_get32(p + 5) & HTTP2_MAX_STREAM_ID;
+        frame->payload = p + HTTP2_FRAME_HEADER_LEN;
+        conn->rbuf_off += need;
+        return 0;
+      }
+    }
+
+    if (conn->rbuf_off + need > sizeof conn->rbuf) {
+      memmove(conn->rbuf, conn->rbuf + conn->rbuf_off, conn->rbuf_len - conn->rbuf_off);
+      conn->rbuf_len -= conn->rbuf_off;
+      conn->rbuf_off = 0;
+    }
+
+    if (http2_flush(conn) < 0 ||
+        (n = network_driver_read(conn->ctx, conn->rbuf + conn->rbuf_len, sizeof conn->rbuf - conn->rbuf_len)) <= 0) {
+      logger("HTTP/2 connection %s", n == 0 ? "closed by the server" : "failed");
+      conn->failed = 1;
+      return -1;
+    }
+
+    conn->rbuf_len += (size_t) n;
+  }
+}
+
+// Padding and priority come before the payload proper
+static int http2_frame_strip(thttp2_conn *conn, struct http2_frame *frame, int has_priority)
+{
+  uint32_t pad_len = 0;
+
+  if (frame->flags & HTTP2_FLAG_PADDED) {
+    if (frame->len < 1 || (pad_len = frame->payload[0]) >= frame->len)
+      return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "invalid padding");
+
+    frame->payload++;
+    frame->len -= 1 + pad_len;
+  }
+
+  if (has_priority && (frame->flags & HTTP2_FLAG_PRIORITY)) {
+    if (frame->len < 5)
+      return http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "short HEADERS frame");
+
+    frame->payload += 5;
+    frame->len -= 5;
+  }
+
+  return 0;
+}
+
+struct http2_block_ctx {
+  int            code;
+  int            keep; // The headers matter, not only the decoder's table
+  thttp_headers *headers;
+  int            failed;
+};
+
+static int http2_on_field(char *name, char *value, void *user_data)
+{
+  struct http2_block_ctx *block_ctx = user_data;
+
+  if (! strcmp(name, ":status")) {
+    block_ctx->code = atoi(value);
+    return 0;
+  }
+
+  // Other pseudo-headers have no place in replies
+  if (name[0] == ':' || ! block_ctx->keep || block_ctx->failed)
+    return 0;
+
+  // The decoding goes on whatever happens, for the table to follow the server
+  if (block_ctx->headers ?
+      http_headers_add(block_ctx->headers, name, value) < 0 :
+      http_headers_new(name, value, &block_ctx->headers) < 0)
+    block_ctx->failed = 1;
+
+  return 0;
+}
+
+// Informational replies are skipped, and so are trailers
+static int http2_block_done(thttp2_conn *conn)
+{
+  struct http2_stream   *stream = http2_stream_lookup(conn, conn->block_stream_id);
+  struct http2_block_ctx block_ctx = { 0, stream && ! stream->code, NULL, 0 };
+  int                    ret = -1;
+
+  conn->in_block = 0;
+
+  if (hpack_decode(conn->decoder, conn->block.data, conn->block.len, http2_on_field, &block_ctx) < 0) {
+    ret = http2_conn_error(conn, HTTP2_COMPRESSION_ERROR, "invalid header block");
+    goto end;
+  }
+
+  ret = 0;
+  if (! stream)
+    goto end;
+
+  if (block_ctx.failed) {
+    ret = http2_stream_error(conn, stream, HTTP2_CANCEL, "failed to store the headers");
+    goto end;
+  }
+
+  if (! stream->code) {
+    if (block_ctx.code < 100 || block_ctx.code > 999) {
+      ret = http2_stream_error(conn, stream, HTTP2_PROTOCOL_ERROR, "missing :status");
+      goto end;
+    }
+
+    if (block_ctx.code < 200)
+      goto end;
+
+    stream->code = block_ctx.code;
+    stream->headers = block_ctx.headers;
+    block_ctx.headers = NULL;
+  }
+
+  if (conn->block_end_stream)
+    ret = http2_stream_end(stream);
+
+ end:
+  http_headers_free(block_ctx.headers);
+  return ret;
+}
+
+static int http2_on_headers(thttp2_conn *conn, struct http2_frame *frame)
+{
+  if (! frame->stream_id)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "HEADERS on stream 0");
+
+  if (http2_frame_strip(conn, frame, 1) < 0)
+    return -1;
+
+  conn->block.len = 0;
+  conn->block_stream_id = frame->stream_id;
+  conn->block_end_stream = frame->flags & HTTP2_FLAG_END_STREAM;
+  conn->in_block = 1;
+
+  if (hpack_buf_append(&conn->block, frame->payload, frame->len) < 0)
+    return -1;
+
+  return frame->flags & HTTP2_FLAG_END_HEADERS ? http2_block_done(conn) : 0;
+}
+
+static int http2_on_continuation(thttp2_conn *conn, struct http2_frame *frame)
+{
+  if (! conn->in_block || frame->stream_id != conn->block_stream_id)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+
+  if (conn->block.len + frame->len > HTTP2_MAX_BLOCK_SIZE)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "header block too large");
+
+  if (hpack_buf_append(&conn->block, frame->payload, frame->len) < 0)
+    return -1;
+
+  return frame->flags & HTTP2_FLAG_END_HEADERS ? http2_block_done(conn) : 0;
+}
+
+// Every DATA byte counts against the windows, padding included, whether the
+// stream still exists or not.  Half a window consumed goes back to the
+// server.
+static int http2_on_data(thttp2_conn *conn, struct http2_frame *frame)
+{
+  struct http2_stream *stream = http2_stream_lookup(conn, frame->stream_id);
+  uint32_t             len = frame->len;
+
+  if (! frame->stream_id || frame->stream_id >= conn->next_stream_id)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "DATA on an idle stream");
+
+  conn->unacked += len;
+  if (conn->unacked > HTTP2_CONN_WINDOW)
+    return http2_conn_error(conn, HTTP2_FLOW_CONTROL, "connection window exceeded");
+
+  if (conn->unacked >= HTTP2_CONN_WINDOW / 2) {
+    if (http2_queue_u32(conn, HTTP2_WINDOW_UPDATE, 0, (uint32_t) conn->unacked) < 0)
+      return -1;
+    conn->unacked = 0;
+  }
+
+  if (http2_frame_strip(conn, frame, 0) < 0)
+    return -1;
+
+  if (! stream)
+    return 0;
+
+  stream->unacked += len;
+  if (stream->unacked > HTTP2_STREAM_WINDOW)
+    return http2_stream_error(conn, stream, HTTP2_FLOW_CONTROL, "stream window exceeded");
+
+  if (! stream->code)
+    return http2_stream_error(conn, stream, HTTP2_PROTOCOL_ERROR, "DATA before HEADERS");
+
+  // Until the sink, if any, takes it
+  if (frame->len) {
+    if (stream->body_len + frame->len > stream->body_size) {
+      size_t         size = stream->body_size ? stream->body_size : HTTP2_MAX_FRAME_SIZE;
+      unsigned char *tmp = NULL;
+
+      while (size < stream->body_len + frame->len)
+        size *= 2;
+
+      if (! (tmp = realloc(stream->body, size))) {
+        logger("realloc: %m");
+        return -1;
+      }
+
+      stream->body = tmp;
+      stream->body_size = size;
+    }
+
+    memcpy(stream->body + stream->body_len, frame->payload, frame->len);
+    stream->body_len += frame->len;
+  }
+
+  if (frame->flags & HTTP2_FLAG_END_STREAM)
+    return http2_stream_end(stream);
+
+  if (stream->unacked >= HTTP2_STREAM_WINDOW / 2) {
+    if (http2_queue_u32(conn, HTTP2_WINDOW_UPDATE, stream->id, (uint32_t) stream->unacked) < 0)
+      return -1;
+    stream->unacked = 0;
+  }
+
+  return 0;
+}
+
+static int http2_on_settings(thttp2_conn *conn, struct http2_frame *frame)
+{
+  if (frame->stream_id)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "SETTINGS on a stream");
+
+  if (frame->flags & HTTP2_FLAG_ACK)
+    return frame->len ? http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "SETTINGS ack with a payload") : 0;
+
+  if (frame->len % 6)
+    return http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "SETTINGS length");
+
+  for (uint32_t off = 0; off < frame->len; off += 6) {
+    unsigned id = (unsigned) frame->payload[off] << 8 | frame->payload[off + 1];
+    uint32_t value = http2_get32(frame->payload + off + 2);
+
+    switch (id) {
+    case HTTP2_SETTINGS_HEADER_TABLE_SIZE:
+      hpack_table_set_limit(conn->encoder, value);
+      break;
+
+    case HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS:
+      conn->max_streams = value;
+      break;
+
+    case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+      // Only for what we would send, which is nothing but headers
+      if (value > HTTP2_MAX_STREAM_ID)
+        return http2_conn_error(conn, HTTP2_FLOW_CONTROL, "SETTINGS_INITIAL_WINDOW_SIZE too large");
+      break;
+
+    case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < HTTP2_MAX_FRAME_SIZE || value > 0xffffff)
+        return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "invalid SETTINGS_MAX_FRAME_SIZE");
+      conn->max_frame_size = value;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return http2_queue_frame(conn, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0);
+}
+
+// Refused streams were not processed at all (RFC 9113 section 8.7), they
+// may go again.
+static int http2_on_rst_stream(thttp2_conn *conn, struct http2_frame *frame)
+{
+  struct http2_stream *stream = NULL;
+  uint32_t             code = 0;
+
+  if (frame->len != 4)
+    return http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "RST_STREAM length");
+
+  if (! frame->stream_id || frame->stream_id >= conn->next_stream_id)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "RST_STREAM on an idle stream");
+
+  if (! (stream = http2_stream_lookup(conn, frame->stream_id)))
+    return 0;
+
+  code = http2_get32(frame->payload);
+  logger_verbose("HTTP/2 stream %"PRIu32" reset by the server, error %"PRIu32, stream->id, code);
+
+  if (code == HTTP2_REFUSED_STREAM && ! stream->got_data)
+    http2_stream_reset(stream, HTTP2_STREAM_PENDING);
+  else
+    stream->state = HTTP2_STREAM_FAILED;
+
+  return 0;
+}
+
+// The streams above the last one the server processes were not processed,
+// they may go on another connection.
+static int http2_on_goaway(thttp2_conn *conn, struct http2_frame *frame)
+{
+  if (frame->stream_id || frame->len < 8)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "invalid GOAWAY");
+
+  conn->goaway = 1;
+  conn->goaway_last_id = http2_get32(frame->payload) & HTTP2_MAX_STREAM_ID;
+  logger_verbose("HTTP/2 connection going away after stream %"PRIu32", error %"PRIu32,
+                 conn->goaway_last_id, http2_get32(frame->payload + 4));
+
+  for (size_t i = 0; i < conn->n_streams; i++) {
+    struct http2_stream *stream = &conn->streams[i];
+
+    if (stream->state == HTTP2_STREAM_OPEN && stream->id > conn->goaway_last_id)
+      http2_stream_reset(stream, HTTP2_STREAM_PENDING);
+  }
+
+  return 0;
+}
+
+static int http2_on_frame(thttp2_conn *conn, struct http2_frame *frame)
+{
+  if (conn->in_block && frame->type != HTTP2_CONTINUATION)
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "header block interrupted");
+
+  switch (frame->type) {
+  case HTTP2_DATA:
+    return http2_on_data(conn, frame);
+
+  case HTTP2_HEADERS:
+    return http2_on_headers(conn, frame);
+
+  case HTTP2_CONTINUATION:
+    return http2_on_continuation(conn, frame);
+
+  case HTTP2_SETTINGS:
+    return http2_on_settings(conn, frame);
+
+  case HTTP2_RST_STREAM:
+    return http2_on_rst_stream(conn, frame);
+
+  case HTTP2_GOAWAY:
+    return http2_on_goaway(conn, frame);
+
+  case HTTP2_PING:
+    if (frame->stream_id || frame->len != 8)
+      return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "invalid PING");
+
+    if (frame->flags & HTTP2_FLAG_ACK)
+      return 0;
+
+    return http2_queue_frame(conn, HTTP2_PING, HTTP2_FLAG_ACK, 0, frame->payload, frame->len);
+
+  case HTTP2_WINDOW_UPDATE:
+    if (frame->len != 4)
+      return http2_conn_error(conn, HTTP2_FRAME_SIZE_ERROR, "WINDOW_UPDATE length");
+
+    if (! frame->stream_id && ! (http2_get32(frame->payload) & HTTP2_MAX_STREAM_ID))
+      return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "empty WINDOW_UPDATE");
+
+    return 0;
+
+  case HTTP2_PUSH_PROMISE:
+    return http2_conn_error(conn, HTTP2_PROTOCOL_ERROR, "PUSH_PROMISE, push being disabled");
+
+  default:
+    // PRIORITY, and unknown types, which are to be ignored
+    return 0;
+  }
+}
+
+
+//
+// Connections
+//
+
+void http2_conn_free(thttp2_conn *conn)
+{
+  if (! conn)
+    return;
+
+  hpack_table_free(conn->encoder);
+  hpack_table_free(conn->decoder);
+  hpack_buf_free(&conn->out);
+  hpack_buf_free(&conn->block);
+  free(conn);
+}
+
+// Our SETTINGS payload: no push, and larger stream windows
+static void http2_settings(unsigned char settings[12])
+{
+  settings[0] = 0;
+  settings[1] = HTTP2_SETTINGS_ENABLE_PUSH;
+  http2_put32(settings + 2, 0);
+  settings[6] = 0;
+  settings[7] = HTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+  http2_put32(settings + 8, HTTP2_STREAM_WINDOW);
+}
+
+// The connection preface and our settings are only queued, they go along
+// with the first requests.
+int http2_conn_new(tnetwork_driver_ctx *ctx, thttp2_conn **connp)
+{
+  thttp2_conn  *conn = NULL;
+  unsigned char settings[12];
+
+  if (! (conn = calloc(1, sizeof *conn))) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  conn->ctx = ctx;
+  conn->next_stream_id = 1;
+  conn->max_frame_size = HTTP2_MAX_FRAME_SIZE;
+  conn->max_streams = HTTP2_DEFAULT_MAX_STREAMS;
+  http2_settings(settings);
+
+  if (hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &conn->encoder) < 0 ||
+      hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &conn->decoder) < 0 ||
+      hpack_buf_append(&conn->out, HTTP2_PREFACE, HTTP2_PREFACE_LEN) < 0 ||
+      http2_queue_frame(conn, HTTP2_SETTINGS, 0, 0, settings, sizeof settings) < 0 ||
+      http2_queue_u32(conn, HTTP2_WINDOW_UPDATE, 0, HTTP2_CONN_WINDOW - HTTP2_INITIAL_WINDOW) < 0) {
+    http2_conn_free(conn);
+    return -1;
+  }
+
+  *connp = conn;
+  return 0;
+}
+
+// A connection the server switched to h2c in reply to an HTTP/1.1 request
+// (RFC 7540 section 3.2): the reply to that request comes as stream 1,
+// after whatever the server sent already, data being the bytes which
+// followed its 101 reply.  The request goes first to http2_send_requests(),
+// among the unanswered ones.
+int http2_conn_new_upgraded(tnetwork_driver_ctx *ctx, unsigned char *data, size_t len, thttp2_conn **connp)
+{
+  thttp2_conn *conn = NULL;
+
+  if (len > HTTP2_RECV_BUF_SIZE) {
+    logger("too much data after the switch to h2c");
+    return -1;
+  }
+
+  if (http2_conn_new(ctx, &conn) < 0)
+    return -1;
+
+  conn->upgraded = 1;
+  conn->next_stream_id = 3;
+  memcpy(conn->rbuf, data, len);
+  conn->rbuf_len = len;
+
+  *connp = conn;
+  return 0;
+}
+
+// Our settings for the HTTP2-Settings header of an upgrade request: the
+// SETTINGS payload, in base64url without padding.
+int http2_upgrade_settings(char **valuep)
+{
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  unsigned char     settings[12];
+  char             *value = NULL;
+  size_t            off = 0;
+
+  http2_settings(settings);
+
+  // 12 bytes, no partial group
+  if (! (value = malloc(sizeof settings / 3 * 4 + 1))) {
+    logger("malloc: %m");
+    return -1;
+  }
+
+  for (size_t i = 0; i < sizeof settings; i += 3) {
+    uint32_t group = (uint32_t) settings[i] << 16 | (uint32_t) settings[i + 1] << 8 | settings[i + 2];
+
+    value[off++] = digits[group >> 18 & 0x3f];
+    value[off++] = digits[group >> 12 & 0x3f];
+    value[off++] = digits[group >> 6 & 0x3f];
+    value[off++] = digits[group & 0x3f];
+  }
+  value[off] = '\0';
+
+  *valuep = value;
+  return 0;
+}
+
+// No more requests on this connection
+void http2_conn_shutdown(thttp2_conn *conn)
+{
+  unsigned char payload[8];
+
+  // The server is closing the connection already
+  if (conn->failed || conn->goaway)
+    return;
+
+  http2_put32(payload, 0);
+  http2_put32(payload + 4, HTTP2_NO_ERROR);
+  if (http2_queue_frame(conn, HTTP2_GOAWAY, 0, 0, payload, sizeof payload) == 0)
+    (void) http2_flush(conn);
+}
+
+// Up to the server's limit of concurrent streams are open at any time, the
+// next ones opening as the previous ones end.  replies[i] gets the reply to
+// requests[i], NULL if none came, e.g. as the connection ended: such
+// requests may go again on another connection.  Requests whose reply is
+// there already are skipped.  Fails when a request cannot go again, part
+// of its reply having gone to its sink.
+int http2_send_requests(thttp2_conn *conn, thttp_request **requests, size_t n_requests, thttp_reply **replies)
+{
+  struct http2_stream *streams = NULL;
+  int                  ret = -1;
+
+  if (! (streams = calloc(n_requests, sizeof *streams))) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  for (size_t i = 0; i < n_requests; i++) {
+    streams[i].request = requests[i];
+    streams[i].replyp = &replies[i];
+    streams[i].sink = http_request_body_sink(requests[i]);
+    streams[i].state = replies[i] ? HTTP2_STREAM_DONE : HTTP2_STREAM_PENDING;
+
+    // The upgrade request, sent already
+    if (conn->upgraded && ! replies[i]) {
+      conn->upgraded = 0;
+      streams[i].id = 1;
+      streams[i].state = HTTP2_STREAM_OPEN;
+    }
+  }
+
+  conn->streams = streams;
+  conn->n_streams = n_requests;
+
+  while (! conn->failed) {
+    struct http2_frame frame = { .len = 0 };
+    size_t             n_open = 0;
+
+    for (size_t i = 0; i < n_requests; i++)
+      n_open += streams[i].state == HTTP2_STREAM_OPEN;
+
+    for (size_t i = 0; i < n_requests && n_open < conn->max_streams; i++) {
+      if (streams[i].state != HTTP2_STREAM_PENDING ||
+          conn->goaway || conn->next_stream_id > HTTP2_MAX_STREAM_ID)
+        continue;
+
+      if (http2_stream_open(conn, &streams[i]) < 0)
+        goto end;
+
+      n_open++;
+    }
+
+    if (! n_open)
+      break;
+
+    if (http2_read_frame(conn, &frame) < 0 || http2_on_frame(conn, &frame) < 0 || http2_sink_flush(conn) < 0) {
+      if (! conn->failed)
+        goto end;
+      break;
+    }
+  }
+
+  if (! conn->failed && http2_flush(conn) < 0)
+    logger("failed to send the last HTTP/2 frames");
+
+  ret = 0;
+  for (size_t i = 0; i < n_requests; i++) {
+    if (streams[i].state != HTTP2_STREAM_DONE && streams[i].got_data) {
+      logger("HTTP/2 stream %"PRIu32" over before its end", streams[i].id);
+      ret = -1;
+    }
+  }
+
+ end:
+  for (size_t i = 0; i < n_requests; i++)
+    http2_stream_reset(&streams[i], streams[i].state);
+  conn->streams = NULL;
+  conn->n_streams = 0;
+  free(streams);
+
+  return ret;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/http2_utest.c"
@@ -0,0 +1,172 @@
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "logger.h"
+#include "http_header_names.h"
+
+// The slot of a name is the top bits of its hash times the seed, the seed
+// found so that no two names of the table share one: a lookup is then one
+// hash and at most one comparison.  Were they to share one, the next free
+// slot would do, a bit slower.
+#define HTTP_HEADER_NAMES_BITS 7
+#define HTTP_HEADER_NAMES_SEED 0x2923u
+
+#define HTTP_HEADER_NAMES_SLOT(hash) \
+  ((uint32_t) ((hash) * HTTP_HEADER_NAMES_SEED) >> (32 - HTTP_HEADER_NAMES_BITS))
+
+#define HTTP_HEADER_NAMES_MASK ((1u << HTTP_HEADER_NAMES_BITS) - 1)
+
+#define HTTP_HEADER_NAMES_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20u : (c))
+
+// All the names one after the other, nul-terminated, then the same in lower
+// case: the interned names point there
+#define X(a, b) b "\0"
+static char http_header_names_buf[] = HTTP_HEADER_TABLE;
+#undef X
+static char http_header_names_lower_buf[sizeof http_header_names_buf];
+
+struct http_header_name {
+  char    *name;
+  char    *lower;
+  uint32_t hash;
+  unsigned len;
+};
+
+static struct http_header_name http_header_names[HTTP_HEADER_UNKNOWN];
+// ID + 1 of the name in each slot, 0 for none
+static uint8_t                 http_header_names_slots[HTTP_HEADER_NAMES_MASK + 1];
+static int                     http_header_names_ready;
+static pthread_once_t          http_header_names_once = PTHREAD_ONCE_INIT;
+
+uint32_t http_header_name_hash(char *name, unsigned *name_lenp)
+{
+  const unsigned char *p = (const unsigned char *) name;
+  uint32_t             hash = 2166136261u;
+
+  for (; *p; p++)
+    hash = (hash ^ HTTP_HEADER_NAMES_LOWER(*p)) * 16777619u;
+
+  *name_lenp = (unsigned) PTRDIFF(p, name);
+  return hash;
+}
+
+static void http_header_names_init(void)
+{
+  char *name = http_header_names_buf;
+  char *lower = http_header_names_lower_buf;
+
+  for (unsigned id = 0; id < HTTP_HEADER_UNKNOWN; id++) {
+    struct http_header_name *n = &http_header_names[id];
+    unsigned                 slot = 0;
+
+    n->name = name;
+    n->lower = lower;
+    n->hash = http_header_name_hash(name, &n->len);
+
+    for (unsigned i = 0; i <= n->len; i++)
+      lower[i] = (char) HTTP_HEADER_NAMES_LOWER((unsigned char) name[i]);
+
+    for (slot = HTTP_HEADER_NAMES_SLOT(n->hash); http_header_names_slots[slot];
+         slot = (slot + 1) & HTTP_HEADER_NAMES_MASK)
+      ;
+    http_header_names_slots[slot] = (uint8_t) (id + 1);
+
+    name += n->len + 1;
+    lower += n->len + 1;
+  }
+
+  __atomic_store_n(&http_header_names_ready, 1, __ATOMIC_RELEASE);
+}
+
+// The flag spares the lookups the cost of pthread_once(), its loads pairing
+// with the store above so that the tables are seen filled
+static void http_header_names_setup(void)
+{
+  if (! __atomic_load_n(&http_header_names_ready, __ATOMIC_ACQUIRE))
+    pthread_once(&http_header_names_once, http_header_names_init);
+}
+
+thttp_header_id http_header_name_find(char *name, uint32_t hash, unsigned name_len)
+{
+  http_header_names_setup();
+
+  for (unsigned slot = HTTP_HEADER_NAMES_SLOT(hash); http_header_names_slots[slot];
+       slot = (slot + 1) & HTTP_HEADER_NAMES_MASK) {
+    unsigned                 id = http_header_names_slots[slot] - 1u;
+    struct http_header_name *n = &http_header_names[id];
+
+    if (n->hash == hash && n->len == name_len && ! strcasecmp(n->name, name))
+      return (thttp_header_id) id;
+  }
+
+  return HTTP_HEADER_UNKNOWN;
+}
+
+thttp_header_id http_header_name_id(char *name)
+{
+  unsigned name_len = 0;
+  uint32_t hash = http_header_name_hash(name, &name_len);
+
+  return http_header_name_find(name, hash, name_len);
+}
+
+char *http_header_name(thttp_header_id id)
+{
+  if (id >= HTTP_HEADER_UNKNOWN)
+    return NULL;
+
+  http_header_names_setup();
+  return http_header_names[id].name;
+}
+
+char *http_header_name_lower(thttp_header_id id)
+{
+  if (id >= HTTP_HEADER_UNKNOWN)
+    return NULL;
+
+  http_header_names_setup();
+  return http_header_names[id].lower;
+}
+
+uint32_t http_header_name_hash_of(thttp_header_id id, unsigned *name_lenp)
+{
+  if (id >= HTTP_HEADER_UNKNOWN) {
+    *name_lenp = 0;
+    return 0;
+  }
+
+  http_header_names_setup();
+  *name_lenp = http_header_names[id].len;
+  return http_header_names[id].hash;
+}
+
+char *http_header_name_intern(thttp_header_id id, char *name)
+{
+  if (id >= HTTP_HEADER_UNKNOWN)
+    return NULL;
+
+  http_header_names_setup();
+
+  if (! strcmp(name, http_header_names[id].name))
+    return http_header_names[id].name;
+  if (! strcmp(name, http_header_names[id].lower))
+    return http_header_names[id].lower;
+
+  return NULL;
+}
+
+int http_header_name_is_interned(char *name)
+{
+  uintptr_t p = (uintptr_t) name;
+
+  return (p >= (uintptr_t) http_header_names_buf &&
+          p < (uintptr_t) http_header_names_buf + sizeof http_header_names_buf) ||
+    (p >= (uintptr_t) http_header_names_lower_buf &&
+     p < (uintptr_t) http_header_names_lower_buf + sizeof http_header_names_lower_buf);
+}
+
+#include "../tests/http_header_names_utest.c"
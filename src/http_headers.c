@@ -1,40 +1,78 @@
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "util.h"
+#include "arena.h"
 #include "logger.h"
 #include "strutil.h"
+#include "http_header_names.h"
 #include "http_headers.h"
 
+#define HTTP_HEADER_MAX_ENTRIES 256
+
+// A header, with what its lookups compare first: the hash and the length
+// of its name, case-folded, and the ID of a well-known name
+struct http_headers_entry {
+  struct http_headers_elem elem;
+  uint32_t        hash;
+  unsigned        key_len;
+  thttp_header_id id;
+  // Index + 1 of the next header of the same name, 0 for none, and of the
+  // last one for the first header of a name
+  unsigned next;
+  unsigned last;
+};
+
 struct http_headers {
-  struct http_headers_elem *elems;
+  struct http_headers_entry *entries;
   unsigned n_elems;
+  unsigned n_alloc;
+
+  // Open addressing, linear probing: index + 1 of the first header of each
+  // name, 0 for an empty slot.  Twice n_alloc slots, allocated right after
+  // the entries.
+  uint16_t *index;
+
+  // Keys and values point into a buffer someone else owns
+  int      views;
+  // Where all of the above comes from, NULL for malloc()
+  tarena  *arena;
 };
 
 void http_headers_free(thttp_headers *headers)
 {
-  if (! headers)
+  // Arena headers go with their arena
+  if (! headers || headers->arena)
     return;
 
-  for (unsigned i = 0; i < headers->n_elems; i++) {
-    free(headers->elems[i].key);
-    free(headers->elems[i].value);
+  for (unsigned i = 0; ! headers->views && i < headers->n_elems; i++) {
+    if (! http_header_name_is_interned(headers->entries[i].elem.key))
+      free(headers->entries[i].elem.key);
+    free(headers->entries[i].elem.value);
   }
 
-  free(headers->elems);
+  free(headers->entries);
   free(headers);
 }
 
-static int http_headers_new_internal(thttp_headers **headersp)
+static int http_headers_new_internal(tarena *arena, thttp_headers **headersp)
 {
-  thttp_headers *headers = malloc(sizeof *headers);
+  thttp_headers *headers = arena_alloc(arena, sizeof *headers);
   if (! headers) {
     logger("malloc: %m");
     goto err;
   }
 
-  headers->elems = NULL;
+  headers->entries = NULL;
   headers->n_elems = 0;
+  headers->n_alloc = 0;
+  headers->index = NULL;
+  headers->views = 0;
+  headers->arena = arena;
 
   if (headersp)
     *headersp = headers;
@@ -46,9 +84,102 @@ static int http_headers_new_internal(thttp_headers **headersp)
   return -1;
 }
 
+// The slot of the first header named key, or the empty one it would take
+static uint16_t *http_headers_slot(thttp_headers *headers, char *key, uint32_t hash, unsigned key_len)
+{
+  unsigned mask = 2 * headers->n_alloc - 1;
+
+  for (unsigned i = hash & mask; ; i = (i + 1) & mask) {
+    struct http_headers_entry *e = NULL;
+
+    if (! headers->index[i])
+      return &headers->index[i];
+
+    e = &headers->entries[headers->index[i] - 1];
+    if (e->hash == hash && e->key_len == key_len && ! strcasecmp(e->elem.key, key))
+      return &headers->index[i];
+  }
+}
+
+// The i-th header, its name hashed already, after those of the same name
+static void http_headers_index_insert(thttp_headers *headers, unsigned i)
+{
+  struct http_headers_entry *e = &headers->entries[i];
+  uint16_t                  *slot = http_headers_slot(headers, e->elem.key, e->hash, e->key_len);
+
+  e->next = 0;
+  e->last = i + 1;
+
+  if (! *slot) {
+    *slot = (uint16_t) (i + 1);
+  } else {
+    struct http_headers_entry *first = &headers->entries[*slot - 1];
+
+    headers->entries[first->last - 1].next = i + 1;
+    first->last = i + 1;
+  }
+}
+
+// Room for n elements, the array doubling so that adding one header after
+// the other does not mean a realloc() each time.  The index grows along,
+// rebuilt in the same allocation.
+static int http_headers_reserve(thttp_headers *headers, unsigned n)
+{
+  struct http_headers_entry *tmp = NULL;
+  unsigned                   n_alloc = headers->n_alloc ? headers->n_alloc : 8;
+
+  if (n > HTTP_HEADER_MAX_ENTRIES) {
+    logger("we reached the maximum number of header keys: %u", n);
+    return -1;
+  }
+
+  if (n <= headers->n_alloc)
+    return 0;
+
+  while (n_alloc < n)
+    n_alloc *= 2;
+
+  if (! (tmp = arena_realloc(headers->arena, headers->entries,
+                             headers->n_alloc * (sizeof *headers->entries + 2 * sizeof *headers->index),
+                             n_alloc * (sizeof *headers->entries + 2 * sizeof *headers->index)))) {
+    logger("realloc: %m");
+    return -1;
+  }
+
+  headers->entries = tmp;
+  headers->n_alloc = n_alloc;
+  headers->index = (uint16_t *) (tmp + n_alloc);
+  memset(headers->index, 0, 2 * n_alloc * sizeof *headers->index);
+
+  for (unsigned i = 0; i < headers->n_elems; i++)
+    http_headers_index_insert(headers, i);
+
+  return 0;
+}
+
+// The next header, its name hashed and looked up among the well-known ones
+static struct http_headers_entry *http_headers_next(thttp_headers *headers, char *key)
+{
+  struct http_headers_entry *e = &headers->entries[headers->n_elems];
+
+  e->hash = http_header_name_hash(key, &e->key_len);
+  e->id = http_header_name_find(key, e->hash, e->key_len);
+  return e;
+}
+
+// The next header, its key and value set, counted and indexed
+static void http_headers_append(thttp_headers *headers, char *key, char *value)
+{
+  struct http_headers_entry *e = &headers->entries[headers->n_elems];
+
+  e->elem.key = key;
+  e->elem.value = value;
+  http_headers_index_insert(headers, headers->n_elems++);
+}
+
 int http_headers_new(char *key, char *value, thttp_headers **headersp)
 {
-  struct http_headers *headers;
+  struct http_headers *headers = NULL;
 
   // We accept empty strings as key/value but not NULL
   if (! key || ! value) {
@@ -56,26 +187,11 @@ int http_headers_new(char *key, char *value, thttp_headers **headersp)
     goto err;
   }
 
-  if (http_headers_new_internal(&headers) < 0)
+  if (http_headers_new_internal(NULL, &headers) < 0)
     goto err;
 
-  if (! (headers->elems = malloc(sizeof *headers->elems))) {
-    logger("malloc: %m");
+  if (http_headers_add(headers, key, value) < 0)
     goto free_header_err;
-  }
-
-  char *nkey = strdup(key);
-  char *nvalue = strdup(value);
-  if (! nkey || ! nvalue) {
-    logger("strdup: %m");
-    free(nkey);
-    free(nvalue);
-    goto free_header_err;
-  }
-
-  headers->elems[0].key = nkey;
-  headers->elems[0].value = nvalue;
-  headers->n_elems = 1;
 
   if (headersp)
     *headersp = headers;
@@ -90,99 +206,225 @@ int http_headers_new(char *key, char *value, thttp_headers **headersp)
   return -1;
 }
 
-// key and value are already allocated, just to pointer assignment here.
+// Appended at the end, as copies of key and value, whether headers of the
+// same name are there already or not.  Well-known names spelled as in
+// HTTP_HEADER_TABLE, or in lower case, are shared rather than copied.
 int http_headers_add(thttp_headers *headers, char *key, char *value)
 {
-#define HTTP_HEADER_MAX_ENTRIES 256
-  unsigned                  n = 0;
-  struct http_headers_elem *tmp = NULL;
+  struct http_headers_entry *e = NULL;
+  char                      *nkey = NULL;
+  char                      *nvalue = NULL;
 
-  // Ok, just append it a the end.
-  n = headers->n_elems + 1;
-
-  if (n > HTTP_HEADER_MAX_ENTRIES) {
-    logger("we reached the maximum number of header keys: %d", n);
+  if (headers->views) {
+    logger("cannot add a copied header to views");
     goto err;
   }
 
-  char *nvalue = strdup(value);
-  char *nkey = strdup(key);
+  if (http_headers_reserve(headers, headers->n_elems + 1) < 0)
+    goto err;
+
+  e = http_headers_next(headers, key);
+  if (! (nkey = http_header_name_intern(e->id, key)))
+    nkey = arena_strdup(headers->arena, key);
+  nvalue = arena_strdup(headers->arena, value);
   if (! nvalue || ! nkey) {
     logger("strdup: %m");
-    free(nvalue);
-    free(nkey);
-  }
-
-  if (! (tmp = realloc(headers->elems, n * sizeof *headers->elems))) {
-    logger("realloc: %m");
+    arena_release(headers->arena, nvalue);
+    if (nkey && ! http_header_name_is_interned(nkey))
+      arena_release(headers->arena, nkey);
     goto err;
   }
 
-  tmp[n-1].key = nkey;
-  tmp[n-1].value = nvalue;
-  headers->elems = tmp;
-  headers->n_elems = n;
+  http_headers_append(headers, nkey, nvalue);
 
   return 0;
 
  err:
   return -1;
-#undef HTTP_HEADER_MAX_ENTRIES
 }
 
+// No headers yet, to be added in arena: they are all released with it, and
+// http_headers_free() does nothing
+int http_headers_new_in(tarena *arena, thttp_headers **headersp)
+{
+  return http_headers_new_internal(arena, headersp);
+}
+
+// Headers which are views into a buffer, e.g. the one a reply was received
+// in: neither the keys nor the values are copied, the buffer has to outlive
+// the headers.  size_hint is how many are expected, to be allocated at once.
+int http_headers_new_view(tarena *arena, unsigned size_hint, thttp_headers **headersp)
+{
+  thttp_headers *headers = NULL;
+
+  if (http_headers_new_internal(arena, &headers) < 0)
+    return -1;
+
+  headers->views = 1;
+  if (size_hint && http_headers_reserve(headers, size_hint) < 0) {
+    http_headers_free(headers);
+    return -1;
+  }
+
+  *headersp = headers;
+  return 0;
+}
+
+int http_headers_add_view(thttp_headers *headers, char *key, char *value)
+{
+  if (! headers->views) {
+    logger("cannot add a view to copied headers");
+    return -1;
+  }
+
+  if (http_headers_reserve(headers, headers->n_elems + 1) < 0)
+    return -1;
+
+  (void) http_headers_next(headers, key);
+  http_headers_append(headers, key, value);
+
+  return 0;
+}
+
+// A copy of all the headers, in the same order, views or not, in arena
+int http_headers_dup_in(tarena *arena, thttp_headers *headers, thttp_headers **copyp)
+{
+  thttp_headers *copy = NULL;
+
+  if (http_headers_new_internal(arena, &copy) < 0)
+    return -1;
+
+  if (http_headers_reserve(copy, headers->n_elems) < 0) {
+    http_headers_free(copy);
+    return -1;
+  }
+
+  for (unsigned i = 0; i < headers->n_elems; i++) {
+    if (http_headers_add(copy, headers->entries[i].elem.key, headers->entries[i].elem.value) < 0) {
+      http_headers_free(copy);
+      return -1;
+    }
+  }
+
+  *copyp = copy;
+  return 0;
+}
+
+int http_headers_dup(thttp_headers *headers, thttp_headers **copyp)
+{
+  return http_headers_dup_in(NULL, headers, copyp);
+}
+
+// The first header named key, the case aside
+static int http_headers_find(thttp_headers *headers, char *key)
+{
+  uint16_t *slot = NULL;
+  unsigned  key_len = 0;
+  uint32_t  hash = 0;
+
+  if (! headers->n_elems)
+    return -1;
+
+  hash = http_header_name_hash(key, &key_len);
+  slot = http_headers_slot(headers, key, hash, key_len);
+
+  return *slot ? *slot - 1 : -1;
+}
+
+// The value of the first header named key is replaced
 int http_headers_update_value(thttp_headers *headers, char *key, char *value)
 {
-  unsigned i = 0;
+  char *nvalue = NULL;
+  int   i = -1;
+
   if (! headers || ! key || ! value) {
     logger("invalid input: provide non-NULL header values");
     goto err;
   }
 
-  for (i = 0; i < headers->n_elems; i++) {
-    if (headers->elems[i].key) {
-      if (0 == strcmp(key, headers->elems[i].key)) {
-        char *nvalue = strdup(value);
-        if (! nvalue) {
-          logger("strdup: %m");
-          goto err;
-        }
-        free(headers->elems[i].value);
-        headers->elems[i].value = nvalue;
-        goto found;
-      }
-    }
+  if (headers->views) {
+    logger("cannot update views");
+    goto err;
   }
 
+  if ((i = http_headers_find(headers, key)) < 0)
+    goto err;
+
+  if (! (nvalue = arena_strdup(headers->arena, value))) {
+    logger("strdup: %m");
+    goto err;
+  }
+
+  arena_release(headers->arena, headers->entries[i].elem.value);
+  headers->entries[i].elem.value = nvalue;
+  return i;
+
  err:
   return -1;
-
- found:
-  return (int) i;
 }
 
+// The first header named key, the case aside: its index, -1 if none
 int http_headers_lookup(thttp_headers *headers, char *key, char **foundp)
 {
-  unsigned i = 0;
+  int i = -1;
+
   if (! headers || ! key) {
     logger("invalid input: both headers and key should be non-NULL");
-    goto not_found;
+    return -1;
   }
 
-  for (i = 0; i < headers->n_elems; i++) {
-    if (headers->elems[i].key) {
-      if (0 == strcmp(key, headers->elems[i].key))
-        goto found;
+  if ((i = http_headers_find(headers, key)) < 0)
+    return -1;
+
+  if (foundp)
+    *foundp = headers->entries[i].elem.value;
+
+  return i;
+}
+
+// The first header of a well-known name, its hash known beforehand and
+// the IDs compared rather than the names
+int http_headers_lookup_id(thttp_headers *headers, thttp_header_id id, char **foundp)
+{
+  unsigned mask = 0;
+  unsigned key_len = 0;
+  uint32_t hash = 0;
+
+  if (! headers || ! headers->n_elems || id >= HTTP_HEADER_UNKNOWN)
+    return -1;
+
+  mask = 2 * headers->n_alloc - 1;
+  hash = http_header_name_hash_of(id, &key_len);
+
+  for (unsigned i = hash & mask; headers->index[i]; i = (i + 1) & mask) {
+    struct http_headers_entry *e = &headers->entries[headers->index[i] - 1];
+
+    if (e->id == id) {
+      if (foundp)
+        *foundp = e->elem.value;
+      return headers->index[i] - 1;
     }
   }
 
- not_found:
   return -1;
+}
+
+// The header of the same name following the one at index prev, as returned
+// by http_headers_lookup() or by this: its index, -1 if none
+int http_headers_lookup_next(thttp_headers *headers, int prev, char **foundp)
+{
+  unsigned next = 0;
+
+  if (! headers || prev < 0 || (unsigned) prev >= headers->n_elems)
+    return -1;
+
+  if (! (next = headers->entries[prev].next))
+    return -1;
 
- found:
   if (foundp)
-    *foundp = headers->elems[i].value;
-  
-  return (int) i;
+    *foundp = headers->entries[next - 1].elem.value;
+
+  return (int) next - 1;
 }
 
 int http_headers_foreach(thttp_headers *headers, titerate_func func, void *user_data)
@@ -191,7 +433,7 @@ int http_headers_foreach(thttp_headers *headers, titerate_func func, void *user_
     goto err;
 
   for (unsigned i = 0; i < headers->n_elems; i++) {
-    struct http_headers_elem e = headers->elems[i];
+    struct http_headers_elem e = headers->entries[i].elem;
     int rc = func(&e, user_data);
     if (rc < 0)
       goto err;
@@ -207,40 +449,47 @@ int http_headers_foreach(thttp_headers *headers, titerate_func func, void *user_
 
 }
 
-struct itarg {
-  char *accu;
-};
-
-static int concat_headers_func(struct http_headers_elem *elem, void *user_data)
+unsigned http_headers_count(thttp_headers *headers)
 {
-  struct itarg *itarg = user_data;
-  char         *buf = NULL;
-
-  if (asprintf(&buf, "%s%s: %s\r\n",
-               itarg->accu ? itarg->accu : "", elem->key, elem->value) < 0) {
-    logger("asprintf: %m");
-    goto err;
-  }
-
-  free(itarg->accu);
-  itarg->accu = buf;
-
-  return 1;
- err:
-  return -1;
+  return headers ? headers->n_elems : 0;
 }
 
+// "key: value\r\n" for each header, measured first so that the string is
+// allocated once, whatever the number of headers.
 char *http_headers_to_string(thttp_headers *headers)
 {
-  struct itarg itarg = { .accu = NULL };
+  char   *buf = NULL;
+  char   *p = NULL;
+  size_t  len = 0;
 
-  if (! headers)
-    goto err;
+  if (! headers || ! headers->n_elems)
+    return NULL;
 
-  if (http_headers_foreach(headers, concat_headers_func, &itarg) < 0)
-    goto err;
+  for (unsigned i = 0; i < headers->n_elems; i++)
+    len += headers->entries[i].key_len + strlen(headers->entries[i].elem.value) + 4;
 
-  return itarg.accu;
- err:
-  return NULL;
+  if (! (buf = malloc(len + 1))) {
+    logger("malloc: %m");
+    return NULL;
+  }
+
+  p = buf;
+  for (unsigned i = 0; i < headers->n_elems; i++) {
+    size_t key_len = headers->entries[i].key_len;
+    size_t value_len = strlen(headers->entries[i].elem.value);
+
+    memcpy(p, headers->entries[i].elem.key, key_len);
+    p += key_len;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, headers->entries[i].elem.value, value_len);
+    p += value_len;
+    *p++ = '\r';
+    *p++ = '\n';
+  }
+  *p = '\0';
+
+  return buf;
 }
+
+#include "../tests/http_headers_utest.c"
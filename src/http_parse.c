@@ -1,49 +1,58 @@
 #define _POSIX_C_SOURCE 200809L // strndup()
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "util.h"
 #include "logger.h"
-#include "strutil.h"
 #include "http_parse.h"
+#include "scan.h"
 
-static int http_parse_code(unsigned char *udata, size_t data_size, int *codep)
+// Only the data_size bytes of data are looked at: the status line is not
+// nul-terminated when parsed in place.  The code has three digits, and
+// something after them, the reason or the line end.
+static int http_parse_code(unsigned char *data, size_t data_size, int *codep)
 {
-  int   code = 0;
-  char  http_resp[] = "HTTP/1.";
-  char *endptr = NULL;
-  char *p = NULL;
-  char *data = (char *) udata;
-  
+  char   http_resp[] = "HTTP/1.";
+  size_t i = 0;
+  int    code = 0;
+
   // Sanity check
   if (! data || ! data_size) {
     goto err;
   }
 
-  while (data && *data && isspace(*data))
-    data++;
-  
-  if (strncasecmp(http_resp, (char *) data, sizeof http_resp - 1))
+  while (i < data_size && isspace(data[i]))
+    i++;
+
+  if (data_size - i < sizeof http_resp - 1 ||
+      strncasecmp(http_resp, (char *) data + i, sizeof http_resp - 1))
     goto err;
 
-  p = data + sizeof http_resp - 1;
+  i += sizeof http_resp - 1;
 
   // Skip the http version
-  while (p && *p && ! isspace(*p))
-    p++;
+  while (i < data_size && data[i] && ! isspace(data[i]))
+    i++;
 
   // Skip spaces
-  while (p && *p && isspace(*p))
-    p++;
+  while (i < data_size && isspace(data[i]))
+    i++;
 
-  if (! p || ! *p)
+  if (data_size - i < 4)
     goto err;
 
-  code = (int) strtol(p, &endptr, 0);
-  if (endptr && ('\0' == *endptr || (char *) p == endptr))
+  for (size_t end = i + 3; i < end; i++) {
+    if (! isdigit(data[i]))
+      goto err;
+    code = code * 10 + data[i] - '0';
+  }
+
+  if (! data[i] || isdigit(data[i]))
     goto err;
-  
+
   if (codep)
     *codep = code;
 
@@ -52,201 +61,672 @@ static int http_parse_code(unsigned char *udata, size_t data_size, int *codep)
   return -1;
 }
 
-// At least make sure we have the CRLF CRLF header-body separator, return the
-// header total length (without the last separator)
-static int http_parse_sanity_check(char *buf, size_t buf_size)
+//
+// Push parser: bytes are fed as they come from the network, and the parser
+// keeps track of where it stands between two calls.  Each byte is looked at
+// once: lines are accumulated up to their LF, body bytes are handed over
+// without any scanning at all.
+//
+
+#define HTTP_PARSER_MAX_LINE_LEN (64 * 1024)
+
+typedef enum {
+  HTTP_PARSER_STATE_STATUS_LINE,
+  HTTP_PARSER_STATE_HEADER_LINE,
+  HTTP_PARSER_STATE_BODY,
+  HTTP_PARSER_STATE_BODY_UNTIL_EOF,
+  HTTP_PARSER_STATE_CHUNK_SIZE,
+  HTTP_PARSER_STATE_CHUNK_DATA,
+  HTTP_PARSER_STATE_CHUNK_END,
+  HTTP_PARSER_STATE_TRAILER,
+  HTTP_PARSER_STATE_DONE,
+  HTTP_PARSER_STATE_ERROR,
+} thttp_parser_state;
+
+struct http_parser {
+  thttp_parser_state           state;
+  int                          is_head;
+  int                          interim;    // Within a 1xx informational reply
+
+  struct http_parser_callbacks callbacks;
+  void                        *user_data;
+
+  // The current line, which may span several feeds
+  char                        *line;
+  size_t                       line_len;
+  size_t                       line_size;
+
+  // Head lines parsed where they lie in the fed buffer
+  int                          in_place;
+  unsigned                     n_lines_hint;
+
+  int                          code;
+  thttp_headers               *headers;
+
+  // Body framing, as announced by the headers
+  int                          te_present;
+  int                          te_chunked;
+  int                          cl_present;
+  unsigned long long           content_length;
+  unsigned long long           remaining;  // Left in the body or in the chunk
+
+  // Only used when there's no on_body callback
+  unsigned char               *body;
+  size_t                       body_len;
+  size_t                       body_size;
+
+  // Where the headers, the body and the reply come from, NULL for malloc()
+  tarena                      *arena;
+};
+
+void http_parser_free(thttp_parser *parser)
 {
-  char *sep = NULL;
-  (void) buf_size;
+  if (! parser)
+    return;
+
+  free(parser->line);
+  http_headers_free(parser->headers);
+  arena_release(parser->arena, parser->body);
+  free(parser);
+}
 
-  if (! (sep = strstr(buf, CRLF CRLF))) {
-    logger("missing the CRLF CRLF header-body separator: %s", buf);
+int http_parser_new(struct http_parser_callbacks *callbacks, void *user_data, int is_head, thttp_parser **parserp)
+{
+  thttp_parser *parser = calloc(1, sizeof *parser);
+  if (! parser) {
+    logger("calloc: %m");
     goto err;
   }
 
-  return (int) PTRDIFF(sep, buf);
+  if (callbacks)
+    parser->callbacks = *callbacks;
+
+  parser->user_data = user_data;
+  parser->is_head = is_head;
+  parser->state = HTTP_PARSER_STATE_STATUS_LINE;
+
+  if (parserp)
+    *parserp = parser;
+  else
+    http_parser_free(parser);
+
+  return 0;
  err:
   return -1;
 }
 
-static int http_parse_headers(unsigned char *buf, size_t buf_size, thttp_headers **headersp)
+// What the reply is made of allocated in arena, to be released with it
+void http_parser_set_arena(thttp_parser *parser, tarena *arena)
 {
-  char          *headers_buf = NULL;
-  char          *p = NULL;
-  thttp_headers *headers = NULL;
-  int            headers_len = -1;
-  char          *nkey = NULL;
-  char          *nvalue = NULL;
+  parser->arena = arena;
+}
 
-  if (! buf)
-    goto err;
+int http_parser_code(thttp_parser *parser)
+{
+  return parser->code;
+}
 
-  if ((headers_len = http_parse_sanity_check((char *) buf, buf_size)) < 0)
-    goto err;
+thttp_headers *http_parser_headers(thttp_parser *parser)
+{
+  return parser->headers;
+}
 
-  if (! (headers_buf = malloc(headers_len + CRLF_LEN + 1))) {
-    logger("malloc: %m");
-    goto err;
-  }
+int http_parser_is_done(thttp_parser *parser)
+{
+  return parser->state == HTTP_PARSER_STATE_DONE;
+}
 
-  memcpy(headers_buf, buf, headers_len + CRLF_LEN);
-  headers_buf[headers_len + CRLF_LEN] = '\0';
+static int http_parser_append_line(thttp_parser *parser, unsigned char *data, size_t len)
+{
+  size_t needed = parser->line_len + len + 1;
 
-  // Ignore the first line: HTTP/1.x <Code> <Reason>\r\n
-  if (! (p = strstr(headers_buf, CRLF))) {
-    logger("missing the very first CRLF separator: %s", headers_buf);
-    goto err;
+  if (needed > parser->line_size) {
+    size_t size = parser->line_size ? parser->line_size * 2 : 256;
+    char  *tmp = NULL;
+
+    if (needed > HTTP_PARSER_MAX_LINE_LEN) {
+      logger("reply line longer than %dKB", HTTP_PARSER_MAX_LINE_LEN / 1024);
+      return -1;
+    }
+
+    while (size < needed)
+      size *= 2;
+
+    if (! (tmp = realloc(parser->line, size))) {
+      logger("realloc: %m");
+      return -1;
+    }
+
+    parser->line = tmp;
+    parser->line_size = size;
   }
 
-  p += CRLF_LEN; // Ok we're at the beginning of the headers
+  memcpy(parser->line + parser->line_len, data, len);
+  parser->line_len += len;
+  parser->line[parser->line_len] = '\0';
 
-  while (p < &headers_buf[headers_len - CRLF_LEN]) {
-    char *colon = NULL;
-    char *eol = NULL;
+  return 0;
+}
 
-    if (! (eol = strstr(p, CRLF)))
-      break;
+static int http_parser_on_body(thttp_parser *parser, unsigned char *data, size_t len)
+{
+  if (parser->callbacks.on_body)
+    return parser->callbacks.on_body(data, len, parser->user_data);
 
-    // Did we reach the end of headers?
-    if (eol == p)
-      break;
+  if (parser->body_len + len + 1 > parser->body_size) {
+    size_t         size = parser->body_size ? parser->body_size : 4096;
+    unsigned char *tmp = NULL;
 
-    // Only consider this header line: "Key: Value"
-    *eol = '\0';
+    while (size < parser->body_len + len + 1)
+      size *= 2;
 
-    if (! (colon = strchr(p, ':'))) {
-      // Don't return the function, simply ignore this line.
-      logger("invalid header line: %s", p);
-      goto err;
+    if (! (tmp = arena_realloc(parser->arena, parser->body, parser->body_size, size))) {
+      logger("realloc: %m");
+      return -1;
     }
 
-    *colon = '\0';
-    if (trim(p, &nkey) <  0 ||
-        (trim(colon + 1, &nvalue) < 0)) {
-      logger("failed to extract key or value: %s", p);
-      free(nkey);
-      free(nvalue);
-      continue;
+    parser->body = tmp;
+    parser->body_size = size;
+  }
+
+  memcpy(parser->body + parser->body_len, data, len);
+  parser->body_len += len;
+  parser->body[parser->body_len] = '\0';
+
+  return 0;
+}
+
+static int http_parser_message_complete(thttp_parser *parser)
+{
+  parser->state = HTTP_PARSER_STATE_DONE;
+
+  if (parser->callbacks.on_message_complete)
+    return parser->callbacks.on_message_complete(parser->user_data);
+
+  return 0;
+}
+
+static int http_parser_status_line(thttp_parser *parser, char *line, size_t line_len)
+{
+  int code = -1;
+
+  // The line still holds its CRLF, and is only nul-terminated when copied
+  if (http_parse_code((unsigned char *) line, line_len, &code) < 0 ||
+      code < 100 || code > 999) {
+    logger("invalid status line: %.*s", (int) line_len, line);
+    return -1;
+  }
+
+  parser->state = HTTP_PARSER_STATE_HEADER_LINE;
+
+  // Informational replies are followed by the actual one, 101 excepted
+  if (code / 100 == 1 && code != 101) {
+    parser->interim = 1;
+    return 0;
+  }
+
+  parser->code = code;
+
+  if (parser->callbacks.on_status)
+    return parser->callbacks.on_status(code, parser->user_data);
+
+  return 0;
+}
+
+static char *http_parser_trim(char *p, char *end)
+{
+  p += scan_ws_span((unsigned char *) p, PTRDIFF(end, p));
+  end -= scan_ws_span_back((unsigned char *) p, PTRDIFF(end, p));
+
+  *end = '\0';
+  return p;
+}
+
+static int http_parser_header_line(thttp_parser *parser, char *line, size_t line_len)
+{
+  char *colon = NULL;
+  char *key = NULL;
+  char *value = NULL;
+
+  colon = line + scan_byte((unsigned char *) line, line_len, ':');
+  if (colon == line + line_len || colon == line) {
+    logger("invalid header line: %s", line);
+    return -1;
+  }
+
+  key = http_parser_trim(line, colon);
+  value = http_parser_trim(colon + 1, line + line_len);
+
+  if (parser->interim)
+    return 0;
+
+  switch (http_header_name_id(key)) {
+  case HTTP_HEADER_TRANSFER_ENCODING: {
+    char  *coding = strrchr(value, ',');
+    size_t coding_len = 0;
+
+    // Only a final "chunked" coding tells where the body ends: the last one
+    // of the comma-separated list, whitespace around (RFC 9112 section 6.1)
+    coding = coding ? coding + 1 : value;
+    coding += strspn(coding, " \t");
+    coding_len = strlen(coding);
+    while (coding_len && (coding[coding_len - 1] == ' ' || coding[coding_len - 1] == '\t'))
+      coding_len--;
+
+    parser->te_present = 1;
+    parser->te_chunked = coding_len == sizeof "chunked" - 1 && 0 == strncasecmp(coding, "chunked", coding_len);
+    break;
+  }
+
+  case HTTP_HEADER_CONTENT_LENGTH: {
+    unsigned long long content_length = 0;
+    char              *endptr = NULL;
+
+    // Digits only: strtoull() would take a sign, or whitespace
+    errno = 0;
+    if (isdigit((unsigned char) *value))
+      content_length = strtoull(value, &endptr, 10);
+
+    if (! endptr || *endptr || errno == ERANGE ||
+        (parser->cl_present && content_length != parser->content_length)) {
+      logger("invalid Content-Length header: %s", value);
+      return -1;
     }
 
-    if (! headers) {
-      if (http_headers_new(nkey, nvalue, &headers) < 0) {
-        logger("failed to create a new HTTP header");
-        free(nkey);
-        free(nvalue);
-        goto err;
-      }
-    } else if (http_headers_add(headers, nkey, nvalue) < 0) {
+    parser->cl_present = 1;
+    parser->content_length = content_length;
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  if (parser->in_place) {
+    if ((! parser->headers && http_headers_new_view(parser->arena, parser->n_lines_hint, &parser->headers) < 0) ||
+        http_headers_add_view(parser->headers, key, value) < 0) {
       logger("failed to add a new key/value to the headers");
-      free(nkey);
-      free(nvalue);
-      goto err;
+      return -1;
     }
-    
-    p = eol + CRLF_LEN;
-    free(nvalue);
-    free(nkey);
+  } else if (! parser->headers && http_headers_new_in(parser->arena, &parser->headers) < 0) {
+    logger("failed to create a new HTTP header");
+    return -1;
+  } else if (http_headers_add(parser->headers, key, value) < 0) {
+    logger("failed to add a new key/value to the headers");
+    return -1;
   }
 
-  free(headers_buf);
+  if (parser->callbacks.on_header)
+    return parser->callbacks.on_header(key, value, parser->user_data);
 
-  if (headersp)
-    *headersp = headers;
-  else
-    http_headers_free(headers);
+  return 0;
+}
+
+// Pick the body framing, following the RFC 9112 section 6.3 rules
+static int http_parser_headers_complete(thttp_parser *parser)
+{
+  if (parser->interim) {
+    parser->interim = 0;
+    parser->state = HTTP_PARSER_STATE_STATUS_LINE;
+    return 0;
+  }
+
+  if (parser->is_head || parser->code / 100 == 1 ||
+      parser->code == 204 || parser->code == 304) {
+    parser->state = HTTP_PARSER_STATE_BODY;
+    parser->remaining = 0;
+  } else if (parser->te_chunked) {
+    parser->state = HTTP_PARSER_STATE_CHUNK_SIZE;
+  } else if (parser->te_present || ! parser->cl_present) {
+    parser->state = HTTP_PARSER_STATE_BODY_UNTIL_EOF;
+  } else {
+    parser->state = HTTP_PARSER_STATE_BODY;
+    parser->remaining = parser->content_length;
+  }
+
+  if (parser->callbacks.on_headers_complete)
+    return parser->callbacks.on_headers_complete(parser->user_data);
 
   return 0;
+}
+
+static int http_parser_chunk_size_line(thttp_parser *parser, char *line, size_t line_len)
+{
+  char              *endptr = NULL;
+  unsigned long long chunk_size = 0;
+  size_t             n_digits = 0;
+
+  // Hex digits only: strtoull() would take a sign, whitespace or "0x"
+  while (n_digits < line_len && isxdigit((unsigned char) line[n_digits]))
+    n_digits++;
+
+  errno = 0;
+  if (n_digits)
+    chunk_size = strtoull(line, &endptr, 16);
+
+  if (endptr != line + n_digits || ! n_digits || errno == ERANGE ||
+      (endptr != line + line_len && *endptr != ';' && ! isspace((unsigned char) *endptr))) {
+    logger("invalid chunk size line: %s", line);
+    return -1;
+  }
+
+  if (0 == chunk_size) {
+    parser->state = HTTP_PARSER_STATE_TRAILER;
+  } else {
+    parser->state = HTTP_PARSER_STATE_CHUNK_DATA;
+    parser->remaining = chunk_size;
+  }
+
+  return 0;
+}
+
+// A whole line is there, LF included
+static int http_parser_line(thttp_parser *parser, char *line, size_t line_len)
+{
+  if (parser->state == HTTP_PARSER_STATE_STATUS_LINE)
+    return http_parser_status_line(parser, line, line_len);
+
+  // Strip the line terminator, being lenient with bare LFs
+  line_len--;
+  if (line_len && line[line_len - 1] == '\r')
+    line_len--;
+  line[line_len] = '\0';
+
+  switch (parser->state) {
+  case HTTP_PARSER_STATE_HEADER_LINE:
+    if (! line_len)
+      return http_parser_headers_complete(parser);
+    return http_parser_header_line(parser, line, line_len);
+
+  case HTTP_PARSER_STATE_CHUNK_SIZE:
+    return http_parser_chunk_size_line(parser, line, line_len);
+
+  case HTTP_PARSER_STATE_CHUNK_END:
+    if (line_len) {
+      logger("missing CRLF after the chunk data");
+      return -1;
+    }
+    parser->state = HTTP_PARSER_STATE_CHUNK_SIZE;
+    return 0;
+
+  case HTTP_PARSER_STATE_TRAILER:
+    // Trailer fields are ignored, up to the final empty line
+    if (! line_len)
+      return http_parser_message_complete(parser);
+    return 0;
+
+  default:
+    break;
+  }
 
- err:
-  free(headers_buf);
-  http_headers_free(headers);
   return -1;
 }
 
-// Just look for the CRLF CRLF then dump the remaining data
-static int http_parse_body(unsigned char *buf, size_t buf_size, unsigned char **bodyp, size_t *body_lenp)
+// Header lines ahead, up to the empty one ending the head
+static unsigned http_parser_count_lines(unsigned char *buf, size_t len)
+{
+  unsigned n = 0;
+  size_t   off = 0;
+
+  while (off < len) {
+    size_t line_len = scan_byte(buf + off, len - off, '\n');
+
+    if (line_len == len - off || line_len <= 1)
+      break;
+
+    n++;
+    off += line_len + 1;
+  }
+
+  return n;
+}
+
+// Head lines are parsed where they lie in the buffers given to
+// http_parser_feed(), the headers being views into them: the buffers have to
+// stay put, and be left alone, as long as the headers are used.  A head line
+// which is not whole in what is fed is left unconsumed, to be fed again along
+// with what follows it.  The body is handled as usual.
+void http_parser_set_in_place(thttp_parser *parser)
 {
-  unsigned char *body = NULL;
-  size_t         body_len = 0;
-  char          *p = NULL;
+  parser->in_place = 1;
+}
 
-  (void) buf_size;
+// Feed the parser with the next bytes of the reply.  Return how many of them
+// were consumed, which is less than len when the reply is complete and
+// followed by extra bytes, or when a callback paused the parsing.
+ssize_t http_parser_feed(thttp_parser *parser, unsigned char *buf, size_t len)
+{
+  size_t off = 0;
+  int    rc = 0;
 
   if (! buf) {
-    logger("must provide a non-NULL body");
+    logger("must provide a non-NULL buffer");
     goto err;
   }
 
-  if (NULL == (p = strstr((char *) buf, CRLF CRLF))) {
-    logger("unable to locate the CRLF CRLF header/body delimiter");
+  if (parser->state == HTTP_PARSER_STATE_ERROR)
     goto err;
-  }
 
-  p += CRLF_LEN * 2;
+  while (parser->state != HTTP_PARSER_STATE_DONE) {
+    size_t n = 0;
 
-  size_t difference = (size_t) PTRDIFF(p, buf);
-  body_len = buf_size - difference;
-  if (NULL == (body = malloc(body_len))) {
-    logger("malloc: %m");
-    goto err;
-  }
+    // Bodiless replies are complete without any further byte
+    if (parser->state == HTTP_PARSER_STATE_BODY && ! parser->remaining) {
+      if ((rc = http_parser_message_complete(parser)))
+        break;
+      continue;
+    }
 
-  memcpy(body, p, body_len);
-  body[body_len - 1] = 0;
+    if (off == len)
+      break;
 
-  if (bodyp)
-    *bodyp = body;
-  else
-    free(body);
+    switch (parser->state) {
+    case HTTP_PARSER_STATE_BODY:
+    case HTTP_PARSER_STATE_CHUNK_DATA:
+      n = len - off < parser->remaining ? len - off : (size_t) parser->remaining;
+      rc = http_parser_on_body(parser, buf + off, n);
+      off += n;
+      parser->remaining -= n;
+      if (! parser->remaining && parser->state == HTTP_PARSER_STATE_CHUNK_DATA)
+        parser->state = HTTP_PARSER_STATE_CHUNK_END;
+      break;
 
-  if (body_lenp)
-    *body_lenp = body_len;
+    case HTTP_PARSER_STATE_BODY_UNTIL_EOF:
+      n = len - off;
+      rc = http_parser_on_body(parser, buf + off, n);
+      off += n;
+      break;
+
+    default: {
+      size_t         to_lf = scan_byte(buf + off, len - off, '\n');
+      unsigned char *lf = to_lf < len - off ? buf + off + to_lf : NULL;
+      int            head = parser->state == HTTP_PARSER_STATE_STATUS_LINE ||
+        parser->state == HTTP_PARSER_STATE_HEADER_LINE;
+
+      if (parser->in_place && head && ! parser->line_len) {
+        // Left for the next feed, which has to come with the rest
+        if (! lf) {
+          rc = HTTP_PARSER_PAUSE;
+          break;
+        }
+
+        if (parser->state == HTTP_PARSER_STATE_HEADER_LINE && ! parser->headers && ! parser->interim)
+          parser->n_lines_hint = http_parser_count_lines(buf + off, len - off);
+
+        rc = http_parser_line(parser, (char *) buf + off, to_lf + 1);
+        off += to_lf + 1;
+        break;
+      }
+
+      n = lf ? to_lf + 1 : len - off;
+      if (http_parser_append_line(parser, buf + off, n) < 0) {
+        rc = -1;
+        break;
+      }
+
+      off += n;
+      if (lf) {
+        rc = http_parser_line(parser, parser->line, parser->line_len);
+        parser->line_len = 0;
+      }
+      break;
+    }
+    }
+
+    if (rc)
+      break;
+  }
+
+  if (rc < 0)
+    goto err;
+
+  return (ssize_t) off;
 
-  return 0;
  err:
-  free(body);
+  parser->state = HTTP_PARSER_STATE_ERROR;
   return -1;
 }
 
-int http_parse_reply(unsigned char *buf, size_t buf_len, thttp_reply **replyp)
+// Within a Content-Length framed body, tell how many bytes are left: the
+// caller may move them on its own, e.g. straight from the socket to a file,
+// then account for them with http_parser_skip_body().
+int http_parser_body_left(thttp_parser *parser, unsigned long long *leftp)
 {
-  unsigned char  *body = NULL;
-  size_t          body_len = 0;
-  thttp_headers  *headers = NULL;
-  thttp_reply *reply = NULL;
-  int             code = -1;
+  if (parser->state != HTTP_PARSER_STATE_BODY || ! parser->remaining)
+    return 0;
 
-  if (! buf) {
-    logger("Got an empty reply to parse");
-    goto err;
+  *leftp = parser->remaining;
+  return 1;
+}
+
+int http_parser_skip_body(thttp_parser *parser, size_t len)
+{
+  if (parser->state != HTTP_PARSER_STATE_BODY || len > parser->remaining) {
+    logger("skipping %zu bytes beyond the body", len);
+    parser->state = HTTP_PARSER_STATE_ERROR;
+    return -1;
   }
 
-  if (http_parse_code(buf, buf_len, &code) < 0) {
-    logger("failed to extract code from %s", buf);
-    goto err;
+  parser->remaining -= len;
+  if (! parser->remaining)
+    return http_parser_message_complete(parser) < 0 ? -1 : 0;
+
+  return 0;
+}
+
+// The peer closed the connection: that's the end of a close-delimited body,
+// and an error anywhere else but after a complete reply.
+int http_parser_finish(thttp_parser *parser)
+{
+  switch (parser->state) {
+  case HTTP_PARSER_STATE_DONE:
+    return 0;
+
+  case HTTP_PARSER_STATE_BODY_UNTIL_EOF:
+    if (http_parser_message_complete(parser) < 0)
+      break;
+    return 0;
+
+  case HTTP_PARSER_STATE_STATUS_LINE:
+    if (! parser->line_len && ! parser->code) {
+      logger("connection closed without any reply");
+      break;
+    }
+    // Fall through
+
+  default:
+    logger("connection closed before the end of the reply");
+    break;
   }
 
-  if (http_parse_headers(buf, buf_len, &headers) < 0)
-    goto err;
+  parser->state = HTTP_PARSER_STATE_ERROR;
+  return -1;
+}
 
-  if (http_parse_body(buf, buf_len, &body, &body_len) < 0)
+// Hand over the parsed reply.  The body is only there if no on_body callback
+// was given.
+int http_parser_reply(thttp_parser *parser, thttp_reply **replyp)
+{
+  thttp_reply *reply = NULL;
+
+  if (parser->state != HTTP_PARSER_STATE_DONE) {
+    logger("the reply is not complete");
     goto err;
+  }
 
-  if (http_reply_new(code, headers, body, body_len, &reply) < 0)
+  if (http_reply_new_in(parser->arena, parser->code, parser->headers, parser->body, parser->body_len, &reply) < 0)
     goto err;
 
+  parser->headers = NULL;
+  parser->body = NULL;
+  parser->body_len = 0;
+  parser->body_size = 0;
+
   if (replyp)
     *replyp = reply;
   else
     http_reply_free(reply);
 
   return 0;
-
  err:
-  http_reply_free(reply);
   return -1;
 }
 
+// Same as http_parser_reply(), the reply taking buf as well, which the headers
+// are views into when parsed in place.  A body read by the caller, after
+// http_parser_skip_body(), comes as body, possibly lying in buf; when NULL,
+// the parser's own is used.
+int http_parser_reply_view(thttp_parser *parser, unsigned char *buf, unsigned char *body, size_t body_len,
+                           int body_in_buf, thttp_reply **replyp)
+{
+  if (parser->state != HTTP_PARSER_STATE_DONE) {
+    logger("the reply is not complete");
+    return -1;
+  }
+
+  if (! body) {
+    body = parser->body;
+    body_len = parser->body_len;
+    body_in_buf = 0;
+  }
+
+  if (http_reply_new_view(parser->arena, parser->code, parser->headers, buf, body, body_len, body_in_buf,
+                          replyp) < 0)
+    return -1;
+
+  parser->headers = NULL;
+  parser->body = NULL;
+  parser->body_len = 0;
+  parser->body_size = 0;
+
+  return 0;
+}
+
+// Parse a reply we already fully have in buf, up to the EOF.
+int http_parse_reply(unsigned char *buf, size_t buf_len, thttp_reply **replyp)
+{
+  thttp_parser *parser = NULL;
+  int           ret = -1;
+
+  if (! buf) {
+    logger("Got an empty reply to parse");
+    goto err;
+  }
+
+  if (http_parser_new(NULL, NULL, 0, &parser) < 0)
+    goto err;
+
+  if (http_parser_feed(parser, buf, buf_len) < 0 ||
+      http_parser_finish(parser) < 0 ||
+      http_parser_reply(parser, replyp) < 0)
+    goto err;
+
+  ret = 0;
+ err:
+  http_parser_free(parser);
+  return ret;
+}
+
 
 //
 // UNIT TESTS
@@ -12,21 +12,34 @@ struct http_reply {
   thttp_headers *headers;
   unsigned char *body;
   size_t         body_len;
+
+  // The receive buffer, which the headers and maybe the body are views into
+  unsigned char *buf;
+  int            body_in_buf;
+
+  // Where all of the above comes from, NULL for malloc()
+  tarena        *arena;
 };
 
 void http_reply_free(thttp_reply *reply)
 {
+  // Arena replies go with their arena
+  if (reply && reply->arena)
+    return;
+
   if (reply) {
-    free(reply->body);
+    if (! reply->body_in_buf)
+      free(reply->body);
     http_headers_free(reply->headers);
+    free(reply->buf);
   }
 
   free(reply);
 }
 
-static int http_reply_new_internal(thttp_reply **replyp)
+static int http_reply_new_internal(tarena *arena, thttp_reply **replyp)
 {
-  thttp_reply *reply = malloc(sizeof *reply);
+  thttp_reply *reply = arena_alloc(arena, sizeof *reply);
   if (! reply)
     goto err;
 
@@ -34,6 +47,9 @@ static int http_reply_new_internal(thttp_reply **replyp)
   reply->headers = NULL;
   reply->body = NULL;
   reply->body_len = 0;
+  reply->buf = NULL;
+  reply->body_in_buf = 0;
+  reply->arena = arena;
 
   if (replyp)
     *replyp = reply;
@@ -45,11 +61,14 @@ static int http_reply_new_internal(thttp_reply **replyp)
   return -1;
 }
 
-int http_reply_new(int code, thttp_headers *headers, unsigned char *body, size_t body_len, thttp_reply **replyp)
+// The reply in arena, the headers and the body being there too: they are
+// all released with it, and http_reply_free() does nothing
+int http_reply_new_in(tarena *arena, int code, thttp_headers *headers, unsigned char *body, size_t body_len,
+                      thttp_reply **replyp)
 {
   thttp_reply *reply;
 
-  if (http_reply_new_internal(&reply) < 0)
+  if (http_reply_new_internal(arena, &reply) < 0)
     goto err;
 
   reply->code = code;
@@ -67,6 +86,28 @@ int http_reply_new(int code, thttp_headers *headers, unsigned char *body, size_t
   return -1;
 }
 
+int http_reply_new(int code, thttp_headers *headers, unsigned char *body, size_t body_len, thttp_reply **replyp)
+{
+  return http_reply_new_in(NULL, code, headers, body, body_len, replyp);
+}
+
+// The reply as received: it takes buf, which headers point into, and the
+// body, which may point into buf as well.
+int http_reply_new_view(tarena *arena, int code, thttp_headers *headers, unsigned char *buf, unsigned char *body,
+                        size_t body_len, int body_in_buf, thttp_reply **replyp)
+{
+  thttp_reply *reply = NULL;
+
+  if (http_reply_new_in(arena, code, headers, body, body_len, &reply) < 0)
+    return -1;
+
+  reply->buf = buf;
+  reply->body_in_buf = body_in_buf;
+
+  *replyp = reply;
+  return 0;
+}
+
 int http_reply_code(thttp_reply *reply)
 {
   return reply->code;
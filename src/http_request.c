@@ -5,6 +5,7 @@
 
 #include "logger.h"
 #include "http_request.h"
+#include "network.h"
 #include "http_headers.h"
 
 #define DEFAULT_TIMEOUT_SEC 5
@@ -27,6 +28,14 @@ struct http_request {
   unsigned       timeout_sec;
   thttp_method   method;
   thttp_headers *headers;
+  char          *driver;
+  thttp_h2c_mode h2c;
+
+  int                   has_sink;
+  struct http_body_sink sink;
+
+  // Where the request and its reply come from, NULL for malloc()
+  tarena               *arena;
 };
 
 int http_request_use_tls(thttp_request *request)
@@ -49,12 +58,71 @@ char *http_request_path(thttp_request *request)
   return request->path;
 }
 
+thttp_method http_request_method(thttp_request *request)
+{
+  return request->method;
+}
+
 unsigned http_request_timeout(thttp_request *request)
 {
   return request->timeout_sec;
 }
 
-static char *http_method_to_str(thttp_method method)
+// Network driver for cleartext connections, by name (see network.c).  NULL
+// stands for the default one.  TLS and non-blocking ones are refused.
+int http_request_set_driver(thttp_request *request, char *driver)
+{
+  char *tmp = NULL;
+
+  if (driver && ! network_driver_is_plain(driver)) {
+    logger("%s: not a network driver for plain HTTP", driver);
+    return -1;
+  }
+
+  if (driver && ! (tmp = arena_strdup(request->arena, driver))) {
+    logger("strdup: %m");
+    return -1;
+  }
+
+  arena_release(request->arena, request->driver);
+  request->driver = tmp;
+  return 0;
+}
+
+char *http_request_driver(thttp_request *request)
+{
+  return request->driver;
+}
+
+// Only for plain connections, TLS ones negotiate HTTP/2 through ALPN
+void http_request_set_h2c(thttp_request *request, thttp_h2c_mode mode)
+{
+  request->h2c = mode;
+}
+
+thttp_h2c_mode http_request_h2c(thttp_request *request)
+{
+  return request->h2c;
+}
+
+thttp_headers *http_request_headers(thttp_request *request)
+{
+  return request->headers;
+}
+
+void http_request_set_body_sink(thttp_request *request, struct http_body_sink *sink)
+{
+  request->has_sink = sink != NULL;
+  if (sink)
+    request->sink = *sink;
+}
+
+struct http_body_sink *http_request_body_sink(thttp_request *request)
+{
+  return request->has_sink ? &request->sink : NULL;
+}
+
+char *http_method_to_str(thttp_method method)
 {
   if (method < 0 || method >= HTTP_METHOD_UNKNOWN) {
     return http_method_mapping[HTTP_METHOD_UNKNOWN].str;
@@ -63,20 +131,31 @@ static char *http_method_to_str(thttp_method method)
   return http_method_mapping[method].str;
 }
 
+tarena *http_request_arena(thttp_request *request)
+{
+  return request->arena;
+}
+
+// An arena request only holds headers from elsewhere: it goes with its
+// arena otherwise
 void http_request_free(thttp_request *request)
 {
   if (request) {
+    http_headers_free(request->headers);
+    if (request->arena)
+      return;
+
     free(request->host);
     free(request->path);
-    http_headers_free(request->headers);
+    free(request->driver);
   }
 
   free(request);
 }
 
-static int http_request_new_internal(thttp_request **requestp)
+static int http_request_new_internal(tarena *arena, thttp_request **requestp)
 {
-  thttp_request *request = malloc(sizeof *request);
+  thttp_request *request = arena_alloc(arena, sizeof *request);
   if (! request)
     goto err;
 
@@ -85,6 +164,10 @@ static int http_request_new_internal(thttp_request **requestp)
   request->path = NULL;
   request->method = HTTP_METHOD_UNKNOWN;
   request->headers = NULL;
+  request->driver = NULL;
+  request->h2c = HTTP_H2C_OFF;
+  request->has_sink = 0;
+  request->arena = arena;
 
   if (requestp)
     *requestp = request;
@@ -96,17 +179,23 @@ static int http_request_new_internal(thttp_request **requestp)
   return -1;
 }
 
-int http_request_new(char *host, uint16_t port, char *path, thttp_method method, thttp_headers *headers, int use_tls, thttp_request **requestp)
+// The request in arena, along with its reply and what it is made of once
+// received: all of them are released with the arena.  The headers are
+// taken over, better made in the arena too.
+int http_request_new_in(tarena *arena, char *host, uint16_t port, char *path, thttp_method method,
+                        thttp_headers *headers, int use_tls, thttp_request **requestp)
 {
   thttp_request *request;
 
-  if (http_request_new_internal(&request) < 0)
+  if (http_request_new_internal(arena, &request) < 0)
     goto err;
 
-  request->host = strdup(host);
-  request->path = strdup(path);
-  if (! request->host || ! request->path)
+  request->host = arena_strdup(arena, host);
+  request->path = arena_strdup(arena, path);
+  if (! request->host || ! request->path) {
+    http_request_free(request);
     goto err;
+  }
 
   request->use_tls = use_tls;
   request->port = port;
@@ -124,23 +213,111 @@ int http_request_new(char *host, uint16_t port, char *path, thttp_method method,
   return -1;
 }
 
-// We might want to send raw data, not a string
+int http_request_new(char *host, uint16_t port, char *path, thttp_method method, thttp_headers *headers, int use_tls, thttp_request **requestp)
+{
+  return http_request_new_in(NULL, host, port, path, method, headers, use_tls, requestp);
+}
+
+// The same request for another path, with its own copy of the headers, in
+// the same arena
+int http_request_dup(thttp_request *request, char *path, thttp_request **copyp)
+{
+  thttp_headers *headers = NULL;
+  thttp_request *copy = NULL;
+
+  if (request->headers && http_headers_dup_in(request->arena, request->headers, &headers) < 0)
+    return -1;
+
+  if (http_request_new_in(request->arena, request->host, request->port, path, request->method, headers,
+                          request->use_tls, &copy) < 0) {
+    http_headers_free(headers);
+    return -1;
+  }
+
+  copy->timeout_sec = request->timeout_sec;
+  copy->h2c = request->h2c;
+  copy->has_sink = request->has_sink;
+  copy->sink = request->sink;
+
+  if (http_request_set_driver(copy, request->driver) < 0) {
+    http_request_free(copy);
+    return -1;
+  }
+
+  *copyp = copy;
+  return 0;
+}
+
+#define IOV_STR(s) ((struct iovec) { .iov_base = (s), .iov_len = strlen(s) })
+
+static int http_request_iovec_header(struct http_headers_elem *elem, void *user_data)
+{
+  struct iovec **iovp = user_data;
+
+  *(*iovp)++ = IOV_STR(elem->key);
+  *(*iovp)++ = IOV_STR(": ");
+  *(*iovp)++ = IOV_STR(elem->value);
+  *(*iovp)++ = IOV_STR("\r\n");
+
+  return 1;
+}
+
+// The request as pieces pointing to its own strings, ready for writev(): the
+// vector is the only allocation, valid as long as the request is unchanged.
+int http_request_get_iovec(thttp_request *request, struct iovec **iovp, int *iovcntp)
+{
+  struct iovec *iov = NULL;
+  struct iovec *p = NULL;
+  size_t        n = 5 + 4 * (size_t) http_headers_count(request->headers);
+
+  if (! (iov = malloc(n * sizeof *iov))) {
+    logger("malloc: %m");
+    return -1;
+  }
+
+  p = iov;
+  *p++ = IOV_STR(http_method_to_str(request->method));
+  *p++ = IOV_STR(" ");
+  *p++ = IOV_STR(request->path);
+  *p++ = IOV_STR(" HTTP/1.1\r\n");
+  if (request->headers)
+    (void) http_headers_foreach(request->headers, http_request_iovec_header, &p);
+  *p++ = IOV_STR("\r\n");
+
+  *iovp = iov;
+  *iovcntp = (int) n;
+  return 0;
+}
+
+// We might want to send raw data, not a string.  Built from the vector, in a
+// buffer of the exact size.
 int http_request_get_buffer(thttp_request *request, unsigned char **bufp, size_t *buf_lenp)
 {
   unsigned char *buf = NULL;
-  char          *header_buf = NULL;
-  int            n = -1;
-
-  header_buf = http_headers_to_string(request->headers);
-
-  n = asprintf((char **) &buf, "%s %s HTTP/1.1\r\n%s\r\n",
-               http_method_to_str(request->method),
-               request->path,
-               header_buf ? header_buf : "");
-  
-  free(header_buf);
-  if (n < 0)
-    goto err;
+  struct iovec  *iov = NULL;
+  int            iovcnt = 0;
+  size_t         len = 0;
+
+  if (http_request_get_iovec(request, &iov, &iovcnt) < 0)
+    return -1;
+
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  // Nul-terminated, though the nul-byte is not part of the request
+  if (! (buf = malloc(len + 1))) {
+    logger("malloc: %m");
+    free(iov);
+    return -1;
+  }
+
+  len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  buf[len] = '\0';
+  free(iov);
 
   if (bufp)
     *bufp = buf;
@@ -148,10 +325,7 @@ int http_request_get_buffer(thttp_request *request, unsigned char **bufp, size_t
     free(buf);
 
   if (buf_lenp)
-    *buf_lenp = (size_t) n + 1;
+    *buf_lenp = len;
 
   return 0;
- err:
-  free(buf);
-  return -1;
 }
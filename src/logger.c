@@ -16,3 +16,25 @@ void logger__(const char *file, const char *func, const int line, const char *fm
 
     fprintf(stderr, "[%s:%s:%d] %s\n", file, func, line, msg);
 }
+
+static int logger_verbose_enabled = 0;
+
+void logger_set_verbose(int verbose)
+{
+  logger_verbose_enabled = verbose;
+}
+
+void logger_verbose(const char *fmt, ...)
+{
+    va_list arg;
+    char msg[MAX_LOG_LEN];
+
+    if (! logger_verbose_enabled)
+      return;
+
+    va_start(arg, fmt);
+    (void) vsnprintf(msg, sizeof msg, fmt, arg);
+    va_end(arg);
+
+    fprintf(stderr, "* %s\n", msg);
+}
@@ -1,18 +1,146 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "cli.h"
 #include "logger.h"
 #include "http.h"
+#include "tls_context.h"
+#include "resolver.h"
+#include "network_connect.h"
+
+struct output {
+  struct cli_options *options;
+  FILE               *file;
+};
+
+static void display_head(struct cli_options *o, int code, thttp_headers *headers)
+{
+  char *header_buf = NULL;
+
+  if (o->display.code)
+    printf("%d\n", code);
+
+  if (o->display.headers) {
+    if ((header_buf = http_headers_to_string(headers)))
+      printf("%s\n", header_buf);
+    free(header_buf);
+  }
+}
+
+static int head_func(int code, thttp_headers *headers, void *user_data)
+{
+  struct output *output = user_data;
+
+  display_head(output->options, code, headers);
+  return 0;
+}
+
+// The body is written as it comes, so that huge downloads only need the
+// receive buffer.  We assume it's made of printable characters when going to
+// the terminal, which is generally not the case, but for the sake of
+// simplicity.
+static int body_func(unsigned char *data, size_t len, void *user_data)
+{
+  struct output *output = user_data;
+
+  if (fwrite(data, 1, len, output->file) != len) {
+    logger("fwrite: %m");
+    return -1;
+  }
+
+  return 0;
+}
+
+// With --output, the body may go to the file straight from the socket, the
+// blocks being reserved beforehand so that the file system can lay them out
+// in one go.
+static int body_fd_func(unsigned long long len, void *user_data)
+{
+  struct output *output = user_data;
+  int            fd = -1;
+  off_t          off = -1;
+
+  if (! output->options->output)
+    return -1;
+
+  if (fflush(output->file)) {
+    logger("fflush: %m");
+    return -1;
+  }
+
+  // Pipelined replies follow each other in the file
+  fd = fileno(output->file);
+  if ((off = lseek(fd, 0, SEEK_CUR)) < 0) {
+    logger("lseek: %m");
+    return -1;
+  }
+
+  if (len <= (unsigned long long) (INT64_MAX - off) &&
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, off, (off_t) len) < 0 && errno != EOPNOTSUPP)
+    logger_verbose("fallocate %s: %s", output->options->output, strerror(errno));
+
+  return fd;
+}
+
+// The target's path and the --path ones, all pipelined on one connection
+static int send_requests(struct cli_options *o, thttp_request *request, thttp_reply ***repliesp, size_t *n_repliesp)
+{
+  thttp_request **requests = NULL;
+  thttp_reply   **replies = NULL;
+  size_t          n_requests = o->n_paths + 1;
+  size_t          n_dups = 0;
+  int             ret = -1;
+
+  if (! (requests = calloc(n_requests, sizeof *requests)) ||
+      ! (replies = calloc(n_requests, sizeof *replies))) {
+    logger("calloc: %m");
+    goto end;
+  }
+
+  requests[0] = request;
+  for (n_dups = 0; n_dups < o->n_paths; n_dups++) {
+    if (http_request_dup(request, o->paths[n_dups], &requests[n_dups + 1]) < 0)
+      goto end;
+  }
+
+  if (n_requests == 1 ? http_send_request(request, &replies[0]) < 0 :
+      http_send_requests_pipelined(NULL, requests, n_requests, replies) < 0)
+    goto end;
+
+  *repliesp = replies;
+  *n_repliesp = n_requests;
+  replies = NULL;
+  ret = 0;
+ end:
+  for (size_t i = 0; replies && i < n_requests; i++)
+    http_reply_free(replies[i]);
+  free(replies);
+  for (size_t i = 0; i < n_dups; i++)
+    http_request_free(requests[i + 1]);
+  free(requests);
+
+  return ret;
+}
 
 int main(int argc, char **argv)
 {
-  char              *header_buf = NULL;
-  thttp_request     *request = NULL;
-  thttp_reply       *reply = NULL;
-  int                rc = EXIT_FAILURE;
-  struct cli_options o;
+  thttp_request        *request = NULL;
+  thttp_reply         **replies = NULL;
+  size_t                n_replies = 0;
+  int                   rc = EXIT_FAILURE;
+  struct cli_options    o;
+  struct output         output = { .options = &o, .file = NULL };
+  struct resolver_stats dns_stats;
+  struct http_body_sink sink = {
+    .head_func = head_func,
+    .body_func = body_func,
+    .user_data = &output,
+    .body_fd_func = body_fd_func,
+  };
 
   if (cli_options_init(&o) < 0)
     goto err;
@@ -20,36 +148,66 @@ int main(int argc, char **argv)
   if (cli_process_args(argc, argv, &o, &request) < 0)
     goto err;
 
-  if (http_send_request(request, &reply) < 0) {
-    logger("Failed to send HTTP request to %s:%"PRIu16"\n", o.host, o.port);
+  logger_set_verbose(o.verbose);
+
+  if ((o.tls.ca_file || o.tls.ca_path || o.tls.ciphers || o.tls.groups || o.tls.session_cache ||
+       o.tls.early_data || o.tls.ktls || o.tls.http2) &&
+      tls_context_configure(&o.tls) < 0)
     goto err;
-  }
 
-  if (o.display.code)
-    printf("%d\n", http_reply_code(reply));
+  if ((o.resolver.stub || o.resolver.nameserver || o.resolver.overrides_file) &&
+      resolver_configure(&o.resolver) < 0)
+    goto err;
 
-  if (o.display.headers) {
-    if ((header_buf = http_headers_to_string(http_reply_header(reply))))
-      printf("%s\n", header_buf);
-    free(header_buf);
+  network_connect_set_fastopen(o.tcp_fastopen);
+
+  for (size_t i = 0; i < o.n_resolve; i++) {
+    if (resolver_add_override(o.resolve[i]) < 0)
+      goto err;
   }
 
-  if (o.display.body) {
-    unsigned char *body = NULL;
+  if (o.output) {
+    if (! (output.file = fopen(o.output, "w"))) {
+      logger("fopen %s: %m", o.output);
+      goto err;
+    }
+  } else if (o.display.body) {
+    output.file = stdout;
+  }
+
+  if (output.file)
+    http_request_set_body_sink(request, &sink);
 
-    (void) http_reply_body(reply, &body);
-    if (body)
-      // Let's assume it's made of printable characters, which is generally
-      // not the case, but for the sake of simplicity.  Otherwise just use
-      // a kind of hexdump function, but it's not really human-enjoyable.
-      printf("%s\n", (char *) body);
+  if (send_requests(&o, request, &replies, &n_replies) < 0) {
+    logger("Failed to send HTTP request to %s:%"PRIu16"\n", o.host, o.port);
+    goto err;
+  }
+
+  if (output.file == stdout) {
+    printf("\n");
+  } else if (! output.file) {
+    for (size_t i = 0; i < n_replies; i++)
+      display_head(&o, http_reply_code(replies[i]), http_reply_header(replies[i]));
   }
 
   rc = EXIT_SUCCESS;
 
  err:
+  if (output.file && output.file != stdout && fclose(output.file)) {
+    logger("fclose %s: %m", o.output);
+    rc = EXIT_FAILURE;
+  }
+
+  resolver_get_stats(&dns_stats);
+  logger_verbose("DNS cache: %lu hits, %lu negative hits, %lu misses",
+                 dns_stats.hits, dns_stats.negative_hits, dns_stats.misses);
+
   cli_options_deinit(&o);
-  http_reply_free(reply);
+  for (size_t i = 0; i < n_replies; i++)
+    http_reply_free(replies[i]);
+  free(replies);
   http_request_free(request);
+  tls_context_cleanup();
+  resolver_cleanup();
   return rc;
 }
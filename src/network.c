@@ -1,25 +1,51 @@
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "util.h"
 #include "logger.h"
 #include "network.h"
 #include "network_plain.h"
 #include "network_tls.h"
+#include "network_nonblock.h"
+#include "network_uring.h"
 
 static struct driver_mapping {
   tnetwork_driver_type type;
   char *name;
   tnetwork_driver_ctx *(*cb_create)(void);
+  // Fit for the blocking exchanges of cleartext HTTP
+  int plain;
 } driver_mapping[] = {
   {
     NETWORK_DRIVER_TYPE_PLAIN,
     "plain",
-    network_driver_plain_create
+    network_driver_plain_create,
+    1
   },
   {
     NETWORK_DRIVER_TYPE_TLS,
     "tls",
-    network_driver_tls_create
+    network_driver_tls_create,
+    0
+  },
+  {
+    NETWORK_DRIVER_TYPE_NONBLOCK,
+    "nonblock",
+    network_driver_nonblock_create,
+    0
+  },
+  {
+    NETWORK_DRIVER_TYPE_TLS_NONBLOCK,
+    "tls-nonblock",
+    network_driver_tls_nonblock_create,
+    0
+  },
+  {
+    NETWORK_DRIVER_TYPE_URING,
+    "uring",
+    network_driver_uring_create,
+    1
   }
 };
 
@@ -29,6 +55,9 @@ char *network_driver_type_to_str(tnetwork_driver_type type)
 #define MAP(x) case NETWORK_DRIVER_TYPE_##x : return #x
     MAP(PLAIN);
     MAP(TLS);
+    MAP(NONBLOCK);
+    MAP(TLS_NONBLOCK);
+    MAP(URING);
 #undef MAP
   }
 
@@ -50,9 +79,145 @@ int network_driver_send(tnetwork_driver_ctx *ctx, void *buf, size_t buf_size)
   return ctx->send_func(ctx, buf, buf_size);
 }
 
-int network_driver_recv(tnetwork_driver_ctx *ctx, unsigned char **bufp, size_t *buf_sizep)
+// Same as network_driver_send(), for a request the server may safely get
+// twice: it may then go before the end of the handshake, saving a round trip.
+int network_driver_send_early(tnetwork_driver_ctx *ctx, void *buf, size_t buf_size)
+{
+  if (! ctx->send_early_func)
+    return ctx->send_func(ctx, buf, buf_size);
+
+  return ctx->send_early_func(ctx, buf, buf_size);
+}
+
+// Drivers without their own gathering write get the pieces in one buffer of
+// the exact size, e.g. a single SSL_write() over TLS.
+static int network_driver_flatten(struct iovec *iov, int iovcnt, unsigned char **bufp, size_t *lenp)
+{
+  unsigned char *buf = NULL;
+  size_t         len = 0;
+
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  if (! (buf = malloc(len ? len : 1))) {
+    logger("malloc: %m");
+    return -1;
+  }
+
+  len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+
+  *bufp = buf;
+  *lenp = len;
+  return 0;
+}
+
+// All the pieces, in order, as with network_driver_send().  The vector is
+// left as is, for another attempt.
+int network_driver_sendv(tnetwork_driver_ctx *ctx, struct iovec *iov, int iovcnt)
+{
+  unsigned char *buf = NULL;
+  size_t         len = 0;
+  int            rc = -1;
+
+  if (ctx->sendv_func)
+    return ctx->sendv_func(ctx, iov, iovcnt);
+
+  if (network_driver_flatten(iov, iovcnt, &buf, &len) < 0)
+    return -1;
+
+  rc = ctx->send_func(ctx, buf, len);
+  free(buf);
+  return rc;
+}
+
+// The gathering counterpart of network_driver_send_early()
+int network_driver_sendv_early(tnetwork_driver_ctx *ctx, struct iovec *iov, int iovcnt)
+{
+  unsigned char *buf = NULL;
+  size_t         len = 0;
+  int            rc = -1;
+
+  if (! ctx->send_early_func)
+    return network_driver_sendv(ctx, iov, iovcnt);
+
+  if (network_driver_flatten(iov, iovcnt, &buf, &len) < 0)
+    return -1;
+
+  rc = ctx->send_early_func(ctx, buf, len);
+  free(buf);
+  return rc;
+}
+
+ssize_t network_driver_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t buf_size)
 {
-  return ctx->recv_func(ctx, bufp, buf_sizep);
+  return ctx->read_func(ctx, buf, buf_size);
+}
+
+// Tell whether an idle connection can still carry a new request.
+int network_driver_is_alive(tnetwork_driver_ctx *ctx)
+{
+  if (! ctx->is_alive_func)
+    return 0;
+
+  return ctx->is_alive_func(ctx);
+}
+
+int network_driver_get_fd(tnetwork_driver_ctx *ctx)
+{
+  if (! ctx->get_fd_func)
+    return -1;
+
+  return ctx->get_fd_func(ctx);
+}
+
+// Drive a pending connection (TCP connect, handshake...) of a non-blocking
+// driver: 0 once established, NETWORK_WANT_READ or NETWORK_WANT_WRITE when
+// waiting for the socket, -1 on error.  Blocking drivers are always done.
+int network_driver_progress(tnetwork_driver_ctx *ctx)
+{
+  if (! ctx->progress_func)
+    return 0;
+
+  return ctx->progress_func(ctx);
+}
+
+// Write as much as possible without blocking, -1 with errno set to EAGAIN
+// when nothing can be written right now.
+ssize_t network_driver_write(tnetwork_driver_ctx *ctx, void *buf, size_t buf_size)
+{
+  if (! ctx->write_func) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  return ctx->write_func(ctx, buf, buf_size);
+}
+
+// Move up to buf_size received bytes to fd without copying them to user
+// space: how many were moved, 0 on EOF, -1 with errno set to ENOTSUP when the
+// driver cannot, e.g. because it decrypts the data itself.
+ssize_t network_driver_splice(tnetwork_driver_ctx *ctx, int fd, size_t buf_size)
+{
+  if (! ctx->splice_func) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  return ctx->splice_func(ctx, fd, buf_size);
+}
+
+// The protocol the server selected through ALPN, NULL if none was, e.g. on
+// plain connections.
+char *network_driver_get_alpn(tnetwork_driver_ctx *ctx)
+{
+  if (! ctx->get_alpn_func)
+    return NULL;
+
+  return ctx->get_alpn_func(ctx);
 }
 
 void network_driver_free(tnetwork_driver_ctx *ctx)
@@ -96,7 +261,7 @@ static tnetwork_driver_ctx *network_driver_create_internal(void *data,
   tnetwork_driver_ctx *ctx = NULL;
 
   for (size_t i = 0; i < N_ELEMS(driver_mapping); i++) {
-    if (cb(data, &driver_mapping[i])) {
+    if (cb(&driver_mapping[i], data)) {
       ctx = driver_mapping[i].cb_create();
       if (! ctx) {
         logger("failed to create a network driver "
@@ -116,6 +281,17 @@ static tnetwork_driver_ctx *network_driver_create_internal(void *data,
   return ctx;
 }
 
+// Whether name is that of a driver which plain HTTP requests can go through
+int network_driver_is_plain(char *name)
+{
+  for (size_t i = 0; i < N_ELEMS(driver_mapping); i++) {
+    if (0 == strcmp(name, driver_mapping[i].name))
+      return driver_mapping[i].plain;
+  }
+
+  return 0;
+}
+
 tnetwork_driver_ctx *network_driver_create_by_name(char *name)
 {
   return network_driver_create_internal(name, cmp_name_cb, name_str_cb);
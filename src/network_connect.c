@@ -0,0 +1,488 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <netdb.h>
+
+#include "util.h"
+#include "logger.h"
+#include "network.h"
+#include "network_connect.h"
+#include "resolver.h"
+#include "event_loop.h"
+
+// Happy Eyeballs (RFC 8305): the addresses of the host, address families
+// interleaved, are tried in turn, the next attempt starting as soon as the
+// previous one fails or after NETWORK_CONNECT_ATTEMPT_DELAY_MS without
+// giving up on it.  The first connection to succeed wins and the others are
+// closed, so that a dead IPv6 path costs a quarter of a second instead of a
+// whole timeout.
+//
+// The resolution, the attempts in flight and the timer of the next one are
+// all watched through a single epoll fd, readable whenever something
+// happened: the connector fits in an event loop like any other fd.
+
+// TCP Fast Open (RFC 7413): once the server gave us a cookie, connect()
+// returns at once and the SYN leaves along with the first write, i.e. the
+// request or the TLS ClientHello, saving a round trip.  The first connection
+// to a server gets the cookie, the kernel keeps it.  As such a connection
+// succeeds at once, it also wins the race: the address it goes to is one that
+// answered before, at least.
+static int network_connect_fastopen = 0;
+
+#define CONNECTOR_TIMER    UINT64_MAX
+#define CONNECTOR_RESOLVER (UINT64_MAX - 1)
+
+struct network_connector {
+  int               epfd;
+  int               tfd;       // Starts the next attempt
+
+  tresolver_query  *query;     // While resolving
+  struct addrinfo  *res;       // Owned, when resolved by the connector
+  struct addrinfo **addrs;     // Interleaved
+  int              *fds;       // Attempt for each address, -1 when none
+  size_t            n_addrs;
+  size_t            next;      // Next address to try
+  size_t            n_pending; // Attempts in flight
+
+  int               fd;        // The winner
+};
+
+// For the next connections
+void network_connect_set_fastopen(int enable)
+{
+  network_connect_fastopen = enable;
+}
+
+int network_set_nonblock(int fd, int nonblock)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return -1;
+
+  return fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+int network_set_timeouts(int fd, unsigned timeout_sec)
+{
+  struct timeval tv = {
+    .tv_sec = timeout_sec,
+    .tv_usec = 0
+  };
+
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) < 0) {
+    logger("setsockopt: %m");
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) < 0) {
+    logger("setsockopt: %m");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Wait for the fd until the deadline, an event_loop_now_ms() date
+int network_wait_fd(int fd, int do_write, long long deadline_ms)
+{
+  struct pollfd pfd = { .fd = fd, .events = do_write ? POLLOUT : POLLIN };
+  long long     remaining_ms = 0;
+  int           rc = -1;
+
+  do {
+    if ((remaining_ms = deadline_ms - event_loop_now_ms()) <= 0)
+      return -1;
+  } while ((rc = poll(&pfd, 1, (int) remaining_ms)) < 0 && errno == EINTR);
+
+  if (rc < 0)
+    logger("poll: %m");
+
+  return rc > 0 ? 0 : -1;
+}
+
+// Alternate the address families, starting with the preferred one, i.e. the
+// first returned by the resolver.  The order within a family is kept.
+static int connector_interleave(struct addrinfo **addrs, size_t n_addrs)
+{
+  struct addrinfo **tmp = NULL;
+  size_t            i_same = 0;
+  size_t            i_other = 0;
+
+  if (n_addrs < 2)
+    return 0;
+
+  if (! (tmp = malloc(n_addrs * sizeof *tmp))) {
+    logger("malloc: %m");
+    return -1;
+  }
+
+  memcpy(tmp, addrs, n_addrs * sizeof *tmp);
+
+  for (size_t i = 0; i < n_addrs; i++) {
+    int same = i % 2 == 0;
+
+    // Skip to the next address of the family whose turn it is, if any left
+    while (i_same < n_addrs && tmp[i_same]->ai_family != tmp[0]->ai_family)
+      i_same++;
+    while (i_other < n_addrs && tmp[i_other]->ai_family == tmp[0]->ai_family)
+      i_other++;
+
+    if (i_same == n_addrs)
+      same = 0;
+    else if (i_other == n_addrs)
+      same = 1;
+
+    addrs[i] = same ? tmp[i_same++] : tmp[i_other++];
+  }
+
+  free(tmp);
+  return 0;
+}
+
+static void connector_close(tnetwork_connector *connector, size_t i)
+{
+  if (connector->fds[i] < 0)
+    return;
+
+  (void) epoll_ctl(connector->epfd, EPOLL_CTL_DEL, connector->fds[i], NULL);
+  (void) close(connector->fds[i]);
+  connector->fds[i] = -1;
+  connector->n_pending--;
+}
+
+static int connector_arm(tnetwork_connector *connector, long delay_ms)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = delay_ms / 1000;
+  its.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+
+  if (timerfd_settime(connector->tfd, 0, &its, NULL) < 0) {
+    logger("timerfd_settime: %m");
+    return -1;
+  }
+
+  return 0;
+}
+
+// The i-th attempt won: close all the others
+static void connector_win(tnetwork_connector *connector, size_t i)
+{
+  (void) epoll_ctl(connector->epfd, EPOLL_CTL_DEL, connector->fds[i], NULL);
+  connector->fd = connector->fds[i];
+  connector->fds[i] = -1;
+  connector->n_pending--;
+
+  for (size_t j = 0; j < connector->n_addrs; j++)
+    connector_close(connector, j);
+
+  connector->next = connector->n_addrs;
+  (void) connector_arm(connector, 0);
+}
+
+// Start an attempt on the next address which does not fail right away: 0
+// once started, 1 when it connected at once, -1 when there is none left.
+static int connector_start_next(tnetwork_connector *connector)
+{
+  while (connector->next < connector->n_addrs) {
+    size_t              i = connector->next++;
+    struct addrinfo    *rp = connector->addrs[i];
+    struct epoll_event  ev = { .events = EPOLLOUT, .data.u64 = i };
+    int                 fd = -1;
+
+    if ((fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     rp->ai_protocol)) < 0)
+      continue;
+
+    connector->fds[i] = fd;
+    connector->n_pending++;
+
+    // Not supported before Linux 4.11, the connection then goes on without
+    if (network_connect_fastopen &&
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &(int) { 1 }, sizeof (int)) < 0)
+      logger_verbose("TCP Fast Open unavailable: %s", strerror(errno));
+
+    if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+      connector_win(connector, i);
+      return 1;
+    }
+
+    if (errno != EINPROGRESS) {
+      logger("connect: %m");
+      connector_close(connector, i);
+      continue;
+    }
+
+    if (epoll_ctl(connector->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      logger("epoll_ctl: %m");
+      connector_close(connector, i);
+      continue;
+    }
+
+    if (connector->next < connector->n_addrs &&
+        connector_arm(connector, NETWORK_CONNECT_ATTEMPT_DELAY_MS) < 0)
+      return -1;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+static int connector_start(tnetwork_connector *connector, struct addrinfo *res)
+{
+  struct addrinfo *rp = NULL;
+  size_t           n_addrs = 0;
+
+  for (rp = res; rp; rp = rp->ai_next)
+    n_addrs++;
+
+  if (! (connector->addrs = calloc(n_addrs, sizeof *connector->addrs)) ||
+      ! (connector->fds = malloc(n_addrs * sizeof *connector->fds))) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  for (rp = res; rp; rp = rp->ai_next) {
+    connector->addrs[connector->n_addrs] = rp;
+    connector->fds[connector->n_addrs] = -1;
+    connector->n_addrs++;
+  }
+
+  if (connector_interleave(connector->addrs, connector->n_addrs) < 0)
+    return -1;
+
+  return connector_start_next(connector) < 0 ? -1 : 0;
+}
+
+void network_connector_free(tnetwork_connector *connector)
+{
+  if (! connector)
+    return;
+
+  if (connector->fds) {
+    for (size_t i = 0; i < connector->n_addrs; i++)
+      connector_close(connector, i);
+  }
+
+  if (connector->fd >= 0)
+    (void) close(connector->fd);
+  if (connector->tfd >= 0)
+    (void) close(connector->tfd);
+  if (connector->epfd >= 0)
+    (void) close(connector->epfd);
+  resolver_query_free(connector->query);
+  free(connector->res);
+
+  free(connector->addrs);
+  free(connector->fds);
+  free(connector);
+}
+
+static int connector_new(tnetwork_connector **connectorp)
+{
+  tnetwork_connector *connector = NULL;
+  struct epoll_event  ev = { .events = EPOLLIN, .data.u64 = CONNECTOR_TIMER };
+
+  if (! (connector = calloc(1, sizeof *connector))) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  connector->fd = -1;
+  connector->tfd = -1;
+
+  if ((connector->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    logger("epoll_create1: %m");
+    goto err;
+  }
+
+  if ((connector->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    logger("timerfd_create: %m");
+    goto err;
+  }
+
+  if (epoll_ctl(connector->epfd, EPOLL_CTL_ADD, connector->tfd, &ev) < 0) {
+    logger("epoll_ctl: %m");
+    goto err;
+  }
+
+  *connectorp = connector;
+  return 0;
+
+ err:
+  network_connector_free(connector);
+  return -1;
+}
+
+// Once resolved, start the first attempt: 0 on success (resolution and
+// attempt started), -1 on failure.
+static int connector_resolve(tnetwork_connector *connector)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.u64 = CONNECTOR_RESOLVER };
+  int                fd = resolver_query_get_fd(connector->query);
+  int                rc = -1;
+
+  if ((rc = resolver_query_progress(connector->query)) > 0) {
+    if (epoll_ctl(connector->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST) {
+      logger("epoll_ctl: %m");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (fd >= 0)
+    (void) epoll_ctl(connector->epfd, EPOLL_CTL_DEL, fd, NULL);
+
+  if (! rc)
+    connector->res = resolver_query_take_result(connector->query);
+
+  resolver_query_free(connector->query);
+  connector->query = NULL;
+
+  if (! connector->res)
+    return -1;
+
+  return connector_start(connector, connector->res);
+}
+
+// Resolve the host and start the first attempt, as soon as resolved
+int network_connector_new(char *host, char *port, tnetwork_connector **connectorp)
+{
+  tnetwork_connector *connector = NULL;
+
+  if (connector_new(&connector) < 0)
+    return -1;
+
+  if (resolver_query_new(host, port, &connector->query) < 0 ||
+      connector_resolve(connector) < 0)
+    goto err;
+
+  *connectorp = connector;
+  return 0;
+
+ err:
+  network_connector_free(connector);
+  return -1;
+}
+
+// The fd to watch for reading while connecting
+int network_connector_get_fd(tnetwork_connector *connector)
+{
+  return connector->epfd;
+}
+
+// Deal with whatever happened: 0 once connected, NETWORK_WANT_READ while
+// waiting on the connector's fd, -1 once all the attempts failed.
+int network_connector_progress(tnetwork_connector *connector)
+{
+  struct epoll_event evs[8];
+  int                n = -1;
+
+  while (connector->fd < 0) {
+    if ((n = epoll_wait(connector->epfd, evs, N_ELEMS(evs), 0)) < 0) {
+      if (errno == EINTR)
+        continue;
+      logger("epoll_wait: %m");
+      return -1;
+    }
+
+    for (int j = 0; j < n && connector->fd < 0; j++) {
+      uint64_t  expirations = 0;
+      size_t    i = (size_t) evs[j].data.u64;
+      int       err = 0;
+      socklen_t len = sizeof err;
+
+      if (evs[j].data.u64 == CONNECTOR_RESOLVER) {
+        if (connector_resolve(connector) < 0)
+          return -1;
+        continue;
+      }
+
+      // Time for the next attempt, the pending ones go on
+      if (evs[j].data.u64 == CONNECTOR_TIMER) {
+        if (read(connector->tfd, &expirations, sizeof expirations) > 0)
+          (void) connector_start_next(connector);
+        continue;
+      }
+
+      if (getsockopt(connector->fds[i], SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+
+      if (! err) {
+        connector_win(connector, i);
+        break;
+      }
+
+      errno = err;
+      logger("connect: %m");
+      connector_close(connector, i);
+
+      // No need to wait for the timer
+      (void) connector_start_next(connector);
+    }
+
+    if (connector->fd < 0 && ! connector->query &&
+        ! connector->n_pending && connector->next == connector->n_addrs)
+      return -1;
+
+    if (! n)
+      return NETWORK_WANT_READ;
+  }
+
+  return 0;
+}
+
+// Hand the connected socket over, in non-blocking mode
+int network_connector_take_fd(tnetwork_connector *connector)
+{
+  int fd = connector->fd;
+
+  connector->fd = -1;
+  return fd;
+}
+
+// Blocking flavour: a connected non-blocking socket, or -1
+int network_connect(char *host, char *port, long long deadline_ms)
+{
+  tnetwork_connector *connector = NULL;
+  int                 fd = -1;
+  int                 rc = -1;
+
+  if (network_connector_new(host, port, &connector) < 0)
+    return -1;
+
+  while ((rc = network_connector_progress(connector)) > 0) {
+    if (network_wait_fd(network_connector_get_fd(connector), 0, deadline_ms) < 0) {
+      logger("connect to %s:%s: timeout", host, port);
+      break;
+    }
+  }
+
+  if (! rc)
+    fd = network_connector_take_fd(connector);
+
+  network_connector_free(connector);
+  return fd;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/network_connect_utest.c"
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "logger.h"
+#include "network_nonblock.h"
+#include "network.h"
+#include "network_connect.h"
+
+// Plain TCP, for event loops: nothing ever blocks.  connect_func only starts
+// the connection, which then goes on through progress_func each time the
+// connector's fd gets readable, racing the addresses of the host.
+typedef struct {
+  tnetwork_driver_ctx driver; // Mandatory as first element of the struct
+
+  int fd;
+  int connected;
+  unsigned timeout_sec;
+
+  tnetwork_connector *connector;
+} tnetwork_driver_nonblock_ctx;
+
+static int network_driver_nonblock_connect(tnetwork_driver_ctx *ctx, char *host, char *port, unsigned timeout_sec)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+
+  driver_ctx->timeout_sec = timeout_sec;
+
+  return network_connector_new(host, port, &driver_ctx->connector);
+}
+
+static int network_driver_nonblock_progress(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+  int                           rc = -1;
+
+  if (driver_ctx->connected)
+    return 0;
+
+  if (! driver_ctx->connector)
+    return -1;
+
+  if ((rc = network_connector_progress(driver_ctx->connector)))
+    return rc;
+
+  driver_ctx->fd = network_connector_take_fd(driver_ctx->connector);
+  driver_ctx->connected = 1;
+
+  network_connector_free(driver_ctx->connector);
+  driver_ctx->connector = NULL;
+
+  return 0;
+}
+
+static ssize_t network_driver_nonblock_write(tnetwork_driver_ctx *ctx, void *buf, size_t len)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+  ssize_t                       n = -1;
+
+  while ((n = send(driver_ctx->fd, buf, len, MSG_NOSIGNAL)) < 0) {
+    if (errno == EINTR)
+      continue;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      logger("send: %m");
+    break;
+  }
+
+  return n;
+}
+
+static ssize_t network_driver_nonblock_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t len)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+  ssize_t                       n = -1;
+
+  while ((n = recv(driver_ctx->fd, buf, len, 0)) < 0) {
+    if (errno == EINTR)
+      continue;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      logger("recv: %m");
+    break;
+  }
+
+  return n;
+}
+
+static int network_driver_nonblock_get_fd(tnetwork_driver_ctx *ctx);
+
+// Blocking flavour of the above, for callers outside of an event loop
+static int network_driver_nonblock_send(tnetwork_driver_ctx *ctx, void *buf, size_t len)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+  unsigned char                *p = (unsigned char *) buf;
+  size_t                        off = 0;
+  int                           rc = 0;
+
+  while (off < len) {
+    struct pollfd pfd = { .fd = -1, .events = POLLOUT };
+    ssize_t       n = -1;
+
+    if ((rc = network_driver_nonblock_progress(ctx)) < 0)
+      return -1;
+
+    if (! rc) {
+      if ((n = network_driver_nonblock_write(ctx, p + off, len - off)) >= 0) {
+        off += (size_t) n;
+        continue;
+      }
+
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+    } else if (rc == NETWORK_WANT_READ) {
+      pfd.events = POLLIN;
+    }
+
+    pfd.fd = network_driver_nonblock_get_fd(ctx);
+    if (poll(&pfd, 1, driver_ctx->timeout_sec * 1000) <= 0) {
+      logger("send: timeout after %u sec", driver_ctx->timeout_sec);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int network_driver_nonblock_is_alive(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+  unsigned char                 c;
+  ssize_t                       n = -1;
+
+  if (driver_ctx->fd < 0 || ! driver_ctx->connected)
+    return 0;
+
+  n = recv(driver_ctx->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return 1;
+
+  return 0;
+}
+
+static int network_driver_nonblock_get_fd(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+
+  if (driver_ctx->connector)
+    return network_connector_get_fd(driver_ctx->connector);
+
+  return driver_ctx->fd;
+}
+
+static char *network_driver_nonblock_get_name(void)
+{
+  return "nonblock";
+}
+
+static void network_driver_nonblock_free(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_nonblock_ctx *driver_ctx = (tnetwork_driver_nonblock_ctx *) ctx;
+
+  if (driver_ctx->fd >= 0)
+    (void) close(driver_ctx->fd);
+
+  network_connector_free(driver_ctx->connector);
+
+  free(driver_ctx);
+}
+
+tnetwork_driver_ctx *network_driver_nonblock_create(void)
+{
+  tnetwork_driver_nonblock_ctx *ctx = calloc(1, sizeof *ctx);
+  if (! ctx) {
+    logger("calloc: %m");
+    return NULL;
+  }
+
+  ctx->fd = -1;
+
+  ctx->driver.connect_func  = network_driver_nonblock_connect;
+  ctx->driver.send_func     = network_driver_nonblock_send;
+  ctx->driver.read_func     = network_driver_nonblock_read;
+  ctx->driver.get_name_func = network_driver_nonblock_get_name;
+  ctx->driver.free_func     = network_driver_nonblock_free;
+  ctx->driver.is_alive_func = network_driver_nonblock_is_alive;
+  ctx->driver.get_fd_func   = network_driver_nonblock_get_fd;
+  ctx->driver.progress_func = network_driver_nonblock_progress;
+  ctx->driver.write_func    = network_driver_nonblock_write;
+
+  return (tnetwork_driver_ctx *) ctx;
+}
@@ -4,142 +4,92 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
-#include <fcntl.h>
-#include <sys/time.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #include "logger.h"
 #include "network_plain.h"
 #include "network.h"
+#include "network_connect.h"
+#include "event_loop.h"
 
 typedef struct {
   tnetwork_driver_ctx driver; // Mandatory as first element of the struct
 
   int fd;
 
+  int pipefd[2]; // For splice(), on first use
 } tnetwork_driver_plain_ctx;
 
-static int set_nonblock(int fd, int nonblock)
+// socket -> pipe -> out_fd: the pipe only holds references to the pages of
+// the socket buffers, the data never goes to user space.  The pipe comes
+// empty and is left so, unless something fails: it is closed then.
+ssize_t network_splice(int fd, int pipefd[2], int out_fd, size_t len)
 {
-  int flags = fcntl(fd, F_GETFL, 0);
-  if (flags < 0)
-    return -1;
-
-  return fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
-}
+  ssize_t n = -1;
+  size_t  off = 0;
 
-static int set_timeouts(int fd, unsigned timeout_sec)
-{
-  struct timeval tv = {
-    .tv_sec = timeout_sec,
-    .tv_usec = 0
-  };
+  if (pipefd[0] < 0) {
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+      logger("pipe2: %m");
+      return -1;
+    }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) < 0) {
-    logger("setsockopt: %m");
-    return -1;
+    // Fewer and larger moves, as far as /proc/sys/fs/pipe-max-size allows
+    (void) fcntl(pipefd[1], F_SETPIPE_SZ, NETWORK_SPLICE_PIPE_SIZE);
   }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) < 0) {
-    logger("setsockopt: %m");
+  while ((n = splice(fd, NULL, pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+    if (errno == EINTR)
+      continue;
+
+    logger("splice: %m");
     return -1;
   }
 
-  return 0;
-}
-
-static int wait_fd(int fd, int do_write, unsigned timeout_sec)
-{ 
-  struct timeval tv = {
-    .tv_sec = timeout_sec,
-    .tv_usec = 0
-  };
-  fd_set rfds, wfds;
+  while (off < (size_t) n) {
+    ssize_t m = splice(pipefd[0], NULL, out_fd, NULL, (size_t) n - off, SPLICE_F_MOVE | SPLICE_F_MORE);
 
-  FD_ZERO(&rfds);
-  FD_ZERO(&wfds);
+    if (m < 0) {
+      if (errno == EINTR)
+        continue;
 
-  if (do_write)
-    FD_SET(fd, &wfds);
-  else
-    FD_SET(fd, &rfds);
+      logger("splice: %m");
+      (void) close(pipefd[0]);
+      (void) close(pipefd[1]);
+      pipefd[0] = pipefd[1] = -1;
+      return -1;
+    }
 
-  if (select(fd + 1, do_write ? NULL : &rfds, do_write ? &wfds : NULL, NULL, &tv) <= 0) {
-    logger("select: %m");
-    return -1;
+    off += (size_t) m;
   }
 
-  return 0;
+  return n;
 }
 
 static int network_driver_plain_connect(tnetwork_driver_ctx *ctx, char *host, char *port, unsigned timeout_sec)
 {
   tnetwork_driver_plain_ctx *driver_ctx = (tnetwork_driver_plain_ctx *) ctx;
+  int                        fd = -1;
 
-  struct addrinfo hints, *res = NULL, *rp = NULL;
-  int fd = -1, gai = -1;
-
-  memset(&hints, 0, sizeof hints);
-  hints.ai_family   = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_protocol = IPPROTO_TCP;
+  if ((fd = network_connect(host, port, event_loop_now_ms() + timeout_sec * 1000LL)) < 0)
+    return -1;
 
-  if ((gai = getaddrinfo(host, port, &hints, &res))) {
-    logger("getaddrinfo: %m");
+  if (network_set_nonblock(fd, 0) < 0) {
+    logger("fcntl: %m");
+    (void) close(fd);
     return -1;
   }
 
-  for (rp = res; rp; rp = rp->ai_next) {
-    if ((fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
-      continue;
-
-    if (set_nonblock(fd, 1) < 0) {
-      logger("fcntl: %m");
-      (void) close(fd);
-      fd = -1;
-      continue;
-    }
-
-    if (connect(fd, rp->ai_addr, rp->ai_addrlen) < 0 && errno != EINPROGRESS) {
-      logger("connect: %m");
-      (void) close(fd);
-      fd = -1;
-      continue;
-    }
-
-    if (! wait_fd(fd, 1, timeout_sec)) {
-      int err = 0; socklen_t len = sizeof err;
-      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
-        if (set_nonblock(fd, 0) < 0) {
-          logger("fcntl: %m");
-          (void) close(fd);
-          fd = -1;
-          continue;
-        }
-
-        if (set_timeouts(fd, timeout_sec) < 0) {
-          logger("setsockopt: %m");
-          (void) close(fd);
-          fd = -1;
-          continue;
-        }
-        break;
-      } else {
-        logger("connect: %m");
-      }
-    } else {
-      logger("connect: timeout after %d sec\n", timeout_sec);
-    }
-
+  if (network_set_timeouts(fd, timeout_sec) < 0) {
     (void) close(fd);
-    fd = -1;
+    return -1;
   }
 
   driver_ctx->fd = fd;
-  freeaddrinfo(res);
-
   return fd;
 }
 
@@ -149,8 +99,9 @@ static int network_driver_plain_send(tnetwork_driver_ctx *ctx, void *buf, size_t
   unsigned char             *p = (unsigned char *) buf;
   size_t                    off = 0;
 
+  // A server gone meanwhile is an error, not a signal
   while (off < len) {
-    ssize_t n = send(driver_ctx->fd, p + off, len - off, 0);
+    ssize_t n = send(driver_ctx->fd, p + off, len - off, MSG_NOSIGNAL);
     if (n < 0) {
       if (errno == EINTR)
         continue;
@@ -162,70 +113,84 @@ static int network_driver_plain_send(tnetwork_driver_ctx *ctx, void *buf, size_t
   return 0;
 }    
 
-static int network_driver_plain_recv(tnetwork_driver_ctx *ctx, unsigned char **datap, size_t *data_lenp)
+// writev() through sendmsg(), for MSG_NOSIGNAL: the kernel gathers the
+// pieces.  After a partial write, the rest of the piece it stopped in goes on
+// its own, the vector itself being left untouched.
+static int network_driver_plain_sendv(tnetwork_driver_ctx *ctx, struct iovec *iov, int iovcnt)
 {
-#define DEFAULT_RECV_BUF_SIZE 4096
-#define MAX_RECV_BUF_SIZE (128 * 1024)
-
   tnetwork_driver_plain_ctx *driver_ctx = (tnetwork_driver_plain_ctx *) ctx;
-  size_t                     n_allocated = 0;
-  size_t                     data_len = 0;
-  unsigned char             *buf = NULL;
 
-  n_allocated =  DEFAULT_RECV_BUF_SIZE * sizeof *buf;
-  if (NULL == (buf = calloc(1, n_allocated))) {
-    logger("calloc: %m");
-    goto err;
-  }
-  
-  while (1) {
-    ssize_t n = recv(driver_ctx->fd, buf + data_len, n_allocated - data_len, 0);
-    if (0 == n) {
-      // Got the EOF
-      goto end;
-    } else if (n > 0) {
-      data_len += (size_t) n;
-
-      // We might have to grow the buffer
-      if (data_len >= n_allocated) {
-        n_allocated *= 2;
-        if (n_allocated > MAX_RECV_BUF_SIZE) {
-          logger("Can't grow the receiving buffer above %dKB\n", MAX_RECV_BUF_SIZE/1024);
-          goto err;
-        }
-
-        // Exponential growth, it's suboptimal but hey.
-        void *tmpbuf = realloc(buf, n_allocated);
-        if (! tmpbuf) {
-          logger("realloc: %m");
-          goto err;
-        }
-
-        buf = tmpbuf;
-      }
-      
-      continue;
-    } else {
-      if (n < 0) {
-        if (errno == EINTR)
-          continue;
+  while (iovcnt > 0) {
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t) (iovcnt < IOV_MAX ? iovcnt : IOV_MAX) };
+    ssize_t       n = sendmsg(driver_ctx->fd, &msg, MSG_NOSIGNAL);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
 
-        goto err;
-      }
+    while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= (ssize_t) iov->iov_len;
+      iov++;
+      iovcnt--;
     }
 
+    if (n > 0) {
+      if (network_driver_plain_send(ctx, (unsigned char *) iov->iov_base + n, iov->iov_len - (size_t) n) < 0)
+        return -1;
+      iov++;
+      iovcnt--;
+    }
+  }
+
+  return 0;
+}
+
+static ssize_t network_driver_plain_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t len)
+{
+  tnetwork_driver_plain_ctx *driver_ctx = (tnetwork_driver_plain_ctx *) ctx;
+  ssize_t                    n = -1;
+
+  while ((n = recv(driver_ctx->fd, buf, len, 0)) < 0) {
+    if (errno == EINTR)
+      continue;
+
+    logger("recv: %m");
     break;
   }
 
- end:
-  *datap = buf;
-  buf[data_len] = 0;
-  *data_lenp = data_len;
+  return n;
+}
+
+static ssize_t network_driver_plain_splice(tnetwork_driver_ctx *ctx, int out_fd, size_t len)
+{
+  tnetwork_driver_plain_ctx *driver_ctx = (tnetwork_driver_plain_ctx *) ctx;
+
+  return network_splice(driver_ctx->fd, driver_ctx->pipefd, out_fd, len);
+}
+
+// An idle connection is alive when nothing is waiting to be read: neither an
+// EOF nor unsolicited data, which would desynchronize the next reply.
+static int network_driver_plain_is_alive(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_plain_ctx *driver_ctx = (tnetwork_driver_plain_ctx *) ctx;
+  unsigned char              c;
+  ssize_t                    n = -1;
+
+  if (driver_ctx->fd < 0)
+    return 0;
+
+  n = recv(driver_ctx->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return 1;
+
   return 0;
+}
 
- err:
-  free(buf);
-  return -1;
+static int network_driver_plain_get_fd(tnetwork_driver_ctx *ctx)
+{
+  return ((tnetwork_driver_plain_ctx *) ctx)->fd;
 }
 
 static char *network_driver_plain_get_name(void)
@@ -240,6 +205,11 @@ static void network_driver_plain_free(tnetwork_driver_ctx *ctx)
   if (driver_ctx->fd >= 0)
     (void) close(driver_ctx->fd);
 
+  if (driver_ctx->pipefd[0] >= 0) {
+    (void) close(driver_ctx->pipefd[0]);
+    (void) close(driver_ctx->pipefd[1]);
+  }
+
   free(driver_ctx);
 }
 
@@ -252,12 +222,17 @@ tnetwork_driver_ctx *network_driver_plain_create(void)
   }
 
   ctx->fd = -1;
+  ctx->pipefd[0] = ctx->pipefd[1] = -1;
 
   ctx->driver.connect_func  = network_driver_plain_connect;
   ctx->driver.send_func     = network_driver_plain_send;
-  ctx->driver.recv_func     = network_driver_plain_recv;
+  ctx->driver.read_func     = network_driver_plain_read;
   ctx->driver.get_name_func = network_driver_plain_get_name;
   ctx->driver.free_func     = network_driver_plain_free;
+  ctx->driver.is_alive_func = network_driver_plain_is_alive;
+  ctx->driver.get_fd_func   = network_driver_plain_get_fd;
+  ctx->driver.splice_func   = network_driver_plain_splice;
+  ctx->driver.sendv_func    = network_driver_plain_sendv;
 
   return (tnetwork_driver_ctx *) ctx;
 }
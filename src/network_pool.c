@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "util.h"
+#include "logger.h"
+#include "network.h"
+#include "network_pool.h"
+
+// Idle connections of a given origin are kept on a LIFO stack: the most
+// recently used one is the least likely to have been closed by the server.
+struct pool_conn {
+  tnetwork_driver_ctx *ctx;
+  time_t               last_used;
+};
+
+struct pool_origin {
+  char             *host;
+  char             *port;
+  int               use_tls;
+  // NULL for the default one, connections of another driver not mixing
+  char             *driver;
+  unsigned          n_active;
+  unsigned          n_idle;
+  struct pool_conn *idle;
+};
+
+struct network_pool {
+  struct pool_origin *origins;
+  unsigned            n_origins;
+  unsigned            max_per_origin;
+  unsigned            idle_timeout_sec;
+};
+
+static time_t pool_now(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+
+  return ts.tv_sec;
+}
+
+static void pool_origin_deinit(struct pool_origin *origin)
+{
+  for (unsigned i = 0; i < origin->n_idle; i++)
+    network_driver_free(origin->idle[i].ctx);
+
+  free(origin->idle);
+  free(origin->host);
+  free(origin->port);
+  free(origin->driver);
+}
+
+void network_pool_free(tnetwork_pool *pool)
+{
+  if (! pool)
+    return;
+
+  for (unsigned i = 0; i < pool->n_origins; i++)
+    pool_origin_deinit(&pool->origins[i]);
+
+  free(pool->origins);
+  free(pool);
+}
+
+int network_pool_new(unsigned max_per_origin, unsigned idle_timeout_sec, tnetwork_pool **poolp)
+{
+  tnetwork_pool *pool = NULL;
+
+  if (! max_per_origin) {
+    logger("the per-origin connection limit must be at least 1");
+    goto err;
+  }
+
+  if (! (pool = malloc(sizeof *pool))) {
+    logger("malloc: %m");
+    goto err;
+  }
+
+  pool->origins = NULL;
+  pool->n_origins = 0;
+  pool->max_per_origin = max_per_origin;
+  pool->idle_timeout_sec = idle_timeout_sec;
+
+  if (poolp)
+    *poolp = pool;
+  else
+    network_pool_free(pool);
+
+  return 0;
+ err:
+  return -1;
+}
+
+static struct pool_origin *pool_origin_lookup(tnetwork_pool *pool, char *host, char *port, int use_tls,
+                                              char *driver)
+{
+  for (unsigned i = 0; i < pool->n_origins; i++) {
+    struct pool_origin *origin = &pool->origins[i];
+
+    if (origin->use_tls == use_tls &&
+        0 == strcmp(origin->port, port) &&
+        0 == strcasecmp(origin->host, host) &&
+        (origin->driver && driver ? 0 == strcmp(origin->driver, driver) : origin->driver == driver))
+      return origin;
+  }
+
+  return NULL;
+}
+
+static struct pool_origin *pool_origin_get(tnetwork_pool *pool, char *host, char *port, int use_tls,
+                                           char *driver)
+{
+  struct pool_origin *origin = NULL;
+  struct pool_origin *tmp = NULL;
+
+  if ((origin = pool_origin_lookup(pool, host, port, use_tls, driver)))
+    return origin;
+
+  if (! (tmp = realloc(pool->origins, (pool->n_origins + 1) * sizeof *tmp))) {
+    logger("realloc: %m");
+    return NULL;
+  }
+
+  pool->origins = tmp;
+  origin = &pool->origins[pool->n_origins];
+
+  origin->host = strdup(host);
+  origin->port = strdup(port);
+  origin->driver = driver ? strdup(driver) : NULL;
+  origin->idle = calloc(pool->max_per_origin, sizeof *origin->idle);
+  if (! origin->host || ! origin->port || (driver && ! origin->driver) || ! origin->idle) {
+    logger("failed to allocate the pool origin %s:%s", host, port);
+    free(origin->host);
+    free(origin->port);
+    free(origin->driver);
+    free(origin->idle);
+    return NULL;
+  }
+
+  origin->use_tls = use_tls;
+  origin->n_active = 0;
+  origin->n_idle = 0;
+  pool->n_origins++;
+
+  return origin;
+}
+
+// Drop the idle connections which outlived the idle timeout, keeping the
+// remaining ones in their LIFO order.
+static void pool_origin_expire(tnetwork_pool *pool, struct pool_origin *origin, time_t now)
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < origin->n_idle; i++) {
+    struct pool_conn *conn = &origin->idle[i];
+
+    if (now - conn->last_used >= (time_t) pool->idle_timeout_sec) {
+      network_driver_free(conn->ctx);
+      continue;
+    }
+
+    origin->idle[n++] = *conn;
+  }
+
+  origin->n_idle = n;
+}
+
+// The driver name only applies to cleartext connections, TLS ones always go
+// through the TLS driver.
+static tnetwork_driver_ctx *pool_connect(char *host, char *port, int use_tls, char *driver, unsigned timeout_sec)
+{
+  tnetwork_driver_ctx *ctx = NULL;
+
+  if (use_tls)
+    ctx = network_driver_create(NETWORK_DRIVER_TYPE_TLS);
+  else if (driver)
+    ctx = network_driver_create_by_name(driver);
+  else
+    ctx = network_driver_create(NETWORK_DRIVER_TYPE_PLAIN);
+
+  if (! ctx) {
+    logger("failed to create the network driver");
+    goto err;
+  }
+
+  if (network_driver_connect(ctx, host, port, timeout_sec) < 0) {
+    logger("tcp connection failed: %s:%s", host, port);
+    goto err;
+  }
+
+  return ctx;
+ err:
+  network_driver_free(ctx);
+  return NULL;
+}
+
+// Hand out a connection to host:port, either an idle one which is still alive
+// or a brand new one, through the named driver (NULL for the default one).
+// Returns 1 when the connection is reused, 0 when it was just established, -1
+// on error.  Without a pool, always connect.
+int network_pool_get(tnetwork_pool *pool, char *host, char *port, int use_tls, char *driver, unsigned timeout_sec, tnetwork_driver_ctx **ctxp)
+{
+  struct pool_origin  *origin = NULL;
+  tnetwork_driver_ctx *ctx = NULL;
+
+  if (! pool) {
+    if (! (ctx = pool_connect(host, port, use_tls, driver, timeout_sec)))
+      goto err;
+
+    *ctxp = ctx;
+    return 0;
+  }
+
+  if (! (origin = pool_origin_get(pool, host, port, use_tls, driver)))
+    goto err;
+
+  pool_origin_expire(pool, origin, pool_now());
+
+  while (origin->n_idle) {
+    ctx = origin->idle[--origin->n_idle].ctx;
+
+    if (network_driver_is_alive(ctx)) {
+      origin->n_active++;
+      *ctxp = ctx;
+      return 1;
+    }
+
+    // The server closed it behind our back, forget about it.
+    network_driver_free(ctx);
+  }
+
+  if (origin->n_active >= pool->max_per_origin) {
+    logger("connection limit reached for %s:%s (%u)",
+           host, port, pool->max_per_origin);
+    goto err;
+  }
+
+  if (! (ctx = pool_connect(host, port, use_tls, driver, timeout_sec)))
+    goto err;
+
+  origin->n_active++;
+  *ctxp = ctx;
+  return 0;
+
+ err:
+  return -1;
+}
+
+// Give back a connection obtained through network_pool_get(), with the same
+// origin and driver.  It is kept for later reuse only if the caller says the
+// exchange left it in a clean state and the peer did not close it in the
+// meantime.
+void network_pool_put(tnetwork_pool *pool, tnetwork_driver_ctx *ctx, char *host, char *port, int use_tls,
+                      char *driver, int reusable)
+{
+  struct pool_origin *origin = NULL;
+
+  if (! ctx)
+    return;
+
+  if (! pool || ! (origin = pool_origin_lookup(pool, host, port, use_tls, driver))) {
+    network_driver_free(ctx);
+    return;
+  }
+
+  if (origin->n_active)
+    origin->n_active--;
+
+  if (! reusable || ! network_driver_is_alive(ctx)) {
+    network_driver_free(ctx);
+    return;
+  }
+
+  pool_origin_expire(pool, origin, pool_now());
+
+  // Can't happen as long as n_idle + n_active <= max_per_origin, but better
+  // close a connection than overflow the stack.
+  if (origin->n_idle >= pool->max_per_origin) {
+    network_driver_free(ctx);
+    return;
+  }
+
+  origin->idle[origin->n_idle].ctx = ctx;
+  origin->idle[origin->n_idle].last_used = pool_now();
+  origin->n_idle++;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/network_pool_utest.c"
@@ -6,17 +6,23 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
-#include <fcntl.h>
-#include <sys/time.h>
+#include <sys/uio.h>
+#include <linux/tls.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
 
+#include "util.h"
 #include "logger.h"
 #include "network.h"
 #include "network_tls.h"
+#include "tls_context.h"
+#include "tls_session.h"
+#include "network_nonblock.h"
+#include "network_plain.h"
+#include "network_connect.h"
+#include "event_loop.h"
 
 
 typedef struct {
@@ -29,284 +35,430 @@ typedef struct {
 
   char *port;
   char *host;
+
+  // Non-blocking flavour: the TCP connection goes through the nonblock
+  // driver, which owns the fd.
+  tnetwork_driver_ctx *tcp;
+  unsigned             timeout_sec;
+  int                  handshake_done;
+
+  // The handshake may end along the first request, with early data
+  long long            deadline_ms;
+
+  // kTLS: the kernel decrypts the records, the socket reads as plain data
+  int                  ktls_recv;
+  int                  pipefd[2]; // For splice(), on first use
+
+  char                 alpn[32]; // Selected protocol, empty if none
 } tnetwork_driver_tls_ctx;
 
-static int set_nonblock(int fd, int nonblock)
+// Everything the handshake needs, on driver_ctx->fd
+static int tls_handshake_init(tnetwork_driver_tls_ctx *driver_ctx)
 {
-  int flags = fcntl(fd, F_GETFL, 0);
-  if (flags < 0)
+  X509_VERIFY_PARAM *param = NULL;
+
+  // Shared by all the connections, with the trust store already loaded
+  if (! (driver_ctx->ssl_ctx = tls_context_acquire())) {
+    logger("no TLS context available");
+    return -1;
+  }
+
+  if (! (driver_ctx->ssl = SSL_new(driver_ctx->ssl_ctx))) {
+    logger("SSL_new failed");
+    return -1;
+  }
+
+  // fd to ssl context association
+  if (SSL_set_fd(driver_ctx->ssl, driver_ctx->fd) != 1) {
+    logger("SSL_set_fd failed");
+    return -1;
+  }
+
+  // Set the SNI
+  if (SSL_set_tlsext_host_name(driver_ctx->ssl, driver_ctx->host) != 1) {
+    logger("SNI failed");
+    return -1;
+  }
+
+  // Offer the session of the previous connection to this server, if any
+  if (tls_session_resume(driver_ctx->ssl, driver_ctx->host, driver_ctx->port) < 0)
+    return -1;
+
+  // Ask for certificate verification
+  SSL_set_verify(driver_ctx->ssl, SSL_VERIFY_PEER, NULL);
+
+  param = SSL_get0_param(driver_ctx->ssl);
+
+  // Make sure the hostname matches
+  X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+  if (! X509_VERIFY_PARAM_set1_host(param, driver_ctx->host, 0)) {
+    logger("X509_VERIFY_PARAM_set1_host failed");
     return -1;
+  }
 
-  return fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+  return 0;
 }
 
-static int set_timeouts(int fd, unsigned timeout_sec)
+// Move the handshake forward on a non-blocking fd: 0 once done,
+// NETWORK_WANT_READ or NETWORK_WANT_WRITE when waiting for the socket, -1 on
+// error.
+static int tls_handshake_step(tnetwork_driver_tls_ctx *driver_ctx)
 {
-  struct timeval tv = {
-    .tv_sec = timeout_sec,
-    .tv_usec = 0
-  };
+  const unsigned char *alpn = NULL;
+  unsigned int         alpn_len = 0;
+  long                 verr = X509_V_OK;
+  int                  n = -1;
+
+  if (driver_ctx->handshake_done)
+    return 0;
+
+  if ((n = SSL_connect(driver_ctx->ssl)) != 1) {
+    switch (SSL_get_error(driver_ctx->ssl, n)) {
+    case SSL_ERROR_WANT_READ:
+      return NETWORK_WANT_READ;
+
+    case SSL_ERROR_WANT_WRITE:
+      return NETWORK_WANT_WRITE;
+
+    default:
+      logger("SSL_connect failed");
+      ERR_print_errors_fp(stderr);
+      return -1;
+    }
+  }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) < 0) {
-    logger("setsockopt: %m");
+  // Result chain verification
+  if ((verr = SSL_get_verify_result(driver_ctx->ssl)) != X509_V_OK) {
+    logger("Cert verify failed: %ld (%s)", verr, X509_verify_cert_error_string(verr));
     return -1;
   }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) < 0) {
-    logger("setsockopt: %m");
-    return -1;
+  logger_verbose("TLS handshake with %s:%s: %s, %s, %s", driver_ctx->host, driver_ctx->port,
+                 SSL_session_reused(driver_ctx->ssl) ? "resumed" : "full",
+                 SSL_get_version(driver_ctx->ssl), SSL_get_cipher_name(driver_ctx->ssl));
+
+  SSL_get0_alpn_selected(driver_ctx->ssl, &alpn, &alpn_len);
+  if (alpn_len && alpn_len < sizeof driver_ctx->alpn) {
+    memcpy(driver_ctx->alpn, alpn, alpn_len);
+    driver_ctx->alpn[alpn_len] = '\0';
+    logger_verbose("ALPN with %s:%s: %s", driver_ctx->host, driver_ctx->port, driver_ctx->alpn);
+  }
+
+  // OpenSSL moves the record layer to the kernel on its own when told so and
+  // able to, for the cipher and TLS version at hand
+  if (SSL_get_options(driver_ctx->ssl) & SSL_OP_ENABLE_KTLS) {
+    driver_ctx->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(driver_ctx->ssl)) &&
+      SSL_version(driver_ctx->ssl) < TLS1_3_VERSION;
+    logger_verbose("kTLS with %s:%s: send %s, receive %s", driver_ctx->host, driver_ctx->port,
+                   BIO_get_ktls_send(SSL_get_wbio(driver_ctx->ssl)) ? "on" : "off",
+                   BIO_get_ktls_recv(SSL_get_rbio(driver_ctx->ssl)) ? "on" : "off");
   }
 
+  driver_ctx->handshake_done = 1;
   return 0;
 }
 
-static int wait_fd(int fd, int do_write, unsigned timeout_sec)
-{ 
-  struct timeval tv = {
-    .tv_sec = timeout_sec,
-    .tv_usec = 0
+// With kTLS, application data goes straight from the kernel to the caller's
+// buffer, without OpenSSL's copy.  Other records only come along with their
+// type: an alert ends the connection, anything else is an error.  TLS 1.3
+// is left to OpenSSL, as session tickets may come at any time.
+static ssize_t tls_ktls_recv(tnetwork_driver_tls_ctx *driver_ctx, unsigned char *buf, size_t len)
+{
+  char            control[CMSG_SPACE(sizeof (unsigned char))];
+  struct iovec    iov = { .iov_base = buf, .iov_len = len };
+  struct msghdr   msg = {
+    .msg_iov        = &iov,
+    .msg_iovlen     = 1,
+    .msg_control    = control,
+    .msg_controllen = sizeof control,
   };
-  fd_set rfds, wfds;
+  struct cmsghdr *cmsg = NULL;
+  ssize_t         n = -1;
 
-  FD_ZERO(&rfds);
-  FD_ZERO(&wfds);
+  do {
+    n = recvmsg(driver_ctx->fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
 
-  if (do_write)
-    FD_SET(fd, &wfds);
-  else
-    FD_SET(fd, &rfds);
+  if (n <= 0)
+    return n;
 
-  if (select(fd + 1, do_write ? NULL : &rfds, do_write ? &wfds : NULL, NULL, &tv) <= 0) {
-    logger("select: %m");
+  if ((cmsg = CMSG_FIRSTHDR(&msg)) &&
+      cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE &&
+      *CMSG_DATA(cmsg) != SSL3_RT_APPLICATION_DATA) {
+    if (*CMSG_DATA(cmsg) == SSL3_RT_ALERT)
+      return 0;
+
+    logger("kTLS: unexpected record of type %u", (unsigned) *CMSG_DATA(cmsg));
+    errno = EPROTO;
     return -1;
   }
 
+  return n;
+}
+
+// The handshake runs on the non-blocking socket under the same deadline as
+// the TCP connection, the socket only gets back to blocking mode afterwards.
+static int tls_handshake_finish(tnetwork_driver_tls_ctx *driver_ctx)
+{
+  int rc = -1;
+
+  while ((rc = tls_handshake_step(driver_ctx)) > 0) {
+    if (network_wait_fd(driver_ctx->fd, rc == NETWORK_WANT_WRITE, driver_ctx->deadline_ms) < 0) {
+      logger("TLS handshake with %s:%s: timeout", driver_ctx->host, driver_ctx->port);
+      return -1;
+    }
+  }
+
+  if (rc < 0 ||
+      network_set_nonblock(driver_ctx->fd, 0) < 0 ||
+      network_set_timeouts(driver_ctx->fd, driver_ctx->timeout_sec) < 0)
+    return -1;
+
   return 0;
 }
 
+// How many bytes may go in the early data of this connection: none unless
+// allowed, and resuming a TLS 1.3 session whose server takes them.  Nor with
+// a session that was on HTTP/2, whose requests only go once the connection
+// preface and the settings went.
+static size_t tls_early_data_max(tnetwork_driver_tls_ctx *driver_ctx)
+{
+  SSL_SESSION         *session = NULL;
+  const unsigned char *alpn = NULL;
+  size_t               alpn_len = 0;
+
+  if (driver_ctx->handshake_done ||
+      ! tls_context_early_data() ||
+      ! (session = SSL_get_session(driver_ctx->ssl)))
+    return 0;
+
+  SSL_SESSION_get0_alpn_selected(session, &alpn, &alpn_len);
+  if (alpn_len == 2 && ! memcmp(alpn, "h2", 2))
+    return 0;
+
+  return SSL_SESSION_get_max_early_data(session);
+}
+
 static int network_driver_tls_connect(tnetwork_driver_ctx *ctx, char *host, char *port, unsigned timeout_sec)
 {
   tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
-  struct addrinfo hints, *res = NULL, *rp = NULL;
-  int fd = -1, gai = -1;
+  int                      fd = -1;
 
-  memset(&hints, 0, sizeof hints);
-  hints.ai_family   = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_protocol = IPPROTO_TCP;
-
-  if (! (driver_ctx->host = strdup(host))) {
+  if (! (driver_ctx->host = strdup(host)) || ! (driver_ctx->port = strdup(port))) {
     logger("strdup: %m");
     return -1;
   }
-  
-  if ((gai = getaddrinfo(driver_ctx->host, port, &hints, &res))) {
-    logger("getaddrinfo: %m");
-    return -1;
-  }
 
-  for (rp = res; rp; rp = rp->ai_next) {
-    if ((fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
-      continue;
+  driver_ctx->timeout_sec = timeout_sec;
+  driver_ctx->deadline_ms = event_loop_now_ms() + timeout_sec * 1000LL;
 
-    if (set_nonblock(fd, 1) < 0) {
-      logger("fcntl: %m");
-      (void) close(fd);
-      fd = -1;
-      continue;
-    }
-
-    if (connect(fd, rp->ai_addr, rp->ai_addrlen) < 0 && errno != EINPROGRESS) {
-      logger("connect: %m");
-      (void) close(fd);
-      fd = -1;
-      continue;
-    }
+  if ((fd = network_connect(host, port, driver_ctx->deadline_ms)) < 0)
+    return -1;
 
-    if (! wait_fd(fd, 1, timeout_sec)) {
-      int err = 0; socklen_t len = sizeof err;
-      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
-        if (set_nonblock(fd, 0) < 0) {
-          logger("fcntl: %m");
-          (void) close(fd);
-          fd = -1;
-          continue;
-        }
-
-        if (set_timeouts(fd, timeout_sec) < 0) {
-          logger("setsockopt: %m");
-          (void) close(fd);
-          fd = -1;
-          continue;
-        }
-        break;
-      } else {
-        logger("connect: %m");
-      }
-    } else {
-      logger("connect: timeout after %d sec\n", timeout_sec);
-    }
+  driver_ctx->fd = fd;
+  if (tls_handshake_init(driver_ctx) < 0)
+    goto err;
 
-    (void) close(fd);
-    fd = -1;
+  // Only offered here: the server picks, and the callers of the non-blocking
+  // flavour speak HTTP/1.1 only
+  if (tls_context_http2() &&
+      SSL_set_alpn_protos(driver_ctx->ssl, (unsigned char *) "\x02h2\x08http/1.1", 12) != 0) {
+    logger("SSL_set_alpn_protos failed");
+    goto err;
   }
 
-  driver_ctx->fd = fd;
-  freeaddrinfo(res);
+  // Left to the first request, which may then go in the early data
+  if (tls_early_data_max(driver_ctx) > 0)
+    return fd;
+
+  if (tls_handshake_finish(driver_ctx) < 0)
+    goto err;
 
   return fd;
+ err:
+  SSL_free(driver_ctx->ssl);
+  driver_ctx->ssl = NULL;
+  driver_ctx->handshake_done = 0;
+  (void) close(fd);
+  driver_ctx->fd = -1;
+  return -1;
 }
 
 static int network_driver_tls_send(tnetwork_driver_ctx *ctx, void *buf, size_t buf_size)
 {
   tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
-  int                      ret = -1;
-  X509_VERIFY_PARAM       *param = NULL;
-
-  driver_ctx->ssl_ctx = SSL_CTX_new(TLS_client_method());
-  if (! driver_ctx->ssl_ctx) {
-    logger("SSL_CTX_new failed");
-    goto end;
-  }
 
-  // Use the trusted paths for CA
-  if (SSL_CTX_set_default_verify_paths(driver_ctx->ssl_ctx) != 1) {
-    logger("SSL_CTX_set_default_verify_paths failed");
-    goto end;
-  }
+  if (! driver_ctx->handshake_done && tls_handshake_finish(driver_ctx) < 0)
+    return -1;
 
-  if (! (driver_ctx->ssl = SSL_new(driver_ctx->ssl_ctx))) {
-    logger("SSL_new failed");
-    goto end;
+  if (SSL_write(driver_ctx->ssl, buf, buf_size) <= 0) {
+    logger("SSL_write failed");
+    ERR_print_errors_fp(stderr);
+    return -1;
   }
 
-  // fd to ssl context association
-  if (SSL_set_fd(driver_ctx->ssl, driver_ctx->fd) != 1) {
-    logger("SSL_set_fd failed");
-    goto end;
-  }
+  return 0;
+}
 
-  // Set the SNI
-  if (SSL_set_tlsext_host_name(driver_ctx->ssl, driver_ctx->host) != 1) {
-    logger("SNI failed");
-    goto end;
-  }
+// The request goes with the ClientHello, encrypted with the resumed session's
+// keys, and the handshake ends right after.  Should the server reject the
+// early data, as it may any time, the request goes again once it is over.
+static int network_driver_tls_send_early(tnetwork_driver_ctx *ctx, void *buf, size_t buf_size)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  size_t                   written = 0;
+  int                      n = -1;
 
-  // Ask for certificate verification
-  SSL_set_verify(driver_ctx->ssl, SSL_VERIFY_PEER, NULL);
+  if (! buf_size || buf_size > tls_early_data_max(driver_ctx))
+    return network_driver_tls_send(ctx, buf, buf_size);
 
-  param = SSL_get0_param(driver_ctx->ssl);
+  while ((n = SSL_write_early_data(driver_ctx->ssl, buf, buf_size, &written)) != 1) {
+    int err = SSL_get_error(driver_ctx->ssl, n);
 
-  // Make sure the hostname matches
-  X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
-  if (! X509_VERIFY_PARAM_set1_host(param, driver_ctx->host, 0)) {
-    logger("X509_VERIFY_PARAM_set1_host failed");
-    goto end;
-  }
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+      logger("SSL_write_early_data failed");
+      ERR_print_errors_fp(stderr);
+      return -1;
+    }
 
-  if (SSL_connect(driver_ctx->ssl) != 1) {
-    logger("SSL_connect failed");
-    ERR_print_errors_fp(stderr);
-    goto end;
+    if (network_wait_fd(driver_ctx->fd, err == SSL_ERROR_WANT_WRITE, driver_ctx->deadline_ms) < 0) {
+      logger("TLS handshake with %s:%s: timeout", driver_ctx->host, driver_ctx->port);
+      return -1;
+    }
   }
 
-  // Result chain verification
-  long verr = SSL_get_verify_result(driver_ctx->ssl);
-  if (verr != X509_V_OK) {
-    logger("Cert verify failed: %ld (%s)", verr, X509_verify_cert_error_string(verr));
-    goto end;
-  }
+  if (tls_handshake_finish(driver_ctx) < 0)
+    return -1;
 
-  if (SSL_write(driver_ctx->ssl, buf, buf_size) < 0) {
-    logger("SSL_write failed");
-    ERR_print_errors_fp(stderr);
-    goto end;
+  if (SSL_get_early_data_status(driver_ctx->ssl) == SSL_EARLY_DATA_ACCEPTED) {
+    logger_verbose("TLS early data: %zu bytes accepted by %s:%s", written, driver_ctx->host, driver_ctx->port);
+    return 0;
   }
 
-  ret = 0;
- end:
-  return ret;
-}    
+  logger_verbose("TLS early data: rejected by %s:%s, sending again", driver_ctx->host, driver_ctx->port);
+  return network_driver_tls_send(ctx, buf, buf_size);
+}
 
-static int network_driver_tls_recv(tnetwork_driver_ctx *ctx, unsigned char **datap, size_t *data_lenp)
+static ssize_t network_driver_tls_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t len)
 {
-#define DEFAULT_RECV_BUF_SIZE 4096
-#define MAX_RECV_BUF_SIZE (128 * 1024)
-
   tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
-  size_t                   n_allocated = 0;
-  size_t                   data_len = 0;
-  unsigned char           *buf = NULL;
+  ssize_t                  n = -1;
 
-  n_allocated =  DEFAULT_RECV_BUF_SIZE * sizeof *buf;
-  if (NULL == (buf = calloc(1, n_allocated))) {
-    logger("calloc: %m");
-    goto err;
+  if (driver_ctx->ktls_recv && ! SSL_has_pending(driver_ctx->ssl)) {
+    if ((n = tls_ktls_recv(driver_ctx, buf, len)) < 0)
+      logger("recvmsg: %m");
+
+    return n;
   }
-  
+
   while (1) {
-    int n = SSL_read(driver_ctx->ssl, buf + data_len, n_allocated - data_len);
-    if (0 == n) {
-      // Got the EOF
-      goto end;
-    } else if (n > 0) {
+    int n = -1;
+
+    // An EOF only shows as an untouched errno
+    errno = 0;
+    n = SSL_read(driver_ctx->ssl, buf, len);
+    if (n > 0)
       // Success!  we actually got something to read.
-      data_len += (size_t) n;
-
-      // We might have to grow the buffer
-      if (data_len >= n_allocated) {
-        n_allocated *= 2;
-        if (n_allocated > MAX_RECV_BUF_SIZE) {
-          logger("Can't grow the receiving buffer above %dKB\n", MAX_RECV_BUF_SIZE/1024);
-          goto err;
-        }
-
-        // Exponential growth, it's suboptimal but hey.
-        void *tmpbuf = realloc(buf, n_allocated);
-        if (! tmpbuf) {
-          logger("realloc: %m");
-          goto err;
-        }
-
-        buf = tmpbuf;
-      }
-      
-      goto again;
-    } else {
-      // Failure or clean EOF?  Let's check first for any error.
-
-      switch(SSL_get_error(driver_ctx->ssl, n)) {
-      case SSL_ERROR_ZERO_RETURN:
-        goto end;
-
-      case SSL_ERROR_WANT_READ:
-      case SSL_ERROR_WANT_WRITE:
-        // Retry!
-        goto again;
-
-      case 0:
-        // Closed socket.
-        goto end;
-
-      default:
-        logger("SSL_read failed");
-        ERR_print_errors_fp(stderr);
-        goto end;
+      return n;
+
+    // Failure or clean EOF?  Let's check first for any error.
+    switch(SSL_get_error(driver_ctx->ssl, n)) {
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      // The socket is blocking, this is its receive timeout running out
+      logger("SSL_read timed out");
+      errno = ETIMEDOUT;
+      return -1;
+
+    case SSL_ERROR_SYSCALL:
+      if (errno == EINTR)
+        continue;
+
+      // Quite a few servers close the socket without any close_notify,
+      // consider it as an EOF and let the framing decide.
+      if (errno == 0)
+        return 0;
+
+      logger("SSL_read: %m");
+      return -1;
+
+    default:
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+      // Same as above, as OpenSSL 3 reports it
+      if (ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+        ERR_clear_error();
+        return 0;
       }
+#endif
+      logger("SSL_read failed");
+      ERR_print_errors_fp(stderr);
+      errno = EIO;
+      return -1;
     }
+  }
+}
 
-  again:
+// Only the plain data of kTLS sockets can go straight to a file
+static ssize_t network_driver_tls_splice(tnetwork_driver_ctx *ctx, int out_fd, size_t len)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+
+  if (! driver_ctx->ktls_recv || SSL_has_pending(driver_ctx->ssl)) {
+    errno = ENOTSUP;
+    return -1;
   }
 
- end:
-  *datap = buf;
-  buf[data_len] = 0;
-  *data_lenp = data_len;
-  return 0;
+  return network_splice(driver_ctx->fd, driver_ctx->pipefd, out_fd, len);
+}
 
- err:
-  free(buf);
-  return -1;
+// Peek through the TLS layer rather than the raw socket: TLS 1.3 servers send
+// session tickets after the handshake, which are not application data and
+// must not be mistaken for a stale connection.
+static int network_driver_tls_is_alive(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  unsigned char            c;
+  int                      n = -1;
+  int                      alive = 0;
+
+  if (driver_ctx->fd < 0 || ! driver_ctx->ssl || ! driver_ctx->handshake_done)
+    return 0;
+
+  if (SSL_pending(driver_ctx->ssl) > 0)
+    return 0;
+
+  if (network_set_nonblock(driver_ctx->fd, 1) < 0) {
+    logger("fcntl: %m");
+    return 0;
+  }
+
+  n = SSL_peek(driver_ctx->ssl, &c, 1);
+  if (n <= 0 && SSL_get_error(driver_ctx->ssl, n) == SSL_ERROR_WANT_READ)
+    alive = 1;
+
+  ERR_clear_error();
+
+  if (network_set_nonblock(driver_ctx->fd, 0) < 0) {
+    logger("fcntl: %m");
+    return 0;
+  }
+
+  return alive;
+}
+
+static char *network_driver_tls_get_alpn(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+
+  return *driver_ctx->alpn ? driver_ctx->alpn : NULL;
+}
+
+static int network_driver_tls_get_fd(tnetwork_driver_ctx *ctx)
+{
+  return ((tnetwork_driver_tls_ctx *) ctx)->fd;
 }
 
 static char *network_driver_tls_get_name(void)
@@ -328,8 +480,16 @@ static void network_driver_tls_free(tnetwork_driver_ctx *ctx)
     SSL_CTX_free(driver_ctx->ssl_ctx);
 
   free(driver_ctx->host);
+  free(driver_ctx->port);
 
-  if (driver_ctx->fd >= 0)
+  if (driver_ctx->pipefd[0] >= 0) {
+    (void) close(driver_ctx->pipefd[0]);
+    (void) close(driver_ctx->pipefd[1]);
+  }
+
+  if (driver_ctx->tcp)
+    network_driver_free(driver_ctx->tcp);
+  else if (driver_ctx->fd >= 0)
     (void) close(driver_ctx->fd);
 
   free(driver_ctx);
@@ -344,12 +504,202 @@ tnetwork_driver_ctx *network_driver_tls_create(void)
   }
 
   ctx->fd = -1;
+  ctx->pipefd[0] = ctx->pipefd[1] = -1;
 
   ctx->driver.connect_func  = network_driver_tls_connect;
   ctx->driver.send_func     = network_driver_tls_send;
-  ctx->driver.recv_func     = network_driver_tls_recv;
+  ctx->driver.read_func     = network_driver_tls_read;
+  ctx->driver.send_early_func = network_driver_tls_send_early;
+  ctx->driver.splice_func   = network_driver_tls_splice;
   ctx->driver.get_name_func = network_driver_tls_get_name;
   ctx->driver.free_func     = network_driver_tls_free;
+  ctx->driver.is_alive_func = network_driver_tls_is_alive;
+  ctx->driver.get_fd_func   = network_driver_tls_get_fd;
+  ctx->driver.get_alpn_func = network_driver_tls_get_alpn;
+
+  return (tnetwork_driver_ctx *) ctx;
+}
+
+
+//
+// Non-blocking flavour, for event loops
+//
+
+static int network_driver_tls_nonblock_connect(tnetwork_driver_ctx *ctx, char *host, char *port, unsigned timeout_sec)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+
+  if (! (driver_ctx->host = strdup(host)) || ! (driver_ctx->port = strdup(port))) {
+    logger("strdup: %m");
+    return -1;
+  }
+
+  driver_ctx->timeout_sec = timeout_sec;
+
+  if (! (driver_ctx->tcp = network_driver_create(NETWORK_DRIVER_TYPE_NONBLOCK)))
+    return -1;
+
+  return network_driver_connect(driver_ctx->tcp, host, port, timeout_sec);
+}
+
+// The TCP connection first, then the handshake
+static int network_driver_tls_nonblock_progress(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  int                      rc = -1;
+
+  if (! driver_ctx->ssl) {
+    if ((rc = network_driver_progress(driver_ctx->tcp)))
+      return rc;
+
+    driver_ctx->fd = network_driver_get_fd(driver_ctx->tcp);
+    if (tls_handshake_init(driver_ctx) < 0)
+      return -1;
+  }
+
+  return tls_handshake_step(driver_ctx);
+}
+
+// SSL_ERROR_WANT_* show up as EAGAIN, like for a plain socket
+static ssize_t tls_nonblock_result(tnetwork_driver_tls_ctx *driver_ctx, int n, char *what)
+{
+  if (n > 0)
+    return n;
+
+  switch (SSL_get_error(driver_ctx->ssl, n)) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    errno = EAGAIN;
+    return -1;
+
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+
+  default:
+    logger("%s failed", what);
+    ERR_print_errors_fp(stderr);
+    errno = EIO;
+    return -1;
+  }
+}
+
+static ssize_t network_driver_tls_nonblock_write(tnetwork_driver_ctx *ctx, void *buf, size_t len)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+
+  return tls_nonblock_result(driver_ctx, SSL_write(driver_ctx->ssl, buf, len), "SSL_write");
+}
+
+static ssize_t network_driver_tls_nonblock_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t len)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  ssize_t                  n = -1;
+
+  if (driver_ctx->ktls_recv && ! SSL_has_pending(driver_ctx->ssl))
+    return tls_ktls_recv(driver_ctx, buf, len);
+
+  n = SSL_read(driver_ctx->ssl, buf, len);
+
+  // As in blocking mode, a missing close_notify is an EOF
+  if ((n = tls_nonblock_result(driver_ctx, (int) n, "SSL_read")) < 0 && errno == EIO)
+    return 0;
+
+  return n;
+}
+
+// Blocking flavour of the above, for callers outside of an event loop
+static int network_driver_tls_nonblock_send(tnetwork_driver_ctx *ctx, void *buf, size_t len)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  long long                deadline_ms = event_loop_now_ms() + driver_ctx->timeout_sec * 1000LL;
+  size_t                   off = 0;
+  int                      rc = 0;
+
+  while (off < len) {
+    ssize_t n = -1;
+
+    if ((rc = network_driver_tls_nonblock_progress(ctx)) < 0)
+      return -1;
+
+    if (! rc) {
+      if ((n = network_driver_tls_nonblock_write(ctx, (unsigned char *) buf + off, len - off)) >= 0) {
+        off += (size_t) n;
+        continue;
+      }
+
+      if (errno != EAGAIN)
+        return -1;
+
+      rc = NETWORK_WANT_WRITE;
+    }
+
+    if (network_wait_fd(network_driver_get_fd(driver_ctx->tcp), rc == NETWORK_WANT_WRITE, deadline_ms) < 0) {
+      logger("send: timeout after %u sec", driver_ctx->timeout_sec);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int network_driver_tls_nonblock_is_alive(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+  unsigned char            c;
+  int                      n = -1;
+  int                      alive = 0;
+
+  if (! driver_ctx->handshake_done || SSL_pending(driver_ctx->ssl) > 0)
+    return 0;
+
+  n = SSL_peek(driver_ctx->ssl, &c, 1);
+  if (n <= 0 && SSL_get_error(driver_ctx->ssl, n) == SSL_ERROR_WANT_READ)
+    alive = 1;
+
+  ERR_clear_error();
+  return alive;
+}
+
+static int network_driver_tls_nonblock_get_fd(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_tls_ctx *driver_ctx = (tnetwork_driver_tls_ctx *) ctx;
+
+  return driver_ctx->tcp ? network_driver_get_fd(driver_ctx->tcp) : -1;
+}
+
+static char *network_driver_tls_nonblock_get_name(void)
+{
+  return "tls-nonblock";
+}
+
+tnetwork_driver_ctx *network_driver_tls_nonblock_create(void)
+{
+  tnetwork_driver_tls_ctx *ctx = calloc(1, sizeof *ctx);
+  if (! ctx) {
+    logger("calloc: %m");
+    return NULL;
+  }
+
+  ctx->fd = -1;
+  ctx->pipefd[0] = ctx->pipefd[1] = -1;
+
+  ctx->driver.connect_func  = network_driver_tls_nonblock_connect;
+  ctx->driver.send_func     = network_driver_tls_nonblock_send;
+  ctx->driver.read_func     = network_driver_tls_nonblock_read;
+  ctx->driver.get_name_func = network_driver_tls_nonblock_get_name;
+  ctx->driver.free_func     = network_driver_tls_free;
+  ctx->driver.is_alive_func = network_driver_tls_nonblock_is_alive;
+  ctx->driver.get_fd_func   = network_driver_tls_nonblock_get_fd;
+  ctx->driver.get_alpn_func = network_driver_tls_get_alpn;
+  ctx->driver.progress_func = network_driver_tls_nonblock_progress;
+  ctx->driver.write_func    = network_driver_tls_nonblock_write;
 
   return (tnetwork_driver_ctx *) ctx;
 }
+
+
+//
+// Unit tests
+//
+
+#include "../tests/network_tls_utest.c"
@@ -0,0 +1,630 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "util.h"
+#include "logger.h"
+#include "network_uring.h"
+#include "network_plain.h"
+#include "network.h"
+#include "network_connect.h"
+#include "event_loop.h"
+
+// Plain TCP over io_uring, through raw syscalls: no liburing needed.
+//
+// The request is queued by send_func and only submitted along with the
+// receive by read_func, so that a request/reply exchange costs a single
+// io_uring_enter() on the fast path.  Receiving goes through a multishot
+// recv into a ring of provided buffers when the kernel supports it (6.0+),
+// which stays armed from one read to the next and across keep-alive
+// exchanges.  Older kernels get one-shot reads into a registered buffer.
+
+#define URING_ENTRIES  8
+#define URING_BUF_SIZE (16 * 1024)
+#define URING_N_BUFS   8 // Power of 2, the size of the provided buffer ring
+#define URING_BGID     0
+
+enum {
+  URING_OP_SEND = 1,
+  URING_OP_RECV,
+};
+
+typedef enum {
+  URING_RECV_MULTISHOT, // Provided buffer ring
+  URING_RECV_FIXED,     // Registered buffer
+  URING_RECV_PLAIN,     // Neither could be registered
+} turing_recv_mode;
+
+struct uring {
+  int                  fd;
+  unsigned             sq_entries;
+
+  void                *sq_ptr;
+  size_t               sq_size;
+  void                *cq_ptr;
+  size_t               cq_size;
+  struct io_uring_sqe *sqes;
+  size_t               sqes_size;
+
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  unsigned             sqe_tail; // Prepared, not yet published
+
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+typedef struct {
+  tnetwork_driver_ctx driver; // Mandatory as first element of the struct
+
+  int fd;
+  unsigned timeout_sec;
+  struct uring ring;
+
+  turing_recv_mode recv_mode;
+  int recv_armed;
+  int eof;
+  int error;
+
+  // URING_N_BUFS buffers in multishot mode, the first one only otherwise
+  unsigned char *bufs;
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  unsigned short buf_ring_tail;
+
+  // What's left of the last received buffer
+  int cur_bid;
+  unsigned char *cur;
+  size_t cur_len;
+
+  unsigned char *send_buf;
+  size_t send_buf_size;
+  size_t send_len;
+  size_t send_off;
+} tnetwork_driver_uring_ctx;
+
+
+//
+// Ring management
+//
+
+static void uring_deinit(struct uring *ring)
+{
+  if (ring->sqes)
+    (void) munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    (void) munmap(ring->cq_ptr, ring->cq_size);
+  if (ring->sq_ptr)
+    (void) munmap(ring->sq_ptr, ring->sq_size);
+  if (ring->fd >= 0)
+    (void) close(ring->fd);
+
+  memset(ring, 0, sizeof *ring);
+  ring->fd = -1;
+}
+
+static int uring_init(struct uring *ring, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(ring, 0, sizeof *ring);
+  memset(&p, 0, sizeof p);
+
+  if ((ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+    logger("io_uring_setup: %m");
+    goto err;
+  }
+
+  // Timed waits need IORING_ENTER_EXT_ARG (5.11), and the single mmap
+  // comes with it.
+  if (! (p.features & IORING_FEAT_EXT_ARG) || ! (p.features & IORING_FEAT_SINGLE_MMAP)) {
+    logger("io_uring is too old, features 0x%x", p.features);
+    goto err;
+  }
+
+  ring->sq_entries = p.sq_entries;
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (ring->cq_size > ring->sq_size)
+    ring->sq_size = ring->cq_size;
+  ring->cq_size = ring->sq_size;
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    ring->sq_ptr = NULL;
+    logger("mmap: %m");
+    goto err;
+  }
+
+  ring->cq_ptr = ring->sq_ptr;
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    logger("mmap: %m");
+    goto err;
+  }
+
+  ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.array);
+  ring->sqe_tail = *ring->sq_tail;
+
+  ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + p.cq_off.cqes);
+
+  return 0;
+ err:
+  uring_deinit(ring);
+  return -1;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+  struct io_uring_sqe *sqe = NULL;
+  unsigned             head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned             idx;
+
+  if (ring->sqe_tail - head >= ring->sq_entries) {
+    logger("io_uring submission queue full");
+    return NULL;
+  }
+
+  idx = ring->sqe_tail++ & *ring->sq_mask;
+  ring->sq_array[idx] = idx;
+
+  sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof *sqe);
+  return sqe;
+}
+
+// Submit whatever was prepared and, unless min_complete is 0, wait for that
+// many completions.
+static int uring_enter(struct uring *ring, unsigned min_complete, unsigned timeout_sec)
+{
+  struct __kernel_timespec       ts = { .tv_sec = timeout_sec, .tv_nsec = 0 };
+  struct io_uring_getevents_arg  arg = {
+    .sigmask    = 0,
+    .sigmask_sz = _NSIG / 8,
+    .ts         = (uintptr_t) &ts,
+  };
+  unsigned                       flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+  while (1) {
+    // The kernel moves the head forward as it consumes the entries, which
+    // makes it safe to resume after an interruption.
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                min_complete ? flags : IORING_ENTER_GETEVENTS,
+                min_complete ? &arg : NULL, min_complete ? sizeof arg : 0) >= 0)
+      return 0;
+
+    if (errno == EINTR)
+      continue;
+
+    if (errno == ETIME)
+      errno = ETIMEDOUT;
+
+    logger("io_uring_enter: %m");
+    return -1;
+  }
+}
+
+static struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+static void uring_cqe_seen(struct uring *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_cqe *uring_wait_cqe(struct uring *ring, unsigned timeout_sec)
+{
+  struct io_uring_cqe *cqe = NULL;
+
+  if ((cqe = uring_peek_cqe(ring)) && ring->sqe_tail == *ring->sq_tail)
+    return cqe;
+
+  if (uring_enter(ring, cqe ? 0 : 1, timeout_sec) < 0)
+    return NULL;
+
+  return uring_peek_cqe(ring);
+}
+
+
+//
+// Receive buffers
+//
+
+static void uring_buf_ring_add(tnetwork_driver_uring_ctx *driver_ctx, unsigned short bid)
+{
+  struct io_uring_buf *buf = &driver_ctx->buf_ring->bufs[driver_ctx->buf_ring_tail & (URING_N_BUFS - 1)];
+
+  buf->addr = (uintptr_t) (driver_ctx->bufs + (size_t) bid * URING_BUF_SIZE);
+  buf->len = URING_BUF_SIZE;
+  buf->bid = bid;
+
+  __atomic_store_n(&driver_ctx->buf_ring->tail, ++driver_ctx->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_setup_buf_ring(tnetwork_driver_uring_ctx *driver_ctx)
+{
+  struct io_uring_buf_reg reg;
+
+  driver_ctx->buf_ring_size = URING_N_BUFS * sizeof(struct io_uring_buf);
+  driver_ctx->buf_ring = mmap(NULL, driver_ctx->buf_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (driver_ctx->buf_ring == MAP_FAILED) {
+    driver_ctx->buf_ring = NULL;
+    return -1;
+  }
+
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = (uintptr_t) driver_ctx->buf_ring;
+  reg.ring_entries = URING_N_BUFS;
+  reg.bgid = URING_BGID;
+
+  if (syscall(__NR_io_uring_register, driver_ctx->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    (void) munmap(driver_ctx->buf_ring, driver_ctx->buf_ring_size);
+    driver_ctx->buf_ring = NULL;
+    return -1;
+  }
+
+  for (unsigned short bid = 0; bid < URING_N_BUFS; bid++)
+    uring_buf_ring_add(driver_ctx, bid);
+
+  return 0;
+}
+
+static void uring_setup_buffers(tnetwork_driver_uring_ctx *driver_ctx)
+{
+  struct iovec iov = { .iov_base = driver_ctx->bufs, .iov_len = URING_BUF_SIZE };
+
+  if (! uring_setup_buf_ring(driver_ctx)) {
+    driver_ctx->recv_mode = URING_RECV_MULTISHOT;
+    return;
+  }
+
+  if (syscall(__NR_io_uring_register, driver_ctx->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+    driver_ctx->recv_mode = URING_RECV_FIXED;
+    return;
+  }
+
+  driver_ctx->recv_mode = URING_RECV_PLAIN;
+}
+
+static int uring_prep_recv(tnetwork_driver_uring_ctx *driver_ctx)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&driver_ctx->ring);
+
+  if (! sqe)
+    return -1;
+
+  sqe->fd = driver_ctx->fd;
+  sqe->user_data = URING_OP_RECV;
+
+  switch (driver_ctx->recv_mode) {
+  case URING_RECV_MULTISHOT:
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    break;
+
+  case URING_RECV_FIXED:
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (uintptr_t) driver_ctx->bufs;
+    sqe->len = URING_BUF_SIZE;
+    sqe->buf_index = 0;
+    break;
+
+  case URING_RECV_PLAIN:
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = (uintptr_t) driver_ctx->bufs;
+    sqe->len = URING_BUF_SIZE;
+    break;
+  }
+
+  driver_ctx->recv_armed = 1;
+  return 0;
+}
+
+static int uring_prep_send(tnetwork_driver_uring_ctx *driver_ctx)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&driver_ctx->ring);
+
+  if (! sqe)
+    return -1;
+
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = driver_ctx->fd;
+  sqe->addr = (uintptr_t) (driver_ctx->send_buf + driver_ctx->send_off);
+  sqe->len = (unsigned) (driver_ctx->send_len - driver_ctx->send_off);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = URING_OP_SEND;
+
+  return 0;
+}
+
+// Handle a completion of the established connection
+static void uring_complete(tnetwork_driver_uring_ctx *driver_ctx, struct io_uring_cqe *cqe)
+{
+  switch (cqe->user_data) {
+  case URING_OP_SEND:
+    if (cqe->res < 0) {
+      driver_ctx->error = -cqe->res;
+      break;
+    }
+
+    // Short send: go on with the rest
+    driver_ctx->send_off += (size_t) cqe->res;
+    if (driver_ctx->send_off < driver_ctx->send_len && uring_prep_send(driver_ctx) < 0)
+      driver_ctx->error = ENOBUFS;
+    break;
+
+  case URING_OP_RECV:
+    if (! (cqe->flags & IORING_CQE_F_MORE))
+      driver_ctx->recv_armed = 0;
+
+    if (cqe->res == -ENOBUFS && driver_ctx->recv_mode == URING_RECV_MULTISHOT)
+      break; // We'll re-arm once the buffers are given back
+
+    if (cqe->res == -EINVAL && driver_ctx->recv_mode == URING_RECV_MULTISHOT) {
+      // Buffer rings without multishot recv: 5.19 kernels
+      driver_ctx->recv_mode = URING_RECV_PLAIN;
+      break;
+    }
+
+    if (cqe->res < 0) {
+      driver_ctx->error = -cqe->res;
+      break;
+    }
+
+    if (0 == cqe->res) {
+      driver_ctx->eof = 1;
+      break;
+    }
+
+    if (driver_ctx->recv_mode == URING_RECV_MULTISHOT) {
+      driver_ctx->cur_bid = (int) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      driver_ctx->cur = driver_ctx->bufs + (size_t) driver_ctx->cur_bid * URING_BUF_SIZE;
+    } else {
+      driver_ctx->cur = driver_ctx->bufs;
+    }
+
+    driver_ctx->cur_len = (size_t) cqe->res;
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+//
+// Driver
+//
+
+static int network_driver_uring_connect(tnetwork_driver_ctx *ctx, char *host, char *port, unsigned timeout_sec)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+  int                        fd = -1;
+
+  driver_ctx->timeout_sec = timeout_sec;
+
+  // The ring only carries the exchanges, the addresses are raced beforehand
+  if ((fd = network_connect(host, port, event_loop_now_ms() + timeout_sec * 1000LL)) < 0)
+    return -1;
+
+  if (network_set_nonblock(fd, 0) < 0) {
+    logger("fcntl: %m");
+    (void) close(fd);
+    return -1;
+  }
+
+  driver_ctx->fd = fd;
+  return fd;
+}
+
+// Only queued: the request leaves along with the receive in read_func.
+static int network_driver_uring_send(tnetwork_driver_ctx *ctx, void *buf, size_t len)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+
+  if (driver_ctx->send_off < driver_ctx->send_len) {
+    logger("a send is still in flight");
+    return -1;
+  }
+
+  if (len > driver_ctx->send_buf_size) {
+    unsigned char *tmp = realloc(driver_ctx->send_buf, len);
+    if (! tmp) {
+      logger("realloc: %m");
+      return -1;
+    }
+
+    driver_ctx->send_buf = tmp;
+    driver_ctx->send_buf_size = len;
+  }
+
+  memcpy(driver_ctx->send_buf, buf, len);
+  driver_ctx->send_len = len;
+  driver_ctx->send_off = 0;
+
+  if (! len)
+    return 0;
+
+  return uring_prep_send(driver_ctx);
+}
+
+static ssize_t network_driver_uring_read(tnetwork_driver_ctx *ctx, unsigned char *buf, size_t len)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+  struct io_uring_cqe       *cqe = NULL;
+
+  while (1) {
+    if (driver_ctx->cur_len) {
+      size_t n = len < driver_ctx->cur_len ? len : driver_ctx->cur_len;
+
+      memcpy(buf, driver_ctx->cur, n);
+      driver_ctx->cur += n;
+      driver_ctx->cur_len -= n;
+
+      if (! driver_ctx->cur_len && driver_ctx->cur_bid >= 0) {
+        uring_buf_ring_add(driver_ctx, (unsigned short) driver_ctx->cur_bid);
+        driver_ctx->cur_bid = -1;
+      }
+
+      return (ssize_t) n;
+    }
+
+    if (driver_ctx->error) {
+      errno = driver_ctx->error;
+      logger("recv: %m");
+      return -1;
+    }
+
+    if (driver_ctx->eof)
+      return 0;
+
+    if (! driver_ctx->recv_armed && uring_prep_recv(driver_ctx) < 0)
+      return -1;
+
+    if (! (cqe = uring_wait_cqe(&driver_ctx->ring, driver_ctx->timeout_sec)))
+      return -1;
+
+    uring_complete(driver_ctx, cqe);
+    uring_cqe_seen(&driver_ctx->ring);
+  }
+}
+
+// An idle connection is alive when nothing came in since the last reply:
+// neither an EOF nor unsolicited data.
+static int network_driver_uring_is_alive(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+  unsigned char              c;
+  ssize_t                    n = -1;
+
+  if (driver_ctx->fd < 0 || driver_ctx->cur_len || driver_ctx->eof || driver_ctx->error)
+    return 0;
+
+  // Let the kernel post whatever completed in the meantime
+  if (uring_enter(&driver_ctx->ring, 0, 0) < 0)
+    return 0;
+
+  if (uring_peek_cqe(&driver_ctx->ring))
+    return 0;
+
+  if (driver_ctx->recv_armed)
+    return 1;
+
+  n = recv(driver_ctx->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return 1;
+
+  return 0;
+}
+
+static int network_driver_uring_get_fd(tnetwork_driver_ctx *ctx)
+{
+  return ((tnetwork_driver_uring_ctx *) ctx)->fd;
+}
+
+static char *network_driver_uring_get_name(void)
+{
+  return "uring";
+}
+
+static void network_driver_uring_free(tnetwork_driver_ctx *ctx)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+
+  // Closing the ring cancels whatever is in flight before the buffers go
+  uring_deinit(&driver_ctx->ring);
+
+  if (driver_ctx->fd >= 0)
+    (void) close(driver_ctx->fd);
+
+  if (driver_ctx->buf_ring)
+    (void) munmap(driver_ctx->buf_ring, driver_ctx->buf_ring_size);
+
+  free(driver_ctx->bufs);
+  free(driver_ctx->send_buf);
+  free(driver_ctx);
+}
+
+tnetwork_driver_ctx *network_driver_uring_create(void)
+{
+  tnetwork_driver_uring_ctx *ctx = calloc(1, sizeof *ctx);
+  if (! ctx) {
+    logger("calloc: %m");
+    return NULL;
+  }
+
+  ctx->fd = -1;
+  ctx->cur_bid = -1;
+  ctx->ring.fd = -1;
+
+  if (uring_init(&ctx->ring, URING_ENTRIES) < 0) {
+    logger("io_uring unavailable, falling back to the plain driver");
+    network_driver_uring_free((tnetwork_driver_ctx *) ctx);
+    return network_driver_plain_create();
+  }
+
+  if (! (ctx->bufs = malloc((size_t) URING_N_BUFS * URING_BUF_SIZE))) {
+    logger("malloc: %m");
+    network_driver_uring_free((tnetwork_driver_ctx *) ctx);
+    return NULL;
+  }
+
+  uring_setup_buffers(ctx);
+
+  ctx->driver.connect_func  = network_driver_uring_connect;
+  ctx->driver.send_func     = network_driver_uring_send;
+  ctx->driver.read_func     = network_driver_uring_read;
+  ctx->driver.get_name_func = network_driver_uring_get_name;
+  ctx->driver.free_func     = network_driver_uring_free;
+  ctx->driver.is_alive_func = network_driver_uring_is_alive;
+  ctx->driver.get_fd_func   = network_driver_uring_get_fd;
+
+  return (tnetwork_driver_ctx *) ctx;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/network_uring_utest.c"
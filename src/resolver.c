@@ -0,0 +1,1076 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "util.h"
+#include "logger.h"
+#include "network.h"
+#include "resolver.h"
+#include "event_loop.h"
+
+// Host name resolution for the connector, with a cache of the answers (and
+// of the failures) for the duration of their TTL.
+//
+// Overrides pin the addresses of a host:port, as curl's --resolve does: no
+// resolver is involved at all, while the host name still goes to the Host
+// header, the SNI and the certificate verification.
+//
+// By default, the resolution goes through getaddrinfo(), which blocks and
+// does not tell the TTLs: the answers are kept RESOLVER_DEFAULT_TTL_SEC.
+// The stub resolver rather sends its own A and AAAA queries to the
+// nameserver over UDP, without blocking: a query then exposes an fd to wait
+// on for reading, like the connector does.  It does not read /etc/hosts,
+// apart from localhost which always is the loopback (RFC 6761).  Its
+// queries advertise EDNS0 and replies of DNS_EDNS_PAYLOAD bytes; one
+// truncated nonetheless is given up for getaddrinfo(), which goes over TCP
+// where need be.
+
+#define DNS_HEADER_LEN     12
+#define DNS_OPT_LEN        11
+#define DNS_QUERY_MAX_LEN  (DNS_HEADER_LEN + 256 + 4 + DNS_OPT_LEN)
+#define DNS_REPLY_MAX_LEN  1500
+// The payload size advertised with EDNS0, that of the DNS flag day 2020
+#define DNS_EDNS_PAYLOAD   1232
+
+#define DNS_TYPE_A         1
+#define DNS_TYPE_SOA       6
+#define DNS_TYPE_AAAA      28
+#define DNS_TYPE_OPT       41
+#define DNS_CLASS_IN       1
+#define DNS_RCODE_NXDOMAIN 3
+
+#define RESOLVER_RESOLV_CONF "/etc/resolv.conf"
+#define RESOLVER_DNS_PORT    53
+
+union resolver_addr {
+  struct sockaddr     sa;
+  struct sockaddr_in  sin;
+  struct sockaddr_in6 sin6;
+};
+
+struct resolver_addrs {
+  size_t              n;
+  union resolver_addr addr[RESOLVER_MAX_ADDRS];
+};
+
+struct resolver_entry {
+  char                 *host;
+  long long             expires_ms;
+  struct resolver_addrs addrs; // None for a failure
+};
+
+// IPv6 first, as getaddrinfo() would usually sort them
+enum {
+  RESOLVER_QUESTION_AAAA,
+  RESOLVER_QUESTION_A,
+  RESOLVER_N_QUESTIONS,
+};
+
+static uint16_t resolver_qtypes[RESOLVER_N_QUESTIONS] = { DNS_TYPE_AAAA, DNS_TYPE_A };
+
+struct resolver_query {
+  char                 *host;
+  uint16_t              port;
+
+  int                   status; // NETWORK_WANT_READ while resolving, 0 once resolved, -1 on failure
+  struct resolver_addrs addrs;
+
+  // Stub resolver: one UDP socket for both questions, and a timer for the
+  // retransmissions, watched through epfd.
+  int                   fd;
+  int                   epfd;
+  int                   tfd;
+  unsigned              n_tries;
+  uint32_t              ttl;
+  struct {
+    uint16_t              id;
+    int                   done;
+    unsigned char         packet[DNS_QUERY_MAX_LEN];
+    size_t                packet_len;
+    struct resolver_addrs addrs;
+  } questions[RESOLVER_N_QUESTIONS];
+};
+
+// Static addresses for host:port, checked before anything else
+struct resolver_override {
+  char                 *host;
+  uint16_t              port;
+  struct resolver_addrs addrs;
+};
+
+static pthread_mutex_t       resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct resolver_entry resolver_cache[RESOLVER_CACHE_MAX_ENTRIES];
+static unsigned              resolver_n_entries = 0;
+static struct resolver_stats resolver_stats;
+static int                   resolver_stub = 0;
+static union resolver_addr   resolver_nameserver; // AF_UNSPEC until known
+
+static struct resolver_override *resolver_overrides = NULL;
+static size_t                    resolver_n_overrides = 0;
+
+
+//
+// Cache
+//
+
+static void resolver_cache_remove(unsigned i)
+{
+  free(resolver_cache[i].host);
+
+  memmove(&resolver_cache[i], &resolver_cache[i + 1],
+          (resolver_n_entries - i - 1) * sizeof resolver_cache[0]);
+  resolver_n_entries--;
+}
+
+static void resolver_cache_flush(void)
+{
+  while (resolver_n_entries)
+    resolver_cache_remove(resolver_n_entries - 1);
+}
+
+// Look the host up, dropping its entry if expired: 1 when found, 0 if not
+static int resolver_cache_lookup(char *host, struct resolver_addrs *addrs)
+{
+  for (unsigned i = 0; i < resolver_n_entries; i++) {
+    if (strcasecmp(resolver_cache[i].host, host))
+      continue;
+
+    if (resolver_cache[i].expires_ms <= event_loop_now_ms()) {
+      resolver_cache_remove(i);
+      return 0;
+    }
+
+    *addrs = resolver_cache[i].addrs;
+    return 1;
+  }
+
+  return 0;
+}
+
+// The oldest entry makes room when the cache is full, unless one expired
+static void resolver_cache_insert(char *host, struct resolver_addrs *addrs, uint32_t ttl_sec)
+{
+  long long now_ms = event_loop_now_ms();
+  char     *key = NULL;
+
+  if (! ttl_sec || ! (key = strdup(host)))
+    return;
+
+  for (unsigned i = resolver_n_entries; i-- > 0; ) {
+    if (! strcasecmp(resolver_cache[i].host, host) || resolver_cache[i].expires_ms <= now_ms)
+      resolver_cache_remove(i);
+  }
+
+  if (resolver_n_entries == RESOLVER_CACHE_MAX_ENTRIES)
+    resolver_cache_remove(0);
+
+  resolver_cache[resolver_n_entries].host = key;
+  resolver_cache[resolver_n_entries].expires_ms = now_ms + ttl_sec * 1000LL;
+  resolver_cache[resolver_n_entries].addrs = *addrs;
+  resolver_n_entries++;
+}
+
+static void resolver_cache_store(char *host, struct resolver_addrs *addrs, uint32_t ttl_sec)
+{
+  pthread_mutex_lock(&resolver_lock);
+  resolver_cache_insert(host, addrs, ttl_sec);
+  pthread_mutex_unlock(&resolver_lock);
+}
+
+
+//
+// Addresses
+//
+
+static void resolver_addrs_add(struct resolver_addrs *addrs, int family, const void *raw)
+{
+  union resolver_addr *addr = &addrs->addr[addrs->n];
+
+  if (addrs->n == RESOLVER_MAX_ADDRS)
+    return;
+
+  memset(addr, 0, sizeof *addr);
+  addr->sa.sa_family = (sa_family_t) family;
+  if (family == AF_INET)
+    memcpy(&addr->sin.sin_addr, raw, sizeof addr->sin.sin_addr);
+  else
+    memcpy(&addr->sin6.sin6_addr, raw, sizeof addr->sin6.sin6_addr);
+
+  addrs->n++;
+}
+
+// addr, addr:port or [addr6]:port, the port defaulting to default_port
+static int resolver_parse_addr(char *str, uint16_t default_port, union resolver_addr *addr)
+{
+  char           buf[INET6_ADDRSTRLEN + 8];
+  char          *host = buf;
+  char          *port = NULL;
+  char          *end = NULL;
+  unsigned long  port_num = default_port;
+
+  if (strlen(str) >= sizeof buf)
+    return -1;
+
+  strcpy(buf, str);
+
+  if (*host == '[') {
+    if (! (end = strchr(++host, ']')) || (end[1] && end[1] != ':'))
+      return -1;
+    *end = '\0';
+    if (end[1])
+      port = end + 2;
+  } else if ((port = strchr(host, ':')) && ! strchr(port + 1, ':')) {
+    *port++ = '\0';
+  } else {
+    // A bare IPv6 address
+    port = NULL;
+  }
+
+  if (port) {
+    errno = 0;
+    port_num = strtoul(port, &end, 10);
+    if (errno || ! *port || *end || ! port_num || port_num > UINT16_MAX)
+      return -1;
+  }
+
+  memset(addr, 0, sizeof *addr);
+  if (inet_pton(AF_INET, host, &addr->sin.sin_addr) == 1) {
+    addr->sin.sin_family = AF_INET;
+    addr->sin.sin_port = htons((uint16_t) port_num);
+  } else if (inet_pton(AF_INET6, host, &addr->sin6.sin6_addr) == 1) {
+    addr->sin6.sin6_family = AF_INET6;
+    addr->sin6.sin6_port = htons((uint16_t) port_num);
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+static socklen_t resolver_addr_len(union resolver_addr *addr)
+{
+  return addr->sa.sa_family == AF_INET ? sizeof addr->sin : sizeof addr->sin6;
+}
+
+// The addresses with the port, as a list made of a single allocation, to be
+// released with free().
+static struct addrinfo *resolver_addrinfo_new(struct resolver_addrs *addrs, uint16_t port)
+{
+  struct addrinfo     *ais = NULL;
+  union resolver_addr *sas = NULL;
+
+  if (! (ais = calloc(addrs->n, sizeof *ais + sizeof *sas))) {
+    logger("calloc: %m");
+    return NULL;
+  }
+
+  sas = (union resolver_addr *) (ais + addrs->n);
+
+  for (size_t i = 0; i < addrs->n; i++) {
+    sas[i] = addrs->addr[i];
+    if (sas[i].sa.sa_family == AF_INET)
+      sas[i].sin.sin_port = htons(port);
+    else
+      sas[i].sin6.sin6_port = htons(port);
+
+    ais[i].ai_family = sas[i].sa.sa_family;
+    ais[i].ai_socktype = SOCK_STREAM;
+    ais[i].ai_protocol = IPPROTO_TCP;
+    ais[i].ai_addr = &sas[i].sa;
+    ais[i].ai_addrlen = resolver_addr_len(&sas[i]);
+    ais[i].ai_next = i + 1 < addrs->n ? &ais[i + 1] : NULL;
+  }
+
+  return ais;
+}
+
+
+//
+// DNS messages
+//
+
+static uint16_t dns_u16(const unsigned char *p)
+{
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t dns_u32(const unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static int dns_skip_name(const unsigned char *msg, size_t len, size_t *offp)
+{
+  size_t off = *offp;
+
+  while (off < len) {
+    unsigned char label_len = msg[off];
+
+    // Compression pointer, which ends the name
+    if ((label_len & 0xc0) == 0xc0) {
+      if (off + 2 > len)
+        return -1;
+      *offp = off + 2;
+      return 0;
+    }
+
+    if (label_len & 0xc0)
+      return -1;
+
+    off += 1 + label_len;
+    if (! label_len) {
+      *offp = off;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+// A recursive query for the host, 0 if the name cannot be encoded
+static size_t dns_query_encode(unsigned char *buf, uint16_t id, uint16_t qtype, char *host)
+{
+  size_t off = DNS_HEADER_LEN;
+
+  memset(buf, 0, DNS_HEADER_LEN);
+  buf[0] = (unsigned char) (id >> 8);
+  buf[1] = (unsigned char) id;
+  buf[2] = 0x01; // Recursion desired
+  buf[5] = 1;    // One question
+
+  while (*host) {
+    size_t label_len = strcspn(host, ".");
+
+    if (! label_len || label_len > 63 || off + 1 + label_len > DNS_HEADER_LEN + 255)
+      return 0;
+
+    buf[off++] = (unsigned char) label_len;
+    memcpy(buf + off, host, label_len);
+    off += label_len;
+
+    host += label_len;
+    if (*host == '.')
+      host++;
+  }
+
+  buf[off++] = 0;
+  buf[off++] = (unsigned char) (qtype >> 8);
+  buf[off++] = (unsigned char) qtype;
+  buf[off++] = 0;
+  buf[off++] = DNS_CLASS_IN;
+
+  // EDNS0 OPT record (RFC 6891): root name, the payload size in place of
+  // the class, no extended rcode, version 0, no flags and no options
+  buf[11] = 1;
+  memset(buf + off, 0, DNS_OPT_LEN);
+  buf[off + 2] = DNS_TYPE_OPT;
+  buf[off + 3] = (unsigned char) (DNS_EDNS_PAYLOAD >> 8);
+  buf[off + 4] = (unsigned char) DNS_EDNS_PAYLOAD;
+  off += DNS_OPT_LEN;
+
+  return off;
+}
+
+// The question of a reply is that of the query, whatever the case of the
+// name: the labels' lengths are below 'A', left alone by tolower()
+static int dns_question_equal(const unsigned char *a, const unsigned char *b, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (tolower(a[i]) != tolower(b[i]))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Pick the addresses out of a reply to query, along with how long they can
+// be cached: the smallest TTL of the answers, or for a negative answer the
+// one of the SOA record (RFC 2308).  Returns 1 when the message is not the
+// reply to this query, its ID, name, type and class, 2 when it was
+// truncated, -1 when the reply is unusable.
+static int dns_reply_parse(const unsigned char *msg, size_t len, const unsigned char *query,
+                           struct resolver_addrs *addrs, uint32_t *ttlp)
+{
+  size_t   off = DNS_HEADER_LEN;
+  uint32_t ttl = UINT32_MAX;
+  unsigned n_answers = 0;
+  unsigned n_records = 0;
+  int      rcode = -1;
+  uint16_t qtype = 0;
+
+  // Ours, well-formed
+  (void) dns_skip_name(query, DNS_QUERY_MAX_LEN, &off);
+  qtype = dns_u16(query + off);
+  off += 4;
+
+  if (len < off || dns_u16(msg) != dns_u16(query) || ! (msg[2] & 0x80) || dns_u16(msg + 4) != 1 ||
+      ! dns_question_equal(msg + DNS_HEADER_LEN, query + DNS_HEADER_LEN, off - DNS_HEADER_LEN))
+    return 1;
+
+  if (msg[2] & 0x02)
+    return 2;
+
+  if ((rcode = msg[3] & 0x0f) && rcode != DNS_RCODE_NXDOMAIN) {
+    logger("DNS error, rcode %d", rcode);
+    return -1;
+  }
+
+  n_answers = dns_u16(msg + 6);
+  n_records = n_answers + dns_u16(msg + 8);
+
+  for (unsigned i = 0; i < n_records; i++) {
+    uint16_t type = 0;
+    uint16_t class = 0;
+    uint32_t record_ttl = 0;
+    uint16_t rdlen = 0;
+
+    if (dns_skip_name(msg, len, &off) < 0 || off + 10 > len)
+      goto malformed;
+
+    type = dns_u16(msg + off);
+    class = dns_u16(msg + off + 2);
+    record_ttl = dns_u32(msg + off + 4);
+    rdlen = dns_u16(msg + off + 8);
+    off += 10;
+
+    if (off + rdlen > len)
+      goto malformed;
+
+    if (i < n_answers) {
+      // Including the CNAME records leading to the addresses
+      if (record_ttl < ttl)
+        ttl = record_ttl;
+
+      if (class == DNS_CLASS_IN && type == qtype && type == DNS_TYPE_A && rdlen == 4)
+        resolver_addrs_add(addrs, AF_INET, msg + off);
+      else if (class == DNS_CLASS_IN && type == qtype && type == DNS_TYPE_AAAA && rdlen == 16)
+        resolver_addrs_add(addrs, AF_INET6, msg + off);
+    } else if (type == DNS_TYPE_SOA && rdlen >= 20 && ! addrs->n) {
+      uint32_t minimum = dns_u32(msg + off + rdlen - 4);
+
+      ttl = record_ttl < minimum ? record_ttl : minimum;
+    }
+
+    off += rdlen;
+  }
+
+  if (ttl == UINT32_MAX)
+    ttl = RESOLVER_NEGATIVE_TTL_SEC;
+
+  *ttlp = ttl;
+  return 0;
+
+ malformed:
+  logger("malformed DNS reply");
+  return -1;
+}
+
+
+//
+// Stub resolver
+//
+
+static int resolver_load_resolv_conf(union resolver_addr *addr)
+{
+  FILE *fp = NULL;
+  char  line[256];
+  char  server[INET6_ADDRSTRLEN + 1];
+  int   ret = -1;
+
+  if ((fp = fopen(RESOLVER_RESOLV_CONF, "r"))) {
+    while (ret < 0 && fgets(line, sizeof line, fp)) {
+      if (sscanf(line, " nameserver %46s", server) == 1 &&
+          resolver_parse_addr(server, RESOLVER_DNS_PORT, addr) == 0)
+        ret = 0;
+    }
+
+    (void) fclose(fp);
+  }
+
+  // As the libc would do
+  if (ret < 0)
+    ret = resolver_parse_addr("127.0.0.1", RESOLVER_DNS_PORT, addr);
+
+  return ret;
+}
+
+static void resolver_stub_close(tresolver_query *query)
+{
+  if (query->fd >= 0)
+    (void) close(query->fd);
+  if (query->tfd >= 0)
+    (void) close(query->tfd);
+  if (query->epfd >= 0)
+    (void) close(query->epfd);
+
+  query->fd = query->tfd = query->epfd = -1;
+}
+
+// (Re)send the unanswered questions, and wait for the next try
+static int resolver_stub_send(tresolver_query *query)
+{
+  struct itimerspec its = {
+    .it_value = {
+      .tv_sec = RESOLVER_STUB_RETRY_MS / 1000,
+      .tv_nsec = (RESOLVER_STUB_RETRY_MS % 1000) * 1000000L,
+    },
+  };
+
+  for (int i = 0; i < RESOLVER_N_QUESTIONS; i++) {
+    if (query->questions[i].done)
+      continue;
+
+    if (send(query->fd, query->questions[i].packet, query->questions[i].packet_len, 0) < 0 &&
+        errno != EAGAIN) {
+      logger("send: %m");
+      return -1;
+    }
+  }
+
+  query->n_tries++;
+
+  if (timerfd_settime(query->tfd, 0, &its, NULL) < 0) {
+    logger("timerfd_settime: %m");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int resolver_stub_start(tresolver_query *query)
+{
+  union resolver_addr nameserver;
+  struct epoll_event  ev = { .events = EPOLLIN };
+
+  pthread_mutex_lock(&resolver_lock);
+  if (resolver_nameserver.sa.sa_family == AF_UNSPEC)
+    (void) resolver_load_resolv_conf(&resolver_nameserver);
+  nameserver = resolver_nameserver;
+  pthread_mutex_unlock(&resolver_lock);
+
+  for (int i = 0; i < RESOLVER_N_QUESTIONS; i++) {
+    uint16_t id = 0;
+
+    // Random IDs, against spoofed replies; distinct, to tell the replies apart
+    if (getrandom(&id, sizeof id, GRND_NONBLOCK) != sizeof id)
+      id = (uint16_t) (event_loop_now_ms() ^ getpid());
+    if (i && id == query->questions[0].id)
+      id++;
+
+    query->questions[i].id = id;
+    if (! (query->questions[i].packet_len = dns_query_encode(query->questions[i].packet, id,
+                                                             resolver_qtypes[i], query->host))) {
+      logger("%s: invalid host name", query->host);
+      return -1;
+    }
+  }
+
+  if ((query->fd = socket(nameserver.sa.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+      connect(query->fd, &nameserver.sa, resolver_addr_len(&nameserver)) < 0) {
+    logger("nameserver socket: %m");
+    return -1;
+  }
+
+  if ((query->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (query->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    logger("resolver fds: %m");
+    return -1;
+  }
+
+  ev.data.fd = query->fd;
+  if (epoll_ctl(query->epfd, EPOLL_CTL_ADD, query->fd, &ev) < 0) {
+    logger("epoll_ctl: %m");
+    return -1;
+  }
+
+  ev.data.fd = query->tfd;
+  if (epoll_ctl(query->epfd, EPOLL_CTL_ADD, query->tfd, &ev) < 0) {
+    logger("epoll_ctl: %m");
+    return -1;
+  }
+
+  query->ttl = UINT32_MAX;
+  query->status = NETWORK_WANT_READ;
+
+  return resolver_stub_send(query);
+}
+
+// Both questions are answered
+static void resolver_stub_finish(tresolver_query *query)
+{
+  for (int i = 0; i < RESOLVER_N_QUESTIONS; i++) {
+    struct resolver_addrs *addrs = &query->questions[i].addrs;
+
+    for (size_t j = 0; j < addrs->n && query->addrs.n < RESOLVER_MAX_ADDRS; j++)
+      query->addrs.addr[query->addrs.n++] = addrs->addr[j];
+  }
+
+  resolver_cache_store(query->host, &query->addrs, query->ttl);
+  resolver_stub_close(query);
+
+  if (! query->addrs.n) {
+    logger("%s: no such host", query->host);
+    query->status = -1;
+    return;
+  }
+
+  query->status = 0;
+}
+
+static int resolver_getaddrinfo(tresolver_query *query);
+
+static int resolver_stub_progress(tresolver_query *query)
+{
+  unsigned char buf[DNS_REPLY_MAX_LEN];
+  uint64_t      expirations = 0;
+  ssize_t       n = -1;
+
+  while ((n = recv(query->fd, buf, sizeof buf, 0)) >= 0 || errno == EINTR) {
+    int n_done = 0;
+
+    for (int i = 0; n > 0 && i < RESOLVER_N_QUESTIONS; i++) {
+      uint32_t ttl = 0;
+      int      rc = 1;
+
+      if (! query->questions[i].done)
+        rc = dns_reply_parse(buf, (size_t) n, query->questions[i].packet, &query->questions[i].addrs, &ttl);
+
+      if (rc < 0)
+        goto err;
+
+      // Too large for a datagram: getaddrinfo() knows how to do without
+      if (rc == 2) {
+        logger_verbose("%s: truncated DNS reply, resolving through getaddrinfo()", query->host);
+        resolver_stub_close(query);
+        query->status = resolver_getaddrinfo(query) < 0 ? -1 : 0;
+        return query->status;
+      }
+
+      if (rc == 0) {
+        query->questions[i].done = 1;
+        if (ttl < query->ttl)
+          query->ttl = ttl;
+      }
+
+      n_done += query->questions[i].done;
+    }
+
+    if (n_done == RESOLVER_N_QUESTIONS) {
+      resolver_stub_finish(query);
+      return query->status;
+    }
+  }
+
+  if (errno != EAGAIN) {
+    logger("%s: nameserver: %m", query->host);
+    goto err;
+  }
+
+  if (read(query->tfd, &expirations, sizeof expirations) > 0) {
+    if (query->n_tries == RESOLVER_STUB_TRIES) {
+      logger("%s: no answer from the nameserver", query->host);
+      goto err;
+    }
+
+    if (resolver_stub_send(query) < 0)
+      goto err;
+  }
+
+  return NETWORK_WANT_READ;
+
+ err:
+  resolver_stub_close(query);
+  query->status = -1;
+  return -1;
+}
+
+
+//
+// Overrides
+//
+
+// 1 when host:port is overridden, with its addresses
+static int resolver_override_lookup(char *host, uint16_t port, struct resolver_addrs *addrs)
+{
+  for (size_t i = 0; i < resolver_n_overrides; i++) {
+    if (resolver_overrides[i].port == port && ! strcasecmp(resolver_overrides[i].host, host)) {
+      *addrs = resolver_overrides[i].addrs;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void resolver_overrides_flush(void)
+{
+  for (size_t i = 0; i < resolver_n_overrides; i++)
+    free(resolver_overrides[i].host);
+
+  free(resolver_overrides);
+  resolver_overrides = NULL;
+  resolver_n_overrides = 0;
+}
+
+// host:port:addr[,addr...], the IPv6 addresses within brackets or not.  The
+// addresses are tried in this order.
+static int resolver_parse_override(char *spec, struct resolver_override *override)
+{
+  char          *buf = NULL;
+  char          *port = NULL;
+  char          *addr = NULL;
+  char          *saveptr = NULL;
+  char          *end = NULL;
+  unsigned long  port_num = 0;
+
+  memset(override, 0, sizeof *override);
+
+  if (! (buf = strdup(spec))) {
+    logger("strdup: %m");
+    return -1;
+  }
+
+  if (! (port = strchr(buf, ':')) || ! (addr = strchr(port + 1, ':')))
+    goto invalid;
+
+  *port++ = '\0';
+  *addr++ = '\0';
+
+  errno = 0;
+  port_num = strtoul(port, &end, 10);
+  if (! *buf || errno || ! *port || *end || ! port_num || port_num > UINT16_MAX)
+    goto invalid;
+
+  for (char *tok = strtok_r(addr, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+    union resolver_addr *a = &override->addrs.addr[override->addrs.n];
+
+    // No port of their own: the parsed one stays 0
+    if (override->addrs.n == RESOLVER_MAX_ADDRS ||
+        resolver_parse_addr(tok, 0, a) < 0 ||
+        (a->sa.sa_family == AF_INET ? a->sin.sin_port : a->sin6.sin6_port))
+      goto invalid;
+
+    override->addrs.n++;
+  }
+
+  if (! override->addrs.n)
+    goto invalid;
+
+  override->host = buf;
+  override->port = (uint16_t) port_num;
+  return 0;
+
+ invalid:
+  logger("invalid address override: %s", spec);
+  free(buf);
+  return -1;
+}
+
+// Whether spec is a valid override, for the command line to tell early
+int resolver_check_override(char *spec)
+{
+  struct resolver_override override;
+
+  if (resolver_parse_override(spec, &override) < 0)
+    return -1;
+
+  free(override.host);
+  return 0;
+}
+
+// Pin the addresses of a host:port, replacing any previous override
+int resolver_add_override(char *spec)
+{
+  struct resolver_override  override;
+  struct resolver_override *tmp = NULL;
+  int                       ret = -1;
+
+  if (resolver_parse_override(spec, &override) < 0)
+    return -1;
+
+  pthread_mutex_lock(&resolver_lock);
+
+  for (size_t i = 0; i < resolver_n_overrides; i++) {
+    if (resolver_overrides[i].port == override.port &&
+        ! strcasecmp(resolver_overrides[i].host, override.host)) {
+      free(resolver_overrides[i].host);
+      resolver_overrides[i] = override;
+      ret = 0;
+      goto end;
+    }
+  }
+
+  if (! (tmp = realloc(resolver_overrides, (resolver_n_overrides + 1) * sizeof *tmp))) {
+    logger("realloc: %m");
+    free(override.host);
+    goto end;
+  }
+
+  resolver_overrides = tmp;
+  resolver_overrides[resolver_n_overrides++] = override;
+  ret = 0;
+
+ end:
+  pthread_mutex_unlock(&resolver_lock);
+  return ret;
+}
+
+// One override per line, blank lines and # comments ignored
+int resolver_load_overrides(char *path)
+{
+  FILE *fp = NULL;
+  char  line[1024];
+  int   ret = 0;
+
+  if (! (fp = fopen(path, "r"))) {
+    logger("fopen %s: %m", path);
+    return -1;
+  }
+
+  while (! ret && fgets(line, sizeof line, fp)) {
+    char *spec = line + strspn(line, " \t");
+
+    spec[strcspn(spec, " \t\r\n#")] = '\0';
+    if (*spec && resolver_add_override(spec) < 0)
+      ret = -1;
+  }
+
+  (void) fclose(fp);
+  return ret;
+}
+
+
+//
+// Queries
+//
+
+static int resolver_getaddrinfo(tresolver_query *query)
+{
+  struct addrinfo  hints, *res = NULL, *rp = NULL;
+  int              gai = -1;
+
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  if ((gai = getaddrinfo(query->host, NULL, &hints, &res))) {
+    logger("getaddrinfo: %s", gai_strerror(gai));
+
+    // Only a definite answer is worth remembering
+    if (gai == EAI_NONAME)
+      resolver_cache_store(query->host, &query->addrs, RESOLVER_NEGATIVE_TTL_SEC);
+    return -1;
+  }
+
+  for (rp = res; rp; rp = rp->ai_next) {
+    if (rp->ai_family == AF_INET)
+      resolver_addrs_add(&query->addrs, AF_INET, &((struct sockaddr_in *) rp->ai_addr)->sin_addr);
+    else if (rp->ai_family == AF_INET6)
+      resolver_addrs_add(&query->addrs, AF_INET6, &((struct sockaddr_in6 *) rp->ai_addr)->sin6_addr);
+  }
+
+  freeaddrinfo(res);
+
+  resolver_cache_store(query->host, &query->addrs, RESOLVER_DEFAULT_TTL_SEC);
+  return query->addrs.n ? 0 : -1;
+}
+
+// Whatever does not need a resolver: 1 when resolved this way
+static int resolver_resolve_locally(tresolver_query *query, int stub)
+{
+  struct in6_addr addr6;
+  struct in_addr  addr;
+
+  if (inet_pton(AF_INET6, query->host, &addr6) == 1) {
+    resolver_addrs_add(&query->addrs, AF_INET6, &addr6);
+    return 1;
+  }
+
+  if (inet_pton(AF_INET, query->host, &addr) == 1) {
+    resolver_addrs_add(&query->addrs, AF_INET, &addr);
+    return 1;
+  }
+
+  if (stub && ! strcasecmp(query->host, "localhost")) {
+    resolver_addrs_add(&query->addrs, AF_INET6, &in6addr_loopback);
+    addr.s_addr = htonl(INADDR_LOOPBACK);
+    resolver_addrs_add(&query->addrs, AF_INET, &addr);
+    return 1;
+  }
+
+  return 0;
+}
+
+void resolver_query_free(tresolver_query *query)
+{
+  if (! query)
+    return;
+
+  resolver_stub_close(query);
+  free(query->host);
+  free(query);
+}
+
+// Start resolving the host, from the cache when possible.  On success, the
+// query then goes on with resolver_query_progress().
+int resolver_query_new(char *host, char *port, tresolver_query **queryp)
+{
+  tresolver_query *query = NULL;
+  unsigned long    port_num = 0;
+  char            *end = NULL;
+  int              stub = 0;
+  int              cached = 0;
+
+  errno = 0;
+  port_num = strtoul(port, &end, 10);
+  if (errno || ! *port || *end || port_num > UINT16_MAX) {
+    logger("invalid port: %s", port);
+    return -1;
+  }
+
+  if (! (query = calloc(1, sizeof *query))) {
+    logger("calloc: %m");
+    return -1;
+  }
+
+  query->fd = query->epfd = query->tfd = -1;
+  query->port = (uint16_t) port_num;
+
+  if (! (query->host = strdup(host))) {
+    logger("strdup: %m");
+    goto err;
+  }
+
+  pthread_mutex_lock(&resolver_lock);
+  stub = resolver_stub;
+  if (! resolver_override_lookup(host, query->port, &query->addrs) &&
+      ! resolver_resolve_locally(query, stub)) {
+    if ((cached = resolver_cache_lookup(host, &query->addrs))) {
+      if (query->addrs.n)
+        resolver_stats.hits++;
+      else
+        resolver_stats.negative_hits++;
+    } else {
+      resolver_stats.misses++;
+    }
+  } else {
+    cached = 1;
+  }
+  pthread_mutex_unlock(&resolver_lock);
+
+  if (cached) {
+    if (! query->addrs.n) {
+      logger("%s: no such host (cached)", host);
+      goto err;
+    }
+  } else if (stub) {
+    if (resolver_stub_start(query) < 0)
+      goto err;
+  } else if (resolver_getaddrinfo(query) < 0) {
+    goto err;
+  }
+
+  *queryp = query;
+  return 0;
+
+ err:
+  resolver_query_free(query);
+  return -1;
+}
+
+// The fd to watch for reading while resolving
+int resolver_query_get_fd(tresolver_query *query)
+{
+  return query->epfd;
+}
+
+// 0 once resolved, NETWORK_WANT_READ while waiting on the query's fd, -1 on
+// failure.
+int resolver_query_progress(tresolver_query *query)
+{
+  if (query->status == NETWORK_WANT_READ)
+    return resolver_stub_progress(query);
+
+  return query->status;
+}
+
+// The addresses, as a single allocation to be released with free()
+struct addrinfo *resolver_query_take_result(tresolver_query *query)
+{
+  if (query->status || ! query->addrs.n)
+    return NULL;
+
+  return resolver_addrinfo_new(&query->addrs, query->port);
+}
+
+
+//
+// Configuration
+//
+
+// Switch resolvers, which starts over with an empty cache, and add the
+// overrides of the file if any
+int resolver_configure(struct resolver_options *options)
+{
+  union resolver_addr nameserver;
+
+  memset(&nameserver, 0, sizeof nameserver);
+  if (options->nameserver &&
+      resolver_parse_addr(options->nameserver, RESOLVER_DNS_PORT, &nameserver) < 0) {
+    logger("invalid nameserver: %s", options->nameserver);
+    return -1;
+  }
+
+  if (options->overrides_file && resolver_load_overrides(options->overrides_file) < 0)
+    return -1;
+
+  pthread_mutex_lock(&resolver_lock);
+  resolver_cache_flush();
+  resolver_stub = options->stub || options->nameserver;
+  resolver_nameserver = nameserver;
+  pthread_mutex_unlock(&resolver_lock);
+
+  return 0;
+}
+
+// Back to getaddrinfo(), with an empty cache, no overrides and no stats
+void resolver_cleanup(void)
+{
+  pthread_mutex_lock(&resolver_lock);
+  resolver_cache_flush();
+  resolver_overrides_flush();
+  memset(&resolver_stats, 0, sizeof resolver_stats);
+  memset(&resolver_nameserver, 0, sizeof resolver_nameserver);
+  resolver_stub = 0;
+  pthread_mutex_unlock(&resolver_lock);
+}
+
+void resolver_get_stats(struct resolver_stats *stats)
+{
+  pthread_mutex_lock(&resolver_lock);
+  *stats = resolver_stats;
+  pthread_mutex_unlock(&resolver_lock);
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/resolver_utest.c"
@@ -0,0 +1,324 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+struct scan_impl {
+  char   *name;
+  int    (*supported)(void);
+  size_t (*byte)(const unsigned char *, size_t, unsigned char);
+  size_t (*ws_span)(const unsigned char *, size_t);
+  size_t (*ws_span_back)(const unsigned char *, size_t);
+};
+
+//
+// Scalar, the reference and the tails of the vectorized ones
+//
+
+static int scan_is_ws(unsigned char c)
+{
+  return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static int scan_scalar_supported(void)
+{
+  return 1;
+}
+
+static size_t scan_scalar_byte(const unsigned char *p, size_t len, unsigned char c)
+{
+  size_t i = 0;
+
+  while (i < len && p[i] != c)
+    i++;
+
+  return i;
+}
+
+static size_t scan_scalar_ws_span(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len && scan_is_ws(p[i]))
+    i++;
+
+  return i;
+}
+
+static size_t scan_scalar_ws_span_back(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len && scan_is_ws(p[len - 1 - i]))
+    i++;
+
+  return i;
+}
+
+#ifdef SCAN_X86
+
+//
+// SSE2, part of x86-64 anyway: a bit per byte of a 16-byte block, from
+// _mm_movemask_epi8()
+//
+
+static int scan_sse2_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+// SP, or HTAB to CR: c - HTAB <= CR - HTAB, unsigned, as min(x, 4) == x
+__attribute__((target("sse2")))
+static unsigned scan_sse2_ws_mask(__m128i v)
+{
+  __m128i off = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8('\r' - '\t')), off);
+  __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+
+  return (unsigned) _mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2_byte(const unsigned char *p, size_t len, unsigned char c)
+{
+  __m128i needle = _mm_set1_epi8((char) c);
+  size_t  i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i  v = _mm_loadu_si128((const __m128i *) (p + i));
+    unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+  }
+
+  return i + scan_scalar_byte(p + i, len - i, c);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2_ws_span(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    unsigned mask = ~scan_sse2_ws_mask(_mm_loadu_si128((const __m128i *) (p + i))) & 0xffff;
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+  }
+
+  return i + scan_scalar_ws_span(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_sse2_ws_span_back(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    unsigned mask = ~scan_sse2_ws_mask(_mm_loadu_si128((const __m128i *) (p + len - i - 16))) & 0xffff;
+
+    if (mask)
+      return i + (size_t) (__builtin_clz(mask) - 16);
+  }
+
+  return i + scan_scalar_ws_span_back(p, len - i);
+}
+
+//
+// AVX2, 32-byte blocks, then a 16-byte one.  The latter is written again
+// rather than calling the SSE2 functions: mixing their legacy encoding with
+// the AVX one stalls the CPU on each transition.
+//
+
+static int scan_avx2_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static unsigned scan_avx2_ws_mask(__m256i v)
+{
+  __m256i off = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(off, _mm256_set1_epi8('\r' - '\t')), off);
+  __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+
+  return (unsigned) _mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+__attribute__((target("avx2")))
+static unsigned scan_avx2_ws_mask128(__m128i v)
+{
+  __m128i off = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8('\r' - '\t')), off);
+  __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+
+  return (unsigned) _mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2_byte(const unsigned char *p, size_t len, unsigned char c)
+{
+  __m256i needle = _mm256_set1_epi8((char) c);
+  size_t  i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i  v = _mm256_loadu_si256((const __m256i *) (p + i));
+    unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+  }
+
+  if (i + 16 <= len) {
+    __m128i  v = _mm_loadu_si128((const __m128i *) (p + i));
+    unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(needle)));
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+    i += 16;
+  }
+
+  return i + scan_scalar_byte(p + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2_ws_span(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    unsigned mask = ~scan_avx2_ws_mask(_mm256_loadu_si256((const __m256i *) (p + i)));
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+  }
+
+  if (i + 16 <= len) {
+    unsigned mask = ~scan_avx2_ws_mask128(_mm_loadu_si128((const __m128i *) (p + i))) & 0xffff;
+
+    if (mask)
+      return i + (size_t) __builtin_ctz(mask);
+    i += 16;
+  }
+
+  return i + scan_scalar_ws_span(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2_ws_span_back(const unsigned char *p, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    unsigned mask = ~scan_avx2_ws_mask(_mm256_loadu_si256((const __m256i *) (p + len - i - 32)));
+
+    if (mask)
+      return i + (size_t) __builtin_clz(mask);
+  }
+
+  if (i + 16 <= len) {
+    unsigned mask = ~scan_avx2_ws_mask128(_mm_loadu_si128((const __m128i *) (p + len - i - 16))) & 0xffff;
+
+    if (mask)
+      return i + (size_t) (__builtin_clz(mask) - 16);
+    i += 16;
+  }
+
+  return i + scan_scalar_ws_span_back(p, len - i);
+}
+
+#endif // SCAN_X86
+
+// From the least to the most preferred
+static struct scan_impl scan_impls[] = {
+  { "scalar", scan_scalar_supported, scan_scalar_byte, scan_scalar_ws_span, scan_scalar_ws_span_back },
+#ifdef SCAN_X86
+  { "sse2",   scan_sse2_supported,   scan_sse2_byte,   scan_sse2_ws_span,   scan_sse2_ws_span_back },
+  { "avx2",   scan_avx2_supported,   scan_avx2_byte,   scan_avx2_ws_span,   scan_avx2_ws_span_back },
+#endif
+};
+
+// Read on each call and changed by scan_set_impl(): only accessed through
+// atomics, the loads pairing with the stores
+static struct scan_impl *scan_current;
+static pthread_once_t    scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_init(void)
+{
+  for (size_t i = N_ELEMS(scan_impls); i-- > 0; ) {
+    if (scan_impls[i].supported()) {
+      __atomic_store_n(&scan_current, &scan_impls[i], __ATOMIC_RELEASE);
+      break;
+    }
+  }
+}
+
+static struct scan_impl *scan_impl(void)
+{
+  struct scan_impl *impl = __atomic_load_n(&scan_current, __ATOMIC_ACQUIRE);
+
+  if (! impl) {
+    pthread_once(&scan_once, scan_init);
+    impl = __atomic_load_n(&scan_current, __ATOMIC_ACQUIRE);
+  }
+
+  return impl;
+}
+
+size_t scan_byte(const unsigned char *p, size_t len, unsigned char c)
+{
+  return scan_impl()->byte(p, len, c);
+}
+
+size_t scan_ws_span(const unsigned char *p, size_t len)
+{
+  return scan_impl()->ws_span(p, len);
+}
+
+size_t scan_ws_span_back(const unsigned char *p, size_t len)
+{
+  return scan_impl()->ws_span_back(p, len);
+}
+
+int scan_set_impl(char *name)
+{
+  (void) scan_impl();
+
+  for (size_t i = 0; i < N_ELEMS(scan_impls); i++) {
+    if (! strcmp(name, scan_impls[i].name)) {
+      if (! scan_impls[i].supported())
+        return -1;
+
+      __atomic_store_n(&scan_current, &scan_impls[i], __ATOMIC_RELEASE);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+char *scan_impl_name(void)
+{
+  return scan_impl()->name;
+}
+
+char **scan_impl_names(void)
+{
+  static char *names[N_ELEMS(scan_impls) + 1];
+
+  for (size_t i = 0; i < N_ELEMS(scan_impls); i++)
+    names[i] = scan_impls[i].name;
+
+  return names;
+}
+
+#include "../tests/scan_utest.c"
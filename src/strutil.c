@@ -2,12 +2,12 @@
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdarg.h>
 
 #include "util.h"
 #include "logger.h"
 #include "strutil.h"
+#include "scan.h"
 
 int trim(char *haystack, char **trimmedp)
 {
@@ -26,9 +26,8 @@ int trim(char *haystack, char **trimmedp)
     goto end;
   }
 
-  while (haystack[i] && isspace((unsigned char) haystack[i]))
-    i++;
-  
+  i = scan_ws_span((unsigned char *) haystack, strlen(haystack));
+
   if (NULL == (trimmed = strdup(haystack + i)))
     goto err;
 
@@ -37,13 +36,10 @@ int trim(char *haystack, char **trimmedp)
   if (! *trimmed) // whitespaces only, once trimmed it's an empty one
     goto end;
 
-  endptr = trimmed + strlen(trimmed) - 1;
-
-  while (endptr > trimmed && isspace((unsigned char) *endptr))
-    endptr--;
-
-  endptr[1] = '\0';
   i = strlen(trimmed);
+  endptr = trimmed + i - scan_ws_span_back((unsigned char *) trimmed, i);
+  *endptr = '\0';
+  i = PTRDIFF(endptr, trimmed);
 
  end:
   if (trimmedp)
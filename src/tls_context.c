@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "util.h"
+#include "logger.h"
+#include "tls_context.h"
+#include "tls_session.h"
+
+// A single SSL_CTX for the whole process, shared by every TLS connection:
+// loading and parsing the trust store would otherwise cost milliseconds per
+// connection.  It is built on first use unless configured before,
+// and reconfiguring it leaves the connections using the previous one alone,
+// as each of them holds a reference.
+
+static pthread_mutex_t tls_context_lock = PTHREAD_MUTEX_INITIALIZER;
+static SSL_CTX        *tls_context_shared = NULL;
+static int             tls_context_shared_early_data = 0;
+static int             tls_context_shared_http2 = 0;
+
+static SSL_CTX *tls_context_new(struct tls_options *options)
+{
+  SSL_CTX *ssl_ctx = NULL;
+
+  if (! (ssl_ctx = SSL_CTX_new(TLS_client_method()))) {
+    logger("SSL_CTX_new failed");
+    goto err;
+  }
+
+  if (options && (options->ca_file || options->ca_path)) {
+    if (SSL_CTX_load_verify_locations(ssl_ctx, options->ca_file, options->ca_path) != 1) {
+      logger("failed to load the CA certificates from %s",
+             options->ca_file ? options->ca_file : options->ca_path);
+      goto err;
+    }
+  } else if (SSL_CTX_set_default_verify_paths(ssl_ctx) != 1) {
+    logger("SSL_CTX_set_default_verify_paths failed");
+    goto err;
+  }
+
+  if (options && options->ciphers &&
+      SSL_CTX_set_cipher_list(ssl_ctx, options->ciphers) != 1) {
+    logger("invalid cipher list: %s", options->ciphers);
+    goto err;
+  }
+
+  if (options && options->groups &&
+      SSL_CTX_set1_groups_list(ssl_ctx, options->groups) != 1) {
+    logger("invalid groups list: %s", options->groups);
+    goto err;
+  }
+
+  // Once the keys are known, the kernel may encrypt and decrypt the records
+  if (options && options->ktls)
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+
+  SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+
+  // Sessions go to our own cache, keyed by server rather than session ID
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_ctx, tls_session_new_cb);
+
+  return ssl_ctx;
+ err:
+  ERR_print_errors_fp(stderr);
+  SSL_CTX_free(ssl_ctx);
+  return NULL;
+}
+
+// Replace the shared context with one built from the given options.  On
+// failure, the current one stays.
+int tls_context_configure(struct tls_options *options)
+{
+  SSL_CTX *ssl_ctx = NULL;
+  SSL_CTX *old = NULL;
+
+  if (! (ssl_ctx = tls_context_new(options)))
+    return -1;
+
+  if (options && options->session_cache && tls_session_cache_load(options->session_cache) < 0) {
+    SSL_CTX_free(ssl_ctx);
+    return -1;
+  }
+
+  pthread_mutex_lock(&tls_context_lock);
+  old = tls_context_shared;
+  tls_context_shared = ssl_ctx;
+  tls_context_shared_early_data = options && options->early_data;
+  tls_context_shared_http2 = options && options->http2;
+  pthread_mutex_unlock(&tls_context_lock);
+
+  SSL_CTX_free(old);
+  return 0;
+}
+
+// Get a reference on the shared context, to be released with SSL_CTX_free().
+SSL_CTX *tls_context_acquire(void)
+{
+  SSL_CTX *ssl_ctx = NULL;
+
+  pthread_mutex_lock(&tls_context_lock);
+
+  if (! tls_context_shared)
+    tls_context_shared = tls_context_new(NULL);
+
+  if ((ssl_ctx = tls_context_shared) && SSL_CTX_up_ref(ssl_ctx) != 1) {
+    logger("SSL_CTX_up_ref failed");
+    ssl_ctx = NULL;
+  }
+
+  pthread_mutex_unlock(&tls_context_lock);
+
+  return ssl_ctx;
+}
+
+// Drop the shared context and the session cache, the next connection builds
+// a default one.
+void tls_context_cleanup(void)
+{
+  SSL_CTX *old = NULL;
+
+  pthread_mutex_lock(&tls_context_lock);
+  old = tls_context_shared;
+  tls_context_shared = NULL;
+  tls_context_shared_early_data = 0;
+  tls_context_shared_http2 = 0;
+  pthread_mutex_unlock(&tls_context_lock);
+
+  SSL_CTX_free(old);
+  tls_session_cache_cleanup();
+}
+
+
+// Whether safe requests may go in the early data of resumed sessions: the
+// server could get them twice, through a replay.
+int tls_context_early_data(void)
+{
+  int early_data = 0;
+
+  pthread_mutex_lock(&tls_context_lock);
+  early_data = tls_context_shared_early_data;
+  pthread_mutex_unlock(&tls_context_lock);
+
+  return early_data;
+}
+
+// Whether connections offer h2 through ALPN
+int tls_context_http2(void)
+{
+  int http2 = 0;
+
+  pthread_mutex_lock(&tls_context_lock);
+  http2 = tls_context_shared_http2;
+  pthread_mutex_unlock(&tls_context_lock);
+
+  return http2;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/tls_context_utest.c"
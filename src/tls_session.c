@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+#include "util.h"
+#include "logger.h"
+#include "tls_session.h"
+
+// Client-side TLS session cache, keyed by host:port, so that the next
+// connection to the same server resumes the session (TLS 1.3 ticket or TLS
+// 1.2 session ID) instead of doing a full handshake.
+//
+// OpenSSL hands us the sessions through the new-session callback of the
+// shared SSL_CTX, which for TLS 1.3 is after the handshake, when the
+// tickets arrive.  The key travels along with the SSL object as ex_data.
+//
+// With a cache file, the cache is loaded from it and written back whenever a
+// session comes in, for separate processes to resume each others' sessions.
+// The file is a sequence of "host:port" lines, each followed by the PEM
+// encoding of the session.
+
+struct tls_session_entry {
+  char        *key;
+  SSL_SESSION *session;
+};
+
+static pthread_mutex_t          tls_session_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tls_session_entry tls_session_cache[TLS_SESSION_CACHE_MAX_ENTRIES];
+static unsigned                 tls_session_n_entries = 0;
+static char                    *tls_session_path = NULL;
+
+static pthread_once_t           tls_session_once = PTHREAD_ONCE_INIT;
+static int                      tls_session_ex_index = -1;
+
+static void tls_session_ex_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp)
+{
+  (void) parent;
+  (void) ad;
+  (void) idx;
+  (void) argl;
+  (void) argp;
+
+  free(ptr);
+}
+
+static void tls_session_ex_init(void)
+{
+  tls_session_ex_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, tls_session_ex_free);
+}
+
+static int tls_session_is_valid(SSL_SESSION *session)
+{
+  return SSL_SESSION_is_resumable(session) &&
+    (time_t) (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) > time(NULL);
+}
+
+static void tls_session_remove(unsigned i)
+{
+  free(tls_session_cache[i].key);
+  SSL_SESSION_free(tls_session_cache[i].session);
+
+  memmove(&tls_session_cache[i], &tls_session_cache[i + 1],
+          (tls_session_n_entries - i - 1) * sizeof tls_session_cache[0]);
+  tls_session_n_entries--;
+}
+
+static int tls_session_lookup(char *key)
+{
+  for (unsigned i = 0; i < tls_session_n_entries; i++) {
+    if (0 == strcmp(tls_session_cache[i].key, key))
+      return (int) i;
+  }
+
+  return -1;
+}
+
+// Takes the ownership of key and session, the oldest entry makes room when
+// the cache is full.
+static void tls_session_insert(char *key, SSL_SESSION *session)
+{
+  int i = tls_session_lookup(key);
+
+  if (i >= 0)
+    tls_session_remove((unsigned) i);
+  else if (tls_session_n_entries == TLS_SESSION_CACHE_MAX_ENTRIES)
+    tls_session_remove(0);
+
+  tls_session_cache[tls_session_n_entries].key = key;
+  tls_session_cache[tls_session_n_entries].session = session;
+  tls_session_n_entries++;
+}
+
+// Write the whole cache to a temporary file renamed over the cache file, so
+// that concurrent processes never read a partial one.  The sessions are
+// secrets: the file is only readable by its owner.
+static int tls_session_save(void)
+{
+  char *tmp_path = NULL;
+  FILE *fp = NULL;
+  int   fd = -1;
+  int   ret = -1;
+
+  if (asprintf(&tmp_path, "%s.%ld.tmp", tls_session_path, (long) getpid()) < 0) {
+    logger("asprintf: %m");
+    tmp_path = NULL;
+    goto end;
+  }
+
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ||
+      ! (fp = fdopen(fd, "w"))) {
+    logger("%s: %m", tmp_path);
+    goto end;
+  }
+
+  fd = -1;
+
+  for (unsigned i = 0; i < tls_session_n_entries; i++) {
+    if (! tls_session_is_valid(tls_session_cache[i].session))
+      continue;
+
+    if (fprintf(fp, "%s\n", tls_session_cache[i].key) < 0 ||
+        ! PEM_write_SSL_SESSION(fp, tls_session_cache[i].session)) {
+      logger("failed to write the TLS session cache %s", tmp_path);
+      goto end;
+    }
+  }
+
+  if (fclose(fp)) {
+    fp = NULL;
+    logger("fclose %s: %m", tmp_path);
+    goto end;
+  }
+
+  fp = NULL;
+
+  if (rename(tmp_path, tls_session_path) < 0) {
+    logger("rename %s: %m", tls_session_path);
+    goto end;
+  }
+
+  ret = 0;
+ end:
+  if (fp)
+    (void) fclose(fp);
+  if (fd >= 0)
+    (void) close(fd);
+  if (ret < 0 && tmp_path)
+    (void) unlink(tmp_path);
+  free(tmp_path);
+  return ret;
+}
+
+static int tls_session_load(FILE *fp)
+{
+  char line[512];
+
+  while (fgets(line, sizeof line, fp)) {
+    SSL_SESSION *session = NULL;
+    char        *key = NULL;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (! *line)
+      continue;
+
+    if (! (session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL))) {
+      logger("invalid TLS session for %s", line);
+      ERR_clear_error();
+      return -1;
+    }
+
+    if (! tls_session_is_valid(session)) {
+      SSL_SESSION_free(session);
+      continue;
+    }
+
+    if (! (key = strdup(line))) {
+      logger("strdup: %m");
+      SSL_SESSION_free(session);
+      return -1;
+    }
+
+    tls_session_insert(key, session);
+  }
+
+  return 0;
+}
+
+// Use a cache file, loading whatever it has already.  A missing file is
+// fine: it will be created.
+int tls_session_cache_load(char *path)
+{
+  FILE *fp = NULL;
+  char *tmp = NULL;
+  int   ret = -1;
+
+  if (! (tmp = strdup(path))) {
+    logger("strdup: %m");
+    return -1;
+  }
+
+  pthread_mutex_lock(&tls_session_lock);
+
+  free(tls_session_path);
+  tls_session_path = tmp;
+
+  if (! (fp = fopen(path, "r"))) {
+    if (errno == ENOENT)
+      ret = 0;
+    else
+      logger("fopen %s: %m", path);
+    goto end;
+  }
+
+  // A corrupted cache only costs full handshakes
+  if (tls_session_load(fp) < 0)
+    logger("ignoring the rest of the TLS session cache %s", path);
+
+  ret = 0;
+ end:
+  pthread_mutex_unlock(&tls_session_lock);
+  if (fp)
+    (void) fclose(fp);
+  return ret;
+}
+
+void tls_session_cache_cleanup(void)
+{
+  pthread_mutex_lock(&tls_session_lock);
+
+  while (tls_session_n_entries)
+    tls_session_remove(tls_session_n_entries - 1);
+
+  free(tls_session_path);
+  tls_session_path = NULL;
+
+  pthread_mutex_unlock(&tls_session_lock);
+}
+
+// To be called before the handshake: tag the connection with its key and
+// offer the cached session, if any.  Returns 1 when a session is offered.
+int tls_session_resume(SSL *ssl, char *host, char *port)
+{
+  char *key = NULL;
+  int   ret = -1;
+  int   i = -1;
+
+  pthread_once(&tls_session_once, tls_session_ex_init);
+  if (tls_session_ex_index < 0) {
+    logger("SSL_get_ex_new_index failed");
+    return -1;
+  }
+
+  if (asprintf(&key, "%s:%s", host, port) < 0) {
+    logger("asprintf: %m");
+    return -1;
+  }
+
+  if (! SSL_set_ex_data(ssl, tls_session_ex_index, key)) {
+    logger("SSL_set_ex_data failed");
+    free(key);
+    return -1;
+  }
+
+  pthread_mutex_lock(&tls_session_lock);
+
+  ret = 0;
+  if ((i = tls_session_lookup(key)) >= 0) {
+    if (! tls_session_is_valid(tls_session_cache[i].session))
+      tls_session_remove((unsigned) i);
+    else if (SSL_set_session(ssl, tls_session_cache[i].session) == 1)
+      ret = 1;
+  }
+
+  pthread_mutex_unlock(&tls_session_lock);
+
+  return ret;
+}
+
+// New-session callback of the SSL_CTX: returns 1 as we keep the reference.
+int tls_session_new_cb(SSL *ssl, SSL_SESSION *session)
+{
+  char *key = NULL;
+
+  if (tls_session_ex_index < 0 || ! (key = SSL_get_ex_data(ssl, tls_session_ex_index)))
+    return 0;
+
+  if (! tls_session_is_valid(session) || ! (key = strdup(key)))
+    return 0;
+
+  pthread_mutex_lock(&tls_session_lock);
+
+  tls_session_insert(key, session);
+  if (tls_session_path)
+    (void) tls_session_save();
+
+  pthread_mutex_unlock(&tls_session_lock);
+
+  return 1;
+}
+
+
+//
+// Unit tests
+//
+
+#include "../tests/tls_session_utest.c"
@@ -1,6 +1,20 @@
+#include "arena.h"
+#include "http_header_names.h"
+#include "http_headers.h"
 #include "http_parse.h"
 #include "cli.h"
 #include "strutil.h"
+#include "scan.h"
+#include "resolver.h"
+#include "network_connect.h"
+#include "network_pool.h"
+#include "network_uring.h"
+#include "network_tls.h"
+#include "http.h"
+#include "tls_context.h"
+#include "tls_session.h"
+#include "hpack.h"
+#include "http2.h"
 
 #include "util.h"
 #include "utest.h"
@@ -11,8 +25,22 @@ int utest_run(void)
 
   int (*funcs[])(void) = {
     strutil_utest,
+    scan_utest,
     cli_utest,
+    arena_utest,
+    http_header_names_utest,
+    http_headers_utest,
     http_parse_utest,
+    hpack_utest,
+    http2_utest,
+    resolver_utest,
+    network_connect_utest,
+    network_pool_utest,
+    network_uring_utest,
+    network_tls_utest,
+    http_utest,
+    tls_context_utest,
+    tls_session_utest,
   };
 
   for (size_t i = 0; i < N_ELEMS(funcs); i++) {
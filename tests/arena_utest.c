@@ -0,0 +1,165 @@
+#include "logger.h"
+
+#define UTEST_ARENA_CHUNK_SIZE 256
+
+struct utest_arena_counts {
+  int n_allocs;
+  int n_reallocs;
+  int n_frees;
+};
+
+static void *utest_arena_alloc(size_t size, void *user_data)
+{
+  struct utest_arena_counts *counts = user_data;
+
+  counts->n_allocs++;
+  return malloc(size);
+}
+
+static void *utest_arena_realloc(void *ptr, size_t size, void *user_data)
+{
+  struct utest_arena_counts *counts = user_data;
+
+  counts->n_reallocs++;
+  return realloc(ptr, size);
+}
+
+static void utest_arena_free(void *ptr, void *user_data)
+{
+  struct utest_arena_counts *counts = user_data;
+
+  counts->n_frees++;
+  free(ptr);
+}
+
+// Allocations are aligned, the last one and large ones grow in place, and
+// every chunk goes back through the hooks.
+static int arena_alloc_utest(void)
+{
+  int                        n_successes = 0;
+  int                        n_failures = 0;
+  struct utest_arena_counts  counts = { 0, 0, 0 };
+  struct arena_hooks         hooks = {
+    .alloc_func = utest_arena_alloc,
+    .realloc_func = utest_arena_realloc,
+    .free_func = utest_arena_free,
+    .user_data = &counts,
+  };
+  tarena                    *arena = NULL;
+  unsigned char             *a = NULL;
+  unsigned char             *b = NULL;
+  unsigned char             *large = NULL;
+  char                      *s = NULL;
+  size_t                     n_misaligned = 0;
+
+  if (arena_new(UTEST_ARENA_CHUNK_SIZE, &hooks, &arena) < 0) {
+    logger("failed to create the arena");
+    return 1;
+  }
+
+  // Within the chunk allocated along with the arena
+  for (size_t size = 1; size <= 16; size++) {
+    if (! (a = arena_alloc(arena, size)) || (uintptr_t) a % ARENA_ALIGN)
+      n_misaligned++;
+  }
+
+  if (! n_misaligned && counts.n_allocs == 1) {
+    n_successes++;
+  } else {
+    logger("%zu allocations misaligned, %d chunks", n_misaligned, counts.n_allocs);
+    n_failures++;
+  }
+
+  // Growing the last one keeps it where it is, not another
+  a = arena_alloc(arena, 8);
+  memset(a, 'a', 8);
+  if (arena_realloc(arena, a, 8, 40) == a && (b = arena_alloc(arena, 8)) &&
+      (a = arena_realloc(arena, a, 40, 48)) != b && a && ! memcmp(a, "aaaaaaaa", 8)) {
+    n_successes++;
+  } else {
+    logger("realloc() of the last allocation failed");
+    n_failures++;
+  }
+
+  // Beyond a quarter of a chunk, each its own, reallocated through the hooks
+  if ((large = arena_alloc(arena, UTEST_ARENA_CHUNK_SIZE)) && (memset(large, 'l', UTEST_ARENA_CHUNK_SIZE), 1) &&
+      (large = arena_realloc(arena, large, UTEST_ARENA_CHUNK_SIZE, 4 * UTEST_ARENA_CHUNK_SIZE)) &&
+      large[UTEST_ARENA_CHUNK_SIZE - 1] == 'l' && counts.n_reallocs == 1) {
+    n_successes++;
+  } else {
+    logger("large allocation failed, %d reallocs", counts.n_reallocs);
+    n_failures++;
+  }
+
+  // Taken back when the last one
+  s = arena_strdup(arena, "released");
+  arena_release(arena, s);
+  if (s && arena_strdup(arena, "again") == s && ! strcmp(s, "again")) {
+    n_successes++;
+  } else {
+    logger("release of the last allocation failed");
+    n_failures++;
+  }
+
+  // The first chunk kept, the others back through the hooks
+  while (counts.n_allocs < 4)
+    (void) arena_alloc(arena, UTEST_ARENA_CHUNK_SIZE / 4);
+
+  arena_reset(arena);
+  if (counts.n_frees == counts.n_allocs - 1 && (a = arena_alloc(arena, 8)) && counts.n_allocs == 4) {
+    n_successes++;
+  } else {
+    logger("reset: %d chunks allocated, %d freed", counts.n_allocs, counts.n_frees);
+    n_failures++;
+  }
+
+  arena_free(arena);
+  if (counts.n_frees == counts.n_allocs) {
+    n_successes++;
+  } else {
+    logger("%d chunks allocated, %d freed", counts.n_allocs, counts.n_frees);
+    n_failures++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Without an arena, the same calls are those of the C library.
+static int arena_none_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  unsigned char *p = arena_alloc(NULL, 4);
+  char          *s = arena_strdup(NULL, "none");
+
+  if (p && s && ! strcmp(s, "none") && (p = arena_realloc(NULL, p, 0, 4096))) {
+    n_successes++;
+  } else {
+    logger("allocations without an arena failed");
+    n_failures++;
+  }
+
+  arena_release(NULL, p);
+  arena_release(NULL, s);
+  arena_free(NULL);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int arena_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    arena_alloc_utest,
+    arena_none_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
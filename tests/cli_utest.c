@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 static int cli_parse_target_utest(void)
 {
   int         n_successes = 0;
@@ -262,6 +264,296 @@ static int cli_parse_header_utest(void)
   return n_failures;
 }
 
+static int utest_cli_two_resolves(struct cli_options *options, thttp_request *request)
+{
+  (void) request;
+  return options->n_resolve == 2 && ! strcmp(options->resolve[0], "a.test:443:192.0.2.1") &&
+    ! strcmp(options->resolve[1], "b.test:80:[2001:db8::1],192.0.2.2");
+}
+
+static int utest_cli_two_paths(struct cli_options *options, thttp_request *request)
+{
+  return options->n_paths == 2 && ! strcmp(options->paths[0], "/a") && ! strcmp(options->paths[1], "/b?c=d") &&
+    ! strcmp(http_request_path(request), "/");
+}
+
+static int utest_cli_h2c_upgrade(struct cli_options *options, thttp_request *request)
+{
+  (void) options;
+  return http_request_h2c(request) == HTTP_H2C_UPGRADE;
+}
+
+static int utest_cli_h2c_off(struct cli_options *options, thttp_request *request)
+{
+  (void) options;
+  return http_request_h2c(request) == HTTP_H2C_OFF;
+}
+
+static int utest_cli_h2c_prior_knowledge(struct cli_options *options, thttp_request *request)
+{
+  (void) options;
+  return http_request_h2c(request) == HTTP_H2C_PRIOR_KNOWLEDGE;
+}
+
+// Options as cli_process_args() gets them, after the target, and the one
+// expected to be set: the string at str_off, the flag at flag_off, or
+// whatever check tells.
+static int cli_process_args_utest(void)
+{
+  int         n_successes = 0;
+  int         n_failures = 0;
+  struct utest {
+    char  *args[5];
+    int    exp_retval;
+    size_t str_off;
+    char  *exp_str;
+    size_t flag_off;
+    int    exp_flag;
+    int  (*check)(struct cli_options *options, thttp_request *request);
+  } utests[] = {
+    {
+      .args = { "--output", "reply.out" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, output),
+      .exp_str = "reply.out",
+    },
+    {
+      .args = { "--output" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--no-such-option" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--driver", "plain" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, driver),
+      .exp_str = "plain",
+    },
+    {
+      .args = { "--driver", "uring" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, driver),
+      .exp_str = "uring",
+    },
+    // Not for cleartext connections
+    {
+      .args = { "--driver", "tls" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--driver", "nonblock" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--driver", "tls-nonblock" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--driver", "none" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--cacert", "/etc/ssl/ca.pem" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, tls.ca_file),
+      .exp_str = "/etc/ssl/ca.pem",
+    },
+    {
+      .args = { "--capath", "/etc/ssl/certs" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, tls.ca_path),
+      .exp_str = "/etc/ssl/certs",
+    },
+    {
+      .args = { "--ciphers", "ECDHE+AESGCM" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, tls.ciphers),
+      .exp_str = "ECDHE+AESGCM",
+    },
+    {
+      // The last one wins
+      .args = { "--tls-groups", "P-256", "--tls-groups", "X25519:P-256" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, tls.groups),
+      .exp_str = "X25519:P-256",
+    },
+    {
+      .args = { "--cacert" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--tls-session-cache", "/tmp/sessions" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, tls.session_cache),
+      .exp_str = "/tmp/sessions",
+    },
+    {
+      .args = { "--verbose" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, verbose),
+      .exp_flag = 1,
+    },
+    {
+      // No argument of its own
+      .args = { "--verbose=yes" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--dns-stub" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, resolver.stub),
+      .exp_flag = 1,
+    },
+    {
+      .args = { "--nameserver", "[2001:db8::53]:5353" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, resolver.nameserver),
+      .exp_str = "[2001:db8::53]:5353",
+    },
+    {
+      .args = { "--nameserver" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--resolve", "a.test:443:192.0.2.1", "--resolve", "b.test:80:[2001:db8::1],192.0.2.2" },
+      .exp_retval = 0,
+      .check = utest_cli_two_resolves,
+    },
+    {
+      .args = { "--resolve", "a.test:443" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--resolve", "a.test:https:192.0.2.1" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--resolve", "a.test:443:a.example" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--resolve", ":443:192.0.2.1" },
+      .exp_retval = -1,
+    },
+    {
+      .args = { "--resolve-file", "/etc/httpc/backends" },
+      .exp_retval = 0,
+      .str_off = offsetof(struct cli_options, resolver.overrides_file),
+      .exp_str = "/etc/httpc/backends",
+    },
+    {
+      .args = { "--tcp-fastopen" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, tcp_fastopen),
+      .exp_flag = 1,
+    },
+    {
+      .args = { "--tls-early-data" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, tls.early_data),
+      .exp_flag = 1,
+    },
+    {
+      .args = { "--ktls" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, tls.ktls),
+      .exp_flag = 1,
+    },
+    {
+      // Pipelined after the target's own
+      .args = { "--path", "/a", "--path", "/b?c=d" },
+      .exp_retval = 0,
+      .check = utest_cli_two_paths,
+    },
+    {
+      .args = { "--path" },
+      .exp_retval = -1,
+    },
+    {
+      // ALPN on TLS, the h2c upgrade on plain connections
+      .args = { "--http2" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, tls.http2),
+      .exp_flag = 1,
+      .check = utest_cli_h2c_upgrade,
+    },
+    {
+      .args = { NULL },
+      .exp_retval = 0,
+      .check = utest_cli_h2c_off,
+    },
+    {
+      .args = { "--http2-prior-knowledge" },
+      .exp_retval = 0,
+      .flag_off = offsetof(struct cli_options, http2_prior_knowledge),
+      .exp_flag = 1,
+      .check = utest_cli_h2c_prior_knowledge,
+    },
+    {
+      // No upgrade when h2c is known to be spoken
+      .args = { "--http2", "--http2-prior-knowledge" },
+      .exp_retval = 0,
+      .check = utest_cli_h2c_prior_knowledge,
+    },
+    {
+      .args = { "--http2-prior-knowledge=upgrade" },
+      .exp_retval = -1,
+    },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest       *u = utests + i;
+    char               *argv[N_ELEMS(u->args) + 3] = { "httpc", "http://localhost/" };
+    int                 argc = 2;
+    struct cli_options  options;
+    thttp_request      *request = NULL;
+    char               *option = NULL;
+    char               *arg = NULL;
+    int                 retval = -1;
+
+    for (size_t j = 0; j < N_ELEMS(u->args) && u->args[j]; j++)
+      argv[argc++] = u->args[j];
+    option = argc > 2 ? argv[2] : "";
+    arg = argc > 3 ? argv[3] : "";
+
+    if (cli_options_init(&options) < 0) {
+      n_failures++;
+      continue;
+    }
+
+    // getopt_long() starts over
+    optind = 0;
+    retval = cli_process_args(argc, argv, &options, &request);
+    if (retval != u->exp_retval) {
+      logger("input '%s %s', expected retval %d, got %d", option, arg, u->exp_retval, retval);
+      n_failures++;
+    } else if (retval == 0 && u->exp_str && strcmp(*(char **) ((char *) &options + u->str_off), u->exp_str)) {
+      logger("input '%s %s', expected %s", option, arg, u->exp_str);
+      n_failures++;
+    } else if (retval == 0 && u->exp_flag && *(int *) ((char *) &options + u->flag_off) != u->exp_flag) {
+      logger("input '%s %s', expected the option set", option, arg);
+      n_failures++;
+    } else if (retval == 0 && u->check && ! u->check(&options, request)) {
+      logger("input '%s %s', unexpected options", option, arg);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    // The headers go with the request, when there is one
+    if (request)
+      http_request_free(request);
+    else
+      http_headers_free(options.headers);
+    cli_options_deinit(&options);
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
 int cli_utest(void)
 {
   int n_errors = 0;
@@ -269,6 +561,7 @@ int cli_utest(void)
   int (*funcs[])(void) = {
     cli_parse_header_utest,
     cli_parse_target_utest,
+    cli_process_args_utest,
   };
 
   for (size_t i = 0; i < N_ELEMS(funcs); i++) {
@@ -0,0 +1,405 @@
+#include <ctype.h>
+
+static size_t utest_hpack_unhex(char *hex, unsigned char *buf, size_t size)
+{
+  size_t n = 0;
+
+  while (*hex && n < size) {
+    unsigned byte = 0;
+
+    if (isspace((unsigned char) *hex)) {
+      hex++;
+      continue;
+    }
+
+    if (sscanf(hex, "%2x", &byte) != 1)
+      break;
+
+    buf[n++] = (unsigned char) byte;
+    hex += 2;
+  }
+
+  return n;
+}
+
+// The fields as "name: value\n" lines
+static int utest_hpack_collect(char *name, char *value, void *user_data)
+{
+  struct hpack_buf *out = user_data;
+
+  return hpack_buf_append(out, name, strlen(name)) < 0 ||
+    hpack_buf_append(out, ": ", 2) < 0 ||
+    hpack_buf_append(out, value, strlen(value)) < 0 ||
+    hpack_buf_append(out, "\n", 1) < 0 ? -1 : 0;
+}
+
+static int hpack_integer_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+  struct utest {
+    size_t   value;
+    unsigned prefix_bits;
+    char    *hex;
+  } utests[] = {
+    // RFC 7541 C.1
+    { .value = 10,   .prefix_bits = 5, .hex = "0a"     },
+    { .value = 1337, .prefix_bits = 5, .hex = "1f9a0a" },
+    { .value = 42,   .prefix_bits = 8, .hex = "2a"     },
+    { .value = 31,   .prefix_bits = 5, .hex = "1f00"   },
+    { .value = 127,  .prefix_bits = 7, .hex = "7f00"   },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest     *u = utests + i;
+    struct hpack_buf  out = { NULL, 0, 0 };
+    unsigned char     exp[16];
+    size_t            exp_len = utest_hpack_unhex(u->hex, exp, sizeof exp);
+    unsigned char    *p = exp;
+    size_t            value = 0;
+
+    if (hpack_encode_int(&out, 0, u->prefix_bits, u->value) < 0 ||
+        out.len != exp_len || memcmp(out.data, exp, exp_len) ||
+        hpack_decode_int(&p, exp + exp_len, u->prefix_bits, &value) < 0 ||
+        value != u->value || p != exp + exp_len) {
+      logger("%zu on %u bits: expected %s, decoded %zu", u->value, u->prefix_bits, u->hex, value);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    hpack_buf_free(&out);
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int hpack_huffman_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+  struct utest {
+    char *str;
+    char *hex;
+  } utests[] = {
+    // RFC 7541 C.4 and C.6
+    { .str = "www.example.com",               .hex = "f1e3c2e5f23a6ba0ab90f4ff"         },
+    { .str = "no-cache",                      .hex = "a8eb10649cbf"                     },
+    { .str = "custom-key",                    .hex = "25a849e95ba97d7f"                 },
+    { .str = "custom-value",                  .hex = "25a849e95bb8e8b4bf"               },
+    { .str = "302",                           .hex = "6402"                             },
+    { .str = "private",                       .hex = "aec3771a4b"                       },
+    { .str = "Mon, 21 Oct 2013 20:13:21 GMT", .hex = "d07abe941054d444a8200595040b8166e082a62d1bff" },
+    { .str = "https://www.example.com",       .hex = "9d29ad171863c78f0b97c8e9ae82ae43d3" },
+    { .str = "",                              .hex = ""                                 },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest     *u = utests + i;
+    struct hpack_buf  out = { NULL, 0, 0 };
+    unsigned char     exp[64];
+    size_t            exp_len = utest_hpack_unhex(u->hex, exp, sizeof exp);
+    char              decoded[128];
+    size_t            decoded_len = 0;
+
+    if (hpack_huffman_encode(&out, u->str, strlen(u->str)) < 0 ||
+        out.len != exp_len || (exp_len && memcmp(out.data, exp, exp_len)) ||
+        hpack_huffman_decode(exp, exp_len, decoded, &decoded_len) < 0 ||
+        decoded_len != strlen(u->str) || memcmp(decoded, u->str, decoded_len)) {
+      logger("'%s': expected %s", u->str, u->hex);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    hpack_buf_free(&out);
+  }
+
+  // Padding with zeros, then longer than a byte, then EOS itself
+  {
+    char          *bad[] = { "00", "1fff", "fffffffc" };
+    unsigned char  buf[8];
+    char           decoded[16];
+    size_t         decoded_len = 0;
+
+    for (size_t i = 0; i < N_ELEMS(bad); i++) {
+      size_t len = utest_hpack_unhex(bad[i], buf, sizeof buf);
+
+      if (hpack_huffman_decode(buf, len, decoded, &decoded_len) < 0) {
+        n_successes++;
+      } else {
+        logger("%s: expected a decoding error", bad[i]);
+        n_failures++;
+      }
+    }
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// RFC 7541 C.3, C.4 and C.6: consecutive header blocks share the table,
+// whose size is checked after each of them.
+static int hpack_decode_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+  struct utest {
+    char   *sequence;
+    size_t  limit;
+    char   *hex;
+    char   *exp_fields;
+    size_t  exp_size;
+  } utests[] = {
+    {
+      .sequence = "C.3.1", .limit = 4096,
+      .hex = "828684410f7777772e6578616d706c652e636f6d",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+      .exp_size = 57,
+    },
+    {
+      .sequence = "C.3.2",
+      .hex = "828684be58086e6f2d6361636865",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+      "cache-control: no-cache\n",
+      .exp_size = 110,
+    },
+    {
+      .sequence = "C.3.3",
+      .hex = "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+      .exp_fields = ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+      "custom-key: custom-value\n",
+      .exp_size = 164,
+    },
+    {
+      .sequence = "C.4.1", .limit = 4096,
+      .hex = "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+      .exp_size = 57,
+    },
+    {
+      .sequence = "C.4.2",
+      .hex = "828684be5886a8eb10649cbf",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+      "cache-control: no-cache\n",
+      .exp_size = 110,
+    },
+    {
+      .sequence = "C.4.3",
+      .hex = "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+      .exp_fields = ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+      "custom-key: custom-value\n",
+      .exp_size = 164,
+    },
+    {
+      .sequence = "C.6.1", .limit = 256,
+      .hex = "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff"
+      "6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+      .exp_fields = ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n",
+      .exp_size = 222,
+    },
+    {
+      .sequence = "C.6.2",
+      .hex = "4883640effc1c0bf",
+      .exp_fields = ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n",
+      .exp_size = 222,
+    },
+    {
+      .sequence = "C.6.3",
+      .hex = "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdf"
+      "cd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+      .exp_fields = ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n"
+      "location: https://www.example.com\ncontent-encoding: gzip\n"
+      "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n",
+      .exp_size = 215,
+    },
+  };
+  thpack_table *table = NULL;
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest     *u = utests + i;
+    struct hpack_buf  out = { NULL, 0, 0 };
+    unsigned char     buf[256];
+    size_t            len = utest_hpack_unhex(u->hex, buf, sizeof buf);
+
+    // A limit starts a new sequence, on a new table
+    if (u->limit) {
+      hpack_table_free(table);
+      if (hpack_table_new(u->limit, &table) < 0) {
+        n_failures++;
+        break;
+      }
+    }
+
+    if (hpack_decode(table, buf, len, utest_hpack_collect, &out) < 0 ||
+        hpack_buf_append(&out, "", 1) < 0 ||
+        strcmp((char *) out.data, u->exp_fields) || table->size != u->exp_size) {
+      logger("%s: expected a table of %zu bytes and\n%s", u->sequence, u->exp_size, u->exp_fields);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    hpack_buf_free(&out);
+  }
+
+  hpack_table_free(table);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int hpack_decode_errors_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+  char *utests[] = {
+    "80",       // Index 0
+    "be",       // Past the end of the empty dynamic table
+    "3fe21f",   // Size update above the limit
+    "82 20",    // Size update after a field
+    "40 05 6b", // Truncated name
+    "40 81 00", // Huffman name padded with zeros
+    "00 01 61 02 00 61", // Nul byte in the value
+    "ff ff ff ff ff 0f", // Integer overflow
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    thpack_table     *table = NULL;
+    struct hpack_buf  out = { NULL, 0, 0 };
+    unsigned char     buf[16];
+    size_t            len = utest_hpack_unhex(utests[i], buf, sizeof buf);
+
+    if (hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &table) < 0) {
+      n_failures++;
+      continue;
+    }
+
+    if (hpack_decode(table, buf, len, utest_hpack_collect, &out) < 0) {
+      n_successes++;
+    } else {
+      logger("%s: expected a decoding error", utests[i]);
+      n_failures++;
+    }
+
+    hpack_buf_free(&out);
+    hpack_table_free(table);
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Our encoder makes the same choices as RFC 7541 C.4, and its output
+// decodes back to the same fields, size updates included.
+static int hpack_encode_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+  struct http_headers_elem c41[] = {
+    { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+  };
+  struct http_headers_elem c42[] = {
+    { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+    { "cache-control", "no-cache" },
+  };
+  struct http_headers_elem c43[] = {
+    { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+    { ":authority", "www.example.com" }, { "custom-key", "custom-value" },
+  };
+  struct utest {
+    struct http_headers_elem *fields;
+    size_t                    n_fields;
+    size_t                    limit; // Set before encoding, if any
+    char                     *exp_hex;
+    char                     *exp_fields;
+  } utests[] = {
+    {
+      .fields = c41, .n_fields = N_ELEMS(c41),
+      .exp_hex = "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+    },
+    {
+      .fields = c42, .n_fields = N_ELEMS(c42),
+      .exp_hex = "828684be5886a8eb10649cbf",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+      "cache-control: no-cache\n",
+    },
+    {
+      .fields = c43, .n_fields = N_ELEMS(c43),
+      .exp_hex = "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+      .exp_fields = ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+      "custom-key: custom-value\n",
+    },
+    {
+      // The table emptied, then back to 4096 bytes
+      .fields = c41, .n_fields = N_ELEMS(c41), .limit = 8192,
+      .exp_hex = "203fe11f828684418cf1e3c2e5f23a6ba0ab90f4ff",
+      .exp_fields = ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+    },
+  };
+  thpack_table *encoder = NULL;
+  thpack_table *decoder = NULL;
+
+  if (hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &encoder) < 0 ||
+      hpack_table_new(8192, &decoder) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest     *u = utests + i;
+    struct hpack_buf  out = { NULL, 0, 0 };
+    struct hpack_buf  fields = { NULL, 0, 0 };
+    unsigned char     exp[64];
+    size_t            exp_len = utest_hpack_unhex(u->exp_hex, exp, sizeof exp);
+
+    if (u->limit) {
+      hpack_table_set_limit(encoder, 0);
+      hpack_table_set_limit(encoder, u->limit);
+    }
+
+    if (hpack_encode(encoder, u->fields, u->n_fields, &out) < 0 ||
+        out.len != exp_len || memcmp(out.data, exp, exp_len) ||
+        hpack_decode(decoder, out.data, out.len, utest_hpack_collect, &fields) < 0 ||
+        hpack_buf_append(&fields, "", 1) < 0 ||
+        strcmp((char *) fields.data, u->exp_fields) || decoder->size != encoder->size) {
+      logger("block #%zu: expected %s", i, u->exp_hex);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    hpack_buf_free(&out);
+    hpack_buf_free(&fields);
+  }
+
+ end:
+  hpack_table_free(encoder);
+  hpack_table_free(decoder);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int hpack_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    hpack_integer_utest,
+    hpack_huffman_utest,
+    hpack_decode_utest,
+    hpack_decode_errors_utest,
+    hpack_encode_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,728 @@
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "http.h"
+
+#define UTEST_H2_MAX_STREAMS 2
+#define UTEST_H2_BIG_SIZE    (3 * 1024 * 1024 + 5)
+#define UTEST_H2_SMALL_SIZE  10
+
+// A stand-in HTTP/2 server, one connection at a time, with its own frame
+// I/O and the same HPACK tables as the client.  It allows
+// UTEST_H2_MAX_STREAMS concurrent streams and refuses the others, sends the
+// DATA frames of its streams in turn, as far as the client's windows allow.
+// Replies to /big/<k> and /small/<k> have bodies of byte j being
+// (j + k) % 251, anything else gets a 404.  Each connection starts in its
+// own mode: HTTP/2 right away, HTTP/2 after an h2c upgrade of the first
+// request, or HTTP/1.1 only, the upgrade being declined.
+
+typedef enum {
+  UTEST_H2_PRIOR,
+  UTEST_H2_UPGRADE,
+  UTEST_H2_DECLINE,
+} tutest_h2_mode;
+
+struct utest_h2_conf {
+  tutest_h2_mode mode;
+  int            goaway_after; // Replies before a GOAWAY, 0 for none
+};
+
+struct utest_h2_stream {
+  uint32_t  id;
+  char      path[64];
+  int       code;
+  size_t    len;
+  size_t    off;
+  long long window;
+  int       headers_sent;
+  int       done;
+};
+
+static int utest_h2_read(int fd, void *buf, size_t len)
+{
+  size_t off = 0;
+
+  while (off < len) {
+    ssize_t n = read(fd, (unsigned char *) buf + off, len - off);
+
+    if (n <= 0)
+      return -1;
+
+    off += (size_t) n;
+  }
+
+  return 0;
+}
+
+static int utest_h2_read_frame(int fd, struct http2_frame *frame, unsigned char *payload)
+{
+  unsigned char header[HTTP2_FRAME_HEADER_LEN];
+
+  if (utest_h2_read(fd, header, sizeof header) < 0)
+    return -1;
+
+  frame->len = (uint32_t) header[0] << 16 | (uint32_t) header[1] << 8 | header[2];
+  frame->type = header[3];
+  frame->flags = header[4];
+  frame->stream_id = http2_get32(header + 5) & HTTP2_MAX_STREAM_ID;
+  frame->payload = payload;
+
+  if (frame->len > HTTP2_MAX_FRAME_SIZE)
+    return -1;
+
+  return utest_h2_read(fd, payload, frame->len);
+}
+
+static int utest_h2_write(int fd, void *buf, size_t len)
+{
+  size_t off = 0;
+
+  while (off < len) {
+    ssize_t n = send(fd, (unsigned char *) buf + off, len - off, MSG_NOSIGNAL);
+
+    if (n <= 0)
+      return -1;
+
+    off += (size_t) n;
+  }
+
+  return 0;
+}
+
+static int utest_h2_write_frame(int fd, uint8_t type, uint8_t flags, uint32_t stream_id, void *payload, size_t len)
+{
+  unsigned char buf[HTTP2_FRAME_HEADER_LEN + HTTP2_MAX_FRAME_SIZE];
+
+  buf[0] = (unsigned char) (len >> 16);
+  buf[1] = (unsigned char) (len >> 8);
+  buf[2] = (unsigned char) len;
+  buf[3] = type;
+  buf[4] = flags;
+  http2_put32(buf + 5, stream_id);
+  if (len)
+    memcpy(buf + HTTP2_FRAME_HEADER_LEN, payload, len);
+
+  return utest_h2_write(fd, buf, HTTP2_FRAME_HEADER_LEN + len);
+}
+
+static int utest_h2_on_field(char *name, char *value, void *user_data)
+{
+  struct utest_h2_stream *stream = user_data;
+
+  if (! strcmp(name, ":path"))
+    (void) snprintf(stream->path, sizeof stream->path, "%s", value);
+
+  return 0;
+}
+
+static size_t utest_h2_body_len(char *path, int *kp)
+{
+  if (sscanf(path, "/big/%d", kp) == 1)
+    return UTEST_H2_BIG_SIZE;
+
+  if (sscanf(path, "/small/%d", kp) == 1)
+    return UTEST_H2_SMALL_SIZE;
+
+  return 0;
+}
+
+// The next frame of each stream, HEADERS first.  Once goaway_after streams
+// are answered, GOAWAY tells the last one, and 1 comes back.
+static int utest_h2_send_replies(int fd, thpack_table *encoder, struct utest_h2_stream *streams, size_t n_streams,
+                                 long long *conn_window, int *n_answered, int goaway_after)
+{
+  int progress = 1;
+
+  while (progress) {
+    progress = 0;
+
+    for (size_t i = 0; i < n_streams; i++) {
+      struct utest_h2_stream *s = &streams[i];
+      unsigned char           data[HTTP2_MAX_FRAME_SIZE];
+      size_t                  chunk = HTTP2_MAX_FRAME_SIZE;
+      int                     k = 0;
+
+      if (s->done)
+        continue;
+
+      if (! s->headers_sent) {
+        struct hpack_buf         block = { NULL, 0, 0 };
+        char                     code[8];
+        char                     len[32];
+        struct http_headers_elem fields[] = { { ":status", code }, { "content-length", len }, { "x-path", s->path } };
+        int                      rc = -1;
+
+        (void) snprintf(code, sizeof code, "%d", s->code);
+        (void) snprintf(len, sizeof len, "%zu", s->len);
+        rc = hpack_encode(encoder, fields, N_ELEMS(fields), &block) < 0 ||
+          utest_h2_write_frame(fd, HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS | (s->len ? 0 : HTTP2_FLAG_END_STREAM),
+                               s->id, block.data, block.len) < 0 ? -1 : 0;
+        hpack_buf_free(&block);
+        if (rc < 0)
+          return -1;
+
+        s->headers_sent = progress = 1;
+        s->done = ! s->len;
+      } else {
+        if (chunk > s->len - s->off)
+          chunk = s->len - s->off;
+        if ((long long) chunk > s->window)
+          chunk = (size_t) s->window;
+        if ((long long) chunk > *conn_window)
+          chunk = (size_t) *conn_window;
+        if (! chunk)
+          continue;
+
+        (void) utest_h2_body_len(s->path, &k);
+        for (size_t j = 0; j < chunk; j++)
+          data[j] = (unsigned char) ((s->off + j + (size_t) k) % 251);
+
+        if (utest_h2_write_frame(fd, HTTP2_DATA, s->off + chunk == s->len ? HTTP2_FLAG_END_STREAM : 0,
+                                 s->id, data, chunk) < 0)
+          return -1;
+
+        s->off += chunk;
+        s->window -= (long long) chunk;
+        *conn_window -= (long long) chunk;
+        s->done = s->off == s->len;
+        progress = 1;
+      }
+
+      if (s->done && ++*n_answered == goaway_after) {
+        unsigned char payload[8];
+
+        http2_put32(payload, s->id);
+        http2_put32(payload + 4, HTTP2_NO_ERROR);
+        (void) utest_h2_write_frame(fd, HTTP2_GOAWAY, 0, 0, payload, sizeof payload);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// upgrade_path, if any, was requested in the upgrade request: stream 1
+static int utest_h2_serve_conn(int fd, int goaway_after, char *upgrade_path)
+{
+  unsigned char          preface[HTTP2_PREFACE_LEN];
+  unsigned char          payload[HTTP2_MAX_FRAME_SIZE];
+  unsigned char          settings[6] = { 0, HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 0, 0, 0, UTEST_H2_MAX_STREAMS };
+  struct utest_h2_stream streams[32];
+  size_t                 n_streams = 0;
+  thpack_table          *encoder = NULL;
+  thpack_table          *decoder = NULL;
+  long long              conn_window = HTTP2_INITIAL_WINDOW;
+  long long              initial_window = HTTP2_INITIAL_WINDOW;
+  int                    n_answered = 0;
+  int                    ret = -1;
+
+  if (utest_h2_read(fd, preface, sizeof preface) < 0 ||
+      memcmp(preface, HTTP2_PREFACE, HTTP2_PREFACE_LEN) ||
+      hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &encoder) < 0 ||
+      hpack_table_new(HPACK_DEFAULT_TABLE_SIZE, &decoder) < 0 ||
+      utest_h2_write_frame(fd, HTTP2_SETTINGS, 0, 0, settings, sizeof settings) < 0)
+    goto end;
+
+  if (upgrade_path) {
+    struct utest_h2_stream *s = &streams[n_streams++];
+    int                     k = 0;
+
+    memset(s, 0, sizeof *s);
+    (void) snprintf(s->path, sizeof s->path, "%s", upgrade_path);
+    s->id = 1;
+    s->len = utest_h2_body_len(s->path, &k);
+    s->code = s->len ? 200 : 404;
+    s->window = initial_window;
+  }
+
+  while (1) {
+    struct http2_frame frame;
+    size_t             n_active = 0;
+    int                rc = utest_h2_send_replies(fd, encoder, streams, n_streams, &conn_window,
+                                                  &n_answered, goaway_after);
+
+    // Gone away: what the client still sends until it closes is of no use
+    if (rc) {
+      while (utest_h2_read_frame(fd, &frame, payload) == 0)
+        ;
+      break;
+    }
+
+    // The client is done with the connection once it closes it
+    if (utest_h2_read_frame(fd, &frame, payload) < 0 || frame.type == HTTP2_GOAWAY)
+      break;
+
+    switch (frame.type) {
+    case HTTP2_SETTINGS:
+      if (frame.flags & HTTP2_FLAG_ACK)
+        break;
+
+      for (uint32_t off = 0; off + 6 <= frame.len; off += 6) {
+        if (payload[off + 1] != HTTP2_SETTINGS_INITIAL_WINDOW_SIZE)
+          continue;
+
+        for (size_t i = 0; i < n_streams; i++)
+          streams[i].window += http2_get32(payload + off + 2) - initial_window;
+        initial_window = http2_get32(payload + off + 2);
+      }
+
+      if (utest_h2_write_frame(fd, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0) < 0)
+        goto end;
+      break;
+
+    case HTTP2_WINDOW_UPDATE:
+      if (! frame.stream_id)
+        conn_window += http2_get32(payload);
+
+      for (size_t i = 0; i < n_streams; i++) {
+        if (streams[i].id == frame.stream_id)
+          streams[i].window += http2_get32(payload);
+      }
+      break;
+
+    case HTTP2_HEADERS:
+      for (size_t i = 0; i < n_streams; i++)
+        n_active += ! streams[i].done;
+
+      if (n_streams == N_ELEMS(streams))
+        goto end;
+
+      memset(&streams[n_streams], 0, sizeof streams[n_streams]);
+      if (hpack_decode(decoder, payload, frame.len, utest_h2_on_field, &streams[n_streams]) < 0)
+        goto end;
+
+      if (n_active >= UTEST_H2_MAX_STREAMS) {
+        unsigned char code[4];
+
+        http2_put32(code, HTTP2_REFUSED_STREAM);
+        if (utest_h2_write_frame(fd, HTTP2_RST_STREAM, 0, frame.stream_id, code, sizeof code) < 0)
+          goto end;
+        break;
+      }
+
+      {
+        struct utest_h2_stream *s = &streams[n_streams++];
+        int                     k = 0;
+
+        s->id = frame.stream_id;
+        s->len = utest_h2_body_len(s->path, &k);
+        s->code = strncmp(s->path, "/missing", 8) ? 200 : 404;
+        s->window = initial_window;
+      }
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  ret = 0;
+ end:
+  hpack_table_free(encoder);
+  hpack_table_free(decoder);
+  return ret;
+}
+
+// An HTTP/1.1 request head, read byte after byte not to read past it
+static int utest_h2_read_head(int fd, char *head, size_t size)
+{
+  size_t len = 0;
+
+  while (len < size - 1) {
+    if (read(fd, head + len, 1) != 1)
+      return -1;
+
+    head[++len] = '\0';
+    if (len >= 4 && ! strcmp(head + len - 4, "\r\n\r\n"))
+      return 0;
+  }
+
+  return -1;
+}
+
+// HTTP/1.1 replies, until the client closes the connection
+static int utest_h2_serve_http1(int fd, char *head, size_t head_size)
+{
+  do {
+    char          path[64];
+    char          reply[256];
+    unsigned char body[4096];
+    size_t        len = 0;
+    int           k = 0;
+    int           n = -1;
+
+    if (sscanf(head, "%*s %63s", path) != 1)
+      return -1;
+
+    len = utest_h2_body_len(path, &k);
+    n = snprintf(reply, sizeof reply, "HTTP/1.1 %s\r\ncontent-length: %zu\r\nx-path: %s\r\n\r\n",
+                 len ? "200 OK" : "404 Not Found", len, path);
+    if (utest_h2_write(fd, reply, (size_t) n) < 0)
+      return -1;
+
+    for (size_t off = 0; off < len; off += sizeof body) {
+      size_t chunk = len - off < sizeof body ? len - off : sizeof body;
+
+      for (size_t j = 0; j < chunk; j++)
+        body[j] = (unsigned char) ((off + j + (size_t) k) % 251);
+
+      if (utest_h2_write(fd, body, chunk) < 0)
+        return -1;
+    }
+  } while (utest_h2_read_head(fd, head, head_size) == 0);
+
+  return 0;
+}
+
+static void utest_h2_serve(int lfd, struct utest_h2_conf *confs, size_t n_conns)
+{
+  for (size_t i = 0; i < n_conns; i++) {
+    char  head[1024];
+    char  path[64];
+    char  switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    int   fd = accept(lfd, NULL, NULL);
+    int   rc = -1;
+
+    if (fd < 0)
+      _exit(1);
+
+    switch (confs[i].mode) {
+    case UTEST_H2_PRIOR:
+      rc = utest_h2_serve_conn(fd, confs[i].goaway_after, NULL);
+      break;
+
+    case UTEST_H2_UPGRADE:
+      if (utest_h2_read_head(fd, head, sizeof head) == 0 &&
+          strstr(head, "\r\nUpgrade: h2c\r\n") && strstr(head, "\r\nHTTP2-Settings: AAIAAAAAAAQAEAAA\r\n") &&
+          sscanf(head, "%*s %63s", path) == 1 &&
+          utest_h2_write(fd, switching, sizeof switching - 1) == 0)
+        rc = utest_h2_serve_conn(fd, confs[i].goaway_after, path);
+      break;
+
+    case UTEST_H2_DECLINE:
+      if (utest_h2_read_head(fd, head, sizeof head) == 0 && strstr(head, "\r\nUpgrade: h2c\r\n"))
+        rc = utest_h2_serve_http1(fd, head, sizeof head);
+      break;
+    }
+
+    if (rc < 0)
+      _exit(1);
+
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+static int utest_h2_listen(uint16_t *portp)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  int                fd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(fd, 4) < 0 ||
+      getsockname(fd, (struct sockaddr *) &addr, &len) < 0) {
+    logger("failed to set up the HTTP/2 test server: %m");
+    if (fd >= 0)
+      (void) close(fd);
+    return -1;
+  }
+
+  *portp = ntohs(addr.sin_port);
+  return fd;
+}
+
+// A batch on a new connection to the stand-in
+static int utest_h2_exchange(uint16_t port, thttp_request **requests, size_t n_requests, thttp_reply **replies)
+{
+  tnetwork_driver_ctx *ctx = network_driver_create(NETWORK_DRIVER_TYPE_PLAIN);
+  thttp2_conn         *conn = NULL;
+  char                 port_buf[8];
+  int                  rc = -1;
+
+  (void) snprintf(port_buf, sizeof port_buf, "%"PRIu16, port);
+  if (ctx && network_driver_connect(ctx, "127.0.0.1", port_buf, 5) >= 0 && http2_conn_new(ctx, &conn) == 0) {
+    rc = http2_send_requests(conn, requests, n_requests, replies);
+    http2_conn_shutdown(conn);
+  }
+
+  http2_conn_free(conn);
+  network_driver_free(ctx);
+  return rc;
+}
+
+// What a reply to path should be
+static int utest_h2_check_reply(char *path, thttp_reply *reply, int sunk)
+{
+  unsigned char *body = NULL;
+  size_t         body_len = 0;
+  char          *x_path = NULL;
+  int            k = 0;
+  size_t         exp_len = utest_h2_body_len(path, &k);
+
+  if (! reply)
+    return 0;
+
+  body_len = http_reply_body(reply, &body);
+  if (http_reply_code(reply) != (exp_len ? 200 : 404) || body_len != (sunk ? 0 : exp_len) ||
+      http_headers_lookup(http_reply_header(reply), "x-path", &x_path) < 0 || strcmp(x_path, path))
+    return 0;
+
+  for (size_t j = 0; j < body_len; j++) {
+    if (body[j] != (unsigned char) ((j + (size_t) k) % 251))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Shared by /big/3 and /small/4, whose bodies must come one after the other
+struct utest_h2_sink {
+  int    n_heads;
+  size_t len;
+  int    mixed;
+};
+
+static int utest_h2_head(int code, thttp_headers *headers, void *user_data)
+{
+  struct utest_h2_sink *sink = user_data;
+
+  (void) headers;
+  sink->n_heads += code == 200;
+  return 0;
+}
+
+static int utest_h2_body(unsigned char *data, size_t len, void *user_data)
+{
+  struct utest_h2_sink *sink = user_data;
+
+  for (size_t j = 0; j < len; j++, sink->len++) {
+    size_t expected = sink->len < UTEST_H2_BIG_SIZE ?
+      (sink->len + 3) % 251 : (sink->len - UTEST_H2_BIG_SIZE + 4) % 251;
+
+    sink->mixed |= data[j] != expected;
+  }
+
+  return 0;
+}
+
+// More requests than the server takes at once, some of them with bodies
+// larger than the stream window, come back whole and each to its request,
+// the sinks getting them in order.
+// A GOAWAY leaves the unanswered requests for the next connection, which
+// only sends those.
+static int http2_multiplex_utest(void)
+{
+  int                   n_successes = 0;
+  int                   n_failures = 0;
+  char                 *paths[] = { "/small/1", "/big/0", "/missing", "/big/3", "/small/4", "/small/5" };
+  thttp_request        *requests[N_ELEMS(paths)] = { NULL };
+  thttp_reply          *replies[N_ELEMS(paths)] = { NULL };
+  struct utest_h2_sink  sink_ctx = { 0, 0, 0 };
+  struct http_body_sink sink = {
+    .head_func = utest_h2_head,
+    .body_func = utest_h2_body,
+    .user_data = &sink_ctx,
+  };
+  struct utest_h2_conf  confs[] = { { UTEST_H2_PRIOR, 0 }, { UTEST_H2_PRIOR, 1 }, { UTEST_H2_PRIOR, 0 } };
+  uint16_t              port = 0;
+  int                   lfd = -1;
+  pid_t                 pid = -1;
+  int                   status = 0;
+  size_t                n_answered = 0;
+
+  if ((lfd = utest_h2_listen(&port)) < 0 || (pid = fork()) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == pid)
+    utest_h2_serve(lfd, confs, N_ELEMS(confs));
+
+  for (size_t i = 0; i < N_ELEMS(paths); i++) {
+    if (http_request_new("127.0.0.1", port, paths[i], HTTP_METHOD_GET, NULL, 0, &requests[i]) < 0) {
+      n_failures++;
+      goto end;
+    }
+  }
+  http_request_set_body_sink(requests[3], &sink);
+  http_request_set_body_sink(requests[4], &sink);
+
+  if (utest_h2_exchange(port, requests, N_ELEMS(paths), replies) < 0) {
+    logger("multiplexed requests failed");
+    n_failures++;
+  } else {
+    for (size_t i = 0; i < N_ELEMS(paths); i++) {
+      if (utest_h2_check_reply(paths[i], replies[i], i == 3 || i == 4)) {
+        n_successes++;
+      } else {
+        logger("%s: bad or missing reply", paths[i]);
+        n_failures++;
+      }
+    }
+
+    if (sink_ctx.n_heads == 2 && sink_ctx.len == UTEST_H2_BIG_SIZE + UTEST_H2_SMALL_SIZE && ! sink_ctx.mixed) {
+      n_successes++;
+    } else {
+      logger("sink: got %d replies and %zu bytes%s", sink_ctx.n_heads, sink_ctx.len,
+             sink_ctx.mixed ? ", mixed up" : "");
+      n_failures++;
+    }
+  }
+
+  for (size_t i = 0; i < N_ELEMS(paths); i++) {
+    http_reply_free(replies[i]);
+    replies[i] = NULL;
+    http_request_set_body_sink(requests[i], NULL);
+  }
+
+  // Going away after the first reply, then the others on the next connection
+  if (utest_h2_exchange(port, requests, 4, replies) < 0) {
+    n_failures++;
+  } else {
+    for (size_t i = 0; i < 4; i++)
+      n_answered += replies[i] != NULL;
+
+    if (n_answered == 1 && replies[0]) {
+      n_successes++;
+    } else {
+      logger("GOAWAY: %zu replies", n_answered);
+      n_failures++;
+    }
+  }
+
+  if (utest_h2_exchange(port, requests, 4, replies) == 0 &&
+      utest_h2_check_reply(paths[0], replies[0], 0) && utest_h2_check_reply(paths[1], replies[1], 0) &&
+      utest_h2_check_reply(paths[2], replies[2], 0) && utest_h2_check_reply(paths[3], replies[3], 0)) {
+    n_successes++;
+  } else {
+    logger("after GOAWAY: bad or missing replies");
+    n_failures++;
+  }
+
+ end:
+  for (size_t i = 0; i < N_ELEMS(paths); i++) {
+    http_reply_free(replies[i]);
+    http_request_free(requests[i]);
+  }
+  if (pid > 0 && (waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status))) {
+    logger("HTTP/2 test server failed");
+    n_failures++;
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Cleartext HTTP/2 straight away, after an accepted upgrade, or with the
+// upgrade declined and HTTP/1.1 pipelining instead: the batch comes back
+// whole either way.  So does a single request switching to h2c.
+static int http2_h2c_utest(void)
+{
+  int                  n_successes = 0;
+  int                  n_failures = 0;
+  char                *paths[] = { "/small/1", "/big/0", "/missing", "/small/3" };
+  thttp_request       *requests[N_ELEMS(paths)] = { NULL };
+  thttp_reply         *replies[N_ELEMS(paths)] = { NULL };
+  struct utest_h2_conf confs[] = {
+    { UTEST_H2_PRIOR,   0 },
+    { UTEST_H2_UPGRADE, 0 },
+    { UTEST_H2_DECLINE, 0 },
+    { UTEST_H2_UPGRADE, 0 },
+  };
+  thttp_h2c_mode       modes[] = { HTTP_H2C_PRIOR_KNOWLEDGE, HTTP_H2C_UPGRADE, HTTP_H2C_UPGRADE };
+  char                *names[] = { "prior knowledge", "upgrade", "declined upgrade" };
+  thttp_reply         *reply = NULL;
+  uint16_t             port = 0;
+  int                  lfd = -1;
+  pid_t                pid = -1;
+  int                  status = 0;
+
+  if ((lfd = utest_h2_listen(&port)) < 0 || (pid = fork()) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == pid)
+    utest_h2_serve(lfd, confs, N_ELEMS(confs));
+
+  for (size_t i = 0; i < N_ELEMS(paths); i++) {
+    if (http_request_new("127.0.0.1", port, paths[i], HTTP_METHOD_GET, NULL, 0, &requests[i]) < 0) {
+      n_failures++;
+      goto end;
+    }
+  }
+
+  for (size_t c = 0; c < N_ELEMS(modes); c++) {
+    size_t n_good = 0;
+
+    for (size_t i = 0; i < N_ELEMS(paths); i++)
+      http_request_set_h2c(requests[i], modes[c]);
+
+    if (http_send_requests_pipelined(NULL, requests, N_ELEMS(paths), replies) == 0) {
+      for (size_t i = 0; i < N_ELEMS(paths); i++)
+        n_good += utest_h2_check_reply(paths[i], replies[i], 0);
+    }
+
+    if (n_good == N_ELEMS(paths)) {
+      n_successes++;
+    } else {
+      logger("%s: %zu good replies out of %zu", names[c], n_good, N_ELEMS(paths));
+      n_failures++;
+    }
+
+    for (size_t i = 0; i < N_ELEMS(paths); i++) {
+      http_reply_free(replies[i]);
+      replies[i] = NULL;
+    }
+  }
+
+  if (http_send_request(requests[1], &reply) == 0 && utest_h2_check_reply(paths[1], reply, 0)) {
+    n_successes++;
+  } else {
+    logger("single upgraded request: bad or missing reply");
+    n_failures++;
+  }
+
+ end:
+  http_reply_free(reply);
+  for (size_t i = 0; i < N_ELEMS(paths); i++)
+    http_request_free(requests[i]);
+  if (pid > 0 && (waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status))) {
+    logger("HTTP/2 test server failed");
+    n_failures++;
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int http2_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    http2_multiplex_utest,
+    http2_h2c_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
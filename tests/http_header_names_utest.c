@@ -0,0 +1,120 @@
+#include <ctype.h>
+
+#include "logger.h"
+
+// Every name is found in its own slot, whatever its case, and only the
+// names of the table are.
+static int http_header_names_lookup_utest(void)
+{
+  int   n_successes = 0;
+  int   n_failures = 0;
+  char *unknown[] = { "", "X-Unknown", "Content-Lengt", "Content-Lengths", "Hos", "TE ", "Accept-" };
+  char  upper[64];
+
+  if (HTTP_HEADER_UNKNOWN < sizeof http_header_names_slots) {
+    n_successes++;
+  } else {
+    logger("%u names, too many for the lookup slots", (unsigned) HTTP_HEADER_UNKNOWN);
+    n_failures++;
+  }
+
+  for (unsigned id = 0; id < HTTP_HEADER_UNKNOWN; id++) {
+    char    *name = http_header_name((thttp_header_id) id);
+    char    *lower = http_header_name_lower((thttp_header_id) id);
+    unsigned len = 0;
+    uint32_t hash = http_header_name_hash(name, &len);
+    size_t   i = 0;
+
+    for (i = 0; name[i] && i < sizeof upper - 1; i++)
+      upper[i] = (char) toupper((unsigned char) name[i]);
+    upper[i] = '\0';
+
+    if (http_header_names_slots[HTTP_HEADER_NAMES_SLOT(hash)] != id + 1) {
+      logger("%s: not in its own slot, HTTP_HEADER_NAMES_SEED needs a new value", name);
+      n_failures++;
+    } else if (http_header_name_id(name) != (thttp_header_id) id ||
+               http_header_name_id(lower) != (thttp_header_id) id ||
+               http_header_name_id(upper) != (thttp_header_id) id || strcasecmp(name, lower) ||
+               http_header_name_hash_of((thttp_header_id) id, &len) != hash || len != strlen(name)) {
+      logger("%s: lookup failed", name);
+      n_failures++;
+    } else if (id && strcasecmp(http_header_name((thttp_header_id) (id - 1)), name) >= 0) {
+      logger("%s: out of order", name);
+      n_failures++;
+    } else if (id == HTTP_HEADER_UNKNOWN - 1) {
+      n_successes++;
+    }
+  }
+
+  for (size_t i = 0; i < N_ELEMS(unknown); i++) {
+    if (http_header_name_id(unknown[i]) != HTTP_HEADER_UNKNOWN) {
+      logger("'%s' found", unknown[i]);
+      n_failures++;
+    } else if (i == N_ELEMS(unknown) - 1) {
+      n_successes++;
+    }
+  }
+
+  if (http_header_name_id("content-length") == HTTP_HEADER_CONTENT_LENGTH &&
+      http_header_name_id("Transfer-Encoding") == HTTP_HEADER_TRANSFER_ENCODING &&
+      ! strcmp(http_header_name(HTTP_HEADER_HTTP2_SETTINGS), "HTTP2-Settings") &&
+      ! strcmp(http_header_name_lower(HTTP_HEADER_WWW_AUTHENTICATE), "www-authenticate") &&
+      ! http_header_name(HTTP_HEADER_UNKNOWN)) {
+    n_successes++;
+  } else {
+    logger("IDs and names do not match");
+    n_failures++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// The names of the table are shared, in either spelling, and the others
+// are left alone.
+static int http_header_names_intern_utest(void)
+{
+  int  n_successes = 0;
+  int  n_failures = 0;
+  char host[] = "Host";
+  char *name = NULL;
+
+  if ((name = http_header_name_intern(HTTP_HEADER_HOST, host)) == http_header_name(HTTP_HEADER_HOST) &&
+      http_header_name_is_interned(name) &&
+      (name = http_header_name_intern(HTTP_HEADER_HOST, "host")) == http_header_name_lower(HTTP_HEADER_HOST) &&
+      http_header_name_is_interned(name)) {
+    n_successes++;
+  } else {
+    logger("Host not interned");
+    n_failures++;
+  }
+
+  if (! http_header_name_intern(HTTP_HEADER_HOST, "HOST") &&
+      ! http_header_name_intern(HTTP_HEADER_UNKNOWN, "X-Unknown") &&
+      ! http_header_name_is_interned(host) &&
+      ! http_header_name_is_interned("Host")) {
+    n_successes++;
+  } else {
+    logger("other spellings interned");
+    n_failures++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int http_header_names_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    http_header_names_lookup_utest,
+    http_header_names_intern_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
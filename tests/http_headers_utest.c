@@ -0,0 +1,183 @@
+#include "logger.h"
+
+#define UTEST_HEADERS_MANY 100
+
+static int utest_headers_collect(struct http_headers_elem *elem, void *user_data)
+{
+  char *order = user_data;
+
+  strncat(order, elem->key, 1);
+  return 1;
+}
+
+// Names match whatever their case, several headers may share one, and the
+// index keeps up with the array as it grows.
+static int http_headers_lookup_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  thttp_headers *headers = NULL;
+  char          *value = NULL;
+  char           key[32];
+  char           order[8] = "";
+  int            i = -1;
+
+  if (http_headers_new("Set-Cookie", "a=1", &headers) < 0 ||
+      http_headers_add(headers, "Content-Type", "text/plain") < 0 ||
+      http_headers_add(headers, "set-cookie", "b=2") < 0 ||
+      http_headers_add(headers, "SET-COOKIE", "c=3") < 0) {
+    logger("failed to build the headers");
+    http_headers_free(headers);
+    return 1;
+  }
+
+  if (http_headers_lookup(headers, "content-type", &value) == 1 && ! strcmp(value, "text/plain") &&
+      http_headers_lookup(headers, "CONTENT-TYPE", NULL) == 1 &&
+      http_headers_lookup(headers, "Content-Typ", NULL) < 0 &&
+      http_headers_lookup(headers, "Content-Types", NULL) < 0 &&
+      http_headers_lookup(headers, "", NULL) < 0) {
+    n_successes++;
+  } else {
+    logger("lookups regardless of the case failed");
+    n_failures++;
+  }
+
+  if ((i = http_headers_lookup(headers, "Set-Cookie", &value)) == 0 && ! strcmp(value, "a=1") &&
+      (i = http_headers_lookup_next(headers, i, &value)) == 2 && ! strcmp(value, "b=2") &&
+      (i = http_headers_lookup_next(headers, i, &value)) == 3 && ! strcmp(value, "c=3") &&
+      http_headers_lookup_next(headers, i, &value) < 0 &&
+      http_headers_lookup_next(headers, 1, NULL) < 0 &&
+      http_headers_lookup_next(headers, 4, NULL) < 0) {
+    n_successes++;
+  } else {
+    logger("Set-Cookie values not found in order, at %d", i);
+    n_failures++;
+  }
+
+  // Known names spelled as in the table or in lower case are not copied
+  if (http_headers_lookup_id(headers, HTTP_HEADER_CONTENT_TYPE, &value) == 1 && ! strcmp(value, "text/plain") &&
+      http_headers_lookup_id(headers, HTTP_HEADER_SET_COOKIE, NULL) == 0 &&
+      http_headers_lookup_id(headers, HTTP_HEADER_HOST, NULL) < 0 &&
+      http_header_name_is_interned(headers->entries[0].elem.key) &&
+      http_header_name_is_interned(headers->entries[2].elem.key) &&
+      ! http_header_name_is_interned(headers->entries[3].elem.key)) {
+    n_successes++;
+  } else {
+    logger("lookups by ID failed");
+    n_failures++;
+  }
+
+  if (http_headers_update_value(headers, "SET-cookie", "z=0") == 0 &&
+      http_headers_lookup(headers, "set-cookie", &value) == 0 && ! strcmp(value, "z=0") &&
+      http_headers_update_value(headers, "X-None", "1") < 0) {
+    n_successes++;
+  } else {
+    logger("update of the first Set-Cookie failed");
+    n_failures++;
+  }
+
+  if (http_headers_foreach(headers, utest_headers_collect, order) == 0 && ! strcmp(order, "SCsS")) {
+    n_successes++;
+  } else {
+    logger("iteration out of the insertion order: %s", order);
+    n_failures++;
+  }
+
+  // Beyond the first allocations, the index rebuilt each time
+  for (unsigned n = 0; n < UTEST_HEADERS_MANY; n++) {
+    snprintf(key, sizeof key, "X-Header-%u", n);
+    if (http_headers_add(headers, key, key) < 0)
+      break;
+  }
+
+  for (unsigned n = 0; n < UTEST_HEADERS_MANY; n++) {
+    snprintf(key, sizeof key, "x-header-%u", n);
+    if (http_headers_lookup(headers, key, &value) != (int) n + 4 || strcasecmp(value, key))
+      break;
+
+    if (n == UTEST_HEADERS_MANY - 1)
+      n_successes++;
+  }
+
+  if (http_headers_count(headers) == UTEST_HEADERS_MANY + 4 &&
+      http_headers_lookup_next(headers, 2, &value) == 3 && ! strcmp(value, "c=3")) {
+    n_successes++;
+  } else {
+    logger("%u headers, lookups failed after growing", http_headers_count(headers));
+    n_failures++;
+  }
+
+  http_headers_free(headers);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Views are indexed as copies are, and copied by http_headers_dup().
+static int http_headers_view_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  char           buf[] = "Vary\0Accept\0VARY\0Origin\0Host\0example.com";
+  thttp_headers *headers = NULL;
+  thttp_headers *copy = NULL;
+  char          *value = NULL;
+  int            i = -1;
+
+  if (http_headers_new_view(NULL, 2, &headers) < 0 ||
+      http_headers_add_view(headers, buf, buf + 5) < 0 ||
+      http_headers_add_view(headers, buf + 12, buf + 17) < 0 ||
+      http_headers_add_view(headers, buf + 24, buf + 29) < 0 ||
+      http_headers_dup(headers, &copy) < 0) {
+    logger("failed to build the headers");
+    http_headers_free(headers);
+    return 1;
+  }
+
+  if ((i = http_headers_lookup(headers, "vary", &value)) == 0 && value == buf + 5 &&
+      http_headers_lookup_next(headers, i, &value) == 1 && value == buf + 17 &&
+      http_headers_lookup(headers, "HOST", &value) == 2 && value == buf + 29) {
+    n_successes++;
+  } else {
+    logger("lookups in views failed");
+    n_failures++;
+  }
+
+  if (http_headers_add(headers, "X-Copy", "1") < 0 && http_headers_update_value(headers, "Host", "a") < 0) {
+    n_successes++;
+  } else {
+    logger("views were modified");
+    n_failures++;
+  }
+
+  if ((i = http_headers_lookup(copy, "Vary", &value)) == 0 && value != buf + 5 && ! strcmp(value, "Accept") &&
+      http_headers_lookup_next(copy, i, &value) == 1 && ! strcmp(value, "Origin") &&
+      http_headers_update_value(copy, "host", "example.org") == 2) {
+    n_successes++;
+  } else {
+    logger("copy of views failed");
+    n_failures++;
+  }
+
+  http_headers_free(copy);
+  http_headers_free(headers);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int http_headers_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    http_headers_lookup_utest,
+    http_headers_view_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
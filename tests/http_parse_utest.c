@@ -117,6 +117,26 @@ static int http_parse_code_utest(void)
       .exp_retval = -1,
       .exp_code = 0,
     },
+    // Within buf_size only, as lines parsed in place are not nul-terminated
+    {
+      .buf = "HTTP/1.1 404 Not Found\r\n",
+      .buf_size = 13,
+      .exp_retval = 0,
+      .exp_code = 404,
+    },
+    {
+      .buf = "HTTP/1.1 404 Not Found\r\n",
+      .buf_size = 12,
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 2000 OK\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 -20 OK\r\n",
+      .exp_retval = -1,
+    },
   };
 
   for (size_t i = 0; i < N_ELEMS(utests); i++) {
@@ -124,7 +144,7 @@ static int http_parse_code_utest(void)
     int           retval = -1;
     int           code = -1;
 
-    if (u->buf)
+    if (u->buf && ! u->buf_size)
       u->buf_size = strlen(u->buf) + 1;
 
     retval = http_parse_code((unsigned char *) u->buf, u->buf_size, &code);
@@ -151,7 +171,6 @@ static int http_parse_body_utest(void)
   int         n_failures = 0;
   struct utest {
     char   *buf;
-    size_t  buf_size;
     int     exp_retval;
     char   *exp_body;
     size_t  exp_body_size;
@@ -169,42 +188,52 @@ static int http_parse_body_utest(void)
       .exp_retval = -1,
     },
     {
+      // No status line
       .buf = "foo\r\n\r\nbar",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 SUCCESS\r\nHost: foo\r\n\r\nbar",
       .exp_retval = 0,
       .exp_body = "bar",
-      .exp_body_size = sizeof "bar", // Because we allocate enough room for trailing \0
+      .exp_body_size = sizeof "bar" - 1,
     },
     {
-      .buf = "HTTP1/1 200 SUCCESS\r\nHost: foo\r\n\r\nbar",
+      .buf = "HTTP/1.1 200 SUCCESS\r\nHost: foo\r\nDate: whatever space\r\n\r\nbar",
       .exp_retval = 0,
       .exp_body = "bar",
-      .exp_body_size = sizeof "bar", // Because we allocate enough room for trailing \0
+      .exp_body_size = sizeof "bar" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 SUCCESS\r\nContent-Length: 2\r\n\r\nbar",
+      .exp_retval = 0,
+      .exp_body = "ba",
+      .exp_body_size = sizeof "ba" - 1,
     },
     {
-      .buf = "HTTP1/1 200 SUCCESS\r\nHost: foo\r\nDate: whatever space\r\n\r\nbar",
+      .buf = "HTTP/1.1 200 SUCCESS\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "2\r\nba\r\n1\r\nr\r\n0\r\n\r\n",
       .exp_retval = 0,
       .exp_body = "bar",
-      .exp_body_size = sizeof "bar", // Because we allocate enough room for trailing \0
+      .exp_body_size = sizeof "bar" - 1,
     },
   };
 
   for (size_t i = 0; i < N_ELEMS(utests); i++) {
-    struct utest   *u = utests + i;
+    struct utest  *u = utests + i;
+    thttp_reply   *reply = NULL;
     unsigned char *body = NULL;
     size_t         body_len = 0;
     int            retval = -1;
 
-    if (u->buf)
-      u->buf_size = strlen(u->buf) + 1;
-
-    retval = http_parse_body((unsigned char *) u->buf, u->buf_size, &body, &body_len);
+    retval = http_parse_reply((unsigned char *) u->buf, u->buf ? strlen(u->buf) : 0, &reply);
     if (retval != u->exp_retval) {
       logger("input '%s', expected %d, got %d", u->buf, u->exp_retval, retval);
       n_failures++;
-      free(body);
     } else {
-      if (body && u->exp_body) {
-        if (strcmp((char *) body, u->exp_body)) {
+      if (reply && u->exp_body) {
+        body_len = http_reply_body(reply, &body);
+        if (! body || strcmp((char *) body, u->exp_body)) {
           logger("input '%s', expected body '%s', got '%s'",
                  u->buf, u->exp_body, body);
           n_failures++;
@@ -218,9 +247,387 @@ static int http_parse_body_utest(void)
       n_successes++;
     }
 
-    free(body);
+    http_reply_free(reply);
+  }
+
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Feed a whole buffer at once, and tell whether it holds a complete reply
+// (1), a partial one (0) or an invalid one (-1).
+static int utest_parser_framing(char *buf, int is_head, int eof, size_t *msg_lenp)
+{
+  thttp_parser *parser = NULL;
+  ssize_t       consumed = -1;
+  int           retval = -1;
+
+  if (http_parser_new(NULL, NULL, is_head, &parser) < 0)
+    return -1;
+
+  if ((consumed = http_parser_feed(parser, (unsigned char *) buf, buf ? strlen(buf) : 0)) < 0)
+    goto end;
+
+  if (eof && http_parser_finish(parser) < 0)
+    goto end;
+
+  *msg_lenp = (size_t) consumed;
+  retval = http_parser_is_done(parser);
+ end:
+  http_parser_free(parser);
+  return retval;
+}
+
+static int http_parser_framing_utest(void)
+{
+  int         n_successes = 0;
+  int         n_failures = 0;
+  struct utest {
+    char   *buf;
+    int     is_head;
+    int     eof;
+    int     exp_retval;
+    size_t  exp_msg_len;
+  } utests[] = {
+    {
+      .buf = NULL,
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n",
+      .exp_retval = 0,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n",
+      .eof = 1,
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nfo",
+      .exp_retval = 0,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nfo",
+      .eof = 1,
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\ncontent-length:  3 \r\n\r\nfoo",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\ncontent-length:  3 \r\n\r\nfoo" - 1,
+    },
+    {
+      // Pipelined leftovers are not part of the message
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nfooHTTP/1.1",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nfoo" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: -3\r\n\r\nfoo",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: +3\r\n\r\nfoo",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 18446744073709551616\r\n\r\nfoo",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\n",
+      .is_head = 1,
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\n" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 204 No Content\r\nContent-Length: 3\r\n\r\n",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 204 No Content\r\nContent-Length: 3\r\n\r\n" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 304 Not Modified\r\nETag: x\r\n\r\n",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 304 Not Modified\r\nETag: x\r\n\r\n" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nfoo\r\n",
+      .exp_retval = 0,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nfoo\r\n0\r\n",
+      .exp_retval = 0,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3;ext=1\r\nfoo\r\n0\r\n\r\n",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3;ext=1\r\nfoo\r\n0\r\n\r\n" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\nContent-Length: 1\r\n\r\n"
+             "a\r\n0123456789\r\n0\r\nExpires: never\r\n\r\n",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\nContent-Length: 1\r\n\r\n"
+                            "a\r\n0123456789\r\n0\r\nExpires: never\r\n\r\n" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nfoobar\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n-3\r\nfoo\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n+3\r\nfoo\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n0x3\r\nfoo\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n10000000000000000\r\nfoo\r\n",
+      .exp_retval = -1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip ,\tChunked\r\n\r\n3\r\nfoo\r\n0\r\n\r\n",
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip ,\tChunked\r\n\r\n3\r\nfoo\r\n0\r\n\r\n" - 1,
+    },
+    {
+      // Not chunked, the last coding being another one: up to the end
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: xchunked\r\n\r\nfoo bar",
+      .eof = 1,
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nTransfer-Encoding: xchunked\r\n\r\nfoo bar" - 1,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\n\r\nfoo bar",
+      .eof = 1,
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\n\r\nfoo bar" - 1,
+    },
+    {
+      // No length at all: the body ends with the connection
+      .buf = "HTTP/1.1 200 OK\r\nServer: foo\r\n\r\nfoobar",
+      .exp_retval = 0,
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nServer: foo\r\n\r\nfoobar",
+      .eof = 1,
+      .exp_retval = 1,
+      .exp_msg_len = sizeof "HTTP/1.1 200 OK\r\nServer: foo\r\n\r\nfoobar" - 1,
+    },
+    {
+      .buf = "FOO/1.1 200 OK\r\n\r\n",
+      .exp_retval = -1,
+    },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest *u = utests + i;
+    int           retval = -1;
+    size_t        msg_len = 0;
+
+    retval = utest_parser_framing(u->buf, u->is_head, u->eof, &msg_len);
+    if (retval != u->exp_retval) {
+      logger("input '%s', expected retval %d, got %d", u->buf, u->exp_retval, retval);
+      n_failures++;
+      continue;
+    }
+    if (retval > 0 && msg_len != u->exp_msg_len) {
+      logger("input '%s', expected message length %zu, got %zu", u->buf, u->exp_msg_len, msg_len);
+      n_failures++;
+      continue;
+    }
+    n_successes++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+struct utest_events {
+  int    code;
+  int    n_headers;
+  int    n_complete;
+  char   body[64];
+  size_t body_len;
+};
+
+static int utest_on_status(int code, void *user_data)
+{
+  ((struct utest_events *) user_data)->code = code;
+  return 0;
+}
+
+static int utest_on_header(char *key, char *value, void *user_data)
+{
+  (void) key;
+  (void) value;
+  ((struct utest_events *) user_data)->n_headers++;
+  return 0;
+}
+
+static int utest_on_body(unsigned char *data, size_t len, void *user_data)
+{
+  struct utest_events *events = user_data;
+
+  if (events->body_len + len >= sizeof events->body)
+    return -1;
+
+  memcpy(events->body + events->body_len, data, len);
+  events->body_len += len;
+  return 0;
+}
+
+static int utest_on_message_complete(void *user_data)
+{
+  ((struct utest_events *) user_data)->n_complete++;
+  return 0;
+}
+
+// Whatever the way the reply is split, the events must be the same
+static int http_parser_split_utest(void)
+{
+  int         n_successes = 0;
+  int         n_failures = 0;
+  struct utest {
+    char *buf;
+    int   exp_code;
+    int   exp_n_headers;
+    char *exp_body;
+  } utests[] = {
+    {
+      .buf = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nServer: foo\r\n\r\nhello",
+      .exp_code = 200,
+      .exp_n_headers = 2,
+      .exp_body = "hello",
+    },
+    {
+      .buf = "HTTP/1.1 100 Continue\r\n\r\n"
+             "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok",
+      .exp_code = 201,
+      .exp_n_headers = 1,
+      .exp_body = "ok",
+    },
+    {
+      .buf = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "5\r\nhello\r\n1;foo=bar\r\n \r\n5\r\nworld\r\n0\r\nExpires: never\r\n\r\n",
+      .exp_code = 200,
+      .exp_n_headers = 1,
+      .exp_body = "hello world",
+    },
+    {
+      .buf = "HTTP/1.0 200 OK\nServer: lenient\n\nuntil the end",
+      .exp_code = 200,
+      .exp_n_headers = 1,
+      .exp_body = "until the end",
+    },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(utests); i++) {
+    struct utest *u = utests + i;
+    size_t        buf_len = strlen(u->buf);
+
+    for (size_t step = 1; step <= buf_len; step++) {
+      struct http_parser_callbacks callbacks = {
+        .on_status           = utest_on_status,
+        .on_header           = utest_on_header,
+        .on_body             = utest_on_body,
+        .on_message_complete = utest_on_message_complete,
+      };
+      struct utest_events events;
+      thttp_parser       *parser = NULL;
+      int                 failed = 0;
+
+      memset(&events, 0, sizeof events);
+      if (http_parser_new(&callbacks, &events, 0, &parser) < 0) {
+        n_failures++;
+        continue;
+      }
+
+      for (size_t off = 0; off < buf_len && ! failed; off += step) {
+        size_t n = buf_len - off < step ? buf_len - off : step;
+
+        if (http_parser_feed(parser, (unsigned char *) u->buf + off, n) != (ssize_t) n)
+          failed = 1;
+      }
+
+      if (! failed && http_parser_finish(parser) < 0)
+        failed = 1;
+
+      if (failed || events.code != u->exp_code || events.n_headers != u->exp_n_headers ||
+          events.n_complete != 1 || events.body_len != strlen(u->exp_body) ||
+          memcmp(events.body, u->exp_body, events.body_len)) {
+        logger("input '%s' fed by %zu bytes, got code %d, %d headers, body '%.*s'",
+               u->buf, step, events.code, events.n_headers, (int) events.body_len, events.body);
+        n_failures++;
+      } else {
+        n_successes++;
+      }
+
+      http_parser_free(parser);
+    }
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// In place, the headers point into the fed buffer, and a head line cut short
+// is only consumed once it comes whole
+static int http_parser_in_place_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  char           buf[] = "HTTP/1.1 200 OK\r\nServer:  utest \r\nContent-Length: 2\r\n\r\nok";
+  size_t         line = PTRDIFF(strstr(buf, "Content-Length"), buf);
+  size_t         cut = line + 4;
+  thttp_parser  *parser = NULL;
+  thttp_headers *headers = NULL;
+  char          *value = NULL;
+  ssize_t        n = -1;
+
+  if (http_parser_new(NULL, NULL, 0, &parser) < 0) {
+    n_failures++;
+    goto end;
+  }
+  http_parser_set_in_place(parser);
+
+  // Lines are nul-terminated where they are
+  if ((n = http_parser_feed(parser, (unsigned char *) buf, cut)) == (ssize_t) line) {
+    n_successes++;
+  } else {
+    logger("%zd bytes consumed out of %zu, a partial line included", n, cut);
+    n_failures++;
+  }
+
+  if (n >= 0 && http_parser_feed(parser, (unsigned char *) buf + n, sizeof buf - 1 - (size_t) n) ==
+      (ssize_t) (sizeof buf - 1 - (size_t) n) && http_parser_is_done(parser)) {
+    n_successes++;
+  } else {
+    logger("the reply was not parsed whole");
+    n_failures++;
+  }
+
+  headers = http_parser_headers(parser);
+  if (headers && http_headers_lookup(headers, "Server", &value) >= 0 && ! strcmp(value, "utest") &&
+      value > buf && value < buf + sizeof buf) {
+    n_successes++;
+  } else {
+    logger("the Server header is not a view into the buffer");
+    n_failures++;
   }
 
+ end:
+  http_parser_free(parser);
 
   logger("Successes: %d, Failures: %d", n_successes, n_failures);
   return n_failures;
@@ -234,6 +641,9 @@ int http_parse_utest(void)
     http_parse_code_utest,
     http_parse_headers_utest,
     http_parse_body_utest,
+    http_parser_framing_utest,
+    http_parser_split_utest,
+    http_parser_in_place_utest,
   };
 
   for (size_t i = 0; i < N_ELEMS(funcs); i++) {
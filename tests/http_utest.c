@@ -0,0 +1,820 @@
+#include <stdio.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define UTEST_ASYNC_N_REQUESTS 64
+#define UTEST_SPLICE_BODY_SIZE (1024 * 1024 + 17)
+#define UTEST_PIPELINE_N_REQUESTS 5
+#define UTEST_PIPELINE_PER_CONN   2
+#define UTEST_IN_PLACE_BIG_BODY   (100 * 1000)
+#define UTEST_IN_PLACE_BIG_HEADER (40 * 1000)
+// Twice the first receive buffer, in headers of UTEST_IN_PLACE_VALUE_LEN
+#define UTEST_IN_PLACE_N_HEADERS  200
+#define UTEST_IN_PLACE_VALUE_LEN  150
+
+// A tiny HTTP server living in the same event loop as the requests: it
+// answers each request with its path as the body, then closes.
+struct utest_server {
+  tevent_loop *loop;
+  int          lfd;
+  int          n_pending;
+};
+
+struct utest_server_conn {
+  struct utest_server *server;
+  char                 buf[1024];
+  size_t               len;
+};
+
+struct utest_async_result {
+  struct utest_server *server;
+  int                  index;
+  int                  n_done;
+  int                  ok;
+};
+
+static void utest_server_conn_handler(int fd, int events, void *user_data)
+{
+  struct utest_server_conn *conn = user_data;
+  char                      reply[1024];
+  char                      path[256];
+  ssize_t                   n = -1;
+  int                       reply_len = -1;
+
+  if (events & EVENT_LOOP_TIMEOUT)
+    goto end;
+
+  n = recv(fd, conn->buf + conn->len, sizeof conn->buf - conn->len - 1, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+
+  if (n <= 0)
+    goto end;
+
+  conn->len += (size_t) n;
+  conn->buf[conn->len] = '\0';
+  if (! strstr(conn->buf, "\r\n\r\n"))
+    return;
+
+  if (sscanf(conn->buf, "GET %255s HTTP/1.1", path) != 1)
+    goto end;
+
+  reply_len = snprintf(reply, sizeof reply,
+                       "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n%s",
+                       strlen(path), path);
+  (void) send(fd, reply, (size_t) reply_len, MSG_NOSIGNAL);
+
+ end:
+  event_loop_del(conn->server->loop, fd);
+  (void) close(fd);
+  free(conn);
+}
+
+static void utest_server_accept_handler(int fd, int events, void *user_data)
+{
+  struct utest_server      *server = user_data;
+  struct utest_server_conn *conn = NULL;
+  int                       cfd = -1;
+
+  (void) events;
+
+  while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if (! (conn = calloc(1, sizeof *conn))) {
+      (void) close(cfd);
+      continue;
+    }
+
+    conn->server = server;
+    if (event_loop_add(server->loop, cfd, EVENT_LOOP_READ, event_loop_now_ms() + 5000,
+                       utest_server_conn_handler, conn) < 0) {
+      (void) close(cfd);
+      free(conn);
+    }
+  }
+}
+
+static void utest_async_done(thttp_request *request, thttp_reply *reply, void *user_data)
+{
+  struct utest_async_result *result = user_data;
+  unsigned char             *body = NULL;
+  size_t                     body_len = 0;
+
+  result->n_done++;
+
+  if (reply) {
+    body_len = http_reply_body(reply, &body);
+    result->ok = http_reply_code(reply) == 200 &&
+      body_len == strlen(http_request_path(request)) &&
+      0 == memcmp(body, http_request_path(request), body_len);
+  }
+
+  http_reply_free(reply);
+
+  // Once everybody got an answer, the listener is the last thing keeping
+  // the loop running.
+  if (0 == --result->server->n_pending)
+    event_loop_del(result->server->loop, result->server->lfd);
+}
+
+static int http_async_fanout_utest(void)
+{
+  int                        n_successes = 0;
+  int                        n_failures = 0;
+  struct utest_server        server = { .loop = NULL, .lfd = -1, .n_pending = 0 };
+  struct utest_async_result  results[UTEST_ASYNC_N_REQUESTS];
+  thttp_request             *requests[UTEST_ASYNC_N_REQUESTS] = { NULL };
+  struct sockaddr_in         addr;
+  socklen_t                  len = sizeof addr;
+  char                       path[32];
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (event_loop_new(&server.loop) < 0 ||
+      (server.lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ||
+      bind(server.lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(server.lfd, UTEST_ASYNC_N_REQUESTS) < 0 ||
+      getsockname(server.lfd, (struct sockaddr *) &addr, &len) < 0 ||
+      event_loop_add(server.loop, server.lfd, EVENT_LOOP_READ, 0,
+                     utest_server_accept_handler, &server) < 0) {
+    logger("failed to set up the loopback server: %m");
+    n_failures++;
+    goto end;
+  }
+
+  for (int i = 0; i < UTEST_ASYNC_N_REQUESTS; i++) {
+    results[i] = (struct utest_async_result) { .server = &server, .index = i };
+
+    snprintf(path, sizeof path, "/request/%d", i);
+    if (http_request_new("127.0.0.1", ntohs(addr.sin_port), path, HTTP_METHOD_GET,
+                         NULL, 0, &requests[i]) < 0 ||
+        http_send_request_async(server.loop, requests[i], utest_async_done, &results[i]) < 0) {
+      logger("request #%d: failed to start", i);
+      n_failures++;
+      continue;
+    }
+
+    server.n_pending++;
+  }
+
+  if (! server.n_pending)
+    event_loop_del(server.loop, server.lfd);
+
+  if (event_loop_run(server.loop) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  for (int i = 0; i < UTEST_ASYNC_N_REQUESTS; i++) {
+    if (! requests[i])
+      continue;
+
+    if (results[i].n_done == 1 && results[i].ok) {
+      n_successes++;
+    } else {
+      logger("request #%d: done %d time(s), %s reply", i,
+             results[i].n_done, results[i].ok ? "good" : "bad");
+      n_failures++;
+    }
+  }
+
+ end:
+  for (int i = 0; i < UTEST_ASYNC_N_REQUESTS; i++)
+    http_request_free(requests[i]);
+  if (server.lfd >= 0)
+    (void) close(server.lfd);
+  event_loop_free(server.loop);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Serve each connection a body of UTEST_SPLICE_BODY_SIZE bytes, i % 251
+static void utest_splice_serve(int lfd)
+{
+  unsigned char *body = malloc(UTEST_SPLICE_BODY_SIZE);
+  char           head[128];
+  int            head_len = -1;
+  int            fd = -1;
+
+  if (! body)
+    _exit(1);
+
+  for (size_t i = 0; i < UTEST_SPLICE_BODY_SIZE; i++)
+    body[i] = (unsigned char) (i % 251);
+
+  head_len = snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+                      UTEST_SPLICE_BODY_SIZE);
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    char   buf[1024];
+    size_t len = 0;
+    size_t off = 0;
+    ssize_t n = -1;
+
+    while (len < sizeof buf - 1 && (n = recv(fd, buf + len, sizeof buf - 1 - len, 0)) > 0) {
+      len += (size_t) n;
+      buf[len] = '\0';
+      if (strstr(buf, "\r\n\r\n"))
+        break;
+    }
+
+    // Along with the head, some of the body comes before the splicing
+    (void) send(fd, head, (size_t) head_len, MSG_NOSIGNAL | MSG_MORE);
+    while (off < UTEST_SPLICE_BODY_SIZE && (n = send(fd, body + off, UTEST_SPLICE_BODY_SIZE - off, MSG_NOSIGNAL)) > 0)
+      off += (size_t) n;
+
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+struct utest_splice_sink {
+  int fd;
+  int n_body_calls;
+};
+
+static int utest_splice_body_fd(unsigned long long len, void *user_data)
+{
+  struct utest_splice_sink *sink = user_data;
+
+  return len == UTEST_SPLICE_BODY_SIZE ? sink->fd : -1;
+}
+
+static int utest_splice_body(unsigned char *data, size_t len, void *user_data)
+{
+  struct utest_splice_sink *sink = user_data;
+
+  sink->n_body_calls++;
+  return write(sink->fd, data, len) == (ssize_t) len ? 0 : -1;
+}
+
+// The body lands in the file whether the driver splices it (plain) or not
+// (uring), in the first case without any body_func call.
+static int http_splice_body_utest(void)
+{
+  int                      n_successes = 0;
+  int                      n_failures = 0;
+  struct sockaddr_in       addr;
+  socklen_t                len = sizeof addr;
+  char                     path[] = "/tmp/httpc-utest-body-XXXXXX";
+  char                    *drivers[] = { "plain", "uring" };
+  unsigned char           *body = NULL;
+  struct utest_splice_sink sink_ctx = { .fd = -1, .n_body_calls = 0 };
+  struct http_body_sink    sink = {
+    .body_func    = utest_splice_body,
+    .user_data    = &sink_ctx,
+    .body_fd_func = utest_splice_body_fd,
+  };
+  int                      lfd = -1;
+  pid_t                    pid = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (! (body = malloc(UTEST_SPLICE_BODY_SIZE)) ||
+      (sink_ctx.fd = mkstemp(path)) < 0 ||
+      (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(lfd, 4) < 0 ||
+      getsockname(lfd, (struct sockaddr *) &addr, &len) < 0 ||
+      (pid = fork()) < 0) {
+    logger("failed to set up the splice test: %m");
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == pid)
+    utest_splice_serve(lfd);
+
+  for (size_t i = 0; i < N_ELEMS(drivers); i++) {
+    thttp_request *request = NULL;
+    thttp_reply   *reply = NULL;
+    ssize_t        n = -1;
+    int            ok = 0;
+
+    sink_ctx.n_body_calls = 0;
+    if (ftruncate(sink_ctx.fd, 0) < 0 || lseek(sink_ctx.fd, 0, SEEK_SET) < 0 ||
+        http_request_new("127.0.0.1", ntohs(addr.sin_port), "/", HTTP_METHOD_GET, NULL, 0, &request) < 0 ||
+        http_request_set_driver(request, drivers[i]) < 0) {
+      http_request_free(request);
+      n_failures++;
+      continue;
+    }
+
+    http_request_set_body_sink(request, &sink);
+    if (http_send_request(request, &reply) == 0 && http_reply_code(reply) == 200 &&
+        (n = pread(sink_ctx.fd, body, UTEST_SPLICE_BODY_SIZE, 0)) == UTEST_SPLICE_BODY_SIZE) {
+      ok = 1;
+      for (size_t j = 0; ok && j < UTEST_SPLICE_BODY_SIZE; j++)
+        ok = body[j] == (unsigned char) (j % 251);
+    }
+
+    if (ok && (i > 0 || 0 == sink_ctx.n_body_calls)) {
+      n_successes++;
+    } else {
+      logger("%s: %zd bytes in the file, %s, %d body_func calls", drivers[i], n,
+             ok ? "good" : "bad", sink_ctx.n_body_calls);
+      n_failures++;
+    }
+
+    http_reply_free(reply);
+    http_request_free(request);
+  }
+
+ end:
+  if (pid > 0) {
+    (void) kill(pid, SIGTERM);
+    (void) waitpid(pid, NULL, 0);
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+  if (sink_ctx.fd >= 0) {
+    (void) close(sink_ctx.fd);
+    (void) unlink(path);
+  }
+  free(body);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Answer UTEST_PIPELINE_PER_CONN requests per connection, then close it
+// without notice.  The body tells the path and the connection's number.
+static void utest_pipeline_serve(int lfd)
+{
+  int fd = -1;
+  int n_conns = 0;
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    char    buf[4096];
+    size_t  len = 0;
+    ssize_t n = -1;
+    int     n_replies = 0;
+
+    n_conns++;
+    while (n_replies < UTEST_PIPELINE_PER_CONN &&
+           (n = recv(fd, buf + len, sizeof buf - 1 - len, 0)) > 0) {
+      char *end = NULL;
+
+      len += (size_t) n;
+      buf[len] = '\0';
+
+      while (n_replies < UTEST_PIPELINE_PER_CONN && (end = strstr(buf, "\r\n\r\n"))) {
+        char path[64] = "";
+        char body[96];
+        char reply[256];
+        int  body_len = -1;
+        int  reply_len = -1;
+
+        (void) sscanf(buf, "%*s %63s", path);
+        body_len = snprintf(body, sizeof body, "%s %d", path, n_conns);
+        reply_len = snprintf(reply, sizeof reply, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s",
+                             body_len, body);
+        (void) send(fd, reply, (size_t) reply_len, MSG_NOSIGNAL);
+        n_replies++;
+
+        len -= (size_t) (end + 4 - buf);
+        memmove(buf, end + 4, len + 1);
+      }
+    }
+
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+// The replies come in order, the unanswered GET requests going again on a
+// new connection, but not a POST one.
+static int http_pipeline_utest(void)
+{
+  int                n_successes = 0;
+  int                n_failures = 0;
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  thttp_request     *requests[UTEST_PIPELINE_N_REQUESTS] = { NULL };
+  thttp_reply       *replies[UTEST_PIPELINE_N_REQUESTS] = { NULL };
+  int                lfd = -1;
+  pid_t              pid = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(lfd, 4) < 0 ||
+      getsockname(lfd, (struct sockaddr *) &addr, &len) < 0 ||
+      (pid = fork()) < 0) {
+    logger("failed to set up the pipelining test: %m");
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == pid)
+    utest_pipeline_serve(lfd);
+
+  for (int i = 0; i < UTEST_PIPELINE_N_REQUESTS; i++) {
+    char path[16];
+
+    (void) snprintf(path, sizeof path, "/%d", i);
+    if (http_request_new("127.0.0.1", ntohs(addr.sin_port), path, HTTP_METHOD_GET, NULL, 0, &requests[i]) < 0) {
+      n_failures++;
+      goto end;
+    }
+  }
+
+  if (http_send_requests_pipelined(NULL, requests, UTEST_PIPELINE_N_REQUESTS, replies) < 0) {
+    logger("pipelined requests failed");
+    n_failures++;
+  } else {
+    for (int i = 0; i < UTEST_PIPELINE_N_REQUESTS; i++) {
+      unsigned char *body = NULL;
+      size_t         body_len = http_reply_body(replies[i], &body);
+      char           expected[32];
+      int            expected_len = snprintf(expected, sizeof expected, "/%d %d",
+                                             i, i / UTEST_PIPELINE_PER_CONN + 1);
+
+      if (body_len == (size_t) expected_len && ! memcmp(body, expected, body_len)) {
+        n_successes++;
+      } else {
+        logger("reply #%d: expected '%s', got '%.*s'", i, expected, (int) body_len, body);
+        n_failures++;
+      }
+    }
+  }
+
+  for (int i = 0; i < UTEST_PIPELINE_N_REQUESTS; i++) {
+    http_reply_free(replies[i]);
+    replies[i] = NULL;
+  }
+
+  // The server may have processed the POST before closing
+  http_request_free(requests[UTEST_PIPELINE_N_REQUESTS - 1]);
+  requests[UTEST_PIPELINE_N_REQUESTS - 1] = NULL;
+  if (http_request_new("127.0.0.1", ntohs(addr.sin_port), "/post", HTTP_METHOD_POST, NULL, 0,
+                       &requests[UTEST_PIPELINE_N_REQUESTS - 1]) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (http_send_requests_pipelined(NULL, requests, UTEST_PIPELINE_N_REQUESTS, replies) < 0 &&
+      replies[0] && replies[1] && ! replies[2]) {
+    n_successes++;
+  } else {
+    logger("pipelined POST request sent again");
+    n_failures++;
+  }
+
+ end:
+  for (int i = 0; i < UTEST_PIPELINE_N_REQUESTS; i++) {
+    http_reply_free(replies[i]);
+    http_request_free(requests[i]);
+  }
+  if (pid > 0) {
+    (void) kill(pid, SIGTERM);
+    (void) waitpid(pid, NULL, 0);
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Once the 4 requests are in, all the replies go in a single write, so that
+// each one comes along with the beginning of the next
+static void utest_in_place_serve(int lfd)
+{
+  char   *replies = NULL;
+  size_t  len = 0;
+  char    buf[4096];
+  size_t  n_heads = 0;
+  ssize_t n = -1;
+  int     fd = -1;
+
+  if (! (replies = malloc(UTEST_IN_PLACE_BIG_BODY + UTEST_IN_PLACE_BIG_HEADER +
+                          UTEST_IN_PLACE_N_HEADERS * (UTEST_IN_PLACE_VALUE_LEN + 32) + 1024)) ||
+      (fd = accept(lfd, NULL, NULL)) < 0)
+    _exit(1);
+
+  len += (size_t) sprintf(replies + len, "HTTP/1.1 100 Continue\r\n\r\n"
+                          "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-A:  spaced \t \r\n\r\nhello");
+
+  len += (size_t) sprintf(replies + len, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", UTEST_IN_PLACE_BIG_BODY);
+  for (int i = 0; i < UTEST_IN_PLACE_BIG_BODY; i++)
+    replies[len++] = (char) ('a' + i % 26);
+
+  len += (size_t) sprintf(replies + len, "HTTP/1.1 200 OK\r\nX-Big: ");
+  memset(replies + len, 'b', UTEST_IN_PLACE_BIG_HEADER);
+  len += UTEST_IN_PLACE_BIG_HEADER;
+  len += (size_t) sprintf(replies + len, "\r\nContent-Length: 3\r\n\r\nabc");
+
+  len += (size_t) sprintf(replies + len, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "5\r\nchunk\r\n6\r\ned bod\r\n0\r\n\r\n");
+
+  len += (size_t) sprintf(replies + len, "HTTP/1.1 200 OK\r\n");
+  for (int i = 0; i < UTEST_IN_PLACE_N_HEADERS; i++) {
+    len += (size_t) sprintf(replies + len, "X-Header-%d: ", i);
+    memset(replies + len, 'c', UTEST_IN_PLACE_VALUE_LEN);
+    len += UTEST_IN_PLACE_VALUE_LEN;
+    len += (size_t) sprintf(replies + len, "\r\n");
+  }
+  len += (size_t) sprintf(replies + len, "Content-Length: 4\r\n\r\nmany");
+
+  while (n_heads < 5 && (n = recv(fd, buf, sizeof buf - 1, 0)) > 0) {
+    buf[n] = '\0';
+    for (char *p = buf; (p = strstr(p, "\r\n\r\n")); p += 4)
+      n_heads++;
+  }
+
+  for (size_t off = 0; off < len; off += (size_t) n) {
+    if ((n = send(fd, replies + off, len - off, MSG_NOSIGNAL)) < 0)
+      _exit(1);
+  }
+
+  while (recv(fd, buf, sizeof buf, 0) > 0)
+    ;
+
+  _exit(0);
+}
+
+// Replies received in place, in arena if not NULL: after an interim one,
+// with a body larger than the receive buffer, with a header larger than it,
+// a chunked one, and one with many headers larger than it together
+static int utest_in_place(tarena *arena)
+{
+  int                n_successes = 0;
+  int                n_failures = 0;
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  thttp_request     *requests[5] = { NULL };
+  thttp_reply       *replies[5] = { NULL };
+  char              *big_body = NULL;
+  char              *big_header = NULL;
+  char              *value = NULL;
+  char              *many_value = NULL;
+  int                lfd = -1;
+  pid_t              pid = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (! (big_body = malloc(UTEST_IN_PLACE_BIG_BODY + 1)) ||
+      ! (big_header = malloc(UTEST_IN_PLACE_BIG_HEADER + 1)) ||
+      ! (many_value = malloc(UTEST_IN_PLACE_VALUE_LEN + 1)) ||
+      (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(lfd, 4) < 0 ||
+      getsockname(lfd, (struct sockaddr *) &addr, &len) < 0 ||
+      (pid = fork()) < 0) {
+    logger("failed to set up the in place test: %m");
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == pid)
+    utest_in_place_serve(lfd);
+
+  for (int i = 0; i < UTEST_IN_PLACE_BIG_BODY; i++)
+    big_body[i] = (char) ('a' + i % 26);
+  big_body[UTEST_IN_PLACE_BIG_BODY] = '\0';
+  memset(big_header, 'b', UTEST_IN_PLACE_BIG_HEADER);
+  big_header[UTEST_IN_PLACE_BIG_HEADER] = '\0';
+  memset(many_value, 'c', UTEST_IN_PLACE_VALUE_LEN);
+  many_value[UTEST_IN_PLACE_VALUE_LEN] = '\0';
+
+  for (size_t i = 0; i < N_ELEMS(requests); i++) {
+    thttp_headers *headers = NULL;
+
+    if (http_headers_new_in(arena, &headers) < 0 || http_headers_add(headers, "Accept", "*/*") < 0 ||
+        http_request_new_in(arena, "127.0.0.1", ntohs(addr.sin_port), "/", HTTP_METHOD_GET, headers, 0,
+                            &requests[i]) < 0) {
+      http_headers_free(headers);
+      n_failures++;
+      goto end;
+    }
+  }
+
+  if (http_send_requests_pipelined(NULL, requests, N_ELEMS(requests), replies) < 0) {
+    logger("pipelined requests failed");
+    n_failures++;
+    goto end;
+  }
+
+  {
+    char *expected[] = { "hello", big_body, "abc", "chunked bod", "many" };
+
+    for (size_t i = 0; i < N_ELEMS(expected); i++) {
+      unsigned char *body = NULL;
+      size_t         body_len = http_reply_body(replies[i], &body);
+
+      // Nul-terminated, as they always were
+      if (http_reply_code(replies[i]) == 200 && body_len == strlen(expected[i]) &&
+          ! strcmp((char *) body, expected[i])) {
+        n_successes++;
+      } else {
+        logger("reply #%zu: %d, unexpected %zu-byte body", i, http_reply_code(replies[i]), body_len);
+        n_failures++;
+      }
+    }
+  }
+
+  if (http_headers_lookup(http_reply_header(replies[0]), "X-A", &value) >= 0 && ! strcmp(value, "spaced") &&
+      http_headers_lookup(http_reply_header(replies[2]), "X-Big", &value) >= 0 && ! strcmp(value, big_header) &&
+      http_headers_lookup(http_reply_header(replies[4]), "X-Header-0", &value) >= 0 && ! strcmp(value, many_value) &&
+      http_headers_lookup(http_reply_header(replies[4]), "X-Header-199", &value) >= 0 &&
+      ! strcmp(value, many_value)) {
+    n_successes++;
+  } else {
+    logger("headers received in place do not match");
+    n_failures++;
+  }
+
+ end:
+  for (size_t i = 0; i < N_ELEMS(requests); i++) {
+    http_reply_free(replies[i]);
+    http_request_free(requests[i]);
+  }
+  if (pid > 0) {
+    (void) kill(pid, SIGTERM);
+    (void) waitpid(pid, NULL, 0);
+  }
+  if (lfd >= 0)
+    (void) close(lfd);
+  free(many_value);
+  free(big_header);
+  free(big_body);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int http_in_place_utest(void)
+{
+  return utest_in_place(NULL);
+}
+
+static void *utest_arena_alloc(size_t size, void *user_data)
+{
+  ++*(int *) user_data;
+  return malloc(size);
+}
+
+static void *utest_arena_realloc(void *ptr, size_t size, void *user_data)
+{
+  (void) user_data;
+  return realloc(ptr, size);
+}
+
+static void utest_arena_free(void *ptr, void *user_data)
+{
+  --*(int *) user_data;
+  free(ptr);
+}
+
+// The same in an arena, through the embedder's allocator: a handful of
+// chunks for the four requests and replies, all released with the arena.
+static int http_arena_utest(void)
+{
+  int                n_successes = 0;
+  int                n_failures = 0;
+  int                n_chunks = 0;
+  int                n_allocs = 0;
+  struct arena_hooks hooks = {
+    .alloc_func = utest_arena_alloc,
+    .realloc_func = utest_arena_realloc,
+    .free_func = utest_arena_free,
+    .user_data = &n_chunks,
+  };
+  tarena            *arena = NULL;
+
+  if (arena_new(0, &hooks, &arena) < 0) {
+    logger("failed to create the arena");
+    return 1;
+  }
+
+  n_failures += utest_in_place(arena);
+  n_allocs = n_chunks;
+  arena_free(arena);
+
+  // The arena, a receive buffer per reply, and the large body
+  if (n_allocs <= 9 && ! n_chunks) {
+    n_successes++;
+  } else {
+    logger("%d chunks allocated, %d left", n_allocs, n_chunks);
+    n_failures++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// The request comes out the same as a vector and as a buffer, headers in
+// their order, with or without any.
+static int http_request_serialize_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  thttp_headers *headers = NULL;
+  struct {
+    int   with_headers;
+    char *expected;
+  } tests[] = {
+    { 0, "GET /a/b?c=d HTTP/1.1\r\n\r\n" },
+    { 1, "GET /a/b?c=d HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\nX-Empty: \r\n\r\n" },
+  };
+
+  if (http_headers_new("Host", "example.com", &headers) < 0 ||
+      http_headers_add(headers, "Accept", "*/*") < 0 ||
+      http_headers_add(headers, "X-Empty", "") < 0) {
+    http_headers_free(headers);
+    logger("Successes: %d, Failures: %d", n_successes, ++n_failures);
+    return n_failures;
+  }
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++) {
+    thttp_request *request = NULL;
+    thttp_headers *copy = NULL;
+    unsigned char *buf = NULL;
+    size_t         buf_len = 0;
+    struct iovec  *iov = NULL;
+    int            iovcnt = 0;
+    size_t         off = 0;
+    int            same = 1;
+
+    if ((tests[i].with_headers && http_headers_dup(headers, &copy) < 0) ||
+        http_request_new("example.com", 80, "/a/b?c=d", HTTP_METHOD_GET, copy, 0, &request) < 0 ||
+        http_request_get_buffer(request, &buf, &buf_len) < 0 ||
+        http_request_get_iovec(request, &iov, &iovcnt) < 0) {
+      n_failures++;
+      goto next;
+    }
+
+    for (int j = 0; j < iovcnt && same; j++) {
+      same = off + iov[j].iov_len <= buf_len && ! memcmp(buf + off, iov[j].iov_base, iov[j].iov_len);
+      off += iov[j].iov_len;
+    }
+
+    if (buf_len == strlen(tests[i].expected) && ! memcmp(buf, tests[i].expected, buf_len) &&
+        same && off == buf_len) {
+      n_successes++;
+    } else {
+      logger("%zu: got \"%.*s\" (%zu bytes from the vector), expected \"%s\"",
+             i, (int) buf_len, buf ? (char *) buf : "", off, tests[i].expected);
+      n_failures++;
+    }
+
+  next:
+    free(iov);
+    free(buf);
+    if (! request)
+      http_headers_free(copy);
+    http_request_free(request);
+  }
+
+  {
+    char *s = http_headers_to_string(headers);
+
+    if (s && ! strcmp(s, "Host: example.com\r\nAccept: */*\r\nX-Empty: \r\n")) {
+      n_successes++;
+    } else {
+      logger("headers to string: \"%s\"", s ? s : "(null)");
+      n_failures++;
+    }
+    free(s);
+  }
+
+  http_headers_free(headers);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int http_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    http_async_fanout_utest,
+    http_splice_body_utest,
+    http_pipeline_utest,
+    http_request_serialize_utest,
+    http_in_place_utest,
+    http_arena_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
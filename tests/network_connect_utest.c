@@ -0,0 +1,284 @@
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+static int network_connect_interleave_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+
+  struct {
+    char *families; // Resolver order, then expected order, '4' or '6' each
+    char *expected;
+  } tests[] = {
+    { "66644", "64646" },
+    { "44466", "46464" },
+    { "6444",  "6444"  },
+    { "4466",  "4646"  },
+    { "64",    "64"    },
+    { "4",     "4"     },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++) {
+    struct addrinfo  ais[8];
+    struct addrinfo *addrs[8];
+    size_t           n = strlen(tests[i].families);
+    char             got[9];
+
+    memset(ais, 0, sizeof ais);
+    for (size_t j = 0; j < n; j++) {
+      ais[j].ai_family = tests[i].families[j] == '6' ? AF_INET6 : AF_INET;
+      addrs[j] = &ais[j];
+    }
+
+    if (connector_interleave(addrs, n) < 0) {
+      n_failures++;
+      continue;
+    }
+
+    for (size_t j = 0; j < n; j++)
+      got[j] = addrs[j]->ai_family == AF_INET6 ? '6' : '4';
+    got[n] = '\0';
+
+    if (0 == strcmp(got, tests[i].expected)) {
+      n_successes++;
+    } else {
+      logger("%s: expected %s, got %s", tests[i].families, tests[i].expected, got);
+      n_failures++;
+    }
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int utest_connect_listen(int backlog, struct sockaddr_in *addr)
+{
+  socklen_t len = sizeof *addr;
+  int       fd = -1;
+
+  memset(addr, 0, sizeof *addr);
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(fd, (struct sockaddr *) addr, sizeof *addr) < 0 ||
+      listen(fd, backlog) < 0 ||
+      getsockname(fd, (struct sockaddr *) addr, &len) < 0) {
+    logger("failed to set up the loopback listener: %m");
+    if (fd >= 0)
+      (void) close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Race a first address against a working second one, and tell how long it
+// took to connect to the latter.
+static long long utest_connect_race(struct sockaddr_in *first, struct sockaddr_in *second)
+{
+  tnetwork_connector *connector = NULL;
+  struct addrinfo     ais[2];
+  struct sockaddr_in  peer;
+  socklen_t           len = sizeof peer;
+  long long           start_ms = event_loop_now_ms();
+  int                 fd = -1;
+  int                 rc = -1;
+  long long           ret = -1;
+
+  memset(ais, 0, sizeof ais);
+  for (int i = 0; i < 2; i++) {
+    ais[i].ai_family = AF_INET;
+    ais[i].ai_socktype = SOCK_STREAM;
+    ais[i].ai_addr = (struct sockaddr *) (i ? second : first);
+    ais[i].ai_addrlen = sizeof *first;
+  }
+  ais[0].ai_next = &ais[1];
+
+  if (connector_new(&connector) < 0 || connector_start(connector, ais) < 0)
+    goto end;
+
+  while ((rc = network_connector_progress(connector)) > 0) {
+    if (network_wait_fd(network_connector_get_fd(connector), 0, start_ms + 3000) < 0)
+      goto end;
+  }
+
+  if (rc < 0 ||
+      (fd = network_connector_take_fd(connector)) < 0 ||
+      getpeername(fd, (struct sockaddr *) &peer, &len) < 0 ||
+      peer.sin_port != second->sin_port) {
+    logger("not connected to the second address");
+    goto end;
+  }
+
+  ret = event_loop_now_ms() - start_ms;
+ end:
+  if (fd >= 0)
+    (void) close(fd);
+  network_connector_free(connector);
+  return ret;
+}
+
+static int network_connect_race_utest(void)
+{
+  int                n_successes = 0;
+  int                n_failures = 0;
+  struct sockaddr_in silent, closed, good;
+  int                fillers[2] = { -1, -1 };
+  int                silent_fd = -1;
+  int                closed_fd = -1;
+  int                good_fd = -1;
+  long long          elapsed_ms = -1;
+
+  // A full accept queue drops the SYNs, as would a dead network path
+  if ((silent_fd = utest_connect_listen(0, &silent)) < 0 ||
+      (closed_fd = utest_connect_listen(1, &closed)) < 0 ||
+      (good_fd = utest_connect_listen(1, &good)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  (void) close(closed_fd);
+  closed_fd = -1;
+
+  for (size_t i = 0; i < N_ELEMS(fillers); i++) {
+    if ((fillers[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0)
+      (void) connect(fillers[i], (struct sockaddr *) &silent, sizeof silent);
+  }
+  usleep(50 * 1000);
+
+  // The second attempt starts after the attempt delay, not the timeout
+  elapsed_ms = utest_connect_race(&silent, &good);
+  if (elapsed_ms >= NETWORK_CONNECT_ATTEMPT_DELAY_MS - 10 &&
+      elapsed_ms < NETWORK_CONNECT_ATTEMPT_DELAY_MS + 500) {
+    n_successes++;
+  } else {
+    logger("silent first address: connected after %lld ms", elapsed_ms);
+    n_failures++;
+  }
+
+  // ... and right away when the first one is refused
+  elapsed_ms = utest_connect_race(&closed, &good);
+  if (elapsed_ms >= 0 && elapsed_ms < NETWORK_CONNECT_ATTEMPT_DELAY_MS) {
+    n_successes++;
+  } else {
+    logger("refused first address: connected after %lld ms", elapsed_ms);
+    n_failures++;
+  }
+
+ end:
+  for (size_t i = 0; i < N_ELEMS(fillers); i++) {
+    if (fillers[i] >= 0)
+      (void) close(fillers[i]);
+  }
+  if (silent_fd >= 0)
+    (void) close(silent_fd);
+  if (good_fd >= 0)
+    (void) close(good_fd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Whether the listener got the data in the SYN of its next connection
+static int utest_connect_syn_data(int lfd, uint16_t port)
+{
+  struct tcp_info info;
+  socklen_t       len = sizeof info;
+  char            port_str[8];
+  char            buf[4];
+  int             fd = -1;
+  int             afd = -1;
+  int             ret = -1;
+
+  (void) snprintf(port_str, sizeof port_str, "%u", port);
+  memset(&info, 0, sizeof info);
+
+  // The data goes with the SYN, or behind it without any cookie yet
+  if ((fd = network_connect("127.0.0.1", port_str, event_loop_now_ms() + 3000)) < 0 ||
+      send(fd, "ping", 4, MSG_NOSIGNAL) != 4 ||
+      (afd = accept(lfd, NULL, NULL)) < 0 ||
+      recv(afd, buf, sizeof buf, MSG_WAITALL) != 4 ||
+      getsockopt(afd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+    goto end;
+
+  ret = !! (info.tcpi_options & TCPI_OPT_SYN_DATA);
+ end:
+  if (afd >= 0)
+    (void) close(afd);
+  if (fd >= 0)
+    (void) close(fd);
+  return ret;
+}
+
+static int network_connect_fastopen_utest(void)
+{
+  int                n_successes = 0;
+  int                n_failures = 0;
+  struct sockaddr_in addr;
+  FILE              *sysctl = NULL;
+  int                mode = 0;
+  int                lfd = -1;
+  int                rc = -1;
+
+  // Both the client and the server sides are needed
+  if ((sysctl = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r"))) {
+    if (fscanf(sysctl, "%d", &mode) != 1)
+      mode = 0;
+    (void) fclose(sysctl);
+  }
+  if ((mode & 3) != 3) {
+    logger("net.ipv4.tcp_fastopen is %d, skipped", mode);
+    goto end;
+  }
+
+  if ((lfd = utest_connect_listen(8, &addr)) < 0 ||
+      setsockopt(lfd, IPPROTO_TCP, TCP_FASTOPEN, &(int) { 8 }, sizeof (int)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  rc = utest_connect_syn_data(lfd, ntohs(addr.sin_port));
+  if (rc == 0) {
+    n_successes++;
+  } else {
+    logger("fast open disabled: expected no data in the SYN, got %d", rc);
+    n_failures++;
+  }
+
+  // The first connection gets the cookie, unless the kernel has it already
+  network_connect_set_fastopen(1);
+  if (utest_connect_syn_data(lfd, ntohs(addr.sin_port)) < 0 ||
+      (rc = utest_connect_syn_data(lfd, ntohs(addr.sin_port))) != 1) {
+    logger("fast open enabled: expected the data in the SYN, got %d", rc);
+    n_failures++;
+  } else {
+    n_successes++;
+  }
+  network_connect_set_fastopen(0);
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int network_connect_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    network_connect_interleave_utest,
+    network_connect_race_utest,
+    network_connect_fastopen_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,146 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Listen on an ephemeral loopback port, the kernel completes the handshakes
+// on its own so we don't even need to accept() before connecting.
+static int utest_listen(char *port_buf, size_t port_buf_size)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  int                fd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    goto err;
+
+  if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(fd, 16) < 0 ||
+      getsockname(fd, (struct sockaddr *) &addr, &len) < 0)
+    goto err;
+
+  snprintf(port_buf, port_buf_size, "%u", (unsigned) ntohs(addr.sin_port));
+  return fd;
+
+ err:
+  logger("failed to set up the loopback listener: %m");
+  if (fd >= 0)
+    (void) close(fd);
+  return -1;
+}
+
+static int network_pool_reuse_utest(void)
+{
+  int                  n_successes = 0;
+  int                  n_failures = 0;
+  char                 port[16];
+  tnetwork_pool       *pool = NULL;
+  tnetwork_driver_ctx *ctx = NULL;
+  tnetwork_driver_ctx *first = NULL;
+  tnetwork_driver_ctx *other = NULL;
+  int                  lfd = -1;
+  int                  sfd = -1;
+  int                  rc = -1;
+
+#define CHECK(cond, ...) do {                   \
+    if (cond) {                                 \
+      n_successes++;                            \
+    } else {                                    \
+      logger(__VA_ARGS__);                      \
+      n_failures++;                             \
+    }                                           \
+  } while (0)
+
+  if ((lfd = utest_listen(port, sizeof port)) < 0 ||
+      network_pool_new(1, NETWORK_POOL_DEFAULT_IDLE_TIMEOUT_SEC, &pool) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  CHECK(rc == 0, "first connection: expected a new connection, got %d", rc);
+  first = ctx;
+
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &other);
+  CHECK(rc < 0, "per-origin limit: expected a failure, got %d", rc);
+
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 1);
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  CHECK(rc == 1 && ctx == first, "idle connection: expected a reuse, got %d", rc);
+
+  // Close the server side: the idle connection must be detected as stale.
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 1);
+  if ((sfd = accept(lfd, NULL, NULL)) >= 0)
+    (void) close(sfd);
+  usleep(10 * 1000);
+
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  CHECK(rc == 0, "stale connection: expected a new connection, got %d", rc);
+
+  // Non-reusable connections are closed on release.
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 0);
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  CHECK(rc == 0, "discarded connection: expected a new connection, got %d", rc);
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 1);
+
+  // Another origin (TLS flag) never shares the idle connections, nor the
+  // per-origin limit.  The handshake fails, the listener not being a TLS
+  // server.
+  rc = network_pool_get(pool, "127.0.0.1", port, 1, NULL, 1, &ctx);
+  CHECK(rc != 1, "TLS origin: expected no reuse, got %d", rc);
+  if (rc == 0)
+    network_pool_put(pool, ctx, "127.0.0.1", port, 1, NULL, 0);
+
+  // Nor does another driver, even a cleartext one
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, "plain", 1, &ctx);
+  CHECK(rc == 0, "named driver: expected a new connection, got %d", rc);
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, "plain", 1);
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, "plain", 1, &ctx);
+  CHECK(rc == 1, "named driver: expected a reuse, got %d", rc);
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, "plain", 1);
+
+  network_pool_free(pool);
+  pool = NULL;
+
+  // A zero idle timeout disables the reuse altogether.
+  if (network_pool_new(1, 0, &pool) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 1);
+  rc = network_pool_get(pool, "127.0.0.1", port, 0, NULL, 1, &ctx);
+  CHECK(rc == 0, "expired connection: expected a new connection, got %d", rc);
+  network_pool_put(pool, ctx, "127.0.0.1", port, 0, NULL, 1);
+
+#undef CHECK
+
+ end:
+  network_pool_free(pool);
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int network_pool_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    network_pool_reuse_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
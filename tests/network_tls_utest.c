@@ -0,0 +1,736 @@
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/pem.h>
+
+static int utest_tls_listen(char *port_buf, size_t port_buf_size)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  int                fd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    goto err;
+
+  if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(fd, 16) < 0 ||
+      getsockname(fd, (struct sockaddr *) &addr, &len) < 0)
+    goto err;
+
+  snprintf(port_buf, port_buf_size, "%u", (unsigned) ntohs(addr.sin_port));
+  return fd;
+
+ err:
+  logger("failed to set up the loopback listener: %m");
+  if (fd >= 0)
+    (void) close(fd);
+  return -1;
+}
+
+// A self-signed certificate for localhost
+static X509 *utest_tls_cert_new(EVP_PKEY *pkey)
+{
+  X509           *cert = X509_new();
+  X509_NAME      *name = NULL;
+  X509_EXTENSION *ext = NULL;
+  X509V3_CTX      v3_ctx;
+
+  if (! cert ||
+      ! X509_set_version(cert, 2) ||
+      ! ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) ||
+      ! X509_gmtime_adj(X509_getm_notBefore(cert), 0) ||
+      ! X509_gmtime_adj(X509_getm_notAfter(cert), 3600) ||
+      ! X509_set_pubkey(cert, pkey) ||
+      ! (name = X509_get_subject_name(cert)) ||
+      ! X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char *) "localhost", -1, -1, 0) ||
+      ! X509_set_issuer_name(cert, name))
+    goto err;
+
+  X509V3_set_ctx_nodb(&v3_ctx);
+  X509V3_set_ctx(&v3_ctx, cert, cert, NULL, NULL, 0);
+  if (! (ext = X509V3_EXT_conf_nid(NULL, &v3_ctx, NID_subject_alt_name, "DNS:localhost")) ||
+      ! X509_add_ext(cert, ext, -1) ||
+      ! X509_sign(cert, pkey, EVP_sha256()))
+    goto err;
+
+  X509_EXTENSION_free(ext);
+  return cert;
+
+ err:
+  ERR_print_errors_fp(stderr);
+  X509_EXTENSION_free(ext);
+  X509_free(cert);
+  return NULL;
+}
+
+// A key and its certificate, the only one trusted by the shared context
+static int utest_tls_trust(char *path, X509 **certp, EVP_PKEY **pkeyp, struct tls_options *options)
+{
+  FILE *fp = NULL;
+  int   fd = -1;
+
+  if (! (*pkeyp = EVP_EC_gen("P-256")) ||
+      ! (*certp = utest_tls_cert_new(*pkeyp)) ||
+      (fd = mkstemp(path)) < 0 ||
+      ! (fp = fdopen(fd, "w"))) {
+    logger("failed to set up the test certificate");
+    if (fd >= 0)
+      (void) close(fd);
+    return -1;
+  }
+
+  if (! PEM_write_X509(fp, *certp) || fclose(fp)) {
+    logger("failed to write the test certificate");
+    return -1;
+  }
+
+  options->ca_file = path;
+  return tls_context_configure(options);
+}
+
+// One TLS connection served by a child process: the request, up to its
+// empty line, gets a fixed reply.
+static void utest_tls_serve(int lfd, X509 *cert, EVP_PKEY *pkey)
+{
+  SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_server_method());
+  SSL     *ssl = NULL;
+  char     buf[1024];
+  size_t   len = 0;
+  char     reply[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+  int      fd = -1;
+
+  if (! ssl_ctx ||
+      SSL_CTX_use_certificate(ssl_ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey(ssl_ctx, pkey) != 1 ||
+      (fd = accept(lfd, NULL, NULL)) < 0 ||
+      ! (ssl = SSL_new(ssl_ctx)) ||
+      SSL_set_fd(ssl, fd) != 1 ||
+      SSL_accept(ssl) != 1)
+    _exit(1);
+
+  while (len < sizeof buf - 1) {
+    int n = SSL_read(ssl, buf + len, (int) (sizeof buf - 1 - len));
+    if (n <= 0)
+      _exit(1);
+
+    len += (size_t) n;
+    buf[len] = '\0';
+    if (strstr(buf, "\r\n\r\n"))
+      break;
+  }
+
+  if (SSL_write(ssl, reply, sizeof reply - 1) != (int) sizeof reply - 1)
+    _exit(1);
+
+  (void) SSL_shutdown(ssl);
+  _exit(0);
+}
+
+// A full exchange with the non-blocking driver, its handshake driven by
+// poll() as an event loop would.
+static int utest_tls_nonblock_exchange(char *port)
+{
+  tnetwork_driver_ctx *ctx = NULL;
+  unsigned char        buf[256];
+  size_t               len = 0;
+  ssize_t              n = -1;
+  int                  rc = -1;
+  int                  ret = -1;
+
+  if (! (ctx = network_driver_create_by_name("tls-nonblock")) ||
+      network_driver_connect(ctx, "localhost", port, 2) < 0)
+    goto end;
+
+  while ((rc = network_driver_progress(ctx)) > 0) {
+    if (network_wait_fd(network_driver_get_fd(ctx), rc == NETWORK_WANT_WRITE, event_loop_now_ms() + 2000) < 0)
+      goto end;
+  }
+
+  if (rc < 0 || network_driver_send(ctx, "GET / HTTP/1.1\r\n\r\n", 18) < 0)
+    goto end;
+
+  while (len < sizeof buf) {
+    if ((n = network_driver_read(ctx, buf + len, sizeof buf - len)) > 0) {
+      len += (size_t) n;
+      continue;
+    }
+
+    if (n == 0 ||
+        errno != EAGAIN ||
+        network_wait_fd(network_driver_get_fd(ctx), 0, event_loop_now_ms() + 2000) < 0)
+      break;
+  }
+
+  if (len < 2 || memcmp(buf + len - 2, "ok", 2)) {
+    logger("unexpected reply of %zu bytes", len);
+    goto end;
+  }
+
+  ret = 0;
+ end:
+  network_driver_free(ctx);
+  return ret;
+}
+
+static int network_tls_nonblock_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  EVP_PKEY *pkey = NULL;
+  X509     *cert = NULL;
+  char      path[] = "/tmp/httpc-utest-cert-XXXXXX";
+  char      port[16];
+  int       lfd = -1;
+  pid_t     pid = -1;
+  int       status = 0;
+
+  if (utest_tls_trust(path, &cert, &pkey, &(struct tls_options) { 0 }) < 0 ||
+      (lfd = utest_tls_listen(port, sizeof port)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == (pid = fork()))
+    utest_tls_serve(lfd, cert, pkey);
+
+  if (pid < 0 || utest_tls_nonblock_exchange(port) < 0) {
+    logger("TLS exchange with the non-blocking driver failed");
+    n_failures++;
+  } else {
+    n_successes++;
+  }
+
+  if (pid > 0 && (waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status))) {
+    logger("TLS test server failed");
+    n_failures++;
+  } else {
+    n_successes++;
+  }
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+  (void) unlink(path);
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Connections served one after the other by a child process, with early data
+// taken on all of them but the last one.  The reply body tells whether the
+// whole request came in the early data.
+static void utest_tls_serve_early(int lfd, X509 *cert, EVP_PKEY *pkey, int n_conns, int max_version)
+{
+  SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_server_method());
+
+  if (! ssl_ctx ||
+      SSL_CTX_set_max_proto_version(ssl_ctx, max_version) != 1 ||
+      SSL_CTX_use_certificate(ssl_ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey(ssl_ctx, pkey) != 1 ||
+      SSL_CTX_set_max_early_data(ssl_ctx, 16384) != 1)
+    _exit(1);
+
+  for (int i = 0; i < n_conns; i++) {
+    SSL    *ssl = NULL;
+    char    buf[1024];
+    char    reply[64];
+    size_t  len = 0;
+    size_t  n = 0;
+    int     early = 0;
+    int     fd = -1;
+    int     rc = -1;
+
+    if ((fd = accept(lfd, NULL, NULL)) < 0 ||
+        ! (ssl = SSL_new(ssl_ctx)) ||
+        SSL_set_fd(ssl, fd) != 1 ||
+        (i == n_conns - 1 && SSL_set_max_early_data(ssl, 0) != 1))
+      _exit(1);
+
+    do {
+      if ((rc = SSL_read_early_data(ssl, buf + len, sizeof buf - 1 - len, &n)) == SSL_READ_EARLY_DATA_ERROR)
+        _exit(1);
+
+      len += n;
+    } while (rc != SSL_READ_EARLY_DATA_FINISH);
+
+    buf[len] = '\0';
+    early = strstr(buf, "\r\n\r\n") != NULL;
+
+    if (SSL_accept(ssl) != 1)
+      _exit(1);
+
+    while (! strstr(buf, "\r\n\r\n") && len < sizeof buf - 1) {
+      int m = SSL_read(ssl, buf + len, (int) (sizeof buf - 1 - len));
+      if (m <= 0)
+        _exit(1);
+
+      len += (size_t) m;
+      buf[len] = '\0';
+    }
+
+    rc = snprintf(reply, sizeof reply, "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n%d", early);
+    if (SSL_write(ssl, reply, rc) != rc)
+      _exit(1);
+
+    (void) SSL_shutdown(ssl);
+    SSL_free(ssl);
+    (void) close(fd);
+  }
+
+  SSL_CTX_free(ssl_ctx);
+  _exit(0);
+}
+
+// A GET through the blocking driver: the reply body, -1 when none came
+static int utest_tls_early_exchange(char *port)
+{
+  char                 req[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  tnetwork_driver_ctx *ctx = NULL;
+  unsigned char        buf[256];
+  size_t               len = 0;
+  ssize_t              n = -1;
+  int                  ret = -1;
+
+  if (! (ctx = network_driver_create(NETWORK_DRIVER_TYPE_TLS)) ||
+      network_driver_connect(ctx, "localhost", port, 2) < 0 ||
+      network_driver_send_early(ctx, req, sizeof req - 1) < 0)
+    goto end;
+
+  while (len < sizeof buf && (n = network_driver_read(ctx, buf + len, sizeof buf - len)) > 0)
+    len += (size_t) n;
+
+  if (len > 4 && ! memcmp(buf + len - 5, "\r\n\r\n", 4))
+    ret = buf[len - 1] - '0';
+ end:
+  network_driver_free(ctx);
+  return ret;
+}
+
+static int network_tls_early_data_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  EVP_PKEY *pkey = NULL;
+  X509     *cert = NULL;
+  char      path[] = "/tmp/httpc-utest-cert-XXXXXX";
+  char      port[16];
+  int       lfd = -1;
+  pid_t     pid = -1;
+  int       status = 0;
+  // A full handshake bringing a ticket, a resumption with its early data
+  // taken, then another one with it rejected: the request goes again.
+  int       expected[] = { 0, 1, 0 };
+
+  if (utest_tls_trust(path, &cert, &pkey, &(struct tls_options) { .early_data = 1 }) < 0 ||
+      (lfd = utest_tls_listen(port, sizeof port)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == (pid = fork()))
+    utest_tls_serve_early(lfd, cert, pkey, (int) N_ELEMS(expected), 0);
+
+  for (size_t i = 0; pid > 0 && i < N_ELEMS(expected); i++) {
+    int early = utest_tls_early_exchange(port);
+
+    if (early == expected[i]) {
+      n_successes++;
+    } else {
+      logger("connection #%zu: expected %d, got %d", i, expected[i], early);
+      n_failures++;
+    }
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status)) {
+    logger("TLS test server failed");
+    n_failures++;
+  } else {
+    n_successes++;
+  }
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+  (void) unlink(path);
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Whether the kernel takes the records over or not, with TLS 1.2 or 1.3,
+// the replies read the same.
+static int network_tls_ktls_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  EVP_PKEY *pkey = NULL;
+  X509     *cert = NULL;
+  char      path[] = "/tmp/httpc-utest-cert-XXXXXX";
+  char      port[16];
+  int       lfd = -1;
+  int       versions[] = { TLS1_2_VERSION, TLS1_3_VERSION };
+
+  if (utest_tls_trust(path, &cert, &pkey, &(struct tls_options) { .ktls = 1 }) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  for (size_t i = 0; i < N_ELEMS(versions); i++) {
+    pid_t pid = -1;
+    int   status = 0;
+    int   rc = -1;
+
+    if ((lfd = utest_tls_listen(port, sizeof port)) < 0) {
+      n_failures++;
+      goto end;
+    }
+
+    if (0 == (pid = fork()))
+      utest_tls_serve_early(lfd, cert, pkey, 1, versions[i]);
+
+    if (pid < 0 || (rc = utest_tls_early_exchange(port)) != 0) {
+      logger("%s: expected a reply, got %d", versions[i] == TLS1_2_VERSION ? "TLS 1.2" : "TLS 1.3", rc);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    if (pid > 0 && (waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status))) {
+      logger("TLS test server failed");
+      n_failures++;
+    }
+
+    (void) close(lfd);
+    lfd = -1;
+  }
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+  (void) unlink(path);
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// The server's preference first, among the protocols the client offers
+static int utest_tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                                 const unsigned char *in, unsigned int inlen, void *arg)
+{
+  char *protos = arg;
+
+  (void) ssl;
+  if (SSL_select_next_proto((unsigned char **) out, outlen, (unsigned char *) protos, (unsigned) strlen(protos),
+                            in, inlen) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// Handshakes only, one per connection, each with its list of protocols
+static void utest_tls_serve_alpn(int lfd, X509 *cert, EVP_PKEY *pkey, char **protos, size_t n_conns)
+{
+  for (size_t i = 0; i < n_conns; i++) {
+    SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_server_method());
+    SSL     *ssl = NULL;
+    char     c;
+    int      fd = -1;
+
+    if (! ssl_ctx ||
+        SSL_CTX_use_certificate(ssl_ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(ssl_ctx, pkey) != 1)
+      _exit(1);
+
+    SSL_CTX_set_alpn_select_cb(ssl_ctx, utest_tls_alpn_select, protos[i]);
+
+    // No session tickets, which would go to a client gone already
+    if (SSL_CTX_set_num_tickets(ssl_ctx, 0) != 1)
+      _exit(1);
+
+    if ((fd = accept(lfd, NULL, NULL)) < 0 ||
+        ! (ssl = SSL_new(ssl_ctx)) ||
+        SSL_set_fd(ssl, fd) != 1 ||
+        SSL_accept(ssl) != 1)
+      _exit(1);
+
+    // Until the client's close_notify, there being nothing to answer
+    while (SSL_read(ssl, &c, 1) > 0)
+      ;
+
+    SSL_free(ssl);
+    SSL_CTX_free(ssl_ctx);
+    (void) close(fd);
+  }
+
+  _exit(0);
+}
+
+// h2 is only offered when asked for, and only selected by servers which
+// have it.
+static int network_tls_alpn_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  EVP_PKEY *pkey = NULL;
+  X509     *cert = NULL;
+  char      path[] = "/tmp/httpc-utest-cert-XXXXXX";
+  char      port[16];
+  int       lfd = -1;
+  pid_t     pid = -1;
+  int       status = 0;
+  struct {
+    int   http2;
+    char *protos;
+    char *expected;
+  } tests[] = {
+    { 1, "\x02h2\x08http/1.1", "h2"       },
+    { 1, "\x08http/1.1",        "http/1.1" },
+    { 0, "\x02h2\x08http/1.1", NULL       },
+  };
+  char     *protos[N_ELEMS(tests)];
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++)
+    protos[i] = tests[i].protos;
+
+  if (utest_tls_trust(path, &cert, &pkey, &(struct tls_options) { .http2 = 1 }) < 0 ||
+      (lfd = utest_tls_listen(port, sizeof port)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == (pid = fork()))
+    utest_tls_serve_alpn(lfd, cert, pkey, protos, N_ELEMS(tests));
+
+  for (size_t i = 0; pid > 0 && i < N_ELEMS(tests); i++) {
+    tnetwork_driver_ctx *ctx = NULL;
+    char                *alpn = NULL;
+
+    if (tls_context_configure(&(struct tls_options) { .ca_file = path, .http2 = tests[i].http2 }) < 0 ||
+        ! (ctx = network_driver_create(NETWORK_DRIVER_TYPE_TLS)) ||
+        network_driver_connect(ctx, "localhost", port, 2) < 0) {
+      logger("connection #%zu failed", i);
+      n_failures++;
+    } else if ((alpn = network_driver_get_alpn(ctx)) ?
+               ! tests[i].expected || strcmp(alpn, tests[i].expected) : tests[i].expected != NULL) {
+      logger("connection #%zu: expected %s, got %s", i, tests[i].expected ? tests[i].expected : "none",
+             alpn ? alpn : "none");
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    network_driver_free(ctx);
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status)) {
+    logger("TLS test server failed");
+    n_failures++;
+  }
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+  (void) unlink(path);
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// A server accepting the TCP connection but never answering the handshake:
+// the connection fails once the connect timeout is over, not later.
+static int network_tls_deadline_utest(void)
+{
+  int                  n_successes = 0;
+  int                  n_failures = 0;
+  tnetwork_driver_ctx *ctx = NULL;
+  char                 port[16];
+  long long            start_ms = 0;
+  long long            elapsed_ms = 0;
+  int                  lfd = -1;
+  int                  rc = -1;
+
+  if ((lfd = utest_tls_listen(port, sizeof port)) < 0 ||
+      ! (ctx = network_driver_create(NETWORK_DRIVER_TYPE_TLS))) {
+    n_failures++;
+    goto end;
+  }
+
+  start_ms = event_loop_now_ms();
+  rc = network_driver_connect(ctx, "127.0.0.1", port, 1);
+  elapsed_ms = event_loop_now_ms() - start_ms;
+
+  if (rc < 0 && elapsed_ms >= 900 && elapsed_ms < 2000) {
+    n_successes++;
+  } else {
+    logger("silent server: connect returned %d after %lld ms", rc, elapsed_ms);
+    n_failures++;
+  }
+
+ end:
+  network_driver_free(ctx);
+  if (lfd >= 0)
+    (void) close(lfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+// Half a reply per connection: the server then either stalls, until the
+// client goes away, or closes the socket without any close_notify.
+static void utest_tls_serve_partial(int lfd, X509 *cert, EVP_PKEY *pkey, int *stalls, size_t n_conns)
+{
+  SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_server_method());
+  char     reply[] = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nok";
+
+  if (! ssl_ctx ||
+      SSL_CTX_use_certificate(ssl_ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey(ssl_ctx, pkey) != 1 ||
+      SSL_CTX_set_num_tickets(ssl_ctx, 0) != 1)
+    _exit(1);
+
+  for (size_t i = 0; i < n_conns; i++) {
+    SSL  *ssl = NULL;
+    char  c;
+    int   fd = -1;
+
+    if ((fd = accept(lfd, NULL, NULL)) < 0 ||
+        ! (ssl = SSL_new(ssl_ctx)) ||
+        SSL_set_fd(ssl, fd) != 1 ||
+        SSL_accept(ssl) != 1 ||
+        SSL_write(ssl, reply, sizeof reply - 1) != (int) sizeof reply - 1)
+      _exit(1);
+
+    if (stalls[i])
+      while (SSL_read(ssl, &c, 1) > 0)
+        ;
+
+    SSL_free(ssl);
+    (void) close(fd);
+  }
+
+  SSL_CTX_free(ssl_ctx);
+  _exit(0);
+}
+
+// Reads through the blocking driver end with the half reply: a server
+// stalling mid-body is a timeout error once the receive timeout is over,
+// one closing the socket is an EOF.
+static int network_tls_read_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  EVP_PKEY *pkey = NULL;
+  X509     *cert = NULL;
+  char      path[] = "/tmp/httpc-utest-cert-XXXXXX";
+  char      port[16];
+  int       lfd = -1;
+  pid_t     pid = -1;
+  int       status = 0;
+  struct {
+    int     stall;
+    ssize_t exp_retval;
+    int     exp_errno;
+  } tests[] = {
+    { 1, -1, ETIMEDOUT },
+    { 0,  0, 0         },
+  };
+  int       stalls[N_ELEMS(tests)];
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++)
+    stalls[i] = tests[i].stall;
+
+  if (utest_tls_trust(path, &cert, &pkey, &(struct tls_options) { 0 }) < 0 ||
+      (lfd = utest_tls_listen(port, sizeof port)) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  if (0 == (pid = fork()))
+    utest_tls_serve_partial(lfd, cert, pkey, stalls, N_ELEMS(tests));
+
+  for (size_t i = 0; pid > 0 && i < N_ELEMS(tests); i++) {
+    tnetwork_driver_ctx *ctx = NULL;
+    unsigned char        buf[256];
+    size_t               len = 0;
+    ssize_t              n = -1;
+    long long            start_ms = 0;
+    long long            elapsed_ms = 0;
+
+    if (! (ctx = network_driver_create(NETWORK_DRIVER_TYPE_TLS)) ||
+        network_driver_connect(ctx, "localhost", port, 1) < 0) {
+      logger("connection #%zu failed", i);
+      n_failures++;
+      network_driver_free(ctx);
+      continue;
+    }
+
+    start_ms = event_loop_now_ms();
+    while (len < sizeof buf && (n = network_driver_read(ctx, buf + len, sizeof buf - len)) > 0)
+      len += (size_t) n;
+    elapsed_ms = event_loop_now_ms() - start_ms;
+
+    if (n != tests[i].exp_retval || (n < 0 && errno != tests[i].exp_errno) ||
+        len < 2 || memcmp(buf + len - 2, "ok", 2) || elapsed_ms >= 2000) {
+      logger("connection #%zu: read returned %zd (%m) after %zu bytes and %lld ms, expected %zd",
+             i, n, len, elapsed_ms, tests[i].exp_retval);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+
+    network_driver_free(ctx);
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status)) {
+    logger("TLS test server failed");
+    n_failures++;
+  }
+
+ end:
+  if (lfd >= 0)
+    (void) close(lfd);
+  (void) unlink(path);
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int network_tls_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    network_tls_nonblock_utest,
+    network_tls_early_data_utest,
+    network_tls_ktls_utest,
+    network_tls_alpn_utest,
+    network_tls_deadline_utest,
+    network_tls_read_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,199 @@
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define UTEST_URING_BIG_LEN (256 * 1024)
+
+static int utest_uring_listen(char *port_buf, size_t port_buf_size)
+{
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof addr;
+  int                fd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    goto err;
+
+  if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      listen(fd, 16) < 0 ||
+      getsockname(fd, (struct sockaddr *) &addr, &len) < 0)
+    goto err;
+
+  snprintf(port_buf, port_buf_size, "%u", (unsigned) ntohs(addr.sin_port));
+  return fd;
+
+ err:
+  logger("failed to set up the loopback listener: %m");
+  if (fd >= 0)
+    (void) close(fd);
+  return -1;
+}
+
+// Read everything up to the EOF, checking it against the byte pattern
+static int utest_uring_read_all(tnetwork_driver_ctx *ctx, size_t expected_len)
+{
+  unsigned char buf[5000]; // Not a divisor of the receive buffers' size
+  size_t        total = 0;
+  ssize_t       n = -1;
+
+  while ((n = network_driver_read(ctx, buf, sizeof buf)) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] != (unsigned char) ((total + (size_t) i) % 251)) {
+        logger("unexpected byte at offset %zu", total + (size_t) i);
+        return -1;
+      }
+    }
+
+    total += (size_t) n;
+  }
+
+  if (n < 0 || total != expected_len) {
+    logger("read %zu bytes instead of %zu", total, expected_len);
+    return -1;
+  }
+
+  return 0;
+}
+
+// A request/reply exchange then a big transfer, in the given receive mode
+static int utest_uring_exchange(turing_recv_mode mode)
+{
+  tnetwork_driver_uring_ctx *driver_ctx = NULL;
+  tnetwork_driver_ctx       *ctx = NULL;
+  char                       port[16];
+  unsigned char              buf[64];
+  int                        lfd = -1;
+  int                        sfd = -1;
+  pid_t                      pid = -1;
+  int                        status = 0;
+  int                        ret = -1;
+
+  if ((lfd = utest_uring_listen(port, sizeof port)) < 0)
+    goto end;
+
+  if (! (ctx = network_driver_uring_create()) ||
+      strcmp(network_driver_get_name(ctx), "uring")) {
+    logger("io_uring unavailable, skipping");
+    ret = 0;
+    goto end;
+  }
+
+  driver_ctx = (tnetwork_driver_uring_ctx *) ctx;
+  if (mode != driver_ctx->recv_mode) {
+    struct iovec iov = { .iov_base = driver_ctx->bufs, .iov_len = URING_BUF_SIZE };
+
+    if (mode == URING_RECV_FIXED &&
+        syscall(__NR_io_uring_register, driver_ctx->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+      logger("io_uring_register: %m");
+      goto end;
+    }
+
+    driver_ctx->recv_mode = mode;
+  }
+
+  if (network_driver_connect(ctx, "127.0.0.1", port, 1) < 0 ||
+      (sfd = accept(lfd, NULL, NULL)) < 0) {
+    logger("connection failed (mode %d)", mode);
+    goto end;
+  }
+
+  if (network_driver_send(ctx, "ping", 4) < 0 ||
+      send(sfd, "pong", 4, 0) != 4 ||
+      network_driver_read(ctx, buf, sizeof buf) != 4 ||
+      memcmp(buf, "pong", 4) ||
+      recv(sfd, buf, sizeof buf, 0) != 4 ||
+      memcmp(buf, "ping", 4)) {
+    logger("ping/pong exchange failed (mode %d)", mode);
+    goto end;
+  }
+
+  if (! network_driver_is_alive(ctx)) {
+    logger("idle connection not alive (mode %d)", mode);
+    goto end;
+  }
+
+  // More than all the receive buffers at once, then EOF
+  if (0 == (pid = fork())) {
+    unsigned char *big = malloc(UTEST_URING_BIG_LEN);
+    size_t         off = 0;
+
+    if (! big)
+      _exit(1);
+
+    for (size_t i = 0; i < UTEST_URING_BIG_LEN; i++)
+      big[i] = (unsigned char) (i % 251);
+
+    while (off < UTEST_URING_BIG_LEN) {
+      ssize_t n = send(sfd, big + off, UTEST_URING_BIG_LEN - off, 0);
+      if (n < 0)
+        _exit(1);
+      off += (size_t) n;
+    }
+
+    _exit(0);
+  }
+
+  (void) close(sfd);
+  sfd = -1;
+
+  if (pid < 0 || utest_uring_read_all(ctx, UTEST_URING_BIG_LEN) < 0) {
+    logger("big transfer failed (mode %d)", mode);
+    goto end;
+  }
+
+  if (network_driver_is_alive(ctx)) {
+    logger("closed connection still alive (mode %d)", mode);
+    goto end;
+  }
+
+  ret = 0;
+ end:
+  if (pid > 0)
+    (void) waitpid(pid, &status, 0);
+  if (sfd >= 0)
+    (void) close(sfd);
+  if (lfd >= 0)
+    (void) close(lfd);
+  network_driver_free(ctx);
+  return ret;
+}
+
+static int network_uring_exchange_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+
+  turing_recv_mode modes[] = {
+    URING_RECV_MULTISHOT,
+    URING_RECV_FIXED,
+    URING_RECV_PLAIN,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(modes); i++) {
+    if (utest_uring_exchange(modes[i]) < 0)
+      n_failures++;
+    else
+      n_successes++;
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int network_uring_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    network_uring_exchange_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,399 @@
+#include "network_connect.h"
+
+// Not rcodes: a truncated reply, one to another name, and one to the same
+// name in another case
+#define UTEST_DNS_TRUNCATED  16
+#define UTEST_DNS_OTHER_NAME 17
+#define UTEST_DNS_OTHER_CASE 18
+
+// Answer the next question waiting on the test nameserver: rcode 0 with an
+// address (192.0.2.1 or 2001:db8::1), any other with a SOA record.  Returns
+// 0 when there was no question, or one without the EDNS0 OPT record.
+static int utest_dns_answer(int sfd, int rcode, uint32_t ttl)
+{
+  unsigned char           buf[512];
+  struct sockaddr_storage from;
+  socklen_t               from_len = sizeof from;
+  ssize_t                 n = recvfrom(sfd, buf, 256, MSG_DONTWAIT, (struct sockaddr *) &from, &from_len);
+  size_t                  len = DNS_HEADER_LEN;
+  uint16_t                qtype = 0;
+  unsigned char           record[] = {
+    0xc0, 0x0c,             // The name of the question
+    0, 0, 0, DNS_CLASS_IN,  // Type, class
+    0, 0, 0, 0,             // TTL
+    0, 0,                   // Length
+  };
+
+  if (n < DNS_HEADER_LEN || dns_u16(buf + 10) != 1 || dns_skip_name(buf, (size_t) n, &len) < 0 ||
+      len + 4 + DNS_OPT_LEN != (size_t) n || dns_u16(buf + len + 4 + 1) != DNS_TYPE_OPT)
+    return 0;
+
+  qtype = dns_u16(buf + len);
+  len += 4;
+  buf[11] = 0; // The OPT record left out
+
+  if (rcode == UTEST_DNS_TRUNCATED) {
+    buf[2] |= 0x82;
+    buf[3] = 0x80;
+    (void) sendto(sfd, buf, len, 0, (struct sockaddr *) &from, from_len);
+    return 1;
+  }
+
+  if (rcode == UTEST_DNS_OTHER_NAME)
+    buf[DNS_HEADER_LEN + 1] = buf[DNS_HEADER_LEN + 1] == 'x' ? 'y' : 'x';
+  else if (rcode == UTEST_DNS_OTHER_CASE)
+    buf[DNS_HEADER_LEN + 1] ^= 0x20;
+
+  if (rcode > 15)
+    rcode = 0;
+
+  buf[2] |= 0x80;                          // Reply
+  buf[3] = (unsigned char) (0x80 | rcode); // Recursion available
+  buf[rcode ? 9 : 7] = 1;                  // One answer, or one authority
+
+  record[3] = rcode ? DNS_TYPE_SOA : (unsigned char) qtype;
+  record[6] = (unsigned char) (ttl >> 24);
+  record[7] = (unsigned char) (ttl >> 16);
+  record[8] = (unsigned char) (ttl >> 8);
+  record[9] = (unsigned char) ttl;
+
+  if (rcode) {
+    // Root mname and rname, then serial, refresh, retry, expire and minimum
+    record[11] = 22;
+    memcpy(buf + len, record, sizeof record);
+    len += sizeof record;
+    memset(buf + len, 0, 22);
+    buf[len + 21] = 30;
+    len += 22;
+  } else {
+    record[11] = qtype == DNS_TYPE_A ? 4 : 16;
+    memcpy(buf + len, record, sizeof record);
+    len += sizeof record;
+    if (qtype == DNS_TYPE_A)
+      (void) inet_pton(AF_INET, "192.0.2.1", buf + len);
+    else
+      (void) inet_pton(AF_INET6, "2001:db8::1", buf + len);
+    len += record[11];
+  }
+
+  (void) sendto(sfd, buf, len, 0, (struct sockaddr *) &from, from_len);
+  return 1;
+}
+
+// Resolve the host through the test nameserver, telling how many questions
+// it answered.
+static int utest_resolve(int sfd, char *host, char *port, int rcode, uint32_t ttl, struct addrinfo **resp)
+{
+  tresolver_query *query = NULL;
+  int              n_questions = 0;
+  int              rc = -1;
+
+  *resp = NULL;
+  if (resolver_query_new(host, port, &query) < 0)
+    return -1;
+
+  while (utest_dns_answer(sfd, rcode, ttl))
+    n_questions++;
+
+  if ((rc = resolver_query_progress(query)) == 0)
+    *resp = resolver_query_take_result(query);
+
+  resolver_query_free(query);
+  return rc < 0 ? -1 : n_questions;
+}
+
+static int resolver_stub_utest(void)
+{
+  int                    n_successes = 0;
+  int                    n_failures = 0;
+  struct sockaddr_in     addr;
+  socklen_t              len = sizeof addr;
+  char                   nameserver[32];
+  char                   hostname[64];
+  struct resolver_stats  stats;
+  struct addrinfo       *res = NULL;
+  tresolver_query       *query = NULL;
+  int                    sfd = -1;
+  int                    rc = -1;
+
+#define CHECK(cond, ...) do {                   \
+    if (cond) {                                 \
+      n_successes++;                            \
+    } else {                                    \
+      logger(__VA_ARGS__);                      \
+      n_failures++;                             \
+    }                                           \
+  } while (0)
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((sfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(sfd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+      getsockname(sfd, (struct sockaddr *) &addr, &len) < 0) {
+    logger("failed to set up the test nameserver: %m");
+    n_failures++;
+    goto end;
+  }
+
+  snprintf(nameserver, sizeof nameserver, "127.0.0.1:%u", (unsigned) ntohs(addr.sin_port));
+  if (resolver_configure(&(struct resolver_options) { .stub = 1, .nameserver = nameserver }) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  // Both families, IPv6 first, with the port
+  rc = utest_resolve(sfd, "example.test", "80", 0, 60, &res);
+  CHECK(rc == 2 && res && res->ai_family == AF_INET6 &&
+        ((struct sockaddr_in6 *) res->ai_addr)->sin6_port == htons(80) &&
+        res->ai_next && res->ai_next->ai_family == AF_INET &&
+        ((struct sockaddr_in *) res->ai_next->ai_addr)->sin_addr.s_addr == htonl(0xc0000201) &&
+        ! res->ai_next->ai_next,
+        "stub resolution: unexpected result (%d)", rc);
+  free(res);
+
+  rc = utest_resolve(sfd, "EXAMPLE.test", "443", 0, 60, &res);
+  CHECK(rc == 0 && res && ((struct sockaddr_in6 *) res->ai_addr)->sin6_port == htons(443),
+        "cached resolution: expected no question, got %d", rc);
+  free(res);
+
+  rc = utest_resolve(sfd, "nxdomain.test", "80", DNS_RCODE_NXDOMAIN, 30, &res);
+  CHECK(rc < 0 && ! res, "NXDOMAIN: expected a failure, got %d", rc);
+
+  rc = utest_resolve(sfd, "nxdomain.test", "80", DNS_RCODE_NXDOMAIN, 30, &res);
+  CHECK(rc < 0 && ! res, "cached NXDOMAIN: expected a failure, got %d", rc);
+  CHECK(! utest_dns_answer(sfd, 0, 0), "cached NXDOMAIN: unexpected question");
+
+  // A zero TTL is not cached
+  rc = utest_resolve(sfd, "volatile.test", "80", 0, 0, &res);
+  free(res);
+  rc = utest_resolve(sfd, "volatile.test", "80", 0, 0, &res);
+  CHECK(rc == 2 && res, "zero TTL: expected 2 questions, got %d", rc);
+  free(res);
+
+  // Addresses need no nameserver
+  rc = utest_resolve(sfd, "::1", "80", 0, 60, &res);
+  CHECK(rc == 0 && res && res->ai_family == AF_INET6, "IPv6 address: unexpected result %d", rc);
+  free(res);
+
+  // The questions are sent again after a while when unanswered
+  if (resolver_query_new("lost.test", "80", &query) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  for (int i = 0; i < RESOLVER_N_QUESTIONS; i++) {
+    unsigned char buf[512];
+
+    (void) recv(sfd, buf, sizeof buf, MSG_DONTWAIT);
+  }
+
+  rc = resolver_query_progress(query);
+  if (rc > 0 && ! network_wait_fd(resolver_query_get_fd(query), 0, event_loop_now_ms() + 2 * RESOLVER_STUB_RETRY_MS))
+    rc = resolver_query_progress(query);
+
+  while (utest_dns_answer(sfd, 0, 60))
+    ;
+
+  if (rc > 0 && ! network_wait_fd(resolver_query_get_fd(query), 0, event_loop_now_ms() + 1000))
+    rc = resolver_query_progress(query);
+  CHECK(rc == 0, "retransmission: expected a resolution, got %d", rc);
+
+  resolver_get_stats(&stats);
+  CHECK(stats.hits == 1 && stats.negative_hits == 1 && stats.misses == 5,
+        "unexpected stats: %lu hits, %lu negative hits, %lu misses",
+        stats.hits, stats.negative_hits, stats.misses);
+
+  // Replies are for the name asked, whatever its case
+  rc = utest_resolve(sfd, "spoofed.test", "80", UTEST_DNS_OTHER_NAME, 60, &res);
+  CHECK(rc == 2 && ! res, "reply to another name: expected it ignored, got %d", rc);
+
+  rc = utest_resolve(sfd, "cased.test", "80", UTEST_DNS_OTHER_CASE, 60, &res);
+  CHECK(rc == 2 && res, "reply in another case: expected a resolution, got %d", rc);
+  free(res);
+
+  // Truncated replies are given up for getaddrinfo(), which knows our own
+  // name, the check skipped otherwise
+  if (gethostname(hostname, sizeof hostname) == 0 &&
+      getaddrinfo(hostname, NULL, NULL, &res) == 0) {
+    freeaddrinfo(res);
+    rc = utest_resolve(sfd, hostname, "80", UTEST_DNS_TRUNCATED, 60, &res);
+    CHECK(rc >= 0 && res, "truncated reply: expected a resolution, got %d", rc);
+    free(res);
+  }
+
+#undef CHECK
+
+ end:
+  resolver_query_free(query);
+  resolver_cleanup();
+  if (sfd >= 0)
+    (void) close(sfd);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int resolver_parse_addr_utest(void)
+{
+  int n_successes = 0;
+  int n_failures = 0;
+
+  struct {
+    char     *str;
+    int       family; // AF_UNSPEC when invalid
+    uint16_t  port;
+  } tests[] = {
+    { "192.0.2.1",          AF_INET,   53   },
+    { "192.0.2.1:5353",     AF_INET,   5353 },
+    { "2001:db8::1",        AF_INET6,  53   },
+    { "[2001:db8::1]:5353", AF_INET6,  5353 },
+    { "[2001:db8::1]",      AF_INET6,  53   },
+    { "192.0.2.1:0",        AF_UNSPEC, 0    },
+    { "192.0.2.1:99999",    AF_UNSPEC, 0    },
+    { "[2001:db8::1]x",     AF_UNSPEC, 0    },
+    { "example.com",        AF_UNSPEC, 0    },
+  };
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++) {
+    union resolver_addr addr;
+    int                 rc = resolver_parse_addr(tests[i].str, 53, &addr);
+    uint16_t            port = 0;
+
+    if (! rc)
+      port = ntohs(addr.sa.sa_family == AF_INET ? addr.sin.sin_port : addr.sin6.sin6_port);
+
+    if (tests[i].family == AF_UNSPEC ? rc < 0 :
+        ! rc && addr.sa.sa_family == tests[i].family && port == tests[i].port) {
+      n_successes++;
+    } else {
+      logger("%s: unexpected result", tests[i].str);
+      n_failures++;
+    }
+  }
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+static int resolver_override_utest(void)
+{
+  int              n_successes = 0;
+  int              n_failures = 0;
+  tresolver_query *query = NULL;
+  struct addrinfo *res = NULL;
+  FILE            *fp = NULL;
+  char             path[] = "/tmp/httpc-utest-resolve-XXXXXX";
+  char             addr[INET6_ADDRSTRLEN];
+  int              fd = -1;
+  int              rc = -1;
+
+  char *invalid[] = {
+    "example.test:443",
+    "example.test:443:",
+    ":443:192.0.2.1",
+    "example.test:https:192.0.2.1",
+    "example.test:443:www.example.com",
+    "example.test:443:192.0.2.1:8443",
+    "example.test:443:[2001:db8::1]:8443",
+  };
+
+#define CHECK(cond, ...) do {                   \
+    if (cond) {                                 \
+      n_successes++;                            \
+    } else {                                    \
+      logger(__VA_ARGS__);                      \
+      n_failures++;                             \
+    }                                           \
+  } while (0)
+
+  for (size_t i = 0; i < N_ELEMS(invalid); i++) {
+    rc = resolver_add_override(invalid[i]);
+    CHECK(rc < 0, "%s: expected a failure, got %d", invalid[i], rc);
+  }
+
+  if ((fd = mkstemp(path)) < 0 || ! (fp = fdopen(fd, "w"))) {
+    n_failures++;
+    goto end;
+  }
+
+  fd = -1;
+  fprintf(fp, "# Backends\n\n  file.test:8080:192.0.2.9  # Trailing comment\n");
+  if (fclose(fp)) {
+    fp = NULL;
+    n_failures++;
+    goto end;
+  }
+
+  fp = NULL;
+
+  // The last one wins
+  rc = resolver_add_override("example.test:443:192.0.2.1");
+  if (! rc)
+    rc = resolver_add_override("Example.test:443:[2001:db8::7],192.0.2.7");
+  if (! rc)
+    rc = resolver_configure(&(struct resolver_options) { .overrides_file = path });
+  CHECK(rc == 0, "failed to set the overrides up");
+
+  // In order, with the port, never reaching any resolver
+  res = NULL;
+  if (resolver_query_new("example.test", "443", &query) == 0 && ! resolver_query_progress(query))
+    res = resolver_query_take_result(query);
+  resolver_query_free(query);
+  query = NULL;
+
+  CHECK(res && res->ai_family == AF_INET6 &&
+        ((struct sockaddr_in6 *) res->ai_addr)->sin6_port == htons(443) &&
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) res->ai_addr)->sin6_addr, addr, sizeof addr) &&
+        ! strcmp(addr, "2001:db8::7") &&
+        res->ai_next && res->ai_next->ai_family == AF_INET && ! res->ai_next->ai_next,
+        "override: unexpected result");
+  free(res);
+
+  res = NULL;
+  if (resolver_query_new("file.test", "8080", &query) == 0 && ! resolver_query_progress(query))
+    res = resolver_query_take_result(query);
+  resolver_query_free(query);
+  query = NULL;
+
+  CHECK(res && res->ai_family == AF_INET &&
+        ((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr == htonl(0xc0000209),
+        "override file: unexpected result");
+  free(res);
+
+  // Another port is not overridden
+  rc = resolver_query_new("file.test", "80", &query);
+  CHECK(rc < 0, "other port: expected a resolution failure, got %d", rc);
+
+#undef CHECK
+
+ end:
+  resolver_query_free(query);
+  resolver_cleanup();
+  if (fp)
+    (void) fclose(fp);
+  else if (fd >= 0)
+    (void) close(fd);
+  (void) unlink(path);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int resolver_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    resolver_parse_addr_utest,
+    resolver_stub_utest,
+    resolver_override_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "logger.h"
+
+#define UTEST_SCAN_BUF_LEN 200
+
+// Every implementation the CPU supports agrees with the scalar one, at any
+// length and alignment, around the bytes next to the whitespace range.
+static int scan_impls_utest(void)
+{
+  int            n_successes = 0;
+  int            n_failures = 0;
+  unsigned char  alphabet[] = { 'a', ' ', '\t', '\n', '\v', '\f', '\r', ':', 0x08, 0x0e, 0x1f, '!', 0x80, 0xff };
+  unsigned char  buf[UTEST_SCAN_BUF_LEN];
+  char          *saved = scan_impl_name();
+  char         **names = scan_impl_names();
+
+  srand(42);
+
+  for (size_t n = 0; names[n]; n++) {
+    size_t n_bad = 0;
+
+    if (scan_set_impl(names[n]) < 0) {
+      logger("%s: not supported here, skipped", names[n]);
+      continue;
+    }
+
+    for (int round = 0; round < 200; round++) {
+      // Mostly whitespace, for long runs, or mostly anything
+      int ws_only = round % 2;
+
+      for (size_t i = 0; i < sizeof buf; i++) {
+        size_t k = (size_t) rand() % (ws_only ? 6 : sizeof alphabet);
+
+        buf[i] = alphabet[ws_only ? k + 1 : k];
+        if (ws_only && rand() % 97 == 0)
+          buf[i] = 'a';
+      }
+
+      for (size_t off = 0; off < 4; off++) {
+        for (size_t len = 0; off + len <= sizeof buf; len += 1 + (size_t) rand() % 7) {
+          unsigned char *p = buf + off;
+
+          n_bad += scan_byte(p, len, ':') != scan_scalar_byte(p, len, ':');
+          n_bad += scan_byte(p, len, '\n') != scan_scalar_byte(p, len, '\n');
+          n_bad += scan_ws_span(p, len) != scan_scalar_ws_span(p, len);
+          n_bad += scan_ws_span_back(p, len) != scan_scalar_ws_span_back(p, len);
+        }
+      }
+    }
+
+    if (n_bad) {
+      logger("%s: %zu results differing from the scalar ones", names[n], n_bad);
+      n_failures++;
+    } else {
+      n_successes++;
+    }
+  }
+
+  // The scalar whitespace is isspace()'s, in the C locale
+  for (int c = 0; c < 256; c++) {
+    unsigned char b = (unsigned char) c;
+
+    if (scan_scalar_ws_span(&b, 1) != (size_t) !! isspace(c)) {
+      logger("byte 0x%02x: whitespace or not, unlike isspace()", c);
+      n_failures++;
+      break;
+    }
+
+    if (c == 255)
+      n_successes++;
+  }
+
+  if (scan_set_impl("no such thing") == 0) {
+    logger("unknown implementation accepted");
+    n_failures++;
+  } else {
+    n_successes++;
+  }
+
+  (void) scan_set_impl(saved);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int scan_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    scan_impls_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,82 @@
+static int tls_context_shared_utest(void)
+{
+  int      n_successes = 0;
+  int      n_failures = 0;
+  SSL_CTX *first = NULL;
+  SSL_CTX *second = NULL;
+  SSL_CTX *third = NULL;
+
+  struct {
+    struct tls_options options;
+    int                expected;
+  } tests[] = {
+    { { NULL,                         NULL, NULL,             NULL,            NULL, 0, 0, 0 }, 0  },
+    { { NULL,                         NULL, "HIGH:!aNULL",    "X25519:P-256",  NULL, 1, 1, 1 }, 0  },
+    { { "/nonexistent/ca-bundle.pem", NULL, NULL,             NULL,            NULL, 0, 0, 0 }, -1 },
+    { { NULL,                         NULL, "NO-SUCH-CIPHER", NULL,            NULL, 0, 0, 0 }, -1 },
+    { { NULL,                         NULL, NULL,             "NO-SUCH-GROUP", NULL, 0, 0, 0 }, -1 },
+  };
+
+  // The same context for everybody...
+  tls_context_cleanup();
+  first = tls_context_acquire();
+  second = tls_context_acquire();
+  if (first && first == second) {
+    n_successes++;
+  } else {
+    logger("expected a shared context, got %p and %p", (void *) first, (void *) second);
+    n_failures++;
+  }
+
+  for (size_t i = 0; i < N_ELEMS(tests); i++) {
+    int rc = tls_context_configure(&tests[i].options);
+
+    if (rc == tests[i].expected) {
+      n_successes++;
+    } else {
+      logger("test #%zu: expected %d, got %d", i, tests[i].expected, rc);
+      n_failures++;
+    }
+  }
+
+  // The failures left the last good configuration alone
+  if (tls_context_early_data() == 1) {
+    n_successes++;
+  } else {
+    logger("expected early data to stay allowed");
+    n_failures++;
+  }
+
+  // ... until it is reconfigured, which leaves the previous one usable by
+  // whoever holds it.
+  third = tls_context_acquire();
+  if (third && third != first && SSL_CTX_get_cert_store(first)) {
+    n_successes++;
+  } else {
+    logger("expected a new context after reconfiguration");
+    n_failures++;
+  }
+
+  SSL_CTX_free(first);
+  SSL_CTX_free(second);
+  SSL_CTX_free(third);
+  tls_context_cleanup();
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int tls_context_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    tls_context_shared_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}
@@ -0,0 +1,154 @@
+#include "tls_context.h"
+
+// A resumable TLS 1.2 session, as if it came from a handshake
+static SSL_SESSION *utest_session_new(SSL *ssl, unsigned char id, long age_sec)
+{
+  SSL_SESSION         *session = SSL_SESSION_new();
+  unsigned char        master_key[48];
+  unsigned char        session_id[32];
+  const SSL_CIPHER    *cipher = SSL_CIPHER_find(ssl, (const unsigned char *) "\xc0\x2f");
+
+  memset(master_key, id, sizeof master_key);
+  memset(session_id, id, sizeof session_id);
+
+  if (! session ||
+      ! cipher ||
+      ! SSL_SESSION_set_protocol_version(session, TLS1_2_VERSION) ||
+      ! SSL_SESSION_set_cipher(session, cipher) ||
+      ! SSL_SESSION_set1_master_key(session, master_key, sizeof master_key) ||
+      ! SSL_SESSION_set1_id(session, session_id, sizeof session_id) ||
+      ! SSL_SESSION_set_time(session, (long) time(NULL) - age_sec) ||
+      ! SSL_SESSION_set_timeout(session, 300)) {
+    SSL_SESSION_free(session);
+    return NULL;
+  }
+
+  return session;
+}
+
+// Offer the cached session for host:port on a new connection, and tell
+// which one it was (its first session ID byte), 0 for none.
+static int utest_resumed_id(SSL_CTX *ssl_ctx, char *host, char *port)
+{
+  SSL                *ssl = SSL_new(ssl_ctx);
+  SSL_SESSION        *session = NULL;
+  const unsigned char *id = NULL;
+  unsigned int        id_len = 0;
+  int                 ret = -1;
+
+  if (! ssl)
+    return -1;
+
+  if ((ret = tls_session_resume(ssl, host, port)) > 0 &&
+      (session = SSL_get_session(ssl)) &&
+      (id = SSL_SESSION_get_id(session, &id_len)) && id_len)
+    ret = id[0];
+
+  SSL_free(ssl);
+  return ret;
+}
+
+static int tls_session_cache_utest(void)
+{
+  int       n_successes = 0;
+  int       n_failures = 0;
+  SSL_CTX  *ssl_ctx = NULL;
+  SSL      *ssl = NULL;
+  char      path[] = "/tmp/httpc-utest-sessions-XXXXXX";
+  int       fd = -1;
+  int       id = -1;
+
+#define CHECK(cond, ...) do {                   \
+    if (cond) {                                 \
+      n_successes++;                            \
+    } else {                                    \
+      logger(__VA_ARGS__);                      \
+      n_failures++;                             \
+    }                                           \
+  } while (0)
+
+  tls_context_cleanup();
+  if ((fd = mkstemp(path)) < 0 || ! (ssl_ctx = tls_context_acquire())) {
+    n_failures++;
+    goto end;
+  }
+
+  (void) close(fd);
+  (void) unlink(path);
+
+  if (tls_session_cache_load(path) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  id = utest_resumed_id(ssl_ctx, "example.com", "443");
+  CHECK(id == 0, "empty cache: expected no session, got %d", id);
+
+  // The sessions come in through the new-session callback of a connection
+  // tagged with its server.  The third one is expired, and refused: the
+  // caller keeps it.
+  for (unsigned char i = 1; i <= 3; i++) {
+    SSL_SESSION *session = NULL;
+    int          rc = -1;
+
+    if ((ssl = SSL_new(ssl_ctx)) &&
+        (session = utest_session_new(ssl, i, i == 3 ? 3600 : 0)) &&
+        tls_session_resume(ssl, i == 3 ? "other.com" : "example.com", "443") >= 0)
+      rc = tls_session_new_cb(ssl, session);
+
+    CHECK(rc == (i == 3 ? 0 : 1), "session #%u: unexpected callback result %d", i, rc);
+    if (rc != 1)
+      SSL_SESSION_free(session);
+
+    SSL_free(ssl);
+    ssl = NULL;
+  }
+
+  id = utest_resumed_id(ssl_ctx, "example.com", "443");
+  CHECK(id == 2, "cached session: expected the most recent one, got %d", id);
+
+  id = utest_resumed_id(ssl_ctx, "example.com", "8443");
+  CHECK(id == 0, "other port: expected no session, got %d", id);
+
+  id = utest_resumed_id(ssl_ctx, "other.com", "443");
+  CHECK(id == 0, "expired session: expected no session, got %d", id);
+
+  // Another process starts with the cache file only
+  tls_session_cache_cleanup();
+  id = utest_resumed_id(ssl_ctx, "example.com", "443");
+  CHECK(id == 0, "cleaned up cache: expected no session, got %d", id);
+
+  if (tls_session_cache_load(path) < 0) {
+    n_failures++;
+    goto end;
+  }
+
+  id = utest_resumed_id(ssl_ctx, "example.com", "443");
+  CHECK(id == 2, "cache file: expected the saved session, got %d", id);
+
+#undef CHECK
+
+ end:
+  SSL_free(ssl);
+  SSL_CTX_free(ssl_ctx);
+  tls_context_cleanup();
+  (void) unlink(path);
+
+  logger("Successes: %d, Failures: %d", n_successes, n_failures);
+  return n_failures;
+}
+
+int tls_session_utest(void)
+{
+  int n_errors = 0;
+
+  int (*funcs[])(void) = {
+    tls_session_cache_utest,
+  };
+
+  for (size_t i = 0; i < N_ELEMS(funcs); i++) {
+    n_errors += funcs[i]();
+  }
+
+  return n_errors;
+}